@@ -0,0 +1,187 @@
+/*
+ compress.c
+
+ A small LZ77 block codec, in the spirit of LZ4, used for bundle entries.
+ It favours decompression speed over ratio: there is no entropy coding.
+
+ A block is a series of sequences. Each sequence is:
+   token: high nibble is the literal count, low nibble the match length - 4.
+          A nibble of 15 means more length bytes follow, summed until one is < 255.
+   literals
+   offset: 2 bytes, little endian, distance back to the start of the match
+   match length extension bytes (if needed)
+ The final sequence only has literals, and ends the block.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 14
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+internal inline uint32_t
+LZ_read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(uint32_t));
+  return value;
+}
+
+internal inline uint32_t
+LZ_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+internal size_t
+LZ_compressBound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+internal size_t
+LZ_writeLength(uint8_t* dst, size_t length) {
+  size_t written = 0;
+  while (length >= 255) {
+    dst[written++] = 255;
+    length -= 255;
+  }
+  dst[written++] = length;
+  return written;
+}
+
+// Returns the compressed size, or 0 if it didn't fit in dstCapacity.
+internal size_t
+LZ_compress(const uint8_t* src, size_t srcLength, uint8_t* dst, size_t dstCapacity) {
+  uint32_t table[LZ_HASH_SIZE];
+  memset(table, 0, sizeof(table));
+
+  size_t ip = 0;
+  size_t op = 0;
+  size_t anchor = 0;
+
+  if (srcLength > LZ_MIN_MATCH) {
+    size_t limit = srcLength - LZ_MIN_MATCH;
+    while (ip < limit) {
+      uint32_t sequence = LZ_read32(src + ip);
+      uint32_t hash = LZ_hash(sequence);
+      size_t ref = table[hash];
+      table[hash] = ip;
+
+      if (ref >= ip || ip - ref > LZ_MAX_OFFSET || LZ_read32(src + ref) != sequence) {
+        ip++;
+        continue;
+      }
+
+      size_t matchLength = LZ_MIN_MATCH;
+      while (ip + matchLength < srcLength && src[ref + matchLength] == src[ip + matchLength]) {
+        matchLength++;
+      }
+
+      size_t literalLength = ip - anchor;
+      // Worst case for this sequence: token, lengths, literals and offset
+      size_t needed = 1 + literalLength + literalLength / 255 + 1 + 2 + matchLength / 255 + 1;
+      if (op + needed > dstCapacity) {
+        return 0;
+      }
+
+      uint8_t* token = dst + op++;
+      size_t matchCode = matchLength - LZ_MIN_MATCH;
+      *token = (min(literalLength, 15) << 4) | min(matchCode, 15);
+      if (literalLength >= 15) {
+        op += LZ_writeLength(dst + op, literalLength - 15);
+      }
+      memcpy(dst + op, src + anchor, literalLength);
+      op += literalLength;
+
+      size_t offset = ip - ref;
+      dst[op++] = offset & 0xFF;
+      dst[op++] = (offset >> 8) & 0xFF;
+      if (matchCode >= 15) {
+        op += LZ_writeLength(dst + op, matchCode - 15);
+      }
+
+      ip += matchLength;
+      anchor = ip;
+    }
+  }
+
+  // Whatever is left over goes out as literals
+  size_t literalLength = srcLength - anchor;
+  if (op + 1 + literalLength + literalLength / 255 + 1 > dstCapacity) {
+    return 0;
+  }
+  dst[op++] = min(literalLength, 15) << 4;
+  if (literalLength >= 15) {
+    op += LZ_writeLength(dst + op, literalLength - 15);
+  }
+  memcpy(dst + op, src + anchor, literalLength);
+  op += literalLength;
+
+  return op;
+}
+
+// Decompresses exactly dstLength bytes, failing on any malformed input.
+internal bool
+LZ_decompress(const uint8_t* src, size_t srcLength, uint8_t* dst, size_t dstLength) {
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < srcLength) {
+    uint8_t token = src[ip++];
+
+    size_t literalLength = token >> 4;
+    if (literalLength == 15) {
+      uint8_t next;
+      do {
+        if (ip >= srcLength) {
+          return false;
+        }
+        next = src[ip++];
+        literalLength += next;
+      } while (next == 255);
+    }
+    if (literalLength > srcLength - ip || literalLength > dstLength - op) {
+      return false;
+    }
+    memcpy(dst + op, src + ip, literalLength);
+    ip += literalLength;
+    op += literalLength;
+
+    if (ip == srcLength) {
+      // That was the final, literal-only sequence
+      break;
+    }
+
+    if (srcLength - ip < 2) {
+      return false;
+    }
+    size_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return false;
+    }
+
+    size_t matchLength = token & 0x0F;
+    if (matchLength == 15) {
+      uint8_t next;
+      do {
+        if (ip >= srcLength) {
+          return false;
+        }
+        next = src[ip++];
+        matchLength += next;
+      } while (next == 255);
+    }
+    matchLength += LZ_MIN_MATCH;
+    if (matchLength > dstLength - op) {
+      return false;
+    }
+
+    // Matches may overlap the bytes they produce, so copy forwards
+    uint8_t* out = dst + op;
+    const uint8_t* match = out - offset;
+    for (size_t i = 0; i < matchLength; i++) {
+      out[i] = match[i];
+    }
+    op += matchLength;
+  }
+
+  return op == dstLength;
+}
@@ -1,88 +1,9 @@
-internal int
-ENGINE_record(void* ptr) {
-  // Thread: Seperate gif record
-  ENGINE* engine = ptr;
-  size_t imageSize = engine->width * engine->height;
-  engine->record.gifPixels = (uint32_t*)malloc(imageSize*4*sizeof(uint8_t));
-  size_t scale = GIF_SCALE;
-  uint32_t* scaledPixels = (uint32_t*)malloc(imageSize*4*sizeof(uint8_t)* scale * scale);
-
-  jo_gif_t gif = jo_gif_start(engine->record.gifName, engine->width * scale, engine->height * scale, 0, 31);
-  uint8_t FPS = 30;
-  double MS_PER_FRAME = ceil(1000.0 / FPS);
-  double lag = 0;
-  uint64_t previousTime = SDL_GetPerformanceCounter();
-  do {
-    SDL_Delay(1);
-    uint64_t currentTime = SDL_GetPerformanceCounter();
-    double elapsed = 1000 * (currentTime - previousTime) / SDL_GetPerformanceFrequency();
-    previousTime = currentTime;
-    if(fabs(elapsed - 1.0/120.0) < .0002){
-      elapsed = 1.0/120.0;
-    }
-    if(fabs(elapsed - 1.0/60.0) < .0002){
-      elapsed = 1.0/60.0;
-    }
-    if(fabs(elapsed - 1.0/30.0) < .0002){
-      elapsed = 1.0/30.0;
-    }
-    lag += elapsed;
-    if (lag >= MS_PER_FRAME) {
-      if (scale > 1) {
-        for (size_t j = 0; j < engine->height * scale; j++) {
-          for (size_t i = 0; i < engine->width * scale; i++) {
-            size_t u = i / scale;
-            size_t v = j / scale;
-            int32_t c = ((uint32_t*)engine->record.gifPixels)[v * engine->width + u];
-            scaledPixels[j * engine->width * scale + i] = c;
-          }
-        }
-        jo_gif_frame(&gif, (uint8_t*)scaledPixels, 4, true);
-      } else {
-        jo_gif_frame(&gif, (uint8_t*)engine->record.gifPixels, 3, true);
-      }
-      lag -= MS_PER_FRAME;
-    }
-  } while(engine->running);
-
-  jo_gif_end(&gif);
-  free(engine->record.gifPixels);
-  return 0;
-}
-
-internal void
-ENGINE_openLogFile(ENGINE* engine) {
-  // DOME-2020-02-02-090000.log
-  char* filename = "DOME-out.log";
-  engine->debug.logFile = fopen(filename, "w+");
-}
-
 internal void
 ENGINE_printLog(ENGINE* engine, char* line, ...) {
-  // Args is mutated by each vsnprintf call,
-  // so it needs to be reinitialised.
   va_list args;
   va_start(args, line);
-  size_t bufSize = vsnprintf(NULL, 0, line, args) + 1;
-  va_end(args);
-
-  char buffer[bufSize];
-  buffer[0] = '\0';
-  va_start(args, line);
-  vsnprintf(buffer, bufSize, line, args);
+  LOG_vprint(LOG_INFO, LOG_GENERAL, line, args);
   va_end(args);
-
-  // Output to console
-  printf("%s", buffer);
-
-  if (engine->debug.logFile == NULL) {
-    ENGINE_openLogFile(engine);
-  }
-  if (engine->debug.logFile != NULL) {
-    // Output to file
-    fputs(buffer, engine->debug.logFile);
-    fflush(engine->debug.logFile);
-  }
 }
 
 internal ENGINE_WRITE_RESULT
@@ -97,7 +18,7 @@ ENGINE_writeFile(ENGINE* engine, char* path, char* buffer, size_t length) {
     fullPath = path;
   }
 
-  ENGINE_printLog(engine, "Writing to filesystem: %s\n", path);
+  LOG_print(LOG_DEBUG, LOG_IO, "Writing to filesystem: %s\n", path);
   int result = writeEntireFile(fullPath, buffer, length);
   if (result == ENOENT) {
     result = ENGINE_WRITE_PATH_INVALID;
@@ -112,8 +33,21 @@ ENGINE_writeFile(ENGINE* engine, char* path, char* buffer, size_t length) {
   return result;
 }
 
-internal char*
-ENGINE_readFile(ENGINE* engine, char* path, size_t* lengthPtr) {
+// The entry a path would be read from in a compressed bundle, if any.
+internal PACK_ENTRY*
+ENGINE_findPackEntry(ENGINE* engine, const char* path) {
+  if (engine->pack == NULL) {
+    return NULL;
+  }
+  if (strncmp(path, "./", 2) == 0) {
+    path += 2;
+  }
+  return PACK_find(engine->pack, path);
+}
+
+// Looks for the path in the egg bundle only, if one is loaded.
+internal bool
+ENGINE_openBundleView(ENGINE* engine, const char* path, FILE_VIEW* view) {
   char pathBuf[PATH_MAX];
 
   if (strncmp(path, "./", 2) == 0) {
@@ -122,31 +56,86 @@ ENGINE_readFile(ENGINE* engine, char* path, size_t* lengthPtr) {
     strcpy(pathBuf, path);
   }
 
+  if (engine->pack != NULL) {
+    PACK_ENTRY* entry = ENGINE_findPackEntry(engine, pathBuf);
+    if (entry != NULL) {
+      LOG_print(LOG_DEBUG, LOG_IO, "Reading from bundle: %s\n", pathBuf);
+      ABC_FIFO* fifo = engine->fifo.shutdown ? NULL : &engine->fifo;
+      if (PACK_read(engine->pack, entry, view, fifo)) {
+        return true;
+      }
+      LOG_print(LOG_WARN, LOG_IO, "Couldn't read %s from bundle: data is corrupt. Falling back\n", pathBuf);
+    }
+  }
+
   if (engine->tar != NULL) {
-    ENGINE_printLog(engine, "Reading from bundle: %s\n", pathBuf);
+    LOG_print(LOG_DEBUG, LOG_IO, "Reading from bundle: %s\n", pathBuf);
 
-    char* file = NULL;
-    int err = readFileFromTar(engine->tar, pathBuf, lengthPtr, &file);
+    int err = viewFileFromTar(engine->tar, pathBuf, view);
     if (err == MTAR_ESUCCESS) {
-      return file;
+      return true;
     }
 
     if (DEBUG_MODE) {
-      ENGINE_printLog(engine, "Couldn't read %s from bundle: %s. Falling back\n", pathBuf, mtar_strerror(err));
+      LOG_print(LOG_WARN, LOG_IO, "Couldn't read %s from bundle: %s. Falling back\n", pathBuf, mtar_strerror(err));
     }
   }
+  return false;
+}
 
+// Relative paths are relative to the game's base path. Returns false if
+// the result doesn't fit in PATH_MAX.
+internal bool
+ENGINE_resolvePath(const char* path, char* pathBuf) {
+  int length;
   if (path[0] != '/') {
-    strcpy(pathBuf, BASEPATH_get());
-    strcat(pathBuf, path);
+    length = snprintf(pathBuf, PATH_MAX, "%s%s", BASEPATH_get(), path);
+  } else {
+    length = snprintf(pathBuf, PATH_MAX, "%s", path);
+  }
+  return length >= 0 && length < PATH_MAX;
+}
+
+internal bool
+ENGINE_openFileView(ENGINE* engine, const char* path, FILE_VIEW* view) {
+  if (ENGINE_openBundleView(engine, path, view)) {
+    return true;
+  }
+
+  char pathBuf[PATH_MAX];
+  if (!ENGINE_resolvePath(path, pathBuf) || !doesFileExist(pathBuf)) {
+    return false;
+  }
+
+  LOG_print(LOG_DEBUG, LOG_IO, "Reading from filesystem: %s\n", pathBuf);
+  view->data = mapEntireFile(pathBuf, &view->length);
+  view->source = FILE_VIEW_MAPPED;
+  if (view->data == NULL) {
+    // Empty files can't be mapped, so read them conventionally
+    view->data = readEntireFile(pathBuf, &view->length);
+    view->source = FILE_VIEW_HEAP;
   }
+  return view->data != NULL;
+}
 
-  if (!doesFileExist(pathBuf)) {
+// Returns a NUL-terminated copy of the file which the caller owns.
+internal char*
+ENGINE_readFile(ENGINE* engine, const char* path, size_t* lengthPtr) {
+  FILE_VIEW view;
+  if (!ENGINE_openFileView(engine, path, &view)) {
     return NULL;
   }
 
-  ENGINE_printLog(engine, "Reading from filesystem: %s\n", pathBuf);
-  return readEntireFile(pathBuf, lengthPtr);
+  char* file = malloc(view.length + 1);
+  if (file != NULL) {
+    memcpy(file, view.data, view.length);
+    file[view.length] = '\0';
+    if (lengthPtr != NULL) {
+      *lengthPtr = view.length;
+    }
+  }
+  FILE_VIEW_close(&view);
+  return file;
 }
 
 internal int
@@ -157,7 +146,20 @@ ENGINE_taskHandler(ABC_TASK* task) {
     // TODO: Push to SDL Event Queue
   } else if (task->type == TASK_LOAD_FILE) {
     FILESYSTEM_loadEventHandler(task->data);
+  } else if (task->type == TASK_DECOMPRESS) {
+    PACK_blockTaskHandler(task->data);
+  } else if (task->type == TASK_DECODE_ASSET) {
+    ASSET_decodeTaskHandler(task->data);
+  } else if (task->type == TASK_SCREENSHOT) {
+    ENGINE_screenshotTaskHandler(task->data);
+  } else if (task->type == TASK_ENCODE_FRAME) {
+    RECORDER_encodeTaskHandler(task->data);
+  } else if (task->type == TASK_POSTPROCESS) {
+    POSTPROCESS_bandTaskHandler(task->data);
   } else if (task->type == TASK_WRITE_FILE) {
+    FILESYSTEM_saveTaskHandler(task->data);
+  } else if (task->type == TASK_WALK_DIRECTORY) {
+    FILESYSTEM_walkTaskHandler(task->data);
   }
   return 0;
 }
@@ -193,9 +195,6 @@ ENGINE_init(ENGINE* engine) {
   engine->renderer = NULL;
   engine->texture = NULL;
   engine->pixels = NULL;
-  engine->blitBuffer.pixels = calloc(0, 0);
-  engine->blitBuffer.width = 0;
-  engine->blitBuffer.height = 0;
 
   engine->lockstep = false;
   engine->debug.avgFps = 58;
@@ -212,13 +211,27 @@ ENGINE_init(ENGINE* engine) {
   engine->width = GAME_WIDTH;
   engine->height = GAME_HEIGHT;
 
+  // Indexed mode starts with a grayscale ramp
+  engine->palette.enabled = false;
+  engine->palette.indices = NULL;
+  for (size_t i = 0; i < ENGINE_PALETTE_SIZE; i++) {
+    engine->palette.colors[i] = 0xFF000000 | (i * 0x010101);
+    engine->palette.remap[i] = i;
+  }
+  engine->palette.cycleCount = 0;
+  engine->palette.fadeColor = 0xFF000000;
+  engine->palette.fadeAmount = 0;
+  engine->palette.ticks = 0;
+  engine->postprocess = NULL;
+
+  LOG_init();
 
   //Create window
   engine->window = SDL_CreateWindow("DOME", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_HIDDEN | SDL_WINDOW_RESIZABLE);
   if(engine->window == NULL)
   {
     char* message = "Window could not be created! SDL_Error: %s\n";
-    ENGINE_printLog(engine, message, SDL_GetError());
+    LOG_print(LOG_ERROR, LOG_GRAPHICS, message, SDL_GetError());
     result = EXIT_FAILURE;
     goto engine_init_end;
   }
@@ -226,8 +239,8 @@ ENGINE_init(ENGINE* engine) {
   ENGINE_setupRenderer(engine, true);
   if (engine->renderer == NULL)
   {
-    char* message = "Could not create a renderer: %s";
-    ENGINE_printLog(engine, message, SDL_GetError());
+    char* message = "Could not create a renderer: %s\n";
+    LOG_print(LOG_ERROR, LOG_GRAPHICS, message, SDL_GetError());
     result = EXIT_FAILURE;
     goto engine_init_end;
   }
@@ -245,6 +258,8 @@ ENGINE_init(ENGINE* engine) {
   }
 
   ENGINE_EVENT_TYPE = SDL_RegisterEvents(1);
+  // Screenshots and recordings are written often, so favour speed over size
+  stbi_write_png_compression_level = 2;
 
   ABC_FIFO_create(&engine->fifo);
   engine->fifo.taskHandler = ENGINE_taskHandler;
@@ -282,20 +297,26 @@ ENGINE_free(ENGINE* engine) {
 
   if (engine->tar != NULL) {
     mtar_close(engine->tar);
+    free(engine->tar);
   }
 
-  if (engine->moduleMap.head != NULL) {
-    MAP_free(&engine->moduleMap);
+  if (engine->pack != NULL) {
+    PACK_close(engine->pack);
+    free(engine->pack);
   }
 
-  if (engine->blitBuffer.pixels != NULL) {
-    free(engine->blitBuffer.pixels);
+  if (engine->moduleMap.entries != NULL) {
+    MAP_free(&engine->moduleMap);
   }
 
   if (engine->pixels != NULL) {
     free(engine->pixels);
   }
 
+  if (engine->palette.indices != NULL) {
+    free(engine->palette.indices);
+  }
+
   if (engine->texture != NULL) {
     SDL_DestroyTexture(engine->texture);
   }
@@ -309,24 +330,71 @@ ENGINE_free(ENGINE* engine) {
   }
 
   // DEBUG features
-  if (engine->debug.logFile != NULL) {
-    fclose(engine->debug.logFile);
-  }
+  LOG_free();
 
   if (engine->debug.errorBuf != NULL) {
     free(engine->debug.errorBuf);
   }
 }
 
+// Accepts both signed and unsigned 32-bit forms of a color. Anything else
+// is rejected, as converting it would be undefined.
+internal inline bool
+ENGINE_toColor(double value, uint32_t* color) {
+  if (!(value >= INT32_MIN && value <= UINT32_MAX)) {
+    return false;
+  }
+  *color = (uint32_t)(int64_t)value;
+  return true;
+}
+
+// In indexed mode, colors are palette indices. They travel through the
+// drawing code as opaque colors with the index in the low byte, so none
+// of the primitives need to know about the mode.
+internal inline bool
+ENGINE_color(ENGINE* engine, double value, uint32_t* color) {
+  if (!ENGINE_toColor(value, color)) {
+    return false;
+  }
+  if (engine->palette.enabled) {
+    *color = 0xFF000000 | (*color & 0xFF);
+  }
+  return true;
+}
+
 internal uint32_t
 ENGINE_pget(ENGINE* engine, int64_t x, int64_t y) {
   int32_t width = engine->width;
   int32_t height = engine->height;
   if (0 <= x && x < width && 0 <= y && y < height) {
+    if (engine->palette.enabled) {
+      return engine->palette.indices[width * y + x];
+    }
     return ((uint32_t*)(engine->pixels))[width * y + x];
   }
-  return 0xFF000000;
+  return engine->palette.enabled ? 0 : 0xFF000000;
 }
+// Draws translucent color c over an opaque pixel
+internal inline uint32_t
+ENGINE_blend(uint32_t current, uint32_t c) {
+  // uint16_t oldA = (0xFF000000 & current) >> 24;
+  uint16_t newA = (0xFF000000 & c) >> 24;
+
+  uint16_t oldR = (255-newA) * ((0x000000FF & current));
+  uint16_t oldG = (255-newA) * ((0x0000FF00 & current) >> 8);
+  uint16_t oldB = (255-newA) * ((0x00FF0000 & current) >> 16);
+  uint16_t newR = newA * ((0x000000FF & c));
+  uint16_t newG = newA * ((0x0000FF00 & c) >> 8);
+  uint16_t newB = newA * ((0x00FF0000 & c) >> 16);
+
+  uint8_t a = 0xFF;
+  uint8_t r = (oldR + newR) / 255;
+  uint8_t g = (oldG + newG) / 255;
+  uint8_t b = (oldB + newB) / 255;
+
+  return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
 inline internal void
 ENGINE_pset(ENGINE* engine, int64_t x, int64_t y, uint32_t c) {
 
@@ -340,25 +408,13 @@ ENGINE_pset(ENGINE* engine, int64_t x, int64_t y, uint32_t c) {
   if ((c & (0xFF << 24)) == 0) {
     return;
   } else if (0 <= x && x < width && 0 <= y && y < height) {
+    if (engine->palette.enabled) {
+      engine->palette.indices[width * y + x] = c & 0xFF;
+      return;
+    }
     if (((c & (0xFF << 24)) >> 24) < 0xFF) {
       uint32_t current = ((uint32_t*)(engine->pixels))[width * y + x];
-
-      // uint16_t oldA = (0xFF000000 & current) >> 24;
-      uint16_t newA = (0xFF000000 & c) >> 24;
-
-      uint16_t oldR = (255-newA) * ((0x000000FF & current));
-      uint16_t oldG = (255-newA) * ((0x0000FF00 & current) >> 8);
-      uint16_t oldB = (255-newA) * ((0x00FF0000 & current) >> 16);
-      uint16_t newR = newA * ((0x000000FF & c));
-      uint16_t newG = newA * ((0x0000FF00 & c) >> 8);
-      uint16_t newB = newA * ((0x00FF0000 & c) >> 16);
-
-      uint8_t a = 0xFF;
-      uint8_t r = (oldR + newR) / 255;
-      uint8_t g = (oldG + newG) / 255;
-      uint8_t b = (oldB + newB) / 255;
-
-      c = (a << 24) | (b << 16) | (g << 8) | r;
+      c = ENGINE_blend(current, c);
     }
 
     // This is a very hot line, so we use pointer arithmetic for
@@ -367,36 +423,6 @@ ENGINE_pset(ENGINE* engine, int64_t x, int64_t y, uint32_t c) {
   }
 }
 
-internal void
-ENGINE_blitBuffer(ENGINE* engine, int32_t x, int32_t y) {
-  PIXEL_BUFFER buffer = engine->blitBuffer;
-
-  uint32_t* blitBuffer = buffer.pixels;
-  for (size_t j = 0; j < buffer.height; j++) {
-    for (size_t i = 0; i < buffer.width; i++) {
-      uint32_t c = *(blitBuffer + (j * buffer.width + i));
-      ENGINE_pset(engine, x + i, y + j, c);
-    }
-  }
-}
-
-internal uint32_t*
-ENGINE_resizeBlitBuffer(ENGINE* engine, size_t width, size_t height) {
-  PIXEL_BUFFER* buffer = &engine->blitBuffer;
-
-  size_t oldBufferSize = buffer->width * buffer->height * sizeof(uint32_t);
-  size_t newBufferSize = width * height * sizeof(uint32_t);
-
-  if (oldBufferSize < newBufferSize) {
-    buffer->pixels = realloc(buffer->pixels, newBufferSize);
-    oldBufferSize = newBufferSize;
-  }
-  memset(buffer->pixels, 0, oldBufferSize);
-  buffer->width = width;
-  buffer->height = height;
-  return buffer->pixels;
-}
-
 inline internal unsigned char*
 defaultFontLookup(utf8_int32_t codepoint) {
   local_persist unsigned char empty[8] = { 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F };
@@ -451,24 +477,6 @@ ENGINE_print(ENGINE* engine, char* text, int64_t x, int64_t y, uint32_t c) {
   }
 }
 
-internal void
-blitPixel(void* dest, size_t pitch, int64_t x, int64_t y, uint32_t c) {
-  uint32_t* pixel = (uint32_t*)dest + (y * pitch + x);
-  *pixel = c;
-}
-
-internal void
-blitLine(void* dest, size_t destPitch, int64_t x, int64_t y, int64_t w, uint32_t* buf) {
-  size_t pitch = destPitch;
-  char* pixels = dest;
-  int64_t startX = mid(0, x, pitch);
-  int64_t endX = mid(0, x + w, pitch);
-  size_t lineWidth = endX - startX;
-  uint32_t* bufStart = buf + (size_t)fabs(fmin(0, x));
-  char* line = pixels + ((y * pitch + startX) * 4);
-  memcpy(line, bufStart, lineWidth * 4);
-}
-
 internal void
 ENGINE_blitLine(ENGINE* engine, int64_t x, int64_t y, int64_t w, uint32_t* buf) {
   y += engine->offsetY;
@@ -488,6 +496,14 @@ ENGINE_blitLine(ENGINE* engine, int64_t x, int64_t y, int64_t w, uint32_t* buf)
   size_t lineWidth = min(endX, pitch) - startX;
   uint32_t* bufStart = buf;
 
+  if (engine->palette.enabled) {
+    uint8_t* line = engine->palette.indices + (y * pitch + startX);
+    for (size_t i = 0; i < lineWidth; i++) {
+      line[i] = bufStart[i];
+    }
+    return;
+  }
+
   char* line = pixels + ((y * pitch + startX) * 4);
   memcpy(line, bufStart, lineWidth * 4);
 }
@@ -560,236 +576,364 @@ ENGINE_line(ENGINE* engine, int64_t x1, int64_t y1, int64_t x2, int64_t y2, uint
 }
 
 
+// Fills pixels x0 to x1 - 1 of row y, blending if the color is translucent.
 internal void
-ENGINE_circle_filled(ENGINE* engine, int64_t x0, int64_t y0, int64_t r, uint32_t c) {
-  int64_t x = 0;
-  int64_t y = r;
-  int64_t d = round(M_PI - (2*r));
-
+ENGINE_fillSpan(ENGINE* engine, int64_t y, int64_t x0, int64_t x1, uint32_t c) {
+  uint8_t alpha = c >> 24;
+  if (alpha == 0) {
+    return;
+  }
 
-  uint16_t alpha = (0xFF000000 & c) >> 24;
-  size_t bufWidth = r * 2 + 1;
-  uint32_t buf[bufWidth];
-  for (size_t i = 0; i < bufWidth; i++) {
-    buf[i] = c;
-  }
-  if (alpha == 0xFF) {
-    while (x <= y) {
-      size_t lineWidthX = x * 2 + 1;
-      size_t lineWidthY = y * 2 + 1;
-
-      ENGINE_blitLine(engine, x0 - x, y0 + y, lineWidthX, buf);
-      ENGINE_blitLine(engine, x0 - x, y0 - y, lineWidthX, buf);
-
-      ENGINE_blitLine(engine, x0 - y, y0 + x, lineWidthY, buf);
-      ENGINE_blitLine(engine, x0 - y, y0 - x, lineWidthY, buf);
-
-      if (d < 0) {
-        d = d + (M_PI * x) + (M_PI * 2);
-      } else {
-        d = d + (M_PI * (x - y)) + (M_PI * 3);
-        y--;
-      }
-      x++;
+  y += engine->offsetY;
+  if (y < 0 || y >= engine->height) {
+    return;
+  }
+  int64_t width = engine->width;
+  x0 = mid(0, x0 + engine->offsetX, width);
+  x1 = mid(0, x1 + engine->offsetX, width);
+  if (engine->palette.enabled) {
+    memset(engine->palette.indices + y * width + x0, c & 0xFF, x1 - x0);
+    return;
+  }
+  uint32_t* line = (uint32_t*)engine->pixels + y * width;
+  if (alpha < 0xFF) {
+    for (int64_t i = x0; i < x1; i++) {
+      line[i] = ENGINE_blend(line[i], c);
     }
-  } else {
-    uint32_t* blitBuffer = ENGINE_resizeBlitBuffer(engine, bufWidth, bufWidth);
-    size_t pitch = engine->blitBuffer.width;
-    while (x <= y) {
-      int64_t c = r;
-      size_t lineWidthX = x * 2 + 1;
-      size_t lineWidthY = y * 2 + 1;
-      blitLine(blitBuffer, pitch, c - x, c + y, lineWidthX, buf);
-      if (y != 0) {
-        blitLine(blitBuffer, pitch, c - x, c - y, lineWidthX, buf);
-      }
-      blitLine(blitBuffer, pitch, c - y, c + x, lineWidthY, buf);
-      if (x != 0) {
-        blitLine(blitBuffer, pitch, c - y, c - x, lineWidthY, buf);
-      }
+    return;
+  }
+  for (int64_t i = x0; i < x1; i++) {
+    line[i] = c;
+  }
+}
 
-      if (d < 0) {
-        d = d + (M_PI * x) + (M_PI * 2);
-      } else {
-        d = d + (M_PI * (x - y)) + (M_PI * 3);
-        y--;
-      }
-      x++;
-    }
-    ENGINE_blitBuffer(engine, x0 - r, y0 - r);
+// Radii are limited so the integer maths below can't overflow
+#define ENGINE_MAX_RADIUS 16383
+
+// The largest x on row dy of an ellipse, given the largest x on an earlier
+// row. A pixel is inside when (2x / a)^2 + (2dy / b)^2 <= 1, where a and b
+// are the full width and height, which keeps everything in integers.
+internal inline int64_t
+ENGINE_ellipseExtent(int64_t x, int64_t dy, int64_t a2, int64_t b2) {
+  int64_t limit = a2 * b2;
+  int64_t row = 4 * dy * dy * a2;
+  while (x >= 0 && 4 * x * x * b2 + row > limit) {
+    x--;
   }
+  return x;
 }
 
+// Draws an ellipse centred on (cx, cy) a row at a time. Every pixel is
+// written exactly once, so translucent shapes blend correctly without an
+// intermediate buffer.
 internal void
-ENGINE_circle(ENGINE* engine, int64_t x0, int64_t y0, int64_t r, uint32_t c) {
-  int64_t x = 0;
-  int64_t y = r;
-  int64_t d = round(M_PI - (2*r));
-
-  size_t pitch = r * 2 + 1;
-  uint32_t* blitBuffer = ENGINE_resizeBlitBuffer(engine, pitch, pitch);
-  pitch = engine->blitBuffer.width;
-
-  while (x <= y) {
-    blitPixel(blitBuffer, pitch, r + x, r + y , c);
-    blitPixel(blitBuffer, pitch, r - x, r - y , c);
-    blitPixel(blitBuffer, pitch, r - x, r + y , c);
-    blitPixel(blitBuffer, pitch, r + x, r - y , c);
-    blitPixel(blitBuffer, pitch, r + y, r + x , c);
-    blitPixel(blitBuffer, pitch, r - y, r - x , c);
-    blitPixel(blitBuffer, pitch, r - y, r + x , c);
-    blitPixel(blitBuffer, pitch, r + y, r - x , c);
-
-    if (d < 0) {
-      d = d + (M_PI * x) + (M_PI * 2);
+ENGINE_ellipseSpans(ENGINE* engine, int64_t cx, int64_t cy, int64_t rx, int64_t ry, bool filled, uint32_t c) {
+  if ((c >> 24) == 0) {
+    return;
+  }
+  rx = mid(0, rx, ENGINE_MAX_RADIUS);
+  ry = mid(0, ry, ENGINE_MAX_RADIUS);
+  int64_t a2 = (2 * rx + 1) * (2 * rx + 1);
+  int64_t b2 = (2 * ry + 1) * (2 * ry + 1);
+
+  // Rows outside the canvas only need their extent, to carry it forward
+  int64_t top = -engine->offsetY;
+  int64_t bottom = (int64_t)engine->height - engine->offsetY;
+
+  int64_t x = ENGINE_ellipseExtent(rx, 0, a2, b2);
+  for (int64_t dy = 0; dy <= ry; dy++) {
+    int64_t next = dy < ry ? ENGINE_ellipseExtent(x, dy + 1, a2, b2) : -1;
+    bool below = cy + dy >= top && cy + dy < bottom;
+    bool above = dy > 0 && cy - dy >= top && cy - dy < bottom;
+    if (filled) {
+      if (below) {
+        ENGINE_fillSpan(engine, cy + dy, cx - x, cx + x + 1, c);
+      }
+      if (above) {
+        ENGINE_fillSpan(engine, cy - dy, cx - x, cx + x + 1, c);
+      }
     } else {
-      d = d + (M_PI * (x - y)) + (M_PI * 3);
-      y--;
+      // Fill in to where the next row starts, so steep parts stay joined
+      int64_t start = min(x, next + 1);
+      for (int side = 0; side < 2; side++) {
+        int64_t y = side == 0 ? cy + dy : cy - dy;
+        if (!(side == 0 ? below : above)) {
+          continue;
+        }
+        if (start == 0) {
+          ENGINE_fillSpan(engine, y, cx - x, cx + x + 1, c);
+        } else {
+          ENGINE_fillSpan(engine, y, cx - x, cx - start + 1, c);
+          ENGINE_fillSpan(engine, y, cx + start, cx + x + 1, c);
+        }
+      }
     }
-    x++;
+    x = next;
   }
-  ENGINE_blitBuffer(engine, x0 - r, y0 - r);
 }
 
-internal inline double
-ellipse_getRegion(double x, double y, int32_t rx, int32_t ry) {
-  double rxSquare = rx * rx;
-  double rySquare = ry * ry;
-  return (rySquare*x) / (rxSquare*y);
+internal void
+ENGINE_circle_filled(ENGINE* engine, int64_t x0, int64_t y0, int64_t r, uint32_t c) {
+  ENGINE_ellipseSpans(engine, x0, y0, r, r, true, c);
 }
 
 internal void
-ENGINE_ellipsefill(ENGINE* engine, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t c) {
-
-  // Calculate radius
-  int64_t swap = x1;
-  if (x1 < x0) {
-    x1 = x0;
-    x0 = swap;
-  }
-  swap = y1;
-  if (y1 < y0) {
-    y1 = y0;
-    y0 = swap;
-  }
+ENGINE_circle(ENGINE* engine, int64_t x0, int64_t y0, int64_t r, uint32_t c) {
+  ENGINE_ellipseSpans(engine, x0, y0, r, r, false, c);
+}
 
-  int32_t rx = (x1 - x0) / 2; // Radius on x
-  int32_t ry = (y1 - y0) / 2; // Radius on y
-  uint32_t rxSquare = rx*rx;
-  uint32_t rySquare = ry*ry;
-  uint32_t rx2ry2 = rxSquare * rySquare;
+// Ellipses are given by their bounding box
+internal void
+ENGINE_ellipsefill(ENGINE* engine, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t c) {
+  int64_t left = min(x0, x1);
+  int64_t top = min(y0, y1);
+  int64_t rx = llabs(x1 - x0) / 2;
+  int64_t ry = llabs(y1 - y0) / 2;
+  ENGINE_ellipseSpans(engine, left + rx, top + ry, rx, ry, true, c);
+}
 
-  int32_t dx = (rx + 1) * 2;
-  int32_t dy = (ry + 1) * 2;
+internal void
+ENGINE_ellipse(ENGINE* engine, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t c) {
+  int64_t left = min(x0, x1);
+  int64_t top = min(y0, y1);
+  int64_t rx = llabs(x1 - x0) / 2;
+  int64_t ry = llabs(y1 - y0) / 2;
+  ENGINE_ellipseSpans(engine, left + rx, top + ry, rx, ry, false, c);
+}
 
-  size_t bufWidth = max(dx, dy);
-  uint32_t buf[bufWidth];
-  for (size_t i = 0; i < bufWidth; i++) {
-    buf[i] = c;
-  }
-  uint32_t* blitBuffer = ENGINE_resizeBlitBuffer(engine, dx, dy);
-  size_t pitch = engine->blitBuffer.width;
+typedef void (*ENGINE_SPAN_FN)(ENGINE* engine, int64_t y, int64_t x0, int64_t x1, void* data);
 
-  // Start drawing at (0, ry)
-  int32_t x = 0;
-  int32_t y = ry;
-  double d = 0;
+typedef struct {
+  double yMin;
+  double yMax;
+  // x at yMin, and its change per row
+  double x;
+  double slope;
+} ENGINE_EDGE;
 
-  while (fabs(ellipse_getRegion(x, y, rx, ry)) < 1) {
-    x++;
-    size_t lineWidthX = x * 2 + 1;
-    double xSquare = x*x;
-    // evaluate decision parameter
-    d = rySquare * xSquare + rxSquare * pow(y - 0.5, 2) - rx2ry2;
+internal int
+ENGINE_compareEdges(const void* a, const void* b) {
+  double first = ((const ENGINE_EDGE*)a)->yMin;
+  double second = ((const ENGINE_EDGE*)b)->yMin;
+  return (first > second) - (first < second);
+}
 
-    if (d > 0) {
-      y--;
+// Scanline fill using an edge table, with the even-odd rule, so concave
+// and self-intersecting shapes work. A pixel is inside when its center
+// is. Spans are clipped to the visible part of the canvas before being
+// passed to fn. Points must be finite. Returns false if there wasn't
+// enough memory.
+internal bool
+ENGINE_scanPolygon(ENGINE* engine, VEC* points, size_t count, ENGINE_SPAN_FN fn, void* data) {
+  if (count < 3) {
+    return true;
+  }
+  ENGINE_EDGE* edges = malloc(count * sizeof(ENGINE_EDGE));
+  ENGINE_EDGE** active = malloc(count * sizeof(ENGINE_EDGE*));
+  double* crossings = malloc(count * sizeof(double));
+  if (edges == NULL || active == NULL || crossings == NULL) {
+    free(crossings);
+    free(active);
+    free(edges);
+    return false;
+  }
+  size_t edgeCount = 0;
+  double top = points[0].y;
+  double bottom = points[0].y;
+  for (size_t i = 0; i < count; i++) {
+    VEC a = points[i];
+    VEC b = points[(i + 1) % count];
+    top = fmin(top, a.y);
+    bottom = fmax(bottom, a.y);
+    if (a.y == b.y) {
+      // Horizontal edges never cross a pixel center
+      continue;
     }
-    blitLine(blitBuffer, pitch, rx - x, ry + y, lineWidthX, buf);
-    blitLine(blitBuffer, pitch, rx - x, ry - y, lineWidthX, buf);
+    if (a.y > b.y) {
+      VEC swap = a;
+      a = b;
+      b = swap;
+    }
+    edges[edgeCount++] = (ENGINE_EDGE){ a.y, b.y, a.x, (b.x - a.x) / (b.y - a.y) };
   }
-
-  while (y > 0) {
-    y--;
-    double ySquare = y*y;
-    // evaluate decision parameter
-    d = rxSquare * ySquare + rySquare * pow(x + 0.5, 2) - rx2ry2;
-
-    if (d <= 0) {
-      x++;
+  qsort(edges, edgeCount, sizeof(ENGINE_EDGE), ENGINE_compareEdges);
+
+  // Clipped as doubles, so far off shapes can't overflow the conversion
+  int64_t clipLeft = -engine->offsetX;
+  int64_t clipRight = (int64_t)engine->width - engine->offsetX;
+  int64_t clipTop = -engine->offsetY;
+  int64_t clipBottom = (int64_t)engine->height - engine->offsetY;
+  int64_t startRow = fmid(clipTop, ceil(top - 0.5), clipBottom);
+  int64_t endRow = fmid(clipTop, ceil(bottom - 0.5), clipBottom);
+
+  size_t next = 0;
+  size_t activeCount = 0;
+  for (int64_t y = startRow; y < endRow; y++) {
+    double center = y + 0.5;
+    while (next < edgeCount && edges[next].yMin <= center) {
+      active[activeCount++] = &edges[next++];
     }
-    size_t lineWidthY = x * 2 + 1;
-    blitLine(blitBuffer, pitch, rx - x, ry + y, lineWidthY, buf);
-    blitLine(blitBuffer, pitch, rx - x, ry - y, lineWidthY, buf);
-  };
-
-  ENGINE_blitBuffer(engine, x0, y0);
+    size_t crossingCount = 0;
+    for (size_t i = 0; i < activeCount; i++) {
+      ENGINE_EDGE* edge = active[i];
+      if (edge->yMax <= center) {
+        active[i--] = active[--activeCount];
+        continue;
+      }
+      double x = edge->x + (center - edge->yMin) * edge->slope;
+      // Insertion sort, as there are usually only a few crossings
+      size_t j = crossingCount++;
+      for (; j > 0 && crossings[j - 1] > x; j--) {
+        crossings[j] = crossings[j - 1];
+      }
+      crossings[j] = x;
+    }
+    for (size_t i = 0; i + 1 < crossingCount; i += 2) {
+      int64_t x0 = fmid(clipLeft, ceil(crossings[i] - 0.5), clipRight);
+      int64_t x1 = fmid(clipLeft, ceil(crossings[i + 1] - 0.5), clipRight);
+      if (x0 < x1) {
+        fn(engine, y, x0, x1, data);
+      }
+    }
+  }
+  free(crossings);
+  free(active);
+  free(edges);
+  return true;
 }
 
 internal void
-ENGINE_ellipse(ENGINE* engine, int64_t x0, int64_t y0, int64_t x1, int64_t y1, uint32_t c) {
-
-  int64_t swap = x1;
-  if (x1 < x0) {
-    x1 = x0;
-    x0 = swap;
-  }
-  swap = y1;
-  if (y1 < y0) {
-    y1 = y0;
-    y0 = swap;
-  }
+ENGINE_solidSpan(ENGINE* engine, int64_t y, int64_t x0, int64_t x1, void* data) {
+  ENGINE_fillSpan(engine, y, x0, x1, *(uint32_t*)data);
+}
 
-  // Calculate radius
-  int32_t rx = llabs(x1 - x0) / 2; // Radius on x
-  int32_t ry = llabs(y1 - y0) / 2; // Radius on y
-  int32_t rxSquare = rx*rx;
-  int32_t rySquare = ry*ry;
-  int32_t rx2ry2 = rxSquare * rySquare;
+internal bool
+ENGINE_polygonfill(ENGINE* engine, VEC* points, size_t count, uint32_t c) {
+  return ENGINE_scanPolygon(engine, points, count, ENGINE_solidSpan, &c);
+}
 
-  // Start drawing at (0, ry)
-  double x = 0;
-  double y = ry;
-  double d = 0;
+internal void
+ENGINE_polygon(ENGINE* engine, VEC* points, size_t count, uint32_t c) {
+  for (size_t i = 0; i < count; i++) {
+    VEC a = points[i];
+    VEC b = points[(i + 1) % count];
+    ENGINE_line(engine, round(a.x), round(a.y), round(b.x), round(b.y), c);
+  }
+}
 
-  int32_t width = (rx + 1) * 2;
-  int32_t height = (ry + 1) * 2;
-  uint32_t* blitBuffer = ENGINE_resizeBlitBuffer(engine, width, height);
-  size_t pitch = engine->blitBuffer.width;
+// Up to four values interpolated linearly across a triangle
+typedef struct {
+  VEC origin;
+  double value[4];
+  double dx[4];
+  double dy[4];
+} ENGINE_GRADIENT;
+
+internal ENGINE_GRADIENT
+ENGINE_gradient(VEC* p, double values[3][4]) {
+  ENGINE_GRADIENT gradient;
+  gradient.origin = p[0];
+  double area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+  for (int k = 0; k < 4; k++) {
+    double d1 = values[1][k] - values[0][k];
+    double d2 = values[2][k] - values[0][k];
+    gradient.value[k] = values[0][k];
+    if (area == 0) {
+      gradient.dx[k] = 0;
+      gradient.dy[k] = 0;
+    } else {
+      gradient.dx[k] = (d1 * (p[2].y - p[0].y) - d2 * (p[1].y - p[0].y)) / area;
+      gradient.dy[k] = (d2 * (p[1].x - p[0].x) - d1 * (p[2].x - p[0].x)) / area;
+    }
+  }
+  return gradient;
+}
 
-  blitPixel(blitBuffer, pitch, rx + x, ry + y , c);
-  blitPixel(blitBuffer, pitch, rx + x, ry - y , c);
+// The gradient's values at the center of pixel (x, y)
+internal inline void
+ENGINE_gradientAt(ENGINE_GRADIENT* gradient, int64_t x, int64_t y, double* out) {
+  double dx = x + 0.5 - gradient->origin.x;
+  double dy = y + 0.5 - gradient->origin.y;
+  for (int k = 0; k < 4; k++) {
+    out[k] = gradient->value[k] + gradient->dx[k] * dx + gradient->dy[k] * dy;
+  }
+}
 
-  while (fabs(ellipse_getRegion(x, y, rx, ry)) < 1) {
-    x++;
-    double xSquare = x*x;
-    // evaluate decision parameter
-    d = rySquare * xSquare + rxSquare * pow(y - 0.5, 2) - rx2ry2;
+internal void
+ENGINE_gouraudSpan(ENGINE* engine, int64_t y, int64_t x0, int64_t x1, void* data) {
+  ENGINE_GRADIENT* gradient = data;
+  double v[4];
+  ENGINE_gradientAt(gradient, x0, y, v);
+  for (int64_t x = x0; x < x1; x++) {
+    // Clamped as doubles, as a nearly flat triangle has huge gradients
+    uint32_t c = ((uint32_t)fmid(0, round(v[3]), 255) << 24)
+      | ((uint32_t)fmid(0, round(v[2]), 255) << 16)
+      | ((uint32_t)fmid(0, round(v[1]), 255) << 8)
+      | (uint32_t)fmid(0, round(v[0]), 255);
+    ENGINE_pset(engine, x, y, c);
+    for (int k = 0; k < 4; k++) {
+      v[k] += gradient->dx[k];
+    }
+  }
+}
 
-    if (d > 0) {
-      y--;
+// Fills a triangle, blending between a color at each corner
+internal bool
+ENGINE_trianglefillGradient(ENGINE* engine, VEC* points, uint32_t* colors) {
+  double values[3][4];
+  for (int i = 0; i < 3; i++) {
+    for (int k = 0; k < 4; k++) {
+      values[i][k] = (colors[i] >> (k * 8)) & 0xFF;
     }
-    blitPixel(blitBuffer, pitch, rx + x, ry + y , c);
-    blitPixel(blitBuffer, pitch, rx - x, ry - y , c);
-    blitPixel(blitBuffer, pitch, rx - x, ry + y , c);
-    blitPixel(blitBuffer, pitch, rx + x, ry - y , c);
   }
+  ENGINE_GRADIENT gradient = ENGINE_gradient(points, values);
+  return ENGINE_scanPolygon(engine, points, 3, ENGINE_gouraudSpan, &gradient);
+}
 
-  while (y > 0) {
-    y--;
-    double ySquare = y*y;
-    // evaluate decision parameter
-    d = rxSquare * ySquare + rySquare * pow(x + 0.5, 2) - rx2ry2;
+typedef struct {
+  ENGINE_GRADIENT gradient;
+  PIXEL_BUFFER* texture;
+} ENGINE_TEXTURED_SPAN;
 
-    if (d <= 0) {
-      x++;
-    }
-    blitPixel(blitBuffer, pitch, rx + x, ry + y , c);
-    blitPixel(blitBuffer, pitch, rx - x, ry - y , c);
-    blitPixel(blitBuffer, pitch, rx - x, ry + y , c);
-    blitPixel(blitBuffer, pitch, rx + x, ry - y , c);
-  };
-  ENGINE_blitBuffer(engine, x0, y0);
+internal void
+ENGINE_texturedSpan(ENGINE* engine, int64_t y, int64_t x0, int64_t x1, void* data) {
+  ENGINE_TEXTURED_SPAN* span = data;
+  PIXEL_BUFFER* texture = span->texture;
+  int64_t width = texture->width;
+  int64_t height = texture->height;
+  double v[4];
+  ENGINE_gradientAt(&span->gradient, x0, y, v);
+  for (int64_t x = x0; x < x1; x++) {
+    // Texture coordinates wrap, so a triangle can tile an image
+    // Wrapped as doubles, as a nearly flat triangle has huge gradients
+    double fu = fmod(floor(v[0]), width);
+    double ft = fmod(floor(v[1]), height);
+    int64_t u = isfinite(fu) ? fu : 0;
+    int64_t t = isfinite(ft) ? ft : 0;
+    u += u < 0 ? width : 0;
+    t += t < 0 ? height : 0;
+    ENGINE_pset(engine, x, y, texture->pixels[t * width + u]);
+    v[0] += span->gradient.dx[0];
+    v[1] += span->gradient.dx[1];
+  }
+}
+
+// Fills a triangle from a texture, given a texture coordinate in pixels
+// at each corner. Sampling is nearest neighbour.
+internal bool
+ENGINE_trianglefillTextured(ENGINE* engine, VEC* points, VEC* uvs, PIXEL_BUFFER* texture) {
+  if (texture->width == 0 || texture->height == 0) {
+    return true;
+  }
+  double values[3][4];
+  for (int i = 0; i < 3; i++) {
+    values[i][0] = uvs[i].x;
+    values[i][1] = uvs[i].y;
+    values[i][2] = 0;
+    values[i][3] = 0;
+  }
+  ENGINE_TEXTURED_SPAN span = { ENGINE_gradient(points, values), texture };
+  return ENGINE_scanPolygon(engine, points, 3, ENGINE_texturedSpan, &span);
 }
 
 internal void
@@ -810,13 +954,8 @@ ENGINE_rectfill(ENGINE* engine, int64_t x, int64_t y, int64_t w, int64_t h, uint
     int64_t y2 = y + h;
 
     if (alpha == 0xFF) {
-      size_t lineWidth = w; // x2 - x1;
-      uint32_t buf[lineWidth];
-      for (size_t i = 0; i < lineWidth; i++) {
-        buf[i] = c;
-      }
       for (int64_t j = y1; j < y2; j++) {
-        ENGINE_blitLine(engine, x, j, lineWidth, buf);
+        ENGINE_fillSpan(engine, j, x, x + w, c);
       }
     } else {
       int64_t x1 = x;
@@ -831,14 +970,6 @@ ENGINE_rectfill(ENGINE* engine, int64_t x, int64_t y, int64_t w, int64_t h, uint
   }
 }
 
-internal bool
-ENGINE_getKeyState(ENGINE* engine, char* keyName) {
-  SDL_Keycode keycode =  SDL_GetKeyFromName(keyName);
-  SDL_Scancode scancode = SDL_GetScancodeFromKey(keycode);
-  uint8_t* state = SDL_GetKeyboardState(NULL);
-  return state[scancode];
-}
-
 internal float
 ENGINE_getMouseX(ENGINE* engine) {
   SDL_Rect viewport = engine->viewport;
@@ -865,11 +996,6 @@ ENGINE_getMouseY(ENGINE* engine) {
   return mouseY * fmax(((float)engine->width / (float)winX), (float)engine->height / (float)winY) - viewport.y;
 }
 
-internal bool
-ENGINE_getMouseButton(int button) {
-  return SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(button);
-}
-
 internal void
 ENGINE_drawDebug(ENGINE* engine) {
   char buffer[20];
@@ -880,6 +1006,10 @@ ENGINE_drawDebug(ENGINE* engine) {
   double alpha = debug->alpha;
   debug->avgFps = alpha * debug->avgFps + (1.0 - alpha) * framesThisSecond;
   snprintf(buffer, sizeof(buffer), "%.01f fps", debug->avgFps);   // here 2 means binary
+
+  // The overlay goes over the resolved frame, rather than into the indices
+  bool indexed = engine->palette.enabled;
+  engine->palette.enabled = false;
   int32_t width = engine->width;
   int32_t height = engine->height;
   int64_t startX = width - 4*8-2;
@@ -900,31 +1030,118 @@ ENGINE_drawDebug(ENGINE* engine) {
   } else {
     ENGINE_print(engine, "Catchup", startX, startY - 16, 0xFFFFFFFF);
   }
+
+  // How long collections took over the previous frame
+  if (memory.gc.collections > 0) {
+    snprintf(buffer, sizeof(buffer), "GC %.1fms", memory.gc.frameDuration);
+    ENGINE_print(engine, buffer, startX, startY - 24, 0xFFFFFFFF);
+  }
+  engine->palette.enabled = indexed;
+}
+
+internal bool
+ENGINE_setIndexed(ENGINE* engine, bool enabled) {
+  if (engine->palette.enabled == enabled) {
+    return true;
+  }
+  if (enabled) {
+    engine->palette.indices = calloc(engine->width * engine->height, 1);
+    if (engine->palette.indices == NULL) {
+      return false;
+    }
+  } else {
+    free(engine->palette.indices);
+    engine->palette.indices = NULL;
+  }
+  engine->palette.enabled = enabled;
+  return true;
+}
+
+// Builds the final color of every index, then expands the indices into
+// the 32-bit canvas. Only called for indexed mode.
+internal void
+ENGINE_resolvePalette(ENGINE* engine) {
+  ENGINE_PALETTE* palette = &engine->palette;
+  uint32_t lookup[ENGINE_PALETTE_SIZE];
+  uint32_t fade = palette->fadeAmount;
+  for (size_t i = 0; i < ENGINE_PALETTE_SIZE; i++) {
+    uint8_t index = palette->remap[i];
+    for (size_t k = 0; k < palette->cycleCount; k++) {
+      ENGINE_PALETTE_CYCLE* cycle = &palette->cycles[k];
+      if (cycle->start <= index && index <= cycle->end) {
+        size_t length = cycle->end - cycle->start + 1;
+        size_t shift = (palette->ticks / cycle->delay) % length;
+        index = cycle->start + (index - cycle->start + length - shift) % length;
+        break;
+      }
+    }
+    uint32_t c = palette->colors[index];
+    if (fade > 0) {
+      uint32_t result = 0;
+      for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t from = (c >> shift) & 0xFF;
+        uint32_t to = (palette->fadeColor >> shift) & 0xFF;
+        result |= ((from * (255 - fade) + to * fade) / 255) << shift;
+      }
+      c = result;
+    }
+    lookup[i] = 0xFF000000 | c;
+  }
+
+  uint8_t* indices = palette->indices;
+  uint32_t* pixels = engine->pixels;
+  size_t count = engine->width * engine->height;
+  size_t i = 0;
+  // Unrolled so the independent loads and stores can overlap
+  for (; i + 4 <= count; i += 4) {
+    pixels[i] = lookup[indices[i]];
+    pixels[i + 1] = lookup[indices[i + 1]];
+    pixels[i + 2] = lookup[indices[i + 2]];
+    pixels[i + 3] = lookup[indices[i + 3]];
+  }
+  for (; i < count; i++) {
+    pixels[i] = lookup[indices[i]];
+  }
 }
 
 internal bool
 ENGINE_canvasResize(ENGINE* engine, uint32_t newWidth, uint32_t newHeight, uint32_t color) {
-  if (engine->initialized && engine->record.makeGif) {
+  if (engine->initialized && engine->record.enabled) {
     return true;
   }
   if (engine->width == newWidth && engine->height == newHeight) {
     return true;
   }
 
-  engine->width = newWidth;
-  engine->height = newHeight;
-  SDL_DestroyTexture(engine->texture);
-  SDL_RenderSetLogicalSize(engine->renderer, newWidth, newHeight);
-
-  engine->texture = SDL_CreateTexture(engine->renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, newWidth, newHeight);
-  if (engine->texture == NULL) {
+  // Everything is allocated before anything is replaced, so a failure
+  // leaves the old canvas as it was.
+  size_t count = (size_t)newWidth * newHeight;
+  SDL_Texture* texture = SDL_CreateTexture(engine->renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, newWidth, newHeight);
+  void* pixels = malloc(count * 4);
+  uint8_t* indices = engine->palette.enabled ? malloc(count) : NULL;
+  if (texture == NULL || pixels == NULL || (engine->palette.enabled && indices == NULL)) {
+    if (texture != NULL) {
+      // The texture was fine, so say what did go wrong
+      SDL_SetError("Not enough memory to resize the canvas");
+      SDL_DestroyTexture(texture);
+    }
+    free(pixels);
+    free(indices);
     return false;
   }
 
-  engine->pixels = realloc(engine->pixels, engine->width * engine->height * 4);
-  if (engine->pixels == NULL) {
-    return false;
+  SDL_DestroyTexture(engine->texture);
+  engine->texture = texture;
+  free(engine->pixels);
+  engine->pixels = pixels;
+  if (engine->palette.enabled) {
+    free(engine->palette.indices);
+    engine->palette.indices = indices;
   }
+  engine->width = newWidth;
+  engine->height = newHeight;
+  SDL_RenderSetLogicalSize(engine->renderer, newWidth, newHeight);
+
   ENGINE_rectfill(engine, 0, 0, engine->width, engine->height, color);
   SDL_RenderGetViewport(engine->renderer, &(engine->viewport));
 
@@ -932,15 +1149,91 @@ ENGINE_canvasResize(ENGINE* engine, uint32_t newWidth, uint32_t newHeight, uint3
 }
 
 internal void
-ENGINE_takeScreenshot(ENGINE* engine) {
-  stbi_write_png("screenshot.png", engine->width, engine->height, 4, engine->pixels, engine->width * 4);
+ENGINE_screenshotTaskHandler(void* data) {
+  // Thread: Async
+  ENGINE_SCREENSHOT* shot = data;
+  uint32_t* pixels = shot->pixels;
+  size_t width = shot->width * shot->scale;
+  size_t height = shot->height * shot->scale;
+
+  if (shot->scale > 1) {
+    pixels = malloc(width * height * 4);
+    for (size_t j = 0; j < height; j++) {
+      uint32_t* row = shot->pixels + (j / shot->scale) * shot->width;
+      for (size_t i = 0; i < width; i++) {
+        pixels[j * width + i] = row[i / shot->scale];
+      }
+    }
+  }
+
+  int length = 0;
+  uint8_t* png = stbi_write_png_to_mem((uint8_t*)pixels, width * 4, width, height, 4, &length);
+  shot->success = png != NULL
+    && ENGINE_writeFile(shot->engine, shot->path, (char*)png, length) == ENGINE_WRITE_SUCCESS;
+  free(png);
+  if (pixels != shot->pixels) {
+    free(pixels);
+  }
+  free(shot->pixels);
+  shot->pixels = NULL;
+
+  if (shot->opHandle != NULL) {
+    // The operation belongs to the VM, so let the main thread finish up
+    SDL_Event event;
+    SDL_memset(&event, 0, sizeof(event));
+    event.type = ENGINE_EVENT_TYPE;
+    event.user.code = EVENT_SCREENSHOT;
+    event.user.data1 = shot;
+    SDL_PushEvent(&event);
+  } else {
+    free(shot->path);
+    free(shot);
+  }
+}
+
+// Snapshots the canvas and leaves the encoding to a worker, so the game
+// doesn't stall. Without a path, the file is named for the time it was taken.
+internal void
+ENGINE_takeScreenshot(ENGINE* engine, const char* path, size_t scale, WrenVM* vm, WrenHandle* opHandle) {
+  local_persist uint32_t count = 0;
+  ENGINE_SCREENSHOT* shot = calloc(1, sizeof(ENGINE_SCREENSHOT));
+  shot->engine = engine;
+  shot->width = engine->width;
+  shot->height = engine->height;
+  shot->scale = max(scale, 1);
+  shot->vm = vm;
+  shot->opHandle = opHandle;
+
+  size_t size = engine->width * engine->height * 4;
+  if (engine->palette.enabled) {
+    ENGINE_resolvePalette(engine);
+  }
+  shot->pixels = malloc(size);
+  memcpy(shot->pixels, engine->pixels, size);
+
+  if (path != NULL) {
+    shot->path = strdup(path);
+  } else {
+    // screenshot-20200202-090000-001.png
+    char timestamp[16];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now));
+    count = (count + 1) % 1000;
+    shot->path = malloc(36);
+    snprintf(shot->path, 36, "screenshot-%s-%03u.png", timestamp, count);
+  }
+
+  INIT_TO_ZERO(ABC_TASK, task);
+  task.type = TASK_SCREENSHOT;
+  task.data = shot;
+  ABC_FIFO_pushTask(&engine->fifo, task);
 }
 
 
 internal void
 ENGINE_reportError(ENGINE* engine) {
   if (engine->debug.errorBuf != NULL) {
-    ENGINE_printLog(engine, engine->debug.errorBuf);
+    LOG_print(LOG_ERROR, LOG_SCRIPT, "%s", engine->debug.errorBuf);
     SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
                              "DOME - Error",
                              engine->debug.errorBuf,
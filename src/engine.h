@@ -1,3 +1,6 @@
+// Compressed egg bundles, see pack.c
+struct PACK_t;
+
 // Forward-declaring some methods for interacting with the AudioEngine
 // for managing memory and initialization
 struct AUDIO_ENGINE_t;
@@ -8,17 +11,22 @@ typedef struct {
   double avgFps;
   double alpha;
   int32_t elapsed;
-  FILE* logFile;
   size_t errorBufLen;
   size_t errorBufMax;
   char* errorBuf;
 } ENGINE_DEBUG;
 
+// Video recording, see recorder.c
+struct RECORDER_t;
+
+// Effects between draw() and the screen, see postprocess.c
+struct POSTPROCESS_t;
+
 typedef struct {
-  bool makeGif;
-  uint32_t* gifPixels;
-  volatile bool frameReady;
-  char* gifName;
+  bool enabled;
+  char* path;
+  size_t interval;
+  struct RECORDER_t* recorder;
 } ENGINE_RECORDER;
 
 typedef struct {
@@ -27,7 +35,44 @@ typedef struct {
   uint32_t* pixels;
 } PIXEL_BUFFER;
 
+#define ENGINE_PALETTE_SIZE 256
+#define ENGINE_PALETTE_MAX_CYCLES 16
+
+typedef struct {
+  uint8_t start;
+  uint8_t end;
+  // Ticks between each step of the rotation
+  uint32_t delay;
+} ENGINE_PALETTE_CYCLE;
+
+// Indexed canvas mode. Drawing writes palette indices into a quarter-size
+// buffer, which is resolved into the 32-bit canvas just before presenting.
 typedef struct {
+  bool enabled;
+  uint8_t* indices;
+  uint32_t colors[ENGINE_PALETTE_SIZE];
+  uint8_t remap[ENGINE_PALETTE_SIZE];
+  ENGINE_PALETTE_CYCLE cycles[ENGINE_PALETTE_MAX_CYCLES];
+  size_t cycleCount;
+  uint32_t fadeColor;
+  uint8_t fadeAmount;
+  uint64_t ticks;
+} ENGINE_PALETTE;
+
+typedef struct {
+  struct ENGINE_t* engine;
+  uint32_t* pixels;
+  size_t width;
+  size_t height;
+  size_t scale;
+  char* path;
+  bool success;
+  // Set when the screenshot was requested from Wren
+  WrenVM* vm;
+  WrenHandle* opHandle;
+} ENGINE_SCREENSHOT;
+
+typedef struct ENGINE_t {
   ENGINE_RECORDER record;
   SDL_Window* window;
   SDL_Renderer *renderer;
@@ -41,11 +86,13 @@ typedef struct {
   int32_t offsetX;
   int32_t offsetY;
   mtar_t* tar;
+  struct PACK_t* pack;
   bool running;
   bool lockstep;
   int exit_status;
   struct AUDIO_ENGINE_t* audioEngine;
-  PIXEL_BUFFER blitBuffer;
+  ENGINE_PALETTE palette;
+  struct POSTPROCESS_t* postprocess;
   bool initialized;
   bool debugEnabled;
   bool vsyncEnabled;
@@ -57,7 +104,9 @@ typedef enum {
   EVENT_NOP,
   EVENT_LOAD_FILE,
   EVENT_WRITE_FILE,
-  EVENT_WRITE_FILE_APPEND
+  EVENT_WRITE_FILE_APPEND,
+  EVENT_SCREENSHOT,
+  EVENT_WALK_DIRECTORY
 } EVENT_TYPE;
 
 typedef enum {
@@ -65,7 +114,13 @@ typedef enum {
   TASK_PRINT,
   TASK_LOAD_FILE,
   TASK_WRITE_FILE,
-  TASK_WRITE_FILE_APPEND
+  TASK_WRITE_FILE_APPEND,
+  TASK_DECOMPRESS,
+  TASK_DECODE_ASSET,
+  TASK_ENCODE_FRAME,
+  TASK_SCREENSHOT,
+  TASK_POSTPROCESS,
+  TASK_WALK_DIRECTORY
 } TASK_TYPE;
 
 typedef enum {
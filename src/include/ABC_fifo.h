@@ -1,15 +1,38 @@
 /*
-  ABC_fifo.h - v0.0.11 - Public Domain
+  ABC_fifo.h - v0.1.0 - Public Domain
   Author: Aviv Beeri, 2018
 
+  A job system built on SDL threads. Each worker owns a deque of tasks:
+  it takes the newest work from its own deque, and steals the oldest
+  from the others once it runs dry. Idle workers sleep until there is
+  something to do.
+
   How To Use:
 
 
   #define ABC_FIFO_IMPL
   #include "ABC_fifo.h"
 
+  ABC_FIFO queue;
+  ABC_FIFO_create(&queue);
+  queue.taskHandler = myHandler;
+  ABC_FIFO_pushTask(&queue, task);
+
+  Related tasks can be pushed into a group, which can be waited on, or
+  given continuation tasks to push once everything in it has finished.
+  A worker waiting on a group (or the whole queue) runs tasks itself
+  while it waits, so it is safe to wait from inside a task. Any other
+  thread only helps with tasks from the group it is waiting on, so it
+  isn't held up by unrelated work.
+
+  Any thread may push tasks.
+
   Version History:
 
+  v0.1.0 - Rewritten as a work-stealing job system. Deques grow instead of
+           blocking when full, the worker count defaults to the number of
+           CPUs, waits block instead of spinning, tasks can be grouped with
+           continuations, and any thread may push.
   v0.0.11 - When closing, we actually make sure all the threads can wake up
             waiting for them all.
   v0.0.10 - We block when closing the FIFO til all threads finish
@@ -48,6 +71,9 @@
 #define SDL_sem void
 #define SDL_atomic_t int
 #define SDL_Thread int
+#define SDL_mutex void
+#define SDL_cond void
+#define SDL_TLSID int
 #endif
 
 
@@ -55,9 +81,14 @@
 #define ABC_FIFO_H
 
 // Initial configuration
+// Number of workers ABC_FIFO_create starts. 0 means one per CPU.
 #ifndef ABC_FIFO_POOL_SIZE
-  #define ABC_FIFO_POOL_SIZE 4
+  #define ABC_FIFO_POOL_SIZE 0
+#endif
+#ifndef ABC_FIFO_MAX_WORKERS
+  #define ABC_FIFO_MAX_WORKERS 64
 #endif
+// Initial capacity of each worker's deque. They grow as needed.
 #ifndef ABC_FIFO_SIZE
   #define ABC_FIFO_SIZE 256
 #endif
@@ -72,27 +103,77 @@ typedef struct {
 } ABC_TASK;
 
 typedef int (*ABC_FIFO_TaskHandler)(ABC_TASK* task);
+
+typedef struct ABC_FIFO_GROUP_t ABC_FIFO_GROUP;
+
+// Storage for a task to push once a group finishes. The caller owns it,
+// and must keep it alive until the task has started.
+typedef struct ABC_FIFO_CONTINUATION_t {
+  ABC_TASK task;
+  ABC_FIFO_GROUP* group;
+  struct ABC_FIFO_CONTINUATION_t* next;
+} ABC_FIFO_CONTINUATION;
+
+// Tracks a set of tasks which haven't finished yet.
+struct ABC_FIFO_GROUP_t {
+  SDL_mutex* lock;
+  SDL_atomic_t pending;
+  ABC_FIFO_CONTINUATION* continuations;
+};
+
 typedef struct {
-  SDL_sem* semaphore;
-  SDL_atomic_t readEntry;
-  SDL_atomic_t completionCount;
-  volatile uint16_t writeEntry;
+  ABC_TASK task;
+  ABC_FIFO_GROUP* group;
+} ABC_FIFO_JOB;
+
+typedef struct {
+  SDL_mutex* lock;
+  ABC_FIFO_JOB* jobs;
+  int head;
+  int count;
+  int capacity;
+  int index;
+  void* queue;
+} ABC_FIFO_DEQUE;
+
+typedef struct {
+  // Sleeping workers wait on this, and are woken when there is new work
+  // or a group they are waiting on finishes.
+  SDL_mutex* sleepLock;
+  SDL_cond* wake;
+  // Other threads wait on this, and are only woken when something finishes
+  SDL_cond* finished;
+  // Tasks which are waiting to start
+  SDL_atomic_t queued;
+  // Tasks which haven't finished yet
+  SDL_atomic_t outstanding;
+  SDL_atomic_t nextDeque;
+  SDL_TLSID workerId;
 
   volatile bool shutdown;
   ABC_FIFO_TaskHandler taskHandler;
-  SDL_Thread* threads[ABC_FIFO_POOL_SIZE];
-
-  ABC_TASK tasks[ABC_FIFO_SIZE];
+  int workerCount;
+  SDL_Thread** threads;
+  ABC_FIFO_DEQUE* deques;
 } ABC_FIFO;
 
 // Public API:
 void ABC_FIFO_create(ABC_FIFO* queue);
+void ABC_FIFO_createWithWorkers(ABC_FIFO* queue, int workerCount);
 void ABC_FIFO_pushTask(ABC_FIFO* queue, ABC_TASK task);
 bool ABC_FIFO_isFull(ABC_FIFO* queue);
 bool ABC_FIFO_isEmpty(ABC_FIFO* queue);
 void ABC_FIFO_waitForEmptyQueue(ABC_FIFO* queue);
 void ABC_FIFO_close(ABC_FIFO* queue);
 
+void ABC_FIFO_initGroup(ABC_FIFO_GROUP* group);
+void ABC_FIFO_destroyGroup(ABC_FIFO_GROUP* group);
+void ABC_FIFO_pushGroupTask(ABC_FIFO* queue, ABC_FIFO_GROUP* group, ABC_TASK task);
+// Pushes the task once everything in the group has finished, or right away
+// if it already has. If next is given, the task counts as part of it.
+void ABC_FIFO_then(ABC_FIFO* queue, ABC_FIFO_GROUP* group, ABC_FIFO_CONTINUATION* continuation, ABC_TASK task, ABC_FIFO_GROUP* next);
+void ABC_FIFO_waitForGroup(ABC_FIFO* queue, ABC_FIFO_GROUP* group);
+
 #endif // ABC_FIFO_ABC_FIFO_H
 
 
@@ -103,55 +184,276 @@ void ABC_FIFO_close(ABC_FIFO* queue);
 #ifdef ABC_FIFO_IMPL
 #define ABC_FIFO_IMPL
 
+static int ABC_FIFO_executeTask(void* data);
+static void ABC_FIFO_runJob(ABC_FIFO* queue, ABC_FIFO_JOB* job);
 
+static int
+ABC_FIFO_currentWorker(ABC_FIFO* queue) {
+  return (int)(uintptr_t)SDL_TLSGet(queue->workerId) - 1;
+}
 
-int16_t mask(int16_t v) {
-  return v & (ABC_FIFO_SIZE - 1);
+static void
+ABC_FIFO_wakeAll(ABC_FIFO* queue) {
+  SDL_LockMutex(queue->sleepLock);
+  SDL_CondBroadcast(queue->wake);
+  SDL_CondBroadcast(queue->finished);
+  SDL_UnlockMutex(queue->sleepLock);
 }
 
+// Returns false if the deque was full and couldn't grow.
+static bool
+ABC_FIFO_dequePush(ABC_FIFO_DEQUE* deque, ABC_FIFO_JOB job) {
+  SDL_LockMutex(deque->lock);
+  if (deque->count == deque->capacity) {
+    int capacity = deque->capacity > 0 ? deque->capacity * 2 : ABC_FIFO_SIZE;
+    ABC_FIFO_JOB* jobs = malloc(capacity * sizeof(ABC_FIFO_JOB));
+    if (jobs == NULL) {
+      SDL_UnlockMutex(deque->lock);
+      return false;
+    }
+    for (int i = 0; i < deque->count; i++) {
+      jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+    }
+    free(deque->jobs);
+    deque->jobs = jobs;
+    deque->head = 0;
+    deque->capacity = capacity;
+  }
+  deque->jobs[(deque->head + deque->count) % deque->capacity] = job;
+  deque->count++;
+  SDL_UnlockMutex(deque->lock);
+  return true;
+}
+
+// The owner takes the newest job, which is most likely to still be in cache
+static bool
+ABC_FIFO_dequePopBack(ABC_FIFO_DEQUE* deque, ABC_FIFO_JOB* job) {
+  bool found = false;
+  SDL_LockMutex(deque->lock);
+  if (deque->count > 0) {
+    deque->count--;
+    *job = deque->jobs[(deque->head + deque->count) % deque->capacity];
+    found = true;
+  }
+  SDL_UnlockMutex(deque->lock);
+  return found;
+}
 
+// Thieves take the oldest job
+static bool
+ABC_FIFO_dequePopFront(ABC_FIFO_DEQUE* deque, ABC_FIFO_JOB* job) {
+  bool found = false;
+  SDL_LockMutex(deque->lock);
+  if (deque->count > 0) {
+    *job = deque->jobs[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    deque->count--;
+    found = true;
+  }
+  SDL_UnlockMutex(deque->lock);
+  return found;
+}
 
+// Takes the oldest job belonging to the group, wherever it is
+static bool
+ABC_FIFO_dequeTakeGroup(ABC_FIFO_DEQUE* deque, ABC_FIFO_GROUP* group, ABC_FIFO_JOB* job) {
+  bool found = false;
+  SDL_LockMutex(deque->lock);
+  for (int i = 0; i < deque->count && !found; i++) {
+    if (deque->jobs[(deque->head + i) % deque->capacity].group != group) {
+      continue;
+    }
+    *job = deque->jobs[(deque->head + i) % deque->capacity];
+    for (int j = i; j < deque->count - 1; j++) {
+      deque->jobs[(deque->head + j) % deque->capacity] = deque->jobs[(deque->head + j + 1) % deque->capacity];
+    }
+    deque->count--;
+    found = true;
+  }
+  SDL_UnlockMutex(deque->lock);
+  return found;
+}
 
-int ABC_FIFO_executeTask(void* data);
+static bool
+ABC_FIFO_findGroupJob(ABC_FIFO* queue, ABC_FIFO_GROUP* group, ABC_FIFO_JOB* job) {
+  bool found = false;
+  for (int i = 0; !found && i < queue->workerCount; i++) {
+    found = ABC_FIFO_dequeTakeGroup(&queue->deques[i], group, job);
+  }
+  if (found) {
+    SDL_AtomicAdd(&queue->queued, -1);
+  }
+  return found;
+}
 
-// Initialise the queue passed in
-void ABC_FIFO_create(ABC_FIFO* queue) {
-  memset(queue, 0, sizeof(ABC_FIFO));
-  queue->semaphore = SDL_CreateSemaphore(0);
+static bool
+ABC_FIFO_findJob(ABC_FIFO* queue, ABC_FIFO_JOB* job) {
+  int self = ABC_FIFO_currentWorker(queue);
+  bool found = self >= 0 && ABC_FIFO_dequePopBack(&queue->deques[self], job);
+  // Start stealing from our neighbour, so thieves spread out
+  for (int i = 1; !found && i <= queue->workerCount; i++) {
+    int victim = (self + i) % queue->workerCount;
+    if (victim != self) {
+      found = ABC_FIFO_dequePopFront(&queue->deques[victim], job);
+    }
+  }
+  if (found) {
+    SDL_AtomicAdd(&queue->queued, -1);
+  }
+  return found;
+}
 
-  for (int i = 0; i < ABC_FIFO_POOL_SIZE; ++i) {
-    queue->threads[i] = SDL_CreateThread(ABC_FIFO_executeTask, NULL, queue);
+static void
+ABC_FIFO_pushJob(ABC_FIFO* queue, ABC_FIFO_JOB job) {
+  SDL_AtomicAdd(&queue->outstanding, 1);
+  int target = ABC_FIFO_currentWorker(queue);
+  if (target < 0) {
+    // Pushes from outside the pool are dealt out between the workers
+    target = (SDL_AtomicAdd(&queue->nextDeque, 1) & 0x7FFFFFFF) % queue->workerCount;
   }
+  if (!ABC_FIFO_dequePush(&queue->deques[target], job)) {
+    // Out of memory, so the job can't wait its turn
+    ABC_FIFO_runJob(queue, &job);
+    return;
+  }
+
+  SDL_LockMutex(queue->sleepLock);
+  SDL_AtomicAdd(&queue->queued, 1);
+  SDL_CondSignal(queue->wake);
+  SDL_UnlockMutex(queue->sleepLock);
 }
 
-// PRE: Only the main thread pushes tasks
-// Blocks if the queue is full.
-void ABC_FIFO_pushTask(ABC_FIFO* queue, ABC_TASK task) {
-  while(ABC_FIFO_isFull(queue)) { };
+static void
+ABC_FIFO_finishGroupTask(ABC_FIFO* queue, ABC_FIFO_GROUP* group) {
+  ABC_FIFO_CONTINUATION* continuation = NULL;
+  SDL_LockMutex(group->lock);
+  bool finished = SDL_AtomicAdd(&group->pending, -1) == 1;
+  if (finished) {
+    continuation = group->continuations;
+    group->continuations = NULL;
+  }
+  SDL_UnlockMutex(group->lock);
+  // Once the lock is released, a waiter or a continuation may destroy the
+  // group, and a continuation may free its own storage once it starts.
+
+  while (continuation != NULL) {
+    ABC_FIFO_CONTINUATION* next = continuation->next;
+    ABC_FIFO_JOB job = { continuation->task, continuation->group };
+    ABC_FIFO_pushJob(queue, job);
+    continuation = next;
+  }
+
+  if (finished) {
+    ABC_FIFO_wakeAll(queue);
+  }
+}
 
-  queue->tasks[mask(queue->writeEntry)] = task;
-  SDL_CompilerBarrier();
-  ++queue->writeEntry;
+static void
+ABC_FIFO_runJob(ABC_FIFO* queue, ABC_FIFO_JOB* job) {
+  queue->taskHandler(&job->task);
+  if (job->group != NULL) {
+    ABC_FIFO_finishGroupTask(queue, job->group);
+  }
+  if (SDL_AtomicAdd(&queue->outstanding, -1) == 1) {
+    ABC_FIFO_wakeAll(queue);
+  }
+}
+
+// Runs tasks until the counter reaches zero, sleeping when there are none.
+// Threads outside the pool only run tasks from the group, if one is given,
+// and otherwise sleep until something finishes.
+static void
+ABC_FIFO_waitForZero(ABC_FIFO* queue, SDL_atomic_t* counter, ABC_FIFO_GROUP* group) {
+  ABC_FIFO_JOB job;
+  if (ABC_FIFO_currentWorker(queue) < 0 && group != NULL) {
+    while (SDL_AtomicGet(counter) > 0) {
+      if (ABC_FIFO_findGroupJob(queue, group, &job)) {
+        ABC_FIFO_runJob(queue, &job);
+        continue;
+      }
+      SDL_LockMutex(queue->sleepLock);
+      while (SDL_AtomicGet(counter) > 0) {
+        SDL_CondWait(queue->finished, queue->sleepLock);
+      }
+      SDL_UnlockMutex(queue->sleepLock);
+    }
+    return;
+  }
 
-  if (SDL_SemValue(queue->semaphore) < ABC_FIFO_POOL_SIZE) {
-    SDL_SemPost(queue->semaphore);
+  while (SDL_AtomicGet(counter) > 0) {
+    if (ABC_FIFO_findJob(queue, &job)) {
+      ABC_FIFO_runJob(queue, &job);
+      continue;
+    }
+    SDL_LockMutex(queue->sleepLock);
+    while (SDL_AtomicGet(counter) > 0 && SDL_AtomicGet(&queue->queued) == 0) {
+      SDL_CondWait(queue->wake, queue->sleepLock);
+    }
+    SDL_UnlockMutex(queue->sleepLock);
   }
 }
 
-int ABC_FIFO_executeTask(void* data) {
-  ABC_FIFO* queue = (ABC_FIFO*)data;
-  while (!queue->shutdown) {
-   int16_t originalReadEntry = SDL_AtomicGet(&queue->readEntry);
-   if (mask(originalReadEntry) != mask(queue->writeEntry)) {
-     if (SDL_AtomicCAS(&queue->readEntry, originalReadEntry, originalReadEntry + 1)) {
-       SDL_CompilerBarrier();
-       ABC_TASK task = queue->tasks[mask(originalReadEntry)];
+// Initialise the queue passed in, with a worker per CPU
+void ABC_FIFO_create(ABC_FIFO* queue) {
+  ABC_FIFO_createWithWorkers(queue, ABC_FIFO_POOL_SIZE);
+}
+
+void ABC_FIFO_createWithWorkers(ABC_FIFO* queue, int workerCount) {
+  memset(queue, 0, sizeof(ABC_FIFO));
+  if (workerCount <= 0) {
+    workerCount = SDL_GetCPUCount();
+  }
+  if (workerCount < 1) {
+    workerCount = 1;
+  } else if (workerCount > ABC_FIFO_MAX_WORKERS) {
+    workerCount = ABC_FIFO_MAX_WORKERS;
+  }
+
+  queue->sleepLock = SDL_CreateMutex();
+  queue->wake = SDL_CreateCond();
+  queue->finished = SDL_CreateCond();
+  queue->workerId = SDL_TLSCreate();
+  queue->workerCount = workerCount;
+  queue->threads = calloc(workerCount, sizeof(SDL_Thread*));
+  queue->deques = calloc(workerCount, sizeof(ABC_FIFO_DEQUE));
+
+  for (int i = 0; i < workerCount; ++i) {
+    queue->deques[i].lock = SDL_CreateMutex();
+    queue->deques[i].index = i;
+    queue->deques[i].queue = queue;
+  }
+  for (int i = 0; i < workerCount; ++i) {
+    queue->threads[i] = SDL_CreateThread(ABC_FIFO_executeTask, NULL, &queue->deques[i]);
+  }
+}
+
+// Safe to call from any thread, including from inside a task.
+void ABC_FIFO_pushTask(ABC_FIFO* queue, ABC_TASK task) {
+  ABC_FIFO_JOB job = { task, NULL };
+  ABC_FIFO_pushJob(queue, job);
+}
+
+static int ABC_FIFO_executeTask(void* data) {
+  ABC_FIFO_DEQUE* deque = (ABC_FIFO_DEQUE*)data;
+  ABC_FIFO* queue = (ABC_FIFO*)deque->queue;
+  SDL_TLSSet(queue->workerId, (void*)(uintptr_t)(deque->index + 1), NULL);
+
+  ABC_FIFO_JOB job;
+  while (true) {
+    if (ABC_FIFO_findJob(queue, &job)) {
+      ABC_FIFO_runJob(queue, &job);
+      continue;
+    }
 
-       queue->taskHandler(&task);
-       SDL_AtomicAdd(&queue->completionCount, 1); // Post-increment
-     }
-    } else {
-      SDL_SemWait(queue->semaphore);
+    SDL_LockMutex(queue->sleepLock);
+    while (SDL_AtomicGet(&queue->queued) == 0 && !queue->shutdown) {
+      SDL_CondWait(queue->wake, queue->sleepLock);
+    }
+    // Finish off anything already queued before we exit
+    bool finished = queue->shutdown && SDL_AtomicGet(&queue->queued) == 0;
+    SDL_UnlockMutex(queue->sleepLock);
+    if (finished) {
+      break;
     }
   }
   return 0;
@@ -159,29 +461,89 @@ int ABC_FIFO_executeTask(void* data) {
 
 // Shutdown pool and block til all threads close
 void ABC_FIFO_close(ABC_FIFO* queue) {
+  SDL_LockMutex(queue->sleepLock);
   queue->shutdown = true;
-  // Tidy up our resources
-  for (int i = 0; i < ABC_FIFO_POOL_SIZE; ++i) {
-    SDL_SemPost(queue->semaphore);
-  }
-  for (int i = 0; i < ABC_FIFO_POOL_SIZE; ++i) {
+  SDL_CondBroadcast(queue->wake);
+  SDL_UnlockMutex(queue->sleepLock);
+
+  for (int i = 0; i < queue->workerCount; ++i) {
     SDL_WaitThread(queue->threads[i], NULL);
   }
 
-  // Destroy queue
-  SDL_DestroySemaphore(queue->semaphore);
+  // Tidy up our resources
+  for (int i = 0; i < queue->workerCount; ++i) {
+    SDL_DestroyMutex(queue->deques[i].lock);
+    free(queue->deques[i].jobs);
+  }
+  free(queue->deques);
+  free(queue->threads);
+  queue->deques = NULL;
+  queue->threads = NULL;
+  SDL_DestroyCond(queue->wake);
+  SDL_DestroyCond(queue->finished);
+  SDL_DestroyMutex(queue->sleepLock);
 }
 
+// The deques grow as needed, so the queue is never full.
 bool ABC_FIFO_isFull(ABC_FIFO* queue) {
-  return mask(queue->writeEntry + 1) == mask(SDL_AtomicGet(&queue->readEntry));
+  return false;
 }
 
 bool ABC_FIFO_isEmpty(ABC_FIFO* queue) {
-  return mask(queue->writeEntry) == mask(SDL_AtomicGet(&queue->readEntry));
+  return SDL_AtomicGet(&queue->outstanding) == 0;
 }
 
 void ABC_FIFO_waitForEmptyQueue(ABC_FIFO* queue) {
-  while (!ABC_FIFO_isEmpty(queue));
+  ABC_FIFO_waitForZero(queue, &queue->outstanding, NULL);
+}
+
+void ABC_FIFO_initGroup(ABC_FIFO_GROUP* group) {
+  group->lock = SDL_CreateMutex();
+  SDL_AtomicSet(&group->pending, 0);
+  group->continuations = NULL;
+}
+
+// PRE: Nothing in the group is still pending
+void ABC_FIFO_destroyGroup(ABC_FIFO_GROUP* group) {
+  SDL_DestroyMutex(group->lock);
+  group->lock = NULL;
+}
+
+void ABC_FIFO_pushGroupTask(ABC_FIFO* queue, ABC_FIFO_GROUP* group, ABC_TASK task) {
+  SDL_AtomicAdd(&group->pending, 1);
+  ABC_FIFO_JOB job = { task, group };
+  ABC_FIFO_pushJob(queue, job);
+}
+
+void ABC_FIFO_then(ABC_FIFO* queue, ABC_FIFO_GROUP* group, ABC_FIFO_CONTINUATION* continuation, ABC_TASK task, ABC_FIFO_GROUP* next) {
+  if (next != NULL) {
+    SDL_AtomicAdd(&next->pending, 1);
+  }
+
+  bool pushNow = false;
+  SDL_LockMutex(group->lock);
+  if (SDL_AtomicGet(&group->pending) == 0) {
+    pushNow = true;
+  } else {
+    continuation->task = task;
+    continuation->group = next;
+    continuation->next = group->continuations;
+    group->continuations = continuation;
+  }
+  SDL_UnlockMutex(group->lock);
+
+  if (pushNow) {
+    ABC_FIFO_JOB job = { task, next };
+    ABC_FIFO_pushJob(queue, job);
+  }
+}
+
+void ABC_FIFO_waitForGroup(ABC_FIFO* queue, ABC_FIFO_GROUP* group) {
+  ABC_FIFO_waitForZero(queue, &group->pending, group);
+  // Make sure the last task has let go of the group before we return,
+  // as the caller is likely to destroy it.
+  SDL_LockMutex(group->lock);
+  SDL_UnlockMutex(group->lock);
 }
 
 #endif // ABC_FIFO_ABC_FIFO_IMPL
@@ -191,5 +553,7 @@ void ABC_FIFO_waitForEmptyQueue(ABC_FIFO* queue) {
 #undef SDL_sem
 #undef SDL_atomic_t
 #undef SDL_Thread
+#undef SDL_mutex
+#undef SDL_cond
+#undef SDL_TLSID
 #endif
-
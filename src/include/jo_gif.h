@@ -5,6 +5,8 @@
  *
  * Latest revisions:
  * 	1.00 (2015-11-03) initial release
+ * 	DOME: frames can be encoded separately from writing, so several frames
+ * 	      can be quantized and compressed on different threads at once
  *
  * Basic usage:
  *	char *frame = new char[128*128*4]; // 4 component. RGBX format, where X is unused 
@@ -46,6 +48,25 @@ extern void jo_gif_frame(jo_gif_t *gif, unsigned char *rgba, short delayCsec, bo
 // gif          | the state (returned from jo_gif_start)
 extern void jo_gif_end(jo_gif_t *gif);
 
+// A frame which has been quantized and compressed, but not yet written.
+typedef struct {
+	unsigned char palette[0x300];
+	unsigned char *data;
+	int length, capacity;
+} jo_gif_frame_t;
+
+// Encodes a frame with its own palette. This only reads the gif, so it is
+// safe to encode several frames at once.
+// gif          | the state (returned from jo_gif_start)
+// rgba         | the pixels
+// out          | receives the encoded frame, free it with jo_gif_frame_free
+extern void jo_gif_encode(const jo_gif_t *gif, unsigned char *rgba, jo_gif_frame_t *out);
+
+// Writes a frame from jo_gif_encode. Frames must be written in order.
+extern void jo_gif_write(jo_gif_t *gif, const jo_gif_frame_t *frame, short delayCsec);
+
+extern void jo_gif_frame_free(jo_gif_frame_t *frame);
+
 #endif
 
 #ifndef JO_GIF_HEADER_FILE_ONLY
@@ -199,7 +220,7 @@ static void jo_gif_quantize(unsigned char *rgba, int rgbaSize, int sample, unsig
 }
 
 typedef struct {
-	FILE *fp;
+	jo_gif_frame_t *out;
 	int numBits;
 	unsigned char buf[256];
 	unsigned char idx;
@@ -208,6 +229,19 @@ typedef struct {
 	int curBits;
 } jo_gif_lzw_t;
 
+// Appends a sub-block of compressed data to the frame
+static void jo_gif_lzw_flush(jo_gif_lzw_t *s) {
+	jo_gif_frame_t *out = s->out;
+	if(out->length + s->idx + 1 > out->capacity) {
+		out->capacity = (out->capacity + s->idx + 1) * 2;
+		out->data = (unsigned char *)realloc(out->data, out->capacity);
+	}
+	out->data[out->length++] = s->idx;
+	memcpy(out->data + out->length, s->buf, s->idx);
+	out->length += s->idx;
+	s->idx = 0;
+}
+
 static void jo_gif_lzw_write(jo_gif_lzw_t *s, int code) {
 	s->outBits |= code << s->curBits;
 	s->curBits += s->numBits;
@@ -216,15 +250,13 @@ static void jo_gif_lzw_write(jo_gif_lzw_t *s, int code) {
 		s->outBits >>= 8;
 		s->curBits -= 8;
 		if (s->idx >= 255) {
-			putc(s->idx, s->fp);
-			fwrite(s->buf, s->idx, 1, s->fp);
-			s->idx = 0;
+			jo_gif_lzw_flush(s);
 		}
 	}
 }
 
-static void jo_gif_lzw_encode(unsigned char *in, int len, FILE *fp) {
-	jo_gif_lzw_t state = {fp, 9};
+static void jo_gif_lzw_encode(unsigned char *in, int len, jo_gif_frame_t *out) {
+	jo_gif_lzw_t state = {out, 9};
 	int maxcode = 511;
 
 	// Note: 30k stack space for dictionary =|
@@ -275,8 +307,7 @@ CONTINUE:
 	jo_gif_lzw_write(&state, 0x101);
 	jo_gif_lzw_write(&state, 0);
 	if(state.idx) {
-		putc(state.idx, fp);
-		fwrite(state.buf, state.idx, 1, fp);
+		jo_gif_lzw_flush(&state);
 	}
 }
 
@@ -306,57 +337,47 @@ jo_gif_t jo_gif_start(const char *filename, short width, short height, short rep
 	return gif;
 }
 
-void jo_gif_frame(jo_gif_t *gif, unsigned char * rgba, short delayCsec, bool localPalette) {
-	if(!gif->fp) {
-		return;
-	}
-	short width = gif->width;
-	short height = gif->height;
-	int size = width * height;
-
-	unsigned char localPalTbl[0x300];
-	unsigned char *palette = gif->frame == 0 || !localPalette ? gif->palette : localPalTbl;
-	if(gif->frame == 0 || localPalette) {
-		jo_gif_quantize(rgba, size*4, 1, palette, gif->numColors);		
-	}
-
-	unsigned char *indexedPixels = (unsigned char *)malloc(size);
-	{
-		unsigned char *ditheredPixels = (unsigned char*)malloc(size*4);
-		memcpy(ditheredPixels, rgba, size*4);
-		for(int k = 0; k < size*4; k+=4) {
-			int rgb[3] = { ditheredPixels[k+0], ditheredPixels[k+1], ditheredPixels[k+2] };
-			int bestd = 0x7FFFFFFF, best = -1;
-			// TODO: exhaustive search. do something better.
-			for(int i = 0; i < gif->numColors; ++i) {
-				int bb = palette[i*3+0]-rgb[0];
-				int gg = palette[i*3+1]-rgb[1];
-				int rr = palette[i*3+2]-rgb[2];
-				int d = bb*bb + gg*gg + rr*rr;
-				if(d < bestd) {
-					bestd = d;
-					best = i;
-				}
-			}
-			indexedPixels[k/4] = best;
-			int diff[3] = { ditheredPixels[k+0] - palette[indexedPixels[k/4]*3+0], ditheredPixels[k+1] - palette[indexedPixels[k/4]*3+1], ditheredPixels[k+2] - palette[indexedPixels[k/4]*3+2] };
-			// Floyd-Steinberg Error Diffusion
-			// TODO: Use something better -- http://caca.zoy.org/study/part3.html
-			if(k+4 < size*4) { 
-				ditheredPixels[k+4+0] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+0]+(diff[0]*7/16), 0, 255); 
-				ditheredPixels[k+4+1] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+1]+(diff[1]*7/16), 0, 255); 
-				ditheredPixels[k+4+2] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+2]+(diff[2]*7/16), 0, 255); 
+// Maps each pixel to its nearest palette entry, with error diffusion
+static void jo_gif_index(const unsigned char *rgba, int width, int size, const unsigned char *palette, int numColors, unsigned char *indexedPixels) {
+	unsigned char *ditheredPixels = (unsigned char*)malloc(size*4);
+	memcpy(ditheredPixels, rgba, size*4);
+	for(int k = 0; k < size*4; k+=4) {
+		int rgb[3] = { ditheredPixels[k+0], ditheredPixels[k+1], ditheredPixels[k+2] };
+		int bestd = 0x7FFFFFFF, best = -1;
+		// TODO: exhaustive search. do something better.
+		for(int i = 0; i < numColors; ++i) {
+			int bb = palette[i*3+0]-rgb[0];
+			int gg = palette[i*3+1]-rgb[1];
+			int rr = palette[i*3+2]-rgb[2];
+			int d = bb*bb + gg*gg + rr*rr;
+			if(d < bestd) {
+				bestd = d;
+				best = i;
 			}
-			if(k+width*4+4 < size*4) { 
-				for(int i = 0; i < 3; ++i) {
-					ditheredPixels[k-4+width*4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k-4+width*4+i]+(diff[i]*3/16), 0, 255); 
-					ditheredPixels[k+width*4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k+width*4+i]+(diff[i]*5/16), 0, 255); 
-					ditheredPixels[k+width*4+4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k+width*4+4+i]+(diff[i]*1/16), 0, 255); 
-				}
+		}
+		indexedPixels[k/4] = best;
+		int diff[3] = { ditheredPixels[k+0] - palette[indexedPixels[k/4]*3+0], ditheredPixels[k+1] - palette[indexedPixels[k/4]*3+1], ditheredPixels[k+2] - palette[indexedPixels[k/4]*3+2] };
+		// Floyd-Steinberg Error Diffusion
+		// TODO: Use something better -- http://caca.zoy.org/study/part3.html
+		if(k+4 < size*4) { 
+			ditheredPixels[k+4+0] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+0]+(diff[0]*7/16), 0, 255); 
+			ditheredPixels[k+4+1] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+1]+(diff[1]*7/16), 0, 255); 
+			ditheredPixels[k+4+2] = (unsigned char)jo_gif_clamp(ditheredPixels[k+4+2]+(diff[2]*7/16), 0, 255); 
+		}
+		if(k+width*4+4 < size*4) { 
+			for(int i = 0; i < 3; ++i) {
+				ditheredPixels[k-4+width*4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k-4+width*4+i]+(diff[i]*3/16), 0, 255); 
+				ditheredPixels[k+width*4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k+width*4+i]+(diff[i]*5/16), 0, 255); 
+				ditheredPixels[k+width*4+4+i] = (unsigned char)jo_gif_clamp(ditheredPixels[k+width*4+4+i]+(diff[i]*1/16), 0, 255); 
 			}
 		}
-		free(ditheredPixels);
 	}
+	free(ditheredPixels);
+}
+
+static void jo_gif_write_frame(jo_gif_t *gif, const unsigned char *palette, const jo_gif_frame_t *data, short delayCsec, bool localPalette) {
+	short width = gif->width;
+	short height = gif->height;
 	if(gif->frame == 0) {
 		// Global Color Table
 		fwrite(palette, 3*(1<<(gif->palSize+1)), 1, gif->fp);
@@ -382,12 +403,60 @@ void jo_gif_frame(jo_gif_t *gif, unsigned char * rgba, short delayCsec, bool loc
 		fwrite(palette, 3*(1<<(gif->palSize+1)), 1, gif->fp);
 	}
 	putc(8, gif->fp); // block terminator
-	jo_gif_lzw_encode(indexedPixels, size, gif->fp);
+	fwrite(data->data, data->length, 1, gif->fp);
 	putc(0, gif->fp); // block terminator
 	++gif->frame;
+}
+
+void jo_gif_frame(jo_gif_t *gif, unsigned char * rgba, short delayCsec, bool localPalette) {
+	if(!gif->fp) {
+		return;
+	}
+	int size = gif->width * gif->height;
+
+	unsigned char localPalTbl[0x300];
+	unsigned char *palette = gif->frame == 0 || !localPalette ? gif->palette : localPalTbl;
+	if(gif->frame == 0 || localPalette) {
+		jo_gif_quantize(rgba, size*4, 1, palette, gif->numColors);		
+	}
+
+	unsigned char *indexedPixels = (unsigned char *)malloc(size);
+	jo_gif_index(rgba, gif->width, size, palette, gif->numColors, indexedPixels);
+
+	jo_gif_frame_t data = {0};
+	jo_gif_lzw_encode(indexedPixels, size, &data);
+	jo_gif_write_frame(gif, palette, &data, delayCsec, localPalette);
+	free(data.data);
+	free(indexedPixels);
+}
+
+void jo_gif_encode(const jo_gif_t *gif, unsigned char *rgba, jo_gif_frame_t *out) {
+	int size = gif->width * gif->height;
+	memset(out, 0, sizeof(jo_gif_frame_t));
+	jo_gif_quantize(rgba, size*4, 1, out->palette, gif->numColors);
+
+	unsigned char *indexedPixels = (unsigned char *)malloc(size);
+	jo_gif_index(rgba, gif->width, size, out->palette, gif->numColors, indexedPixels);
+	jo_gif_lzw_encode(indexedPixels, size, out);
 	free(indexedPixels);
 }
 
+void jo_gif_write(jo_gif_t *gif, const jo_gif_frame_t *frame, short delayCsec) {
+	if(!gif->fp) {
+		return;
+	}
+	if(gif->frame == 0) {
+		memcpy(gif->palette, frame->palette, sizeof(gif->palette));
+	}
+	jo_gif_write_frame(gif, frame->palette, frame, delayCsec, true);
+}
+
+void jo_gif_frame_free(jo_gif_frame_t *frame) {
+	free(frame->data);
+	frame->data = NULL;
+	frame->length = frame->capacity = 0;
+}
+
 void jo_gif_end(jo_gif_t *gif) {
 	if(!gif->fp) {
 		return;
@@ -1,4 +1,10 @@
 internal void FILESYSTEM_loadEventHandler(void* task);
+internal void ASSET_decodeTaskHandler(void* task);
+internal void RECORDER_encodeTaskHandler(void* task);
+internal void ENGINE_screenshotTaskHandler(void* task);
+internal void POSTPROCESS_bandTaskHandler(void* task);
+internal void FILESYSTEM_saveTaskHandler(void* task);
+internal void FILESYSTEM_walkTaskHandler(void* task);
 
 global_variable char* basePath = NULL;
 
@@ -91,9 +97,167 @@ doesFileExist(char* path) {
   return access(path, F_OK) != -1;
 }
 
+typedef enum {
+  // Memory we don't own, such as the bytes of a Wren string
+  FILE_VIEW_BORROWED,
+  // Memory inside the mapped egg bundle, valid until the engine shuts down
+  FILE_VIEW_BUNDLE,
+  // A file mapped on its own, which must be unmapped when released
+  FILE_VIEW_MAPPED,
+  // A heap allocation which must be freed when released
+  FILE_VIEW_HEAP
+} FILE_VIEW_SOURCE;
+
+// A read-only window onto the contents of a file, which lets asset
+// loaders decode straight from the bundle without intermediate copies.
+typedef struct {
+  const char* data;
+  size_t length;
+  FILE_VIEW_SOURCE source;
+} FILE_VIEW;
+
+typedef struct {
+  char* data;
+  size_t length;
+} MAPPED_TAR;
+
+internal char*
+mapEntireFile(char* path, size_t* lengthPtr) {
+#ifdef __MINGW32__
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return NULL;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return NULL;
+  }
+  // The view keeps the mapping alive, so we can drop our handle now.
+  char* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (data == NULL) {
+    return NULL;
+  }
+  *lengthPtr = size.QuadPart;
+  return data;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat statbuf;
+  // Zero-length files can't be mapped, so callers fall back to reading them.
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  char* data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  *lengthPtr = statbuf.st_size;
+  return data;
+#endif
+}
+
+internal void
+unmapEntireFile(const char* data, size_t length) {
+#ifdef __MINGW32__
+  UnmapViewOfFile(data);
+#else
+  munmap((void*)data, length);
+#endif
+}
+
+internal void
+FILE_VIEW_close(FILE_VIEW* view) {
+  if (view->data == NULL) {
+    return;
+  }
+  if (view->source == FILE_VIEW_MAPPED) {
+    unmapEntireFile(view->data, view->length);
+  } else if (view->source == FILE_VIEW_HEAP) {
+    free((void*)view->data);
+  }
+  view->data = NULL;
+  view->length = 0;
+}
+
+// microtar stream callbacks, so the bundle is read from memory
+// instead of through a FILE*.
+internal int
+tarMapRead(mtar_t* tar, void* data, unsigned size) {
+  MAPPED_TAR* map = tar->stream;
+  if ((size_t)tar->pos + size > map->length) {
+    return MTAR_EREADFAIL;
+  }
+  memcpy(data, map->data + tar->pos, size);
+  return MTAR_ESUCCESS;
+}
+
+internal int
+tarMapWrite(mtar_t* tar, const void* data, unsigned size) {
+  return MTAR_EWRITEFAIL;
+}
+
+internal int
+tarMapSeek(mtar_t* tar, unsigned pos) {
+  MAPPED_TAR* map = tar->stream;
+  return (pos <= map->length) ? MTAR_ESUCCESS : MTAR_ESEEKFAIL;
+}
+
+internal int
+tarMapClose(mtar_t* tar) {
+  MAPPED_TAR* map = tar->stream;
+  if (map != NULL) {
+    unmapEntireFile(map->data, map->length);
+    free(map);
+    tar->stream = NULL;
+  }
+  return MTAR_ESUCCESS;
+}
+
+internal int
+openMappedTar(mtar_t* tar, char* path) {
+  MAPPED_TAR* map = malloc(sizeof(MAPPED_TAR));
+  if (map == NULL) {
+    return MTAR_EOPENFAIL;
+  }
+  map->data = mapEntireFile(path, &map->length);
+  if (map->data == NULL) {
+    free(map);
+    return MTAR_EOPENFAIL;
+  }
+
+  memset(tar, 0, sizeof(mtar_t));
+  tar->read = tarMapRead;
+  tar->write = tarMapWrite;
+  tar->seek = tarMapSeek;
+  tar->close = tarMapClose;
+  tar->stream = map;
+
+  // Check the first header is valid before we commit to the bundle
+  mtar_header_t h;
+  int err = mtar_read_header(tar, &h);
+  if (err != MTAR_ESUCCESS) {
+    mtar_close(tar);
+  }
+  return err;
+}
+
 internal int
-readFileFromTar(mtar_t* tar, char* path, size_t* lengthPtr, char** data) {
-  // We assume the tar open has been done already
+viewFileFromTar(mtar_t* bundle, char* path, FILE_VIEW* view) {
+  // We assume the tar open has been done already.
+  // Searching a copy of the cursor means worker threads can look up
+  // files at the same time as the main thread.
+  mtar_t tar = *bundle;
   int err;
   mtar_header_t h;
 
@@ -102,12 +266,12 @@ readFileFromTar(mtar_t* tar, char* path, size_t* lengthPtr, char** data) {
   strcpy(compatiblePath, "./");
   strcat(compatiblePath, path);
 
-  err = mtar_rewind(tar);
+  err = mtar_rewind(&tar);
   if (err != MTAR_ESUCCESS) {
     return err;
   }
 
-  while ((err = mtar_read_header(tar, &h)) == MTAR_ESUCCESS) {
+  while ((err = mtar_read_header(&tar, &h)) == MTAR_ESUCCESS) {
     // search for "<path>", "./<path>" and "/<path>"
     // see https://github.com/avivbeeri/nest/pull/2
     if (!strcmp(h.name, path) ||
@@ -115,7 +279,7 @@ readFileFromTar(mtar_t* tar, char* path, size_t* lengthPtr, char** data) {
         !strcmp(h.name, compatiblePath + 1)) {
       break;
     }
-    err = mtar_next(tar);
+    err = mtar_next(&tar);
 
     if (err != MTAR_ESUCCESS) {
       return err;
@@ -126,19 +290,18 @@ readFileFromTar(mtar_t* tar, char* path, size_t* lengthPtr, char** data) {
     return err;
   }
 
-  size_t length = h.size;
-  *data = calloc(1, length + 1);
-  if ((err = mtar_read_data(tar, *data, length)) != MTAR_ESUCCESS) {
-    // Some kind of problem reading the file
-    free(*data);
-    return err;
+  // The entry data follows directly after its header
+  MAPPED_TAR* map = tar.stream;
+  size_t start = (size_t)tar.last_header + sizeof(mtar_raw_header_t);
+  if (start + h.size > map->length) {
+    return MTAR_EREADFAIL;
   }
 
-  if (lengthPtr != NULL) {
-    *lengthPtr = length;
-  }
+  view->data = map->data + start;
+  view->length = h.size;
+  view->source = FILE_VIEW_BUNDLE;
 
-  return err;
+  return MTAR_ESUCCESS;
 }
 
 internal int
@@ -152,6 +315,94 @@ writeEntireFile(char* path, char* data, size_t length) {
   return 0;
 }
 
+// Writes to a temporary file beside the target and renames it into place,
+// so a crash part way through leaves either the old file or the new one.
+// With sync, the data is on the disk before the rename, and the rename is
+// on the disk before we return, not just handed to the OS.
+internal int
+writeEntireFileAtomic(char* path, char* data, size_t length, bool sync) {
+  size_t tempLength = strlen(path) + 5;
+  char tempPath[tempLength];
+  snprintf(tempPath, tempLength, "%s.tmp", path);
+
+  FILE* file = fopen(tempPath, "wb");
+  if (file == NULL) {
+    return errno;
+  }
+  // Stdio doesn't promise to set errno, so clear it before each call and
+  // fall back to EIO.
+  int result = 0;
+  errno = 0;
+  if (fwrite(data, sizeof(char), length, file) != length) {
+    result = errno != 0 ? errno : EIO;
+  }
+  errno = 0;
+  if (result == 0 && fflush(file) != 0) {
+    result = errno != 0 ? errno : EIO;
+  }
+  if (result == 0 && sync) {
+#ifdef __MINGW32__
+    if (_commit(fileno(file)) != 0) {
+#else
+    if (fsync(fileno(file)) != 0) {
+#endif
+      result = errno;
+    }
+  }
+  errno = 0;
+  if (fclose(file) != 0 && result == 0) {
+    result = errno != 0 ? errno : EIO;
+  }
+
+  if (result == 0) {
+#ifdef __MINGW32__
+    // rename() won't replace an existing file on Windows, and
+    // MOVEFILE_WRITE_THROUGH waits for the move to reach the disk
+    if (!MoveFileEx(tempPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+      result = EIO;
+    }
+#else
+    if (rename(tempPath, path) != 0) {
+      result = errno;
+    } else if (sync) {
+      // The rename is an entry in the directory, which has its own sync
+      char dirPath[tempLength];
+      strcpy(dirPath, path);
+      int dir = open(dirname(dirPath), O_RDONLY);
+      if (dir == -1 || fsync(dir) != 0) {
+        result = errno;
+      }
+      if (dir != -1) {
+        close(dir);
+      }
+    }
+#endif
+  }
+  if (result != 0) {
+    remove(tempPath);
+  }
+  return result;
+}
+
+// fseek and ftell only take a long, which is 32 bits on Windows
+internal int
+seekFile(FILE* file, uint64_t offset, int whence) {
+#ifdef __MINGW32__
+  return _fseeki64(file, offset, whence);
+#else
+  return fseeko(file, offset, whence);
+#endif
+}
+
+internal uint64_t
+tellFile(FILE* file) {
+#ifdef __MINGW32__
+  return _ftelli64(file);
+#else
+  return ftello(file);
+#endif
+}
+
 internal char*
 readEntireFile(char* path, size_t* lengthPtr) {
   FILE* file = fopen(path, "rb");
@@ -0,0 +1,409 @@
+/*
+ log.c
+
+ Messages are formatted straight into a slot of a fixed ring, which any
+ thread can claim without a lock, and a background thread writes them to
+ the console and DOME-out.log. Logging never waits on the disk, so even
+ verbose logging leaves frame timing alone. Messages too long for a slot
+ are formatted onto the heap and the slot carries the pointer instead. If
+ the ring is full, messages are dropped and counted rather than blocking
+ the caller, except for errors, which are written directly.
+
+ Draining takes two locks. The output mutex keeps whole batches in order
+ and is held while writing. The drain spinlock is only held long enough
+ to find the messages waiting and, once they are written, to hand their
+ slots back, so nobody spins while the disk is busy.
+
+ Before the thread starts and after it stops, messages are written
+ directly. On a crash, whatever is still in the ring is written out with
+ write(2) before the process dies, since stdio can't be used in a signal
+ handler.
+ */
+
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 512
+#define LOG_FILE_NAME "DOME-out.log"
+
+typedef enum {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARN,
+  LOG_ERROR
+} LOG_LEVEL;
+
+typedef enum {
+  LOG_GENERAL,
+  LOG_IO,
+  LOG_SCRIPT,
+  LOG_AUDIO,
+  LOG_GRAPHICS,
+  LOG_SUBSYSTEM_COUNT
+} LOG_SUBSYSTEM;
+
+global_variable const char* LOG_SUBSYSTEM_NAMES[LOG_SUBSYSTEM_COUNT] = {
+  "general", "io", "script", "audio", "graphics"
+};
+
+global_variable const char* LOG_LEVEL_NAMES[] = {
+  "debug", "info", "warn", "error"
+};
+
+typedef struct {
+  // Equal to the claiming position + 1 once the message is written, and
+  // moved on a lap by the reader once it has been consumed
+  SDL_atomic_t sequence;
+  size_t length;
+  // Set when the message didn't fit in text, and freed once written
+  char* overflow;
+  char text[LOG_MESSAGE_SIZE];
+} LOG_SLOT;
+
+typedef struct {
+  LOG_LEVEL level;
+  uint32_t subsystems;
+
+  LOG_SLOT slots[LOG_RING_SIZE];
+  SDL_atomic_t head;
+  SDL_atomic_t dropped;
+  // Only touched by whoever holds the drain lock
+  unsigned int tail;
+  SDL_SpinLock drainLock;
+  // Held for the whole of a drain, including the writing
+  SDL_mutex* outputLock;
+
+  SDL_Thread* thread;
+  SDL_sem* wake;
+  SDL_atomic_t running;
+  FILE* file;
+  // The descriptor behind file, for the crash handler
+  volatile sig_atomic_t fd;
+  bool closed;
+} LOG;
+
+global_variable LOG logger = {
+  .level = LOG_INFO,
+  .subsystems = (1 << LOG_SUBSYSTEM_COUNT) - 1,
+  .fd = -1
+};
+
+internal inline bool
+LOG_enabled(LOG_LEVEL level, LOG_SUBSYSTEM subsystem) {
+  return level >= logger.level && (logger.subsystems & (1 << subsystem)) != 0;
+}
+
+internal void
+LOG_output(const char* text) {
+  fputs(text, stdout);
+  if (logger.file == NULL && !logger.closed) {
+    logger.file = fopen(LOG_FILE_NAME, "w+");
+    if (logger.file != NULL) {
+      logger.fd = fileno(logger.file);
+    }
+  }
+  if (logger.file != NULL) {
+    fputs(text, logger.file);
+  }
+}
+
+// PRE: outputLock is held
+internal void
+LOG_flush(void) {
+  fflush(stdout);
+  if (logger.file != NULL) {
+    fflush(logger.file);
+  }
+}
+
+internal void
+LOG_lockOutput(void) {
+  if (logger.outputLock != NULL) {
+    SDL_LockMutex(logger.outputLock);
+  }
+}
+
+internal void
+LOG_unlockOutput(void) {
+  if (logger.outputLock != NULL) {
+    SDL_UnlockMutex(logger.outputLock);
+  }
+}
+
+// PRE: outputLock is held
+internal bool
+LOG_drain(void) {
+  // Claim everything waiting. Producers can't reuse the slots until they
+  // are handed back, so they can be read without the spinlock.
+  SDL_AtomicLock(&logger.drainLock);
+  unsigned int start = logger.tail;
+  unsigned int end = start;
+  while ((unsigned int)SDL_AtomicGet(&logger.slots[end % LOG_RING_SIZE].sequence) == end + 1) {
+    end++;
+  }
+  SDL_AtomicUnlock(&logger.drainLock);
+
+  for (unsigned int position = start; position != end; position++) {
+    LOG_SLOT* slot = &logger.slots[position % LOG_RING_SIZE];
+    LOG_output(slot->overflow != NULL ? slot->overflow : slot->text);
+  }
+  bool wrote = start != end;
+
+  int dropped = SDL_AtomicSet(&logger.dropped, 0);
+  if (dropped > 0) {
+    char text[64];
+    snprintf(text, sizeof(text), "[%i log messages dropped]\n", dropped);
+    LOG_output(text);
+    wrote = true;
+  }
+  if (wrote) {
+    LOG_flush();
+  }
+
+  // The crash handler reads the slots too, so they go back under the lock
+  SDL_AtomicLock(&logger.drainLock);
+  for (unsigned int position = start; position != end; position++) {
+    LOG_SLOT* slot = &logger.slots[position % LOG_RING_SIZE];
+    free(slot->overflow);
+    slot->overflow = NULL;
+    SDL_AtomicSet(&slot->sequence, position + LOG_RING_SIZE);
+  }
+  logger.tail = end;
+  SDL_AtomicUnlock(&logger.drainLock);
+  return wrote;
+}
+
+internal int
+LOG_threadFn(void* data) {
+  while (SDL_AtomicGet(&logger.running)) {
+    SDL_SemWaitTimeout(logger.wake, 100);
+    LOG_lockOutput();
+    LOG_drain();
+    LOG_unlockOutput();
+  }
+  return 0;
+}
+
+internal void
+LOG_crashWrite(int fd, const char* text, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, text, length);
+    if (written <= 0) {
+      return;
+    }
+    text += written;
+    length -= written;
+  }
+}
+
+// Only async-signal-safe calls from here on. Everything before the tail
+// has already been flushed by the drain, so only the ring needs writing.
+// A batch which was being written when the crash came is written again,
+// as it's better to repeat a message than to lose it.
+internal void
+LOG_crashHandler(int sig) {
+  // The log thread may have been mid-drain, so don't wait on it forever
+  bool locked = false;
+  for (int i = 0; i < 1000 && !locked; i++) {
+    locked = SDL_AtomicTryLock(&logger.drainLock);
+  }
+  if (locked) {
+    int fd = logger.fd;
+    unsigned int tail = logger.tail;
+    while (true) {
+      LOG_SLOT* slot = &logger.slots[tail % LOG_RING_SIZE];
+      if ((unsigned int)SDL_AtomicGet(&slot->sequence) != tail + 1) {
+        break;
+      }
+      const char* text = slot->overflow != NULL ? slot->overflow : slot->text;
+      LOG_crashWrite(STDOUT_FILENO, text, slot->length);
+      if (fd != -1) {
+        LOG_crashWrite(fd, text, slot->length);
+      }
+      tail++;
+    }
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// Writes a message straight out, after anything still waiting in the ring
+// so the order is kept.
+internal void
+LOG_writeDirect(const char* format, va_list args) {
+  char stackText[LOG_MESSAGE_SIZE];
+  char* text = stackText;
+  va_list measure;
+  va_copy(measure, args);
+  int length = vsnprintf(NULL, 0, format, measure);
+  va_end(measure);
+  if (length >= LOG_MESSAGE_SIZE) {
+    text = malloc(length + 1);
+    if (text == NULL) {
+      text = stackText;
+      length = LOG_MESSAGE_SIZE - 1;
+    }
+  }
+  vsnprintf(text, length < 0 ? sizeof(stackText) : (size_t)length + 1, format, args);
+
+  LOG_lockOutput();
+  LOG_drain();
+  LOG_output(text);
+  LOG_flush();
+  LOG_unlockOutput();
+  if (text != stackText) {
+    free(text);
+  }
+}
+
+internal void
+LOG_vprint(LOG_LEVEL level, LOG_SUBSYSTEM subsystem, const char* format, va_list args) {
+  if (!LOG_enabled(level, subsystem)) {
+    return;
+  }
+  if (!SDL_AtomicGet(&logger.running)) {
+    LOG_writeDirect(format, args);
+    return;
+  }
+
+  // Claim a slot, as in Vyukov's bounded queue
+  unsigned int position = SDL_AtomicGet(&logger.head);
+  LOG_SLOT* slot;
+  while (true) {
+    slot = &logger.slots[position % LOG_RING_SIZE];
+    int difference = (int)((unsigned int)SDL_AtomicGet(&slot->sequence) - position);
+    if (difference == 0) {
+      if (SDL_AtomicCAS(&logger.head, position, position + 1)) {
+        break;
+      }
+    } else if (difference < 0) {
+      if (level == LOG_ERROR) {
+        LOG_writeDirect(format, args);
+      } else {
+        SDL_AtomicIncRef(&logger.dropped);
+      }
+      return;
+    }
+    position = SDL_AtomicGet(&logger.head);
+  }
+
+  va_list copy;
+  va_copy(copy, args);
+  int length = vsnprintf(slot->text, LOG_MESSAGE_SIZE, format, copy);
+  va_end(copy);
+  slot->overflow = NULL;
+  if (length < 0) {
+    length = 0;
+    slot->text[0] = '\0';
+  } else if (length >= LOG_MESSAGE_SIZE) {
+    char* overflow = malloc(length + 1);
+    if (overflow != NULL) {
+      vsnprintf(overflow, length + 1, format, args);
+      slot->overflow = overflow;
+    } else {
+      length = LOG_MESSAGE_SIZE - 1;
+    }
+  }
+  slot->length = length;
+  SDL_AtomicSet(&slot->sequence, position + 1);
+  SDL_SemPost(logger.wake);
+}
+
+internal void
+LOG_print(LOG_LEVEL level, LOG_SUBSYSTEM subsystem, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  LOG_vprint(level, subsystem, format, args);
+  va_end(args);
+}
+
+internal bool
+LOG_setLevel(const char* name) {
+  for (size_t i = 0; i < sizeof(LOG_LEVEL_NAMES) / sizeof(LOG_LEVEL_NAMES[0]); i++) {
+    if (SDL_strcasecmp(name, LOG_LEVEL_NAMES[i]) == 0) {
+      logger.level = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Takes a comma separated list of subsystems, and logs only those.
+internal bool
+LOG_setFilter(const char* list) {
+  uint32_t subsystems = 0;
+  const char* start = list;
+  while (*start != '\0') {
+    size_t length = strcspn(start, ",");
+    bool found = false;
+    for (size_t i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+      if (strlen(LOG_SUBSYSTEM_NAMES[i]) == length && SDL_strncasecmp(start, LOG_SUBSYSTEM_NAMES[i], length) == 0) {
+        subsystems |= 1 << i;
+        found = true;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+    start += length;
+    if (*start == ',') {
+      start++;
+    }
+  }
+  logger.subsystems = subsystems;
+  return true;
+}
+
+internal void
+LOG_init(void) {
+  for (unsigned int i = 0; i < LOG_RING_SIZE; i++) {
+    SDL_AtomicSet(&logger.slots[i].sequence, i);
+  }
+  SDL_AtomicSet(&logger.head, 0);
+  SDL_AtomicSet(&logger.dropped, 0);
+  logger.tail = 0;
+
+  logger.outputLock = SDL_CreateMutex();
+  logger.wake = SDL_CreateSemaphore(0);
+  if (logger.wake == NULL) {
+    return;
+  }
+  SDL_AtomicSet(&logger.running, 1);
+  logger.thread = SDL_CreateThread(LOG_threadFn, "DOME log", NULL);
+  if (logger.thread == NULL) {
+    SDL_AtomicSet(&logger.running, 0);
+    SDL_DestroySemaphore(logger.wake);
+    logger.wake = NULL;
+    return;
+  }
+
+  signal(SIGSEGV, LOG_crashHandler);
+  signal(SIGABRT, LOG_crashHandler);
+  signal(SIGFPE, LOG_crashHandler);
+  signal(SIGILL, LOG_crashHandler);
+}
+
+// Writes out anything left and stops the thread.
+internal void
+LOG_free(void) {
+  if (logger.thread != NULL) {
+    SDL_AtomicSet(&logger.running, 0);
+    SDL_SemPost(logger.wake);
+    SDL_WaitThread(logger.thread, NULL);
+    logger.thread = NULL;
+    SDL_DestroySemaphore(logger.wake);
+    logger.wake = NULL;
+
+    LOG_lockOutput();
+    LOG_drain();
+    LOG_unlockOutput();
+  }
+  if (logger.outputLock != NULL) {
+    SDL_DestroyMutex(logger.outputLock);
+    logger.outputLock = NULL;
+  }
+  if (logger.file != NULL) {
+    logger.fd = -1;
+    fclose(logger.file);
+    logger.file = NULL;
+  }
+  logger.closed = true;
+}
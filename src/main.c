@@ -8,6 +8,7 @@
 // Standard libs
 #ifdef __MINGW32__
 #include <windows.h>
+#include <io.h>
 #endif
 #include <stdio.h>
 #include <errno.h>
@@ -18,9 +19,15 @@
 #include <utf8.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <signal.h>
 #include <libgen.h>
 
 
@@ -82,6 +89,12 @@
     return; \
   }
 
+#define ASSERT_SLOT_TYPE_RETURN(vm, slot, type, fieldName, value) \
+  if (wrenGetSlotType(vm, slot) != WREN_TYPE_##type) { \
+    VM_ABORT(vm, #fieldName " was not " #type); \
+    return value; \
+  }
+
 
 
 // Constants
@@ -91,9 +104,24 @@
 #define SCREEN_WIDTH GAME_WIDTH * 2
 #define SCREEN_HEIGHT GAME_HEIGHT * 2
 
-// Used in the io variable, but we need to catch it here
-global_variable WrenHandle* bufferClass = NULL;
-global_variable WrenHandle* audioEngineClass = NULL;
+// Handles into the VM, made once and kept for its lifetime. The classes
+// of built-in modules are captured when those modules first load.
+typedef struct {
+  WrenHandle* gameClass;
+  WrenHandle* audioEngineClass;
+  WrenHandle* bufferClass;
+  WrenHandle* pointerClass;
+  WrenHandle* structClass;
+  WrenHandle* vectorClass;
+  WrenHandle* inputClass;
+  WrenHandle* init;
+  // Shared by Game and AudioEngine, as a call handle is only a signature
+  WrenHandle* update;
+  WrenHandle* draw;
+  WrenHandle* dispatch;
+} VM_HANDLES;
+
+global_variable VM_HANDLES vmHandles;
 
 // These are set by cmd arguments
 #ifdef DEBUG
@@ -107,26 +135,36 @@ global_variable size_t GIF_SCALE = 1;
 // Game code
 #include "math.c"
 #include "strings.c"
+#include "memory.c"
 #include "audio_types.c"
 #include "modules/map.c"
 #include "engine.h"
 #include "debug.c"
+#include "log.c"
 /*
 #include "util/font.c"
 */
 #include "util/font8x8.h"
 #include "io.c"
+#include "compress.c"
+#include "pack.c"
 #include "engine.c"
+#include "recorder.c"
+#include "postprocess.c"
 #include "modules/dome.c"
 #if DOME_OPT_FFI
 #include "modules/ffi.c"
 #endif
-#include "modules/font.c"
 #include "modules/io.c"
+#include "modules/serialize.c"
+#include "modules/font.c"
+#include "modules/vector.c"
 #include "modules/audio.c"
 #include "modules/graphics.c"
 #include "modules/image.c"
+#include "modules/assets.c"
 #include "modules/input.c"
+#include "replay.c"
 #include "vm.c"
 
 internal void
@@ -152,11 +190,26 @@ printVersion(ENGINE* engine) {
 #endif
 }
 
+// Parses a whole decimal number from an option, within [min, max]
+internal bool
+parseOptionInteger(const char* text, long min, long max, long* value) {
+  char* end;
+  errno = 0;
+  long result = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE || result < min || result > max) {
+    return false;
+  }
+  *value = result;
+  return true;
+}
 
 internal void
 printUsage(ENGINE* engine) {
   ENGINE_printLog(engine, "\nUsage: \n");
-  ENGINE_printLog(engine, "  dome [-c] [-d | --debug] [-r<gif> | --record=<gif>] [-b<buf> | --buffer=<buf>] [entry path]\n");
+  ENGINE_printLog(engine, "  dome [-c] [-d | --debug] [-r<file> | --record=<file>] [-e<n> | --record-every=<n>] [-b<buf> | --buffer=<buf>] [entry path]\n");
+  ENGINE_printLog(engine, "  dome [-i<file> | --record-input=<file>] [-I<file> | --replay-input=<file>] [entry path]\n");
+  ENGINE_printLog(engine, "  dome [-l<level> | --log-level=<level>] [-L<list> | --log-filter=<list>] [entry path]\n");
+  ENGINE_printLog(engine, "  dome -p<dir> | --pack=<dir> [output egg]\n");
   ENGINE_printLog(engine, "  dome -h | --help\n");
   ENGINE_printLog(engine, "  dome -v | --version\n");
   ENGINE_printLog(engine, "\nOptions: \n");
@@ -165,9 +218,19 @@ printUsage(ENGINE* engine) {
   ENGINE_printLog(engine, "  -c --console        Opens a console window for development.\n");
 #endif
   ENGINE_printLog(engine, "  -d --debug          Enables debug mode.\n");
+  ENGINE_printLog(engine, "  -e --record-every=<n> Record every <n>th game frame (default: 2 for gifs, otherwise 1).\n");
   ENGINE_printLog(engine, "  -h --help           Show this screen.\n");
+  ENGINE_printLog(engine, "  -l --log-level=<level> Only log messages at <level> or above: debug, info, warn or error (default: info).\n");
+  ENGINE_printLog(engine, "  -L --log-filter=<list> Only log the comma separated subsystems: general, io, script, audio, graphics.\n");
+  ENGINE_printLog(engine, "  -i --record-input=<file> Record the input of every update to <file>.\n");
+  ENGINE_printLog(engine, "  -I --replay-input=<file> Replay recorded input as fast as possible, then exit.\n");
+  ENGINE_printLog(engine, "  -H --heap=<mb>      Heap size before the first garbage collection, 1-2047 (default: 16).\n");
+  ENGINE_printLog(engine, "  -M --heap-min=<mb>  Smallest heap to grow from after a collection, 1-2047 (default: 4).\n");
+  ENGINE_printLog(engine, "  -G --heap-growth=<n> Grow the heap by <n> percent of live memory after a collection, 1-1000 (default: 100).\n");
+  ENGINE_printLog(engine, "  -p --pack=<dir>     Compress <dir> into an egg bundle (default: game.egg).\n");
   ENGINE_printLog(engine, "  -v --version        Show version.\n");
-  ENGINE_printLog(engine, "  -r --record=<gif>   Record video to <gif>.\n");
+  ENGINE_printLog(engine, "  -r --record=<file>  Record video to a .gif, .y4m or numbered .png files (default: dome.gif).\n");
+  ENGINE_printLog(engine, "  -s --scale=<n>      Scale up recordings and screenshots by <n>.\n");
 }
 
 int main(int argc, char* args[])
@@ -181,14 +244,16 @@ int main(int argc, char* args[])
   WrenVM* vm = NULL;
   size_t gameFileLength;
   char* gameFile;
+  char* packDirectory = NULL;
+  char* logLevel = NULL;
   INIT_TO_ZERO(ENGINE, engine);
-  engine.record.gifName = "test.gif";
-  engine.record.makeGif = false;
+  engine.record.path = "dome.gif";
+  engine.record.enabled = false;
 
   //Initialize SDL
   if (SDL_Init(SDL_INIT_VIDEO) < 0)
   {
-    ENGINE_printLog(&engine, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+    LOG_print(LOG_ERROR, LOG_GENERAL, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
     result = EXIT_FAILURE;
     goto cleanup;
   }
@@ -206,8 +271,17 @@ int main(int argc, char* args[])
     #endif
     {"debug", 'd', OPTPARSE_NONE},
     {"help", 'h', OPTPARSE_NONE},
+    {"log-level", 'l', OPTPARSE_REQUIRED},
+    {"log-filter", 'L', OPTPARSE_REQUIRED},
+    {"heap", 'H', OPTPARSE_REQUIRED},
+    {"heap-min", 'M', OPTPARSE_REQUIRED},
+    {"heap-growth", 'G', OPTPARSE_REQUIRED},
+    {"pack", 'p', OPTPARSE_REQUIRED},
     {"version", 'v', OPTPARSE_NONE},
     {"record", 'r', OPTPARSE_OPTIONAL},
+    {"record-every", 'e', OPTPARSE_REQUIRED},
+    {"record-input", 'i', OPTPARSE_REQUIRED},
+    {"replay-input", 'I', OPTPARSE_REQUIRED},
     {"scale", 's', OPTPARSE_REQUIRED},
     {0}
   };
@@ -251,14 +325,71 @@ int main(int argc, char* args[])
         printTitle(&engine);
         printUsage(&engine);
         goto cleanup;
+      case 'H':
+      case 'M':
+        {
+          long megabytes;
+          if (!parseOptionInteger(options.optarg, MEMORY_HEAP_MIN_MB, MEMORY_HEAP_MAX_MB, &megabytes)) {
+            fprintf(stderr, "%s: %s must be a number of megabytes from %d to %d, not '%s'\n",
+                args[0], option == 'H' ? "--heap" : "--heap-min",
+                MEMORY_HEAP_MIN_MB, MEMORY_HEAP_MAX_MB, options.optarg);
+            printUsage(&engine);
+            result = EXIT_FAILURE;
+            goto cleanup;
+          }
+          size_t bytes = (size_t)megabytes * 1024 * 1024;
+          if (option == 'H') {
+            memory.initialHeapSize = bytes;
+          } else {
+            memory.minHeapSize = bytes;
+          }
+        } break;
+      case 'G':
+        {
+          long percent;
+          if (!parseOptionInteger(options.optarg, MEMORY_GROWTH_MIN, MEMORY_GROWTH_MAX, &percent)) {
+            fprintf(stderr, "%s: --heap-growth must be a percentage from %d to %d, not '%s'\n",
+                args[0], MEMORY_GROWTH_MIN, MEMORY_GROWTH_MAX, options.optarg);
+            printUsage(&engine);
+            result = EXIT_FAILURE;
+            goto cleanup;
+          }
+          memory.heapGrowthPercent = percent;
+        } break;
+      case 'l':
+        logLevel = options.optarg;
+        break;
+      case 'L':
+        if (!LOG_setFilter(options.optarg)) {
+          fprintf(stderr, "%s: unknown log subsystem in '%s'\n", args[0], options.optarg);
+          result = EXIT_FAILURE;
+          goto cleanup;
+        }
+        break;
+      case 'p':
+        packDirectory = options.optarg;
+        break;
       case 'r':
-        engine.record.makeGif = true;
+        engine.record.enabled = true;
         if (options.optarg != NULL) {
-          engine.record.gifName = options.optarg;
-        } else {
-          engine.record.gifName = "dome.gif";
+          engine.record.path = options.optarg;
         }
-        ENGINE_printLog(&engine, "GIF Recording is enabled: Saving to %s\n", engine.record.gifName);
+        ENGINE_printLog(&engine, "Recording is enabled: Saving to %s\n", engine.record.path);
+        break;
+      case 'e':
+        {
+          int interval = atoi(options.optarg);
+          // Zero picks a default for the format
+          engine.record.interval = max(interval, 0);
+        } break;
+      case 'i':
+        replay.mode = REPLAY_RECORD;
+        replay.path = options.optarg;
+        break;
+      case 'I':
+        replay.mode = REPLAY_PLAY;
+        replay.path = options.optarg;
+        inputState.replaying = true;
         break;
       case 'v':
         printTitle(&engine);
@@ -271,6 +402,23 @@ int main(int argc, char* args[])
     }
   }
 
+  // Debug mode shows everything, unless a level was asked for
+  if (logLevel != NULL) {
+    if (!LOG_setLevel(logLevel)) {
+      fprintf(stderr, "%s: unknown log level '%s'\n", args[0], logLevel);
+      result = EXIT_FAILURE;
+      goto cleanup;
+    }
+  } else if (DEBUG_MODE) {
+    LOG_setLevel("debug");
+  }
+
+  if (packDirectory != NULL) {
+    char* outputPath = optparse_arg(&options);
+    result = PACK_create(&engine, packDirectory, outputPath != NULL ? outputPath : "game.egg");
+    goto cleanup;
+  }
+
   {
     char* defaultEggName = "game.egg";
     char* mainFileName = "main.wren";
@@ -303,17 +451,27 @@ int main(int argc, char* args[])
     strcat(pathBuf, fileName ? fileName : defaultEggName);
 
     if (doesFileExist(pathBuf)) {
-      engine.tar = malloc(sizeof(mtar_t));
-      int tarResult = mtar_open(engine.tar, pathBuf, "r");
-      if (tarResult == MTAR_ESUCCESS) {
+      // Prefer the compressed format, but keep accepting plain tarballs
+      engine.pack = malloc(sizeof(PACK));
+      if (PACK_open(engine.pack, pathBuf)) {
         ENGINE_printLog(&engine, "Loading bundle %s\n", pathBuf);
       } else {
-        free(engine.tar);
-        engine.tar = NULL;
+        free(engine.pack);
+        engine.pack = NULL;
+
+        engine.tar = malloc(sizeof(mtar_t));
+        int tarResult = openMappedTar(engine.tar, pathBuf);
+        if (tarResult == MTAR_ESUCCESS) {
+          ENGINE_printLog(&engine, "Loading bundle %s\n", pathBuf);
+        } else {
+          free(engine.tar);
+          engine.tar = NULL;
+        }
       }
     }
 
-    if (engine.tar != NULL) {
+    bool bundled = engine.tar != NULL || engine.pack != NULL;
+    if (bundled) {
       strcpy(pathBuf, mainFileName);
     } else {
       strcpy(pathBuf, fileName ? fileName : mainFileName);
@@ -321,10 +479,10 @@ int main(int argc, char* args[])
 
     gameFile = ENGINE_readFile(&engine, pathBuf, &gameFileLength);
     if (gameFile == NULL) {
-      if (engine.tar != NULL) {
-        ENGINE_printLog(&engine, "Error: Could not load %s in bundle.\n", pathBuf);
+      if (bundled) {
+        LOG_print(LOG_ERROR, LOG_IO, "Error: Could not load %s in bundle.\n", pathBuf);
       } else {
-        ENGINE_printLog(&engine, "Error: Could not load %s.\n", pathBuf);
+        LOG_print(LOG_ERROR, LOG_IO, "Error: Could not load %s.\n", pathBuf);
       }
       printUsage(&engine);
       result = EXIT_FAILURE;
@@ -344,23 +502,15 @@ int main(int argc, char* args[])
     result = EXIT_FAILURE;
     goto cleanup;
   }
-  // Load the class into slot 0.
-
-
-  wrenEnsureSlots(vm, 3);
-  WrenHandle* initMethod = wrenMakeCallHandle(vm, "init()");
-  WrenHandle* updateMethod = wrenMakeCallHandle(vm, "update()");
-  WrenHandle* drawMethod = wrenMakeCallHandle(vm, "draw(_)");
-  wrenGetVariable(vm, "main", "Game", 0);
-  WrenHandle* gameClass = wrenGetSlotHandle(vm, 0);
+  VM_makeHandles(vm);
 
   // Initiate game loop
   uint8_t FPS = 60;
   double MS_PER_FRAME = ceil(1000.0 / FPS);
-  SDL_Thread* recordThread = NULL;
 
-  wrenSetSlotHandle(vm, 0, gameClass);
-  interpreterResult = wrenCall(vm, initMethod);
+  wrenEnsureSlots(vm, 1);
+  wrenSetSlotHandle(vm, 0, vmHandles.gameClass);
+  interpreterResult = wrenCall(vm, vmHandles.init);
   if (interpreterResult != WREN_RESULT_SUCCESS) {
     result = EXIT_FAILURE;
     goto vm_cleanup;
@@ -372,17 +522,27 @@ int main(int argc, char* args[])
   SDL_SetRenderDrawColor(engine.renderer, 0x00, 0x00, 0x00, 0xFF);
 
   // Resizing from init must happen before we begin recording
-  if (engine.record.makeGif) {
-    recordThread = SDL_CreateThread(ENGINE_record, "DOMErecorder", &engine);
+  if (engine.record.enabled) {
+    engine.record.enabled = RECORDER_start(&engine);
+  }
+  if (!REPLAY_start(&engine)) {
+    result = EXIT_FAILURE;
+    goto vm_cleanup;
   }
   uint64_t previousTime = SDL_GetPerformanceCounter();
   int32_t lag = 0;
   bool windowHasFocus = false;
   SDL_Event event;
   while (engine.running) {
+    // The frame starts before input, so Wren code run while dispatching
+    // events counts towards the time it has used
+    uint64_t currentTime = SDL_GetPerformanceCounter();
+    int32_t elapsed = 1000 * (currentTime - previousTime) / SDL_GetPerformanceFrequency();
+    previousTime = currentTime;
 
     // processInput()
     while(SDL_PollEvent(&event)) {
+      INPUT_handleEvent(&event);
       switch (event.type)
       {
         case SDL_QUIT:
@@ -407,34 +567,47 @@ int main(int argc, char* args[])
             if (keyCode == SDLK_F3 && event.key.state == SDL_PRESSED && event.key.repeat == 0) {
               engine.debugEnabled = !engine.debugEnabled;
             } else if (keyCode == SDLK_F2 && event.key.state == SDL_PRESSED && event.key.repeat == 0) {
-              ENGINE_takeScreenshot(&engine);
+              ENGINE_takeScreenshot(&engine, NULL, GIF_SCALE, NULL, NULL);
             }
           } break;
         case SDL_CONTROLLERDEVICEADDED:
           {
-            GAMEPAD_eventAdded(vm, event.cdevice.which);
+            if (!inputState.replaying) {
+              INPUT_pushEvent(INPUT_EVENT_GAMEPAD_ADDED, event.cdevice.which);
+            }
           } break;
         case SDL_CONTROLLERDEVICEREMOVED:
           {
-            GAMEPAD_eventRemoved(vm, event.cdevice.which);
+            if (!inputState.replaying) {
+              INPUT_pushEvent(INPUT_EVENT_GAMEPAD_REMOVED, event.cdevice.which);
+            }
           } break;
         case SDL_USEREVENT:
           {
-            ENGINE_printLog(&engine, "Event code %i\n", event.user.code);
+            LOG_print(LOG_DEBUG, LOG_GENERAL, "Event code %i\n", event.user.code);
             if (event.user.code == EVENT_LOAD_FILE) {
               FILESYSTEM_loadEventComplete(&event);
+            } else if (event.user.code == EVENT_WRITE_FILE) {
+              FILESYSTEM_saveEventComplete(&event);
+            } else if (event.user.code == EVENT_WALK_DIRECTORY) {
+              FILESYSTEM_walkEventComplete(&event);
+            } else if (event.user.code == EVENT_SCREENSHOT) {
+              CANVAS_screenshotComplete(&event);
             }
           }
       }
     }
 
-    uint64_t currentTime = SDL_GetPerformanceCounter();
-    int32_t elapsed = 1000 * (currentTime - previousTime) / SDL_GetPerformanceFrequency();
-    previousTime = currentTime;
+    // Everything that happened since the last frame goes to Wren at once
+    interpreterResult = INPUT_dispatchEvents(vm);
+    if (interpreterResult != WREN_RESULT_SUCCESS) {
+      result = EXIT_FAILURE;
+      goto vm_cleanup;
+    }
 
     // If we aren't focused, we skip the update loop and let the CPU sleep
     // to be good citizens
-    if (windowHasFocus) {
+    if (windowHasFocus && replay.mode != REPLAY_PLAY) {
       SDL_Delay(50);
       continue;
     }
@@ -451,21 +624,38 @@ int main(int argc, char* args[])
     lag += elapsed;
 
     // update()
+    size_t ticks = 0;
+
+    // Replays run one tick per frame, as fast as frames can be drawn
+    if (replay.mode == REPLAY_PLAY) {
+      lag = MS_PER_FRAME + 1;
+    }
 
     while (lag > MS_PER_FRAME) {
-      wrenEnsureSlots(vm, 8);
-      wrenSetSlotHandle(vm, 0, gameClass);
-      interpreterResult = wrenCall(vm, updateMethod);
+      INPUT_tick(&engine);
+      REPLAY_tick(&engine);
+      if (!engine.running) {
+        break;
+      }
+      // Replayed gamepads connect as the tick starts
+      interpreterResult = INPUT_dispatchEvents(vm);
+      if (interpreterResult != WREN_RESULT_SUCCESS) {
+        result = EXIT_FAILURE;
+        goto vm_cleanup;
+      }
+      wrenEnsureSlots(vm, 1);
+      wrenSetSlotHandle(vm, 0, vmHandles.gameClass);
+      interpreterResult = wrenCall(vm, vmHandles.update);
       if (interpreterResult != WREN_RESULT_SUCCESS) {
         result = EXIT_FAILURE;
         goto vm_cleanup;
       }
       // updateAudio()
-      if (audioEngineClass != NULL) {
-        wrenEnsureSlots(vm, 3);
-        wrenSetSlotHandle(vm, 0, audioEngineClass);
+      if (vmHandles.audioEngineClass != NULL) {
+        wrenEnsureSlots(vm, 1);
+        wrenSetSlotHandle(vm, 0, vmHandles.audioEngineClass);
         AUDIO_ENGINE_lock(engine.audioEngine);
-        interpreterResult = wrenCall(vm, updateMethod);
+        interpreterResult = wrenCall(vm, vmHandles.update);
         AUDIO_ENGINE_unlock(engine.audioEngine);
         if (interpreterResult != WREN_RESULT_SUCCESS) {
           result = EXIT_FAILURE;
@@ -473,8 +663,9 @@ int main(int argc, char* args[])
         }
       }
       lag -= MS_PER_FRAME;
+      ticks++;
 
-      if (engine.lockstep) {
+      if (engine.lockstep || replay.mode == REPLAY_PLAY) {
         lag = mid(0, lag, MS_PER_FRAME);
         break;
       }
@@ -482,15 +673,20 @@ int main(int argc, char* args[])
 
 
     // render();
-    wrenEnsureSlots(vm, 8);
-    wrenSetSlotHandle(vm, 0, gameClass);
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotHandle(vm, 0, vmHandles.gameClass);
     wrenSetSlotDouble(vm, 1, ((double)lag / MS_PER_FRAME));
-    interpreterResult = wrenCall(vm, drawMethod);
+    interpreterResult = wrenCall(vm, vmHandles.draw);
     if (interpreterResult != WREN_RESULT_SUCCESS) {
       result = EXIT_FAILURE;
       goto vm_cleanup;
     }
 
+    if (engine.palette.enabled) {
+      engine.palette.ticks += ticks;
+      ENGINE_resolvePalette(&engine);
+    }
+
     if (engine.debugEnabled) {
       engine.debug.elapsed = elapsed;
       ENGINE_drawDebug(&engine);
@@ -498,18 +694,33 @@ int main(int argc, char* args[])
 
 
     // Flip Buffer to Screen
-    SDL_UpdateTexture(engine.texture, 0, engine.pixels, engine.width * 4);
-    // Flip buffer for recording
-    if (engine.record.makeGif) {
-      size_t imageSize = engine.width * engine.height * 4;
-      memcpy(engine.record.gifPixels, engine.pixels, imageSize);
+    SDL_Texture* texture = POSTPROCESS_apply(&engine);
+    if (texture == NULL) {
+      texture = engine.texture;
+      SDL_UpdateTexture(engine.texture, 0, engine.pixels, engine.width * 4);
+    }
+    RECORDER_update(&engine, ticks);
+
+    // Anything left of this frame would otherwise be spent waiting, so it
+    // is a good time to collect garbage.
+    {
+      double budget = 1000.0 / FPS;
+      SDL_DisplayMode mode;
+      if (engine.vsyncEnabled && SDL_GetWindowDisplayMode(engine.window, &mode) == 0 && mode.refresh_rate > 0) {
+        budget = 1000.0 / mode.refresh_rate;
+      }
+      double used = 1000.0 * (SDL_GetPerformanceCounter() - currentTime) / SDL_GetPerformanceFrequency();
+      MEMORY_collectIdle(vm, budget - used);
     }
 
     // clear screen
     SDL_RenderClear(engine.renderer);
-    SDL_RenderCopy(engine.renderer, engine.texture, NULL, NULL);
+    SDL_RenderCopy(engine.renderer, texture, NULL, NULL);
     SDL_RenderPresent(engine.renderer);
 
+    MEMORY_frame();
+    DBUFFER_releaseHandles(vm);
+
     if (!engine.vsyncEnabled) {
       SDL_Delay(1);
     }
@@ -517,31 +728,26 @@ int main(int argc, char* args[])
 
 vm_cleanup:
 
-  if (recordThread != NULL) {
-    SDL_WaitThread(recordThread, NULL);
-  }
+  RECORDER_finish(&engine);
+  REPLAY_finish(&engine);
+  POSTPROCESS_free(&engine);
   // Finish processing async threads so we can release resources
   ENGINE_finishAsync(&engine);
   while(SDL_PollEvent(&event)) {
     if (event.type == SDL_USEREVENT) {
       if (event.user.code == EVENT_LOAD_FILE) {
         FILESYSTEM_loadEventComplete(&event);
+      } else if (event.user.code == EVENT_WRITE_FILE) {
+        FILESYSTEM_saveEventComplete(&event);
+      } else if (event.user.code == EVENT_WALK_DIRECTORY) {
+        FILESYSTEM_walkEventComplete(&event);
+      } else if (event.user.code == EVENT_SCREENSHOT) {
+        CANVAS_screenshotComplete(&event);
       }
     }
   }
 
-  wrenReleaseHandle(vm, initMethod);
-  wrenReleaseHandle(vm, drawMethod);
-  wrenReleaseHandle(vm, updateMethod);
-  wrenReleaseHandle(vm, gameClass);
-
-  if (bufferClass != NULL) {
-    wrenReleaseHandle(vm, bufferClass);
-  }
-
-  if (audioEngineClass != NULL) {
-    wrenReleaseHandle(vm, audioEngineClass);
-  }
+  VM_releaseHandles(vm);
 
 cleanup:
   // Free resources
@@ -550,6 +756,9 @@ cleanup:
   BASEPATH_free();
   AUDIO_ENGINE_halt(engine.audioEngine);
   VM_free(vm);
+  MEMORY_free();
+  INPUT_free();
+  FILESYSTEM_free();
   result = engine.exit_status;
   ENGINE_free(&engine);
   //Quit SDL subsystems
@@ -0,0 +1,353 @@
+/*
+ memory.c
+
+ The allocator the Wren VM uses for its objects, strings and buffers.
+
+ Wren only hands us a pointer and a new size, so every block carries a small
+ header with the size that was asked for. Requests up to MEMORY_SMALL_MAX
+ bytes are rounded up to a size class and served from that class's free
+ list, which is refilled a chunk at a time. Anything larger goes to the
+ system allocator. Freed small blocks go back on their list rather than to
+ libc, so a game which churns through vectors and short strings every frame
+ settles into reusing the same memory.
+
+ Only the main thread calls into Wren, so none of this is locked.
+
+ Wren collects garbage whenever its heap passes a threshold, which can land
+ in the middle of update(). Wren's own threshold is set out of reach and the
+ allocator applies the same rule itself, so every collection goes through
+ MEMORY_runCollection and is timed. To make collections during update()
+ rare, the game loop offers any time left at the end of a frame to
+ MEMORY_collectIdle, which collects early once the heap is most of the way
+ to the next threshold.
+ */
+
+#define MEMORY_CLASS_COUNT 8
+#define MEMORY_SMALL_MAX 256
+#define MEMORY_CHUNK_SIZE (64 * 1024)
+#define MEMORY_LARGE MEMORY_CLASS_COUNT
+
+// How full the heap must be, as a percentage of Wren's next threshold,
+// before an idle collection is worthwhile
+#define MEMORY_IDLE_COLLECT_PERCENT 75
+// A guess at the cost of a collection, until we've timed one
+#define MEMORY_COLLECT_ESTIMATE_MS 2.0
+// A requested collection waits this many frames for idle time at most
+#define MEMORY_MAX_DEFER_FRAMES 30
+// The heap settings accepted from the command line and from Wren
+#define MEMORY_HEAP_MIN_MB 1
+#define MEMORY_HEAP_MAX_MB 2047
+#define MEMORY_GROWTH_MIN 1
+#define MEMORY_GROWTH_MAX 1000
+
+// Keeps whatever follows aligned for any type, since C99 has no max_align_t
+typedef union {
+  long double d;
+  uint64_t i;
+  void* p;
+} MEMORY_ALIGN;
+
+typedef union {
+  struct {
+    size_t size;
+    uint32_t sizeClass;
+  } info;
+  MEMORY_ALIGN align;
+} MEMORY_HEADER;
+
+typedef struct MEMORY_FREE_t {
+  struct MEMORY_FREE_t* next;
+} MEMORY_FREE;
+
+typedef struct MEMORY_CHUNK_t {
+  struct MEMORY_CHUNK_t* next;
+  MEMORY_ALIGN align;
+} MEMORY_CHUNK;
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t frees;
+  size_t bytes;
+  size_t peakBytes;
+  size_t reserved;
+  // Totals at the start of the frame in progress, and over the last one
+  uint64_t frameStartAllocations;
+  uint64_t frameStartAllocated;
+  uint64_t allocated;
+  uint64_t frameAllocations;
+  uint64_t frameBytes;
+} MEMORY_STATS;
+
+typedef struct {
+  // The VM to collect when the heap passes the threshold, once it exists
+  WrenVM* vm;
+  bool collecting;
+  bool requested;
+  size_t deferred;
+  // Worked out from how much was live after each collection, so changes
+  // to the settings apply from the next one. Zero until the first.
+  size_t threshold;
+  uint64_t collections;
+  double lastDuration;
+  // Time spent collecting in the frame in progress, and in the last one
+  double frameTime;
+  double frameDuration;
+} MEMORY_GC;
+
+typedef struct {
+  // Set from the command line or from Memory
+  size_t initialHeapSize;
+  size_t minHeapSize;
+  int heapGrowthPercent;
+
+  MEMORY_FREE* freeLists[MEMORY_CLASS_COUNT];
+  MEMORY_CHUNK* chunks;
+  MEMORY_STATS stats;
+  MEMORY_GC gc;
+} MEMORY;
+
+global_variable const size_t MEMORY_CLASS_SIZES[MEMORY_CLASS_COUNT] = {
+  16, 32, 48, 64, 96, 128, 192, 256
+};
+
+// Tuned so a typical game collects every few seconds rather than every
+// few frames. Wren's own defaults are 10MB, 1MB and 50%.
+global_variable MEMORY memory = {
+  .initialHeapSize = 16 * 1024 * 1024,
+  .minHeapSize = 4 * 1024 * 1024,
+  .heapGrowthPercent = 100
+};
+
+internal inline uint32_t
+MEMORY_sizeClass(size_t size) {
+  if (size > MEMORY_SMALL_MAX) {
+    return MEMORY_LARGE;
+  }
+  uint32_t sizeClass = 0;
+  while (MEMORY_CLASS_SIZES[sizeClass] < size) {
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+internal bool
+MEMORY_refill(uint32_t sizeClass) {
+  size_t stride = sizeof(MEMORY_HEADER) + MEMORY_CLASS_SIZES[sizeClass];
+  MEMORY_CHUNK* chunk = malloc(MEMORY_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return false;
+  }
+  chunk->next = memory.chunks;
+  memory.chunks = chunk;
+  memory.stats.reserved += MEMORY_CHUNK_SIZE;
+
+  char* start = (char*)&chunk->align;
+  size_t count = (MEMORY_CHUNK_SIZE - (start - (char*)chunk)) / stride;
+  // Link them in address order, so neighbouring allocations stay close
+  for (size_t i = count; i > 0; i--) {
+    MEMORY_FREE* block = (MEMORY_FREE*)(start + (i - 1) * stride);
+    block->next = memory.freeLists[sizeClass];
+    memory.freeLists[sizeClass] = block;
+  }
+  return true;
+}
+
+internal MEMORY_HEADER*
+MEMORY_allocate(size_t size) {
+  uint32_t sizeClass = MEMORY_sizeClass(size);
+  MEMORY_HEADER* header;
+  if (sizeClass == MEMORY_LARGE) {
+    header = malloc(sizeof(MEMORY_HEADER) + size);
+    if (header == NULL) {
+      return NULL;
+    }
+    memory.stats.reserved += size;
+  } else {
+    if (memory.freeLists[sizeClass] == NULL && !MEMORY_refill(sizeClass)) {
+      return NULL;
+    }
+    header = (MEMORY_HEADER*)memory.freeLists[sizeClass];
+    memory.freeLists[sizeClass] = memory.freeLists[sizeClass]->next;
+  }
+  header->info.size = size;
+  header->info.sizeClass = sizeClass;
+  memory.stats.allocations++;
+  memory.stats.allocated += size;
+  memory.stats.bytes += size;
+  memory.stats.peakBytes = max(memory.stats.peakBytes, memory.stats.bytes);
+  return header;
+}
+
+internal void
+MEMORY_release(MEMORY_HEADER* header) {
+  memory.stats.frees++;
+  memory.stats.bytes -= header->info.size;
+  if (header->info.sizeClass == MEMORY_LARGE) {
+    memory.stats.reserved -= header->info.size;
+    free(header);
+  } else {
+    MEMORY_FREE* block = (MEMORY_FREE*)header;
+    block->next = memory.freeLists[header->info.sizeClass];
+    memory.freeLists[header->info.sizeClass] = block;
+  }
+}
+
+internal size_t MEMORY_nextCollection(void);
+internal double MEMORY_runCollection(WrenVM* vm);
+
+// Matches the contract of WrenReallocateFn
+internal void*
+MEMORY_reallocate(void* pointer, size_t newSize) {
+  MEMORY_HEADER* header = pointer == NULL ? NULL : (MEMORY_HEADER*)pointer - 1;
+  if (newSize == 0) {
+    if (header != NULL) {
+      MEMORY_release(header);
+    }
+    return NULL;
+  }
+  // Wren would collect at this point, before the allocation is made
+  MEMORY_GC* gc = &memory.gc;
+  if (gc->vm != NULL && !gc->collecting && memory.stats.bytes + newSize > MEMORY_nextCollection()) {
+    MEMORY_runCollection(gc->vm);
+  }
+  if (header == NULL) {
+    header = MEMORY_allocate(newSize);
+    return header == NULL ? NULL : header + 1;
+  }
+
+  // Growing or shrinking within a size class can keep the block
+  uint32_t sizeClass = MEMORY_sizeClass(newSize);
+  if (sizeClass != MEMORY_LARGE && sizeClass == header->info.sizeClass) {
+    memory.stats.bytes += newSize - header->info.size;
+    if (newSize > header->info.size) {
+      memory.stats.allocated += newSize - header->info.size;
+    }
+    memory.stats.peakBytes = max(memory.stats.peakBytes, memory.stats.bytes);
+    header->info.size = newSize;
+    return header + 1;
+  }
+
+  MEMORY_HEADER* result = MEMORY_allocate(newSize);
+  if (result == NULL) {
+    return NULL;
+  }
+  memcpy(result + 1, header + 1, min(newSize, header->info.size));
+  MEMORY_release(header);
+  return result + 1;
+}
+
+// Wren frees the module sources it is given, so they have to come from here.
+// This never collects, since Wren is in the middle of an import.
+internal char*
+MEMORY_copyString(const char* text, size_t length) {
+  MEMORY_HEADER* header = MEMORY_allocate(length + 1);
+  if (header == NULL) {
+    return NULL;
+  }
+  char* copy = (char*)(header + 1);
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+// Takes over collecting for the VM. Wren's own threshold has to be out of
+// reach, which VM_create arranges.
+internal void
+MEMORY_attach(WrenVM* vm) {
+  memory.gc.vm = vm;
+}
+
+// Must be called before the VM is freed.
+internal void
+MEMORY_detach(void) {
+  memory.gc.vm = NULL;
+}
+
+// Called once per game loop, to keep the per-frame counts.
+internal void
+MEMORY_frame(void) {
+  MEMORY_STATS* stats = &memory.stats;
+  stats->frameAllocations = stats->allocations - stats->frameStartAllocations;
+  stats->frameBytes = stats->allocated - stats->frameStartAllocated;
+  stats->frameStartAllocations = stats->allocations;
+  stats->frameStartAllocated = stats->allocated;
+
+  memory.gc.frameDuration = memory.gc.frameTime;
+  memory.gc.frameTime = 0;
+}
+
+// Where the next collection is due.
+internal size_t
+MEMORY_nextCollection(void) {
+  if (memory.gc.threshold == 0) {
+    return memory.initialHeapSize;
+  }
+  return memory.gc.threshold;
+}
+
+// Every collection comes through here, however it was started.
+internal double
+MEMORY_runCollection(WrenVM* vm) {
+  MEMORY_GC* gc = &memory.gc;
+  gc->collecting = true;
+  uint64_t start = SDL_GetPerformanceCounter();
+  wrenCollectGarbage(vm);
+  double duration = 1000.0 * (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+  gc->collecting = false;
+
+  gc->requested = false;
+  gc->deferred = 0;
+  gc->collections++;
+  gc->lastDuration = duration;
+  gc->frameTime += duration;
+  // The same rule Wren uses to pick its next threshold
+  size_t live = memory.stats.bytes;
+  size_t grown = live + live / 100 * memory.heapGrowthPercent;
+  gc->threshold = max(grown, memory.minHeapSize);
+  return duration;
+}
+
+// Asks for a collection at the next opportunity, for when finalizers
+// need to run soon but not this instant.
+internal void
+MEMORY_scheduleCollection(void) {
+  memory.gc.requested = true;
+}
+
+// Collects garbage if it is nearly due and fits in the time left before
+// the frame is presented.
+internal void
+MEMORY_collectIdle(WrenVM* vm, double remainingMs) {
+  MEMORY_GC* gc = &memory.gc;
+  size_t threshold = MEMORY_nextCollection();
+  bool due = memory.stats.bytes >= threshold / 100 * MEMORY_IDLE_COLLECT_PERCENT;
+  if (!due && !gc->requested) {
+    return;
+  }
+
+  double estimate = gc->collections > 0 ? gc->lastDuration * 1.25 : MEMORY_COLLECT_ESTIMATE_MS;
+  bool overdue = gc->requested && gc->deferred >= MEMORY_MAX_DEFER_FRAMES;
+  if (remainingMs < estimate && !overdue) {
+    if (gc->requested) {
+      gc->deferred++;
+    }
+    return;
+  }
+
+  MEMORY_runCollection(vm);
+}
+
+// Only safe once the VM has been freed.
+internal void
+MEMORY_free(void) {
+  MEMORY_CHUNK* chunk = memory.chunks;
+  while (chunk != NULL) {
+    MEMORY_CHUNK* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  memory.chunks = NULL;
+  for (size_t i = 0; i < MEMORY_CLASS_COUNT; i++) {
+    memory.freeLists[i] = NULL;
+  }
+}
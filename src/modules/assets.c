@@ -0,0 +1,289 @@
+typedef struct ASSET_BATCH_t ASSET_BATCH;
+
+typedef struct {
+  ASSET_BATCH* batch;
+  char* path;
+  ASSET_TYPE type;
+  SDL_atomic_t ready;
+  bool adopted;
+  char* error;
+  // Set while the file is being decompressed from the bundle
+  PACK_READ* read;
+  union {
+    IMAGE image;
+    AUDIO_DATA audio;
+    FONT font;
+  } asset;
+} ASSET_ENTRY;
+
+// Each pending decode holds a reference, as well as the Wren object,
+// so the batch outlives whichever finishes last.
+struct ASSET_BATCH_t {
+  ENGINE* engine;
+  SDL_atomic_t refCount;
+  SDL_atomic_t loaded;
+  size_t count;
+  ASSET_ENTRY* entries;
+};
+
+internal ASSET_TYPE
+ASSET_typeFromPath(const char* path) {
+  const char* dot = strrchr(path, '.');
+  if (dot == NULL || strlen(dot) > 8) {
+    return ASSET_TYPE_UNKNOWN;
+  }
+  char ext[9];
+  size_t i = 0;
+  for (; dot[i] != '\0'; i++) {
+    ext[i] = tolower(dot[i]);
+  }
+  ext[i] = '\0';
+
+  if (STRINGS_EQUAL(ext, ".png") || STRINGS_EQUAL(ext, ".jpg")
+      || STRINGS_EQUAL(ext, ".jpeg") || STRINGS_EQUAL(ext, ".bmp")) {
+    return ASSET_TYPE_IMAGE;
+  } else if (STRINGS_EQUAL(ext, ".wav") || STRINGS_EQUAL(ext, ".ogg")) {
+    return ASSET_TYPE_AUDIO;
+  } else if (STRINGS_EQUAL(ext, ".ttf")) {
+    return ASSET_TYPE_FONT;
+  }
+  return ASSET_TYPE_UNKNOWN;
+}
+
+internal void
+ASSET_BATCH_release(ASSET_BATCH* batch) {
+  if (!SDL_AtomicDecRef(&batch->refCount)) {
+    return;
+  }
+
+  for (size_t i = 0; i < batch->count; i++) {
+    ASSET_ENTRY* entry = &batch->entries[i];
+    // Anything the game never took still needs freeing
+    if (!entry->adopted) {
+      switch (entry->type) {
+        case ASSET_TYPE_IMAGE: IMAGE_finalize(&entry->asset.image); break;
+        case ASSET_TYPE_AUDIO: AUDIO_finalize(&entry->asset.audio); break;
+        case ASSET_TYPE_FONT: FONT_finalize(&entry->asset.font); break;
+        default: break;
+      }
+    }
+    free(entry->path);
+    free(entry->error);
+  }
+  free(batch->entries);
+  free(batch);
+}
+
+// Starts decompressing the file across the pool if it is a compressed
+// entry of more than one block, with the decode as a continuation so no
+// worker sits waiting on the blocks.
+internal bool
+ASSET_beginRead(ASSET_ENTRY* entry) {
+  ENGINE* engine = entry->batch->engine;
+  PACK_ENTRY* packEntry = ENGINE_findPackEntry(engine, entry->path);
+  if (packEntry == NULL || packEntry->method != PACK_METHOD_LZ || packEntry->size <= engine->pack->blockSize) {
+    return false;
+  }
+  PACK_READ* read = malloc(sizeof(PACK_READ));
+  if (read == NULL) {
+    return false;
+  }
+  if (!PACK_beginRead(engine->pack, packEntry, read)) {
+    free(read);
+    return false;
+  }
+  entry->read = read;
+  PACK_pushBlocks(read, &engine->fifo, 0);
+
+  INIT_TO_ZERO(ABC_TASK, task);
+  task.type = TASK_DECODE_ASSET;
+  task.data = entry;
+  ABC_FIFO_then(&engine->fifo, &read->group, &read->then, task, NULL);
+  return true;
+}
+
+// Runs twice for a file which is decompressed by ASSET_beginRead: once to
+// start that, and again to decode once the blocks are done.
+internal void
+ASSET_decodeTaskHandler(void* data) {
+  // Thread: Async
+  ASSET_ENTRY* entry = data;
+  ASSET_BATCH* batch = entry->batch;
+
+  if (entry->read == NULL && ASSET_beginRead(entry)) {
+    return;
+  }
+
+  const char* error = NULL;
+  FILE_VIEW view;
+  bool opened;
+  if (entry->read != NULL) {
+    opened = PACK_finishRead(entry->read, &view);
+    free(entry->read);
+    entry->read = NULL;
+    if (!opened) {
+      // Let the usual path report it and fall back
+      opened = ENGINE_openFileView(batch->engine, entry->path, &view);
+    }
+  } else {
+    opened = ENGINE_openFileView(batch->engine, entry->path, &view);
+  }
+  if (!opened) {
+    error = "Could not find file";
+  } else {
+    switch (entry->type) {
+      case ASSET_TYPE_IMAGE: error = IMAGE_decode(&entry->asset.image, &view); break;
+      case ASSET_TYPE_AUDIO: error = AUDIO_decode(&entry->asset.audio, &view); break;
+      case ASSET_TYPE_FONT: error = FONT_decode(&entry->asset.font, &view); break;
+      default: break;
+    }
+    FILE_VIEW_close(&view);
+  }
+
+  if (error != NULL) {
+    size_t len = strlen(error) + strlen(entry->path) + 3;
+    entry->error = malloc(len);
+    snprintf(entry->error, len, "%s: %s", error, entry->path);
+  }
+
+  // The atomics also publish the decoded asset to the main thread
+  SDL_AtomicSet(&entry->ready, 1);
+  SDL_AtomicAdd(&batch->loaded, 1);
+  ASSET_BATCH_release(batch);
+}
+
+internal void
+ASSET_BATCH_allocate(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, LIST, "paths");
+  size_t count = wrenGetListCount(vm, 1);
+  wrenEnsureSlots(vm, 3);
+
+  // Check everything up front, so we don't start work we'd abandon
+  for (size_t i = 0; i < count; i++) {
+    wrenGetListElement(vm, 1, i, 2);
+    ASSERT_SLOT_TYPE(vm, 2, STRING, "asset path");
+    const char* path = wrenGetSlotString(vm, 2);
+    if (ASSET_typeFromPath(path) == ASSET_TYPE_UNKNOWN) {
+      size_t len = 31 + strlen(path);
+      char message[len];
+      snprintf(message, len, "Unknown type of asset for %s", path);
+      VM_ABORT(vm, message);
+      return;
+    }
+  }
+
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  ASSET_BATCH* batch = malloc(sizeof(ASSET_BATCH));
+  batch->engine = engine;
+  batch->count = count;
+  batch->entries = calloc(max(count, 1), sizeof(ASSET_ENTRY));
+  SDL_AtomicSet(&batch->refCount, count + 1);
+  SDL_AtomicSet(&batch->loaded, 0);
+
+  for (size_t i = 0; i < count; i++) {
+    ASSET_ENTRY* entry = &batch->entries[i];
+    wrenGetListElement(vm, 1, i, 2);
+    entry->batch = batch;
+    entry->path = strdup(wrenGetSlotString(vm, 2));
+    entry->type = ASSET_typeFromPath(entry->path);
+    SDL_AtomicSet(&entry->ready, 0);
+  }
+
+  ASSET_BATCH** ref = wrenSetSlotNewForeign(vm, 0, 0, sizeof(ASSET_BATCH*));
+  *ref = batch;
+
+  for (size_t i = 0; i < count; i++) {
+    INIT_TO_ZERO(ABC_TASK, task);
+    task.type = TASK_DECODE_ASSET;
+    task.data = &batch->entries[i];
+    ABC_FIFO_pushTask(&engine->fifo, task);
+  }
+}
+
+internal void
+ASSET_BATCH_finalize(void* data) {
+  ASSET_BATCH_release(*(ASSET_BATCH**)data);
+}
+
+internal void
+ASSET_BATCH_getCount(WrenVM* vm) {
+  ASSET_BATCH* batch = *(ASSET_BATCH**)wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, batch->count);
+}
+
+internal void
+ASSET_BATCH_getLoaded(WrenVM* vm) {
+  ASSET_BATCH* batch = *(ASSET_BATCH**)wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, SDL_AtomicGet(&batch->loaded));
+}
+
+internal ASSET_ENTRY*
+ASSET_BATCH_getEntry(WrenVM* vm, int batchSlot, int indexSlot) {
+  ASSET_BATCH* batch = *(ASSET_BATCH**)wrenGetSlotForeign(vm, batchSlot);
+  ASSERT_SLOT_TYPE_RETURN(vm, indexSlot, NUM, "index", NULL);
+  double index = wrenGetSlotDouble(vm, indexSlot);
+  if (index < 0 || index >= batch->count) {
+    VM_ABORT(vm, "Asset index out of bounds");
+    return NULL;
+  }
+  ASSET_ENTRY* entry = &batch->entries[(size_t)index];
+  if (!SDL_AtomicGet(&entry->ready)) {
+    VM_ABORT(vm, "Asset is still loading");
+    return NULL;
+  }
+  return entry;
+}
+
+internal void
+ASSET_BATCH_getType(WrenVM* vm) {
+  ASSET_ENTRY* entry = ASSET_BATCH_getEntry(vm, 0, 1);
+  if (entry == NULL) {
+    return;
+  }
+  switch (entry->type) {
+    case ASSET_TYPE_IMAGE: wrenSetSlotString(vm, 0, "image"); break;
+    case ASSET_TYPE_AUDIO: wrenSetSlotString(vm, 0, "audio"); break;
+    case ASSET_TYPE_FONT: wrenSetSlotString(vm, 0, "font"); break;
+    default: wrenSetSlotNull(vm, 0); break;
+  }
+}
+
+internal void
+ASSET_BATCH_getError(WrenVM* vm) {
+  ASSET_ENTRY* entry = ASSET_BATCH_getEntry(vm, 0, 1);
+  if (entry == NULL) {
+    return;
+  }
+  if (entry->error != NULL) {
+    wrenSetSlotString(vm, 0, entry->error);
+  } else {
+    wrenSetSlotNull(vm, 0);
+  }
+}
+
+// Moves a decoded asset out of the batch in slot 1 into a newly allocated
+// foreign object. The object is zeroed first, so it is safe to finalize
+// if we abort.
+internal bool
+ASSET_adopt(WrenVM* vm, ASSET_TYPE type, void* asset, size_t size) {
+  memset(asset, 0, size);
+  ASSET_ENTRY* entry = ASSET_BATCH_getEntry(vm, 1, 2);
+  if (entry == NULL) {
+    return false;
+  }
+  if (entry->type != type) {
+    VM_ABORT(vm, "Asset is of the wrong type");
+    return false;
+  }
+  if (entry->error != NULL) {
+    VM_ABORT(vm, entry->error);
+    return false;
+  }
+  if (entry->adopted) {
+    VM_ABORT(vm, "Asset has already been taken");
+    return false;
+  }
+  memcpy(asset, &entry->asset, size);
+  entry->adopted = true;
+  return true;
+}
@@ -62,9 +62,9 @@ const uint16_t bytesPerSample = 2 * 2 /* channels */;
 // here as it holds a lock.
 internal void
 AUDIO_ENGINE_capture(WrenVM* vm) {
-  if (audioEngineClass == NULL) {
+  if (vmHandles.audioEngineClass == NULL) {
     wrenGetVariable(vm, "audio", "AudioEngine", 0);
-    audioEngineClass = wrenGetSlotHandle(vm, 0);
+    vmHandles.audioEngineClass = wrenGetSlotHandle(vm, 0);
   }
 }
 
@@ -119,27 +119,34 @@ void AUDIO_ENGINE_mix(void*  userdata,
   }
 }
 
-internal void AUDIO_allocate(WrenVM* vm) {
-  wrenEnsureSlots(vm, 1);
-  AUDIO_DATA* data = (AUDIO_DATA*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(AUDIO_DATA));
-  int length;
-  ASSERT_SLOT_TYPE(vm, 1, STRING, "buffer");
-  const char* fileBuffer = wrenGetSlotBytes(vm, 1, &length);
+// Decodes the file into the mixer's format, returning an error message on
+// failure. Safe to call from worker threads.
+internal const char*
+AUDIO_decode(AUDIO_DATA* data, FILE_VIEW* view) {
+  data->buffer = NULL;
+  const char* fileBuffer = view->data;
+  // Both decoders take an int. Views aren't NUL terminated, so the magic
+  // numbers are compared with memcmp once the length allows it, as in
+  // FONT_decode.
+  if (view->length > INT_MAX) {
+    return "Audio file is too large";
+  }
+  int length = view->length;
 
   int16_t* tempBuffer;
-  if (strncmp(fileBuffer, "RIFF", 4) == 0 &&
-      strncmp(&fileBuffer[8], "WAVE", 4) == 0) {
+  if (length >= 12 &&
+      memcmp(fileBuffer, "RIFF", 4) == 0 &&
+      memcmp(&fileBuffer[8], "WAVE", 4) == 0) {
     data->audioType = AUDIO_TYPE_WAV;
 
     // Loading the WAV file
     SDL_RWops* src = SDL_RWFromConstMem(fileBuffer, length);
     void* result = SDL_LoadWAV_RW(src, 1, &data->spec, ((uint8_t**)&tempBuffer), &data->length);
     if (result == NULL) {
-      VM_ABORT(vm, "Invalid WAVE file");
-      return;
+      return "Invalid WAVE file";
     }
     data->length /= sizeof(int16_t) * data->spec.channels;
-  } else if (strncmp(fileBuffer, "OggS", 4) == 0) {
+  } else if (length >= 4 && memcmp(fileBuffer, "OggS", 4) == 0) {
     data->audioType = AUDIO_TYPE_OGG;
 
     int channelsInFile = 0;
@@ -148,8 +155,7 @@ internal void AUDIO_allocate(WrenVM* vm) {
     // Loading the OGG file
     int32_t result = stb_vorbis_decode_memory((const unsigned char*)fileBuffer, length, &channelsInFile, &freq, &tempBuffer);
     if (result == -1) {
-      VM_ABORT(vm, "Invalid OGG file");
-      return;
+      return "Invalid OGG file";
     }
     data->length = result;
 
@@ -157,12 +163,18 @@ internal void AUDIO_allocate(WrenVM* vm) {
     data->spec.freq = freq;
     data->spec.format = AUDIO_S16LSB;
   } else {
-    VM_ABORT(vm, "Audio file was of an incompatible format");
-    return;
+    return "Audio file was of an incompatible format";
   }
 
   data->buffer = calloc(channels * data->length, sizeof(float));
-  assert(data->buffer != NULL);
+  if (data->buffer == NULL) {
+    if (data->audioType == AUDIO_TYPE_WAV) {
+      SDL_FreeWAV((uint8_t*)tempBuffer);
+    } else {
+      free(tempBuffer);
+    }
+    return "Not enough memory to decode audio";
+  }
   assert(data->length != UINT32_MAX);
   // Process incoming values into an intermediate mixable format
   for (uint32_t i = 0; i < data->length; i++) {
@@ -179,6 +191,29 @@ internal void AUDIO_allocate(WrenVM* vm) {
   } else if (data->audioType == AUDIO_TYPE_OGG) {
     free(tempBuffer);
   }
+  return NULL;
+}
+
+internal void AUDIO_allocate(WrenVM* vm) {
+  wrenEnsureSlots(vm, 1);
+  if (ASSET_isPreloaded(vm)) {
+    AUDIO_DATA* data = (AUDIO_DATA*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(AUDIO_DATA));
+    ASSET_adopt(vm, ASSET_TYPE_AUDIO, data, sizeof(AUDIO_DATA));
+    return;
+  }
+
+  FILE_VIEW view;
+  if (!ASSET_openView(vm, &view)) {
+    return;
+  }
+  AUDIO_DATA* data = (AUDIO_DATA*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(AUDIO_DATA));
+  const char* error = AUDIO_decode(data, &view);
+  FILE_VIEW_close(&view);
+  if (error != NULL) {
+    VM_ABORT(vm, error);
+    return;
+  }
+
   if (DEBUG_MODE) {
     ENGINE* engine = wrenGetUserData(vm);
     DEBUG_printAudioSpec(engine, data->spec, data->audioType);
@@ -94,3 +94,112 @@ VERSION_getString(WrenVM* vm) {
   printf("len: %i \n", len);
   wrenSetSlotBytes(vm, 0, version, len);
 }
+
+internal void
+MEMORY_getBytes(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.bytes);
+}
+
+internal void
+MEMORY_getPeakBytes(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.peakBytes);
+}
+
+internal void
+MEMORY_getReserved(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.reserved);
+}
+
+internal void
+MEMORY_getAllocations(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.allocations);
+}
+
+internal void
+MEMORY_getFrees(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.frees);
+}
+
+internal void
+MEMORY_getFrameAllocations(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.frameAllocations);
+}
+
+internal void
+MEMORY_getFrameBytes(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.stats.frameBytes);
+}
+
+internal void
+MEMORY_getHeapSize(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.initialHeapSize);
+}
+
+internal void
+MEMORY_getMinHeapSize(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.minHeapSize);
+}
+
+internal void
+MEMORY_getHeapGrowth(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.heapGrowthPercent);
+}
+
+internal bool
+MEMORY_getHeapSlot(WrenVM* vm, size_t* bytes) {
+  ASSERT_SLOT_TYPE_RETURN(vm, 1, NUM, "heap size", false);
+  double value = wrenGetSlotDouble(vm, 1);
+  if (!(value >= (double)MEMORY_HEAP_MIN_MB * 1024 * 1024 && value <= (double)MEMORY_HEAP_MAX_MB * 1024 * 1024)) {
+    VM_ABORT(vm, "heap size must be between 1MB and 2047MB");
+    return false;
+  }
+  *bytes = value;
+  return true;
+}
+
+internal void
+MEMORY_setHeapSize(WrenVM* vm) {
+  size_t bytes;
+  if (MEMORY_getHeapSlot(vm, &bytes)) {
+    memory.initialHeapSize = bytes;
+  }
+}
+
+internal void
+MEMORY_setMinHeapSize(WrenVM* vm) {
+  size_t bytes;
+  if (MEMORY_getHeapSlot(vm, &bytes)) {
+    memory.minHeapSize = bytes;
+  }
+}
+
+internal void
+MEMORY_setHeapGrowth(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "heap growth");
+  double value = wrenGetSlotDouble(vm, 1);
+  if (!(value >= MEMORY_GROWTH_MIN && value <= MEMORY_GROWTH_MAX) || value != floor(value)) {
+    VM_ABORT(vm, "heap growth must be a whole number from 1 to 1000");
+    return;
+  }
+  memory.heapGrowthPercent = value;
+}
+
+internal void
+MEMORY_collect(WrenVM* vm) {
+  MEMORY_runCollection(vm);
+}
+
+internal void
+MEMORY_requestCollection(WrenVM* vm) {
+  MEMORY_scheduleCollection();
+}
+
+internal void
+MEMORY_getCollections(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.gc.collections);
+}
+
+internal void
+MEMORY_getCollectTime(WrenVM* vm) {
+  wrenSetSlotDouble(vm, 0, memory.gc.frameDuration);
+}
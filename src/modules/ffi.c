@@ -38,14 +38,64 @@ LIBRARY_HANDLE_allocate(WrenVM* vm) {
 internal void
 LIBRARY_HANDLE_finalize(void* ptr) {
   LIBRARY_HANDLE* handle = ptr;
-  printf("SDL Unload Library: %s", handle->name);
-  SDL_UnloadObject(handle);
+  LOG_print(LOG_DEBUG, LOG_SCRIPT, "Unloading library: %s\n", handle->name);
+  SDL_UnloadObject(handle->handle);
 }
 
 
+// How a value is moved between a Wren slot and C, decided once at bind time
+// so that calls don't need to inspect the ffi_type.
+typedef enum {
+  FFI_KIND_VOID,
+  FFI_KIND_FLOAT,
+  FFI_KIND_DOUBLE,
+  FFI_KIND_LONGDOUBLE,
+  FFI_KIND_UINT8,
+  FFI_KIND_SINT8,
+  FFI_KIND_UINT16,
+  FFI_KIND_SINT16,
+  FFI_KIND_UINT32,
+  FFI_KIND_SINT32,
+  FFI_KIND_UINT64,
+  FFI_KIND_SINT64,
+  FFI_KIND_POINTER,
+  FFI_KIND_STRUCT,
+  FFI_KIND_UNSUPPORTED
+} FFI_KIND;
+
+typedef union {
+  float f;
+  double d;
+  long double ld;
+  uint8_t u8;
+  int8_t s8;
+  uint16_t u16;
+  int16_t s16;
+  uint32_t u32;
+  int32_t s32;
+  uint64_t u64;
+  int64_t s64;
+  void* p;
+  // libffi widens small integer return values to these
+  ffi_arg arg;
+  ffi_sarg sarg;
+} FFI_VALUE;
+
+typedef struct {
+  FFI_KIND kind;
+  FFI_VALUE value;
+} FFI_ARG;
+
 typedef struct {
   void* methodPtr;
   ffi_cif cif;
+  FFI_KIND returnKind;
+  STRUCT_TYPE* returnStruct;
+  size_t argCount;
+  // The marshalling plan, followed by the value pointers passed to
+  // ffi_call, which point into the plan for everything but structs.
+  FFI_ARG* plan;
+  void** values;
   ffi_type* argTypes[];
 } FUNCTION;
 
@@ -56,11 +106,17 @@ ffi_type* toFFIType(char* name) {
     return &ffi_type_slong;
   } else if (STRINGS_EQUAL(name, "unsigned long")) {
     return &ffi_type_ulong;
+  } else if (STRINGS_EQUAL(name, "long long")) {
+    return &ffi_type_sint64;
+  } else if (STRINGS_EQUAL(name, "unsigned long long")) {
+    return &ffi_type_uint64;
+  } else if (STRINGS_EQUAL(name, "size_t")) {
+    return sizeof(size_t) == 8 ? &ffi_type_uint64 : &ffi_type_uint32;
   } else if (STRINGS_EQUAL(name, "short")) {
     return &ffi_type_sshort;
   } else if (STRINGS_EQUAL(name, "unsigned short")) {
     return &ffi_type_ushort;
-  } else if (STRINGS_EQUAL(name, "char")) {
+  } else if (STRINGS_EQUAL(name, "char") || STRINGS_EQUAL(name, "signed char")) {
     return &ffi_type_schar;
   } else if (STRINGS_EQUAL(name, "unsigned char")) {
     return &ffi_type_uchar;
@@ -98,22 +154,93 @@ ffi_type* toFFIType(char* name) {
   }
 }
 
+internal FFI_KIND
+FFI_kindOf(ffi_type* type) {
+  switch (type->type) {
+    case FFI_TYPE_VOID: return FFI_KIND_VOID;
+    case FFI_TYPE_FLOAT: return FFI_KIND_FLOAT;
+    case FFI_TYPE_DOUBLE: return FFI_KIND_DOUBLE;
+    case FFI_TYPE_LONGDOUBLE: return FFI_KIND_LONGDOUBLE;
+    case FFI_TYPE_UINT8: return FFI_KIND_UINT8;
+    case FFI_TYPE_SINT8: return FFI_KIND_SINT8;
+    case FFI_TYPE_UINT16: return FFI_KIND_UINT16;
+    case FFI_TYPE_SINT16: return FFI_KIND_SINT16;
+    case FFI_TYPE_UINT32: return FFI_KIND_UINT32;
+    case FFI_TYPE_SINT32: return FFI_KIND_SINT32;
+    case FFI_TYPE_UINT64: return FFI_KIND_UINT64;
+    case FFI_TYPE_SINT64: return FFI_KIND_SINT64;
+    case FFI_TYPE_INT: return type->size == 8 ? FFI_KIND_SINT64 : FFI_KIND_SINT32;
+    case FFI_TYPE_POINTER: return FFI_KIND_POINTER;
+    case FFI_TYPE_STRUCT: return FFI_KIND_STRUCT;
+    default: return FFI_KIND_UNSUPPORTED;
+  }
+}
+
+// Integers wrap around to the width of the C type, as they would in C.
+// NaN and the infinities become 0.
+internal inline uint64_t
+FFI_toInteger(double value) {
+  value = floor(value);
+  if (value >= -9223372036854775808.0 && value < 9223372036854775808.0) {
+    return (uint64_t)(int64_t)value;
+  }
+  // Reduce modulo 2^64 first, which fmod does exactly
+  double remainder = fmod(value, 18446744073709551616.0);
+  if (remainder != remainder) {
+    return 0;
+  } else if (remainder >= 9223372036854775808.0) {
+    return (uint64_t)remainder;
+  } else if (remainder < -9223372036854775808.0) {
+    return (uint64_t)(int64_t)(remainder + 18446744073709551616.0);
+  }
+  return (uint64_t)(int64_t)remainder;
+}
+
 internal void
 FUNCTION_allocate(WrenVM* vm) {
   LIBRARY_HANDLE* library = wrenGetSlotForeign(vm, 1);
   char* fnName = wrenGetSlotString(vm, 2);
-  printf("%s\n", fnName);
-  char* returnType = wrenGetSlotString(vm, 3);
   size_t argCount = wrenGetListCount(vm, 4);
   // TODO: Variadic functions
   FUNCTION* function = wrenSetSlotNewForeign(vm, 0, 0, sizeof(FUNCTION) + sizeof(ffi_type*) * argCount);
+  function->argCount = argCount;
+  function->plan = NULL;
+  function->values = NULL;
+  function->returnStruct = NULL;
   function->methodPtr = SDL_LoadFunction(library->handle, fnName);
   if (function->methodPtr == NULL) {
     wrenSetSlotString(vm, 1, "Could not bind to function");
     wrenAbortFiber(vm, 1);
+    return;
+  }
+
+  ffi_type* retType;
+  if (wrenGetSlotType(vm, 3) == WREN_TYPE_STRING) {
+    retType = toFFIType(wrenGetSlotString(vm, 3));
+  } else if (wrenGetSlotType(vm, 3) == WREN_TYPE_FOREIGN) {
+    function->returnStruct = wrenGetSlotForeign(vm, 3);
+    retType = &(function->returnStruct->typeData);
+  } else {
+    wrenSetSlotString(vm, 1, "Invalid return type");
+    wrenAbortFiber(vm, 1);
+    return;
+  }
+  function->returnKind = FFI_kindOf(retType);
+  if (function->returnKind == FFI_KIND_UNSUPPORTED) {
+    wrenSetSlotString(vm, 1, "Unsupported return type");
+    wrenAbortFiber(vm, 1);
+    return;
   }
 
-  ffi_type* retType = toFFIType(returnType);
+  if (argCount > 0) {
+    function->plan = malloc(argCount * (sizeof(FFI_ARG) + sizeof(void*)));
+    if (function->plan == NULL) {
+      wrenSetSlotString(vm, 1, "Not enough memory to bind function");
+      wrenAbortFiber(vm, 1);
+      return;
+    }
+    function->values = (void**)(function->plan + argCount);
+  }
 
   ffi_type** argTypes = function->argTypes;
   for (size_t i = 0; i < argCount; i++) {
@@ -121,15 +248,23 @@ FUNCTION_allocate(WrenVM* vm) {
     wrenGetListElement(vm, 4, i, 3);
     if (wrenGetSlotType(vm, 3) == WREN_TYPE_STRING) {
       char* typeName = wrenGetSlotString(vm, 3);
-      printf("%s\n", typeName);
       argTypes[i] = toFFIType(typeName);
     } else if (wrenGetSlotType(vm, 3) == WREN_TYPE_FOREIGN) {
       STRUCT_TYPE* data = (STRUCT_TYPE*)wrenGetSlotForeign(vm, 3);
       argTypes[i] = &(data->typeData);
     } else {
-      VM_ABORT(vm, "Invalid argument type");
+      wrenSetSlotString(vm, 1, "Invalid argument type");
+      wrenAbortFiber(vm, 1);
       return;
     }
+    FFI_KIND kind = FFI_kindOf(argTypes[i]);
+    if (kind == FFI_KIND_VOID || kind == FFI_KIND_UNSUPPORTED) {
+      wrenSetSlotString(vm, 1, "Unsupported argument type");
+      wrenAbortFiber(vm, 1);
+      return;
+    }
+    function->plan[i].kind = kind;
+    function->values[i] = &(function->plan[i].value);
   }
 
   ffi_status result = ffi_prep_cif(&function->cif, FFI_DEFAULT_ABI, argCount, retType, argTypes);
@@ -144,142 +279,140 @@ FUNCTION_allocate(WrenVM* vm) {
 }
 
 internal void
-FUNCTION_finalize(void* function) {
-  // free(function);
+FUNCTION_finalize(void* data) {
+  FUNCTION* function = data;
+  free(function->plan);
+}
+
+// Stores the value in the slot as argument index, following the plan.
+internal bool
+FUNCTION_marshal(WrenVM* vm, FUNCTION* function, size_t index, int slot) {
+  FFI_ARG* arg = &(function->plan[index]);
+  WrenType slotType = wrenGetSlotType(vm, slot);
+  if (arg->kind == FFI_KIND_POINTER) {
+    if (slotType == WREN_TYPE_STRING) {
+      arg->value.p = (void*)wrenGetSlotString(vm, slot);
+    } else if (slotType == WREN_TYPE_FOREIGN) {
+      // ASSUME POINTER
+      arg->value.p = *(void**)wrenGetSlotForeign(vm, slot);
+    } else if (slotType == WREN_TYPE_NULL) {
+      arg->value.p = NULL;
+    } else {
+      return false;
+    }
+    return true;
+  } else if (arg->kind == FFI_KIND_STRUCT) {
+    if (slotType != WREN_TYPE_FOREIGN) {
+      return false;
+    }
+    // Structs are passed from their own storage, rather than copied
+    STRUCT* data = (STRUCT*)wrenGetSlotForeign(vm, slot);
+    function->values[index] = data->start;
+    return true;
+  }
+
+  if (slotType != WREN_TYPE_NUM) {
+    return false;
+  }
+  double value = wrenGetSlotDouble(vm, slot);
+  switch (arg->kind) {
+    case FFI_KIND_FLOAT: arg->value.f = value; break;
+    case FFI_KIND_DOUBLE: arg->value.d = value; break;
+    case FFI_KIND_LONGDOUBLE: arg->value.ld = value; break;
+    case FFI_KIND_UINT8: arg->value.u8 = FFI_toInteger(value); break;
+    case FFI_KIND_SINT8: arg->value.s8 = FFI_toInteger(value); break;
+    case FFI_KIND_UINT16: arg->value.u16 = FFI_toInteger(value); break;
+    case FFI_KIND_SINT16: arg->value.s16 = FFI_toInteger(value); break;
+    case FFI_KIND_UINT32: arg->value.u32 = FFI_toInteger(value); break;
+    case FFI_KIND_SINT32: arg->value.s32 = FFI_toInteger(value); break;
+    case FFI_KIND_UINT64: arg->value.u64 = FFI_toInteger(value); break;
+    case FFI_KIND_SINT64: arg->value.s64 = FFI_toInteger(value); break;
+    default: return false;
+  }
+  return true;
+}
+
+// Makes the call once the arguments are in place, and leaves the result in
+// slot 0. classSlot is a free slot for creating Pointers and Structs.
+internal void
+FUNCTION_invoke(WrenVM* vm, FUNCTION* function, int classSlot) {
+  FFI_VALUE result;
+  if (function->returnKind == FFI_KIND_STRUCT) {
+    size_t size = function->returnStruct->typeData.size;
+    // Small structs may be written back a whole register at a time
+    size_t blobSize = max(size, sizeof(ffi_arg));
+    wrenSetSlotHandle(vm, classSlot, vmHandles.structClass);
+    // Nothing allocates after this, so the function outlives losing slot 0
+    STRUCT* data = (STRUCT*)wrenSetSlotNewForeign(vm, 0, classSlot, sizeof(STRUCT) + blobSize);
+    data->dataType = function->returnStruct;
+    data->start = (uint8_t*)&data->blob;
+    ffi_call(&(function->cif), FFI_FN(function->methodPtr), data->start, function->values);
+    return;
+  }
+
+  ffi_call(&(function->cif), FFI_FN(function->methodPtr), &result, function->values);
+
+  switch (function->returnKind) {
+    case FFI_KIND_FLOAT: wrenSetSlotDouble(vm, 0, result.f); break;
+    case FFI_KIND_DOUBLE: wrenSetSlotDouble(vm, 0, result.d); break;
+    case FFI_KIND_LONGDOUBLE: wrenSetSlotDouble(vm, 0, result.ld); break;
+    case FFI_KIND_UINT8: wrenSetSlotDouble(vm, 0, (uint8_t)result.arg); break;
+    case FFI_KIND_SINT8: wrenSetSlotDouble(vm, 0, (int8_t)result.sarg); break;
+    case FFI_KIND_UINT16: wrenSetSlotDouble(vm, 0, (uint16_t)result.arg); break;
+    case FFI_KIND_SINT16: wrenSetSlotDouble(vm, 0, (int16_t)result.sarg); break;
+    case FFI_KIND_UINT32: wrenSetSlotDouble(vm, 0, (uint32_t)result.arg); break;
+    case FFI_KIND_SINT32: wrenSetSlotDouble(vm, 0, (int32_t)result.sarg); break;
+    case FFI_KIND_UINT64: wrenSetSlotDouble(vm, 0, result.u64); break;
+    case FFI_KIND_SINT64: wrenSetSlotDouble(vm, 0, result.s64); break;
+    case FFI_KIND_POINTER: {
+      wrenSetSlotHandle(vm, classSlot, vmHandles.pointerClass);
+      void** obj = wrenSetSlotNewForeign(vm, 0, classSlot, sizeof(void*));
+      *obj = result.p;
+    } break;
+    case FFI_KIND_VOID:
+    default: wrenSetSlotNull(vm, 0); break;
+  }
 }
 
 internal void
 FUNCTION_call(WrenVM* vm) {
-  wrenEnsureSlots(vm, 3);
+  wrenEnsureSlots(vm, 4);
   FUNCTION* function = wrenGetSlotForeign(vm, 0);
-  unsigned int argCount = wrenGetListCount(vm, 1);
-  void* args[argCount];
-  ffi_type** argTypes = function->cif.arg_types;
+  ASSERT_SLOT_TYPE(vm, 1, LIST, "arguments");
 
-  if (argCount != function->cif.nargs) {
-    wrenSetSlotString(vm, 1, "FFI: Argument mismatch");
-    wrenAbortFiber(vm, 1);
+  if ((size_t)wrenGetListCount(vm, 1) != function->argCount) {
+    VM_ABORT(vm, "FFI: Argument mismatch");
     return;
   }
-
-  for (unsigned int i = 0; i < argCount; i++) {
+  for (size_t i = 0; i < function->argCount; i++) {
     // Move element i from List to slot 2
     wrenGetListElement(vm, 1, i, 2);
-    ffi_type* ffiType = argTypes[i];
-    args[i] = alloca(sizeof(ffiType->size));
-    switch (ffiType->type) {
-      case FFI_TYPE_FLOAT: {
-        if (wrenGetSlotType(vm, 2) != WREN_TYPE_NUM) {
-          goto fail_cast;
-        }
-        float* value = args[i];
-        *value = wrenGetSlotDouble(vm, 2);
-      } break;
-      case FFI_TYPE_DOUBLE: {
-        if (wrenGetSlotType(vm, 2) != WREN_TYPE_NUM) {
-          goto fail_cast;
-        }
-        double* value = args[i];
-        *value = wrenGetSlotDouble(vm, 2);
-      } break;
-      case FFI_TYPE_INT:
-      case FFI_TYPE_SINT32: {
-        if (wrenGetSlotType(vm, 2) != WREN_TYPE_NUM) {
-          goto fail_cast;
-        }
-        int32_t* value = args[i];
-        *value = floor(wrenGetSlotDouble(vm, 2));
-      } break;
-      case FFI_TYPE_POINTER: {
-        if (wrenGetSlotType(vm, 2) == WREN_TYPE_STRING) {
-          char** ptr = (char**)args[i];
-          char* text = wrenGetSlotString(vm, 2);
-          *ptr = text;
-        } else if (wrenGetSlotType(vm, 2) == WREN_TYPE_FOREIGN) {
-          // ASSUME POINTER
-         void** ptr = (void**)wrenGetSlotForeign(vm, 2);
-         void** value = args[i];
-         *value = *ptr;
-        } else {
-          goto fail_cast;
-        }
-      } break;
-      case FFI_TYPE_STRUCT: {
-        if (wrenGetSlotType(vm, 2) == WREN_TYPE_FOREIGN) {
-          STRUCT* data = (STRUCT*)wrenGetSlotForeign(vm, 2);
-          args[i] = &(data->blob);
-        } else {
-          goto fail_cast;
-        }
-      } break;
-      case FFI_TYPE_COMPLEX:
-      default: {
-        fail_cast:
-        wrenSetSlotString(vm, 1, "FFI: Argument mismatch");
-        wrenAbortFiber(vm, 1);
-        return;
-      }
+    if (!FUNCTION_marshal(vm, function, i, 2)) {
+      VM_ABORT(vm, "FFI: Argument mismatch");
+      return;
     }
   }
+  FUNCTION_invoke(vm, function, 3);
+}
 
-  void* returnValue = alloca(function->cif.rtype->size);
-  ffi_call(&(function->cif), FFI_FN(function->methodPtr), returnValue, args);
-
-  ffi_type* returnType = function->cif.rtype;
-  switch (returnType->type) {
-    case FFI_TYPE_UINT8: {
-      uint8_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_SINT8: {
-      int8_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_UINT16: {
-      uint16_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_SINT16: {
-      int16_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_UINT32: {
-      uint32_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_SINT32: {
-      int32_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_UINT64: {
-      uint64_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_SINT64: {
-      int64_t* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_FLOAT: {
-      float* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_DOUBLE: {
-      double* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_LONGDOUBLE: {
-      long double* ptr = returnValue;
-      wrenSetSlotDouble(vm, 0, *ptr);
-    } break;
-    case FFI_TYPE_POINTER: {
-      void** ptr = returnValue;
-      wrenGetVariable(vm, "ffi", "Pointer", 0);
-      void** obj = wrenSetSlotNewForeign(vm, 0, 0, sizeof(void*));
-      *obj = *ptr;
-    } break;
-    case FFI_TYPE_VOID:
-    default: wrenSetSlotNull(vm, 0); break;
+// Takes the arguments straight from the call's own slots, so that no list
+// needs to be made for them.
+internal void
+FUNCTION_callDirect(WrenVM* vm) {
+  FUNCTION* function = wrenGetSlotForeign(vm, 0);
+  size_t argCount = wrenGetSlotCount(vm) - 1;
+  if (argCount != function->argCount) {
+    VM_ABORT(vm, "FFI: Argument mismatch");
+    return;
   }
+  for (size_t i = 0; i < argCount; i++) {
+    if (!FUNCTION_marshal(vm, function, i, i + 1)) {
+      VM_ABORT(vm, "FFI: Argument mismatch");
+      return;
+    }
+  }
+  wrenEnsureSlots(vm, argCount + 2);
+  FUNCTION_invoke(vm, function, argCount + 1);
 }
 
 
@@ -293,7 +426,6 @@ STRUCT_TYPE_allocate(WrenVM* vm) {
   for (size_t i = 0; i < elementCount; i++) {
     wrenGetListElement(vm, 1, i, 2);
     WrenType slotType = wrenGetSlotType(vm, 2);
-    printf("%s\n", DEBUG_printWrenType(slotType));
     if (slotType == WREN_TYPE_STRING) {
       char* typeName = wrenGetSlotString(vm, 2);
       type->elements[i] = toFFIType(typeName);
@@ -332,7 +464,6 @@ STRUCT_TYPE_getOffset(WrenVM* vm) {
 internal void
 STRUCT_allocate(WrenVM* vm) {
   STRUCT_TYPE* dataType = wrenGetSlotForeign(vm, 1);
-  printf("%li\n", dataType->typeData.size);
   STRUCT* data = wrenSetSlotNewForeign(vm, 0, 0, sizeof(STRUCT) + dataType->typeData.size);
   data->dataType = dataType;
   data->start = (uint8_t*)&data->blob;
@@ -510,6 +641,22 @@ POINTER_allocate(WrenVM* vm) {
   *obj = NULL;
 }
 
+internal void
+POINTER_capture(WrenVM* vm) {
+  if (vmHandles.pointerClass == NULL) {
+    wrenGetVariable(vm, "ffi", "Pointer", 0);
+    vmHandles.pointerClass = wrenGetSlotHandle(vm, 0);
+  }
+}
+
+internal void
+STRUCT_capture(WrenVM* vm) {
+  if (vmHandles.structClass == NULL) {
+    wrenGetVariable(vm, "ffi", "Struct", 0);
+    vmHandles.structClass = wrenGetSlotHandle(vm, 0);
+  }
+}
+
 internal void
 POINTER_reserve(WrenVM* vm) {
   POINTER_allocate(vm);
@@ -1,5 +1,5 @@
 typedef struct {
-  const unsigned char* file;
+  FILE_VIEW file;
   stbtt_fontinfo info;
 } FONT;
 
@@ -11,31 +11,62 @@ typedef struct {
   int32_t offsetY;
 } FONT_RASTER;
 
+// The font keeps reading from the file, so on success it takes over the
+// view, leaving the caller's closed. Safe to call from worker threads.
+internal const char*
+FONT_decode(FONT* font, FILE_VIEW* view) {
+  font->file.data = NULL;
+  char magic[4] = {0x00, 0x01, 0x00, 0x00};
+  if (view->length < 4 || memcmp(view->data, magic, 4) != 0) {
+    return "Given file is not a TTF file";
+  }
+  if (view->source == FILE_VIEW_BORROWED) {
+    // stb_truetype reads from the file data on demand, so we need
+    // our own copy of anything Wren might free.
+    char* copy = malloc(view->length * sizeof(char));
+    if (copy == NULL) {
+      return "Not enough memory to load font";
+    }
+    memcpy(copy, view->data, view->length * sizeof(char));
+    view->data = copy;
+    view->source = FILE_VIEW_HEAP;
+  }
+  font->file = *view;
+  view->data = NULL;
+  view->length = 0;
+
+  const unsigned char* file = (const unsigned char*)font->file.data;
+  int result = stbtt_InitFont(&(font->info), file, stbtt_GetFontOffsetForIndex(file, 0));
+  if (!result) {
+    return "Loading font failed";
+  }
+  return NULL;
+}
+
 internal void
 FONT_allocate(WrenVM* vm) {
-  FONT* font = wrenSetSlotNewForeign(vm, 0, 0, sizeof(FONT));
-  int size;
-  // ASSERT
-  ASSERT_SLOT_TYPE(vm, 1, STRING, "text");
-  const unsigned char* file = (const unsigned char*) wrenGetSlotBytes(vm, 1, &size);
-  char magic[4] = {0x00, 0x01, 0x00, 0x00};
-  if (memcmp(file, magic, 4) != 0) {
-    VM_ABORT(vm, "Given file is not a TTF file");
+  if (ASSET_isPreloaded(vm)) {
+    FONT* font = wrenSetSlotNewForeign(vm, 0, 0, sizeof(FONT));
+    ASSET_adopt(vm, ASSET_TYPE_FONT, font, sizeof(FONT));
     return;
   }
-  font->file = malloc(size * sizeof(char));
-  memcpy(font->file, file, size * sizeof(char));
-  int result = stbtt_InitFont(&(font->info), font->file, stbtt_GetFontOffsetForIndex(file, 0));
 
-  if (!result) {
-    VM_ABORT(vm, "Loading font failed");
+  FILE_VIEW view;
+  if (!ASSET_openView(vm, &view)) {
+    return;
+  }
+  FONT* font = wrenSetSlotNewForeign(vm, 0, 0, sizeof(FONT));
+  const char* error = FONT_decode(font, &view);
+  FILE_VIEW_close(&view);
+  if (error != NULL) {
+    VM_ABORT(vm, error);
   }
 }
 
 internal void
 FONT_finalize(void* data) {
   FONT* font = data;
-  free(font->file);
+  FILE_VIEW_close(&font->file);
 }
 
 internal void
@@ -77,7 +108,13 @@ FONT_RASTER_print(WrenVM* vm) {
   char* text = wrenGetSlotString(vm, 1);
   int64_t x = wrenGetSlotDouble(vm, 2);
   int64_t y = wrenGetSlotDouble(vm, 3);
-  uint32_t color = wrenGetSlotDouble(vm, 4);
+  uint32_t color;
+  if (!ENGINE_color(engine, wrenGetSlotDouble(vm, 4), &color)) {
+    VM_ABORT(vm, "color must be a 32-bit number");
+    return;
+  }
+  // Indexed colors can't be blended
+  bool antialias = raster->antialias && !engine->palette.enabled;
 
   unsigned char *bitmap;
   int w, h;
@@ -104,7 +141,7 @@ FONT_RASTER_print(WrenVM* vm) {
 
     for (int j = 0; j < h; j++) {
       for (int i = 0; i < w; i++) {
-        if (raster->antialias) {
+        if (antialias) {
           uint8_t alpha = baseAlpha * bitmap[j * w + i];
           outColor = (alpha << 24) | (color & 0x00FFFFFF);
         } else {
@@ -1,3 +1,24 @@
+// Reads a color in the slot for drawing, aborting if it isn't a 32-bit number.
+internal bool
+CANVAS_getColor(WrenVM* vm, int slot, uint32_t* color) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  if (!ENGINE_color(engine, wrenGetSlotDouble(vm, slot), color)) {
+    VM_ABORT(vm, "color must be a 32-bit number");
+    return false;
+  }
+  return true;
+}
+
+// As above, but as a plain packed color, whatever the canvas mode.
+internal bool
+GRAPHICS_getColor(WrenVM* vm, int slot, uint32_t* color) {
+  if (!ENGINE_toColor(wrenGetSlotDouble(vm, slot), color)) {
+    VM_ABORT(vm, "color must be a 32-bit number");
+    return false;
+  }
+  return true;
+}
+
 internal void
 CANVAS_print(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, STRING, "text");
@@ -8,7 +29,10 @@ CANVAS_print(WrenVM* vm) {
   char* text = (char*)wrenGetSlotString(vm, 1);
   int64_t x = round(wrenGetSlotDouble(vm, 2));
   int64_t y = round(wrenGetSlotDouble(vm, 3));
-  uint32_t c = round(wrenGetSlotDouble(vm, 4));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 4, &c)) {
+    return;
+  }
 
   ENGINE_print(engine, text, x, y, c);
 }
@@ -34,7 +58,10 @@ CANVAS_pset(WrenVM* vm)
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   int64_t x = round(wrenGetSlotDouble(vm, 1));
   int64_t y = round(wrenGetSlotDouble(vm, 2));
-  uint32_t c = round(wrenGetSlotDouble(vm, 3));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 3, &c)) {
+    return;
+  }
   ENGINE_pset(engine, x,y,c);
 }
 
@@ -53,7 +80,10 @@ CANVAS_circle_filled(WrenVM* vm)
     VM_ABORT(vm, "Circle radius must not be negative");
     return;
   }
-  uint32_t c = round(wrenGetSlotDouble(vm, 4));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 4, &c)) {
+    return;
+  }
   ENGINE_circle_filled(engine, x, y, r, c);
 }
 
@@ -72,7 +102,10 @@ CANVAS_circle(WrenVM* vm)
     VM_ABORT(vm, "Circle radius must not be negative");
     return;
   }
-  uint32_t c = round(wrenGetSlotDouble(vm, 4));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 4, &c)) {
+    return;
+  }
   ENGINE_circle(engine, x, y, r, c);
 }
 internal void
@@ -88,7 +121,10 @@ CANVAS_line(WrenVM* vm)
   int64_t y1 = round(wrenGetSlotDouble(vm, 2));
   int64_t x2 = round(wrenGetSlotDouble(vm, 3));
   int64_t y2 = round(wrenGetSlotDouble(vm, 4));
-  uint32_t c = round(wrenGetSlotDouble(vm, 5));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 5, &c)) {
+    return;
+  }
   ENGINE_line(engine, x1, y1, x2, y2, c);
 }
 
@@ -105,7 +141,10 @@ CANVAS_ellipse(WrenVM* vm)
   int64_t y1 = round(wrenGetSlotDouble(vm, 2));
   int64_t x2 = round(wrenGetSlotDouble(vm, 3));
   int64_t y2 = round(wrenGetSlotDouble(vm, 4));
-  uint32_t c = round(wrenGetSlotDouble(vm, 5));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 5, &c)) {
+    return;
+  }
   ENGINE_ellipse(engine, x1, y1, x2, y2, c);
 }
 
@@ -122,7 +161,10 @@ CANVAS_ellipsefill(WrenVM* vm)
   int64_t y1 = round(wrenGetSlotDouble(vm, 2));
   int64_t x2 = round(wrenGetSlotDouble(vm, 3));
   int64_t y2 = round(wrenGetSlotDouble(vm, 4));
-  uint32_t c = round(wrenGetSlotDouble(vm, 5));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 5, &c)) {
+    return;
+  }
   ENGINE_ellipsefill(engine, x1, y1, x2, y2, c);
 }
 
@@ -147,7 +189,10 @@ CANVAS_rect(WrenVM* vm)
     VM_ABORT(vm, "Rectangle height must not be negative");
     return;
   }
-  uint32_t c = round(wrenGetSlotDouble(vm, 5));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 5, &c)) {
+    return;
+  }
   ENGINE_rect(engine, x, y, w, h, c);
 }
 
@@ -172,7 +217,10 @@ CANVAS_rectfill(WrenVM* vm)
     VM_ABORT(vm, "Rectangle height must not be negative");
     return;
   }
-  uint32_t c = round(wrenGetSlotDouble(vm, 5));
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 5, &c)) {
+    return;
+  }
   ENGINE_rectfill(engine, x, y, w, h, c);
 }
 
@@ -180,8 +228,11 @@ internal void
 CANVAS_cls(WrenVM* vm)
 {
   ASSERT_SLOT_TYPE(vm, 1, NUM, "color");
-  uint32_t c = round(wrenGetSlotDouble(vm, 1));
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 1, &c)) {
+    return;
+  }
   int64_t offsetX = engine->offsetX;
   int64_t offsetY = engine->offsetY;
   // Backgrounds are opaque
@@ -200,6 +251,123 @@ CANVAS_getHeight(WrenVM* vm) {
   wrenSetSlotDouble(vm, 0, engine->height);
 }
 
+// Components are kept as given, and packed once whenever they change
+typedef struct {
+  double r;
+  double g;
+  double b;
+  double a;
+  uint32_t packed;
+} COLOR;
+
+internal void
+COLOR_allocate(WrenVM* vm) {
+  COLOR* color = wrenSetSlotNewForeign(vm, 0, 0, sizeof(COLOR));
+  memset(color, 0, sizeof(COLOR));
+}
+
+// Clamped in floating point, as converting an out of range double is undefined
+internal inline uint32_t
+COLOR_channel(double value) {
+  return value >= 255 ? 255 : (value > 0 ? (uint32_t)value : 0);
+}
+
+internal void
+COLOR_setRGB(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "red");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "green");
+  ASSERT_SLOT_TYPE(vm, 3, NUM, "blue");
+  ASSERT_SLOT_TYPE(vm, 4, NUM, "alpha");
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  color->r = wrenGetSlotDouble(vm, 1);
+  color->g = wrenGetSlotDouble(vm, 2);
+  color->b = wrenGetSlotDouble(vm, 3);
+  color->a = wrenGetSlotDouble(vm, 4);
+  // ABGR, to match the canvas
+  color->packed = (COLOR_channel(color->a) << 24)
+    | (COLOR_channel(color->b) << 16)
+    | (COLOR_channel(color->g) << 8)
+    | COLOR_channel(color->r);
+}
+
+internal void
+COLOR_setNum(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "color");
+  uint32_t packed;
+  if (!GRAPHICS_getColor(vm, 1, &packed)) {
+    return;
+  }
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  color->packed = packed;
+  color->r = color->packed & 0xFF;
+  color->g = (color->packed >> 8) & 0xFF;
+  color->b = (color->packed >> 16) & 0xFF;
+  color->a = (color->packed >> 24) & 0xFF;
+}
+
+internal void
+COLOR_toNum(WrenVM* vm) {
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, color->packed);
+}
+
+internal void
+COLOR_getR(WrenVM* vm) {
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, color->r);
+}
+
+internal void
+COLOR_getG(WrenVM* vm) {
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, color->g);
+}
+
+internal void
+COLOR_getB(WrenVM* vm) {
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, color->b);
+}
+
+internal void
+COLOR_getA(WrenVM* vm) {
+  COLOR* color = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, color->a);
+}
+
+internal void
+CANVAS_screenshot(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "scale");
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  const char* path = NULL;
+  if (wrenGetSlotType(vm, 1) != WREN_TYPE_NULL) {
+    ASSERT_SLOT_TYPE(vm, 1, STRING, "path");
+    path = wrenGetSlotString(vm, 1);
+  }
+  double scale = wrenGetSlotDouble(vm, 2);
+  if (scale < 1 || scale > 16 || scale != floor(scale)) {
+    VM_ABORT(vm, "Screenshot scale must be a whole number from 1 to 16");
+    return;
+  }
+  ENGINE_takeScreenshot(engine, path, scale, vm, wrenGetSlotHandle(vm, 3));
+}
+
+internal void
+CANVAS_screenshotComplete(SDL_Event* event) {
+  // Thread: Main
+  ENGINE_SCREENSHOT* shot = event->user.data1;
+  WrenVM* vm = shot->vm;
+  wrenEnsureSlots(vm, 2);
+  wrenSetSlotHandle(vm, 1, shot->opHandle);
+  ASYNCOP* op = (ASYNCOP*)wrenGetSlotForeign(vm, 1);
+  op->error = !shot->success;
+  op->complete = true;
+
+  wrenReleaseHandle(vm, shot->opHandle);
+  free(shot->path);
+  free(shot);
+}
+
 internal void
 CANVAS_resize(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, NUM, "width");
@@ -208,7 +376,10 @@ CANVAS_resize(WrenVM* vm) {
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   uint32_t width = wrenGetSlotDouble(vm, 1);
   uint32_t height = wrenGetSlotDouble(vm, 2);
-  uint32_t color = wrenGetSlotDouble(vm, 3);
+  uint32_t color;
+  if (!CANVAS_getColor(vm, 3, &color)) {
+    return;
+  }
   bool success = ENGINE_canvasResize(engine, width, height, color);
   if (success == false) {
     VM_ABORT(vm, SDL_GetError());
@@ -224,3 +395,652 @@ CANVAS_offset(WrenVM* vm) {
   engine->offsetX = wrenGetSlotDouble(vm, 1);
   engine->offsetY = wrenGetSlotDouble(vm, 2);
 }
+
+// Region access works directly on the pixels of the canvas or an image, in
+// buffer coordinates, ignoring Canvas.offset. Pixels are exchanged as RGBA
+// bytes, which is how they are laid out in memory.
+
+typedef struct {
+  int64_t x;
+  int64_t y;
+  int64_t w;
+  int64_t h;
+  // The part of the region which lies inside the buffer
+  int64_t x0;
+  int64_t y0;
+  int64_t x1;
+  int64_t y1;
+} REGION;
+
+typedef struct {
+  uint32_t from;
+  uint32_t to;
+} REGION_COLOR_PAIR;
+
+// Region data is passed as a Wren string, so it has to stay well short of
+// the largest string Wren can hold
+#define REGION_MAX_BYTES (256 * 1024 * 1024)
+#define REGION_MAX_COORD 1073741824.0
+
+// Reads x, y, width and height from slots 1 to 4
+internal bool
+REGION_fromSlots(WrenVM* vm, PIXEL_BUFFER* buffer, REGION* region) {
+  ASSERT_SLOT_TYPE_RETURN(vm, 1, NUM, "x", false);
+  ASSERT_SLOT_TYPE_RETURN(vm, 2, NUM, "y", false);
+  ASSERT_SLOT_TYPE_RETURN(vm, 3, NUM, "width", false);
+  ASSERT_SLOT_TYPE_RETURN(vm, 4, NUM, "height", false);
+  double x = round(wrenGetSlotDouble(vm, 1));
+  double y = round(wrenGetSlotDouble(vm, 2));
+  double w = round(wrenGetSlotDouble(vm, 3));
+  double h = round(wrenGetSlotDouble(vm, 4));
+  if (w < 0 || h < 0) {
+    VM_ABORT(vm, "Region can't have a negative size");
+    return false;
+  }
+  // Written so that NaN fails too
+  if (!(fabs(x) <= REGION_MAX_COORD && fabs(y) <= REGION_MAX_COORD
+        && w <= REGION_MAX_COORD && h <= REGION_MAX_COORD)) {
+    VM_ABORT(vm, "Region is out of range");
+    return false;
+  }
+  region->x = x;
+  region->y = y;
+  region->w = w;
+  region->h = h;
+  region->x0 = mid(0, region->x, buffer->width);
+  region->y0 = mid(0, region->y, buffer->height);
+  region->x1 = mid(0, region->x + region->w, buffer->width);
+  region->y1 = mid(0, region->y + region->h, buffer->height);
+  return true;
+}
+
+// The size of the region's pixel data, which fits in an int
+internal bool
+REGION_byteLength(WrenVM* vm, REGION* region, size_t* length) {
+  if (region->w > 0 && region->h > REGION_MAX_BYTES / 4 / region->w) {
+    VM_ABORT(vm, "Region is too large");
+    return false;
+  }
+  *length = region->w * region->h * 4;
+  return true;
+}
+
+internal void
+REGION_read(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  REGION region;
+  size_t length;
+  if (!REGION_fromSlots(vm, buffer, &region) || !REGION_byteLength(vm, &region, &length)) {
+    return;
+  }
+  // Pixels outside of the buffer read as transparent
+  uint32_t* out = calloc(max(length, 1), 1);
+  if (out == NULL) {
+    VM_ABORT(vm, "Not enough memory to read region");
+    return;
+  }
+  size_t span = (region.x1 - region.x0) * 4;
+  for (int64_t j = region.y0; j < region.y1 && span > 0; j++) {
+    uint32_t* dest = out + (j - region.y) * region.w + (region.x0 - region.x);
+    memcpy(dest, buffer->pixels + j * buffer->width + region.x0, span);
+  }
+  wrenSetSlotBytes(vm, 0, (const char*)out, length);
+  free(out);
+}
+
+internal void
+REGION_write(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  REGION region;
+  size_t expected;
+  if (!REGION_fromSlots(vm, buffer, &region) || !REGION_byteLength(vm, &region, &expected)) {
+    return;
+  }
+  size_t length = 0;
+  const char* data = DBUFFER_getSlotBytes(vm, 5, &length);
+  if (data == NULL) {
+    VM_ABORT(vm, "Region data was not a String or DataBuffer");
+    return;
+  }
+  if (length != expected) {
+    VM_ABORT(vm, "Region data must be four bytes per pixel");
+    return;
+  }
+  // Neither strings nor buffers guarantee alignment, so copy a row at a time
+  size_t span = (region.x1 - region.x0) * 4;
+  for (int64_t j = region.y0; j < region.y1 && span > 0; j++) {
+    const char* src = data + ((j - region.y) * region.w + (region.x0 - region.x)) * 4;
+    memcpy(buffer->pixels + j * buffer->width + region.x0, src, span);
+  }
+  wrenSetSlotNull(vm, 0);
+}
+
+internal int
+REGION_comparePairs(const void* a, const void* b) {
+  uint32_t first = ((const REGION_COLOR_PAIR*)a)->from;
+  uint32_t second = ((const REGION_COLOR_PAIR*)b)->from;
+  return (first > second) - (first < second);
+}
+
+// Slot 5 holds a flat list of [from, to, from, to, ...] colors
+internal void
+REGION_paletteMap(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  REGION region;
+  if (!REGION_fromSlots(vm, buffer, &region)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 5, LIST, "palette map");
+  size_t count = wrenGetListCount(vm, 5) / 2;
+  if (count == 0) {
+    wrenSetSlotNull(vm, 0);
+    return;
+  }
+  REGION_COLOR_PAIR* pairs = malloc(count * sizeof(REGION_COLOR_PAIR));
+  if (pairs == NULL) {
+    VM_ABORT(vm, "Not enough memory for palette map");
+    return;
+  }
+  wrenEnsureSlots(vm, 7);
+  for (size_t i = 0; i < count; i++) {
+    wrenGetListElement(vm, 5, i * 2, 6);
+    if (wrenGetSlotType(vm, 6) != WREN_TYPE_NUM) {
+      free(pairs);
+      VM_ABORT(vm, "palette map was not NUM");
+      return;
+    }
+    if (!GRAPHICS_getColor(vm, 6, &pairs[i].from)) {
+      free(pairs);
+      return;
+    }
+    wrenGetListElement(vm, 5, i * 2 + 1, 6);
+    if (wrenGetSlotType(vm, 6) != WREN_TYPE_NUM) {
+      free(pairs);
+      VM_ABORT(vm, "palette map was not NUM");
+      return;
+    }
+    if (!GRAPHICS_getColor(vm, 6, &pairs[i].to)) {
+      free(pairs);
+      return;
+    }
+  }
+  qsort(pairs, count, sizeof(REGION_COLOR_PAIR), REGION_comparePairs);
+
+  // Neighbouring pixels are often the same color, so remember the last one
+  uint32_t lastFrom = 0;
+  uint32_t lastTo = 0;
+  bool hasLast = false;
+  for (int64_t j = region.y0; j < region.y1; j++) {
+    uint32_t* row = buffer->pixels + j * buffer->width;
+    for (int64_t i = region.x0; i < region.x1; i++) {
+      uint32_t c = row[i];
+      if (hasLast && c == lastFrom) {
+        row[i] = lastTo;
+        continue;
+      }
+      REGION_COLOR_PAIR key = { c, 0 };
+      REGION_COLOR_PAIR* match = bsearch(&key, pairs, count, sizeof(REGION_COLOR_PAIR), REGION_comparePairs);
+      lastFrom = c;
+      lastTo = match == NULL ? c : match->to;
+      hasLast = true;
+      row[i] = lastTo;
+    }
+  }
+  free(pairs);
+  wrenSetSlotNull(vm, 0);
+}
+
+internal void
+REGION_threshold(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  REGION region;
+  if (!REGION_fromSlots(vm, buffer, &region)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 5, NUM, "level");
+  ASSERT_SLOT_TYPE(vm, 6, NUM, "below");
+  ASSERT_SLOT_TYPE(vm, 7, NUM, "above");
+  uint32_t level = mid(0, round(wrenGetSlotDouble(vm, 5)), 256);
+  uint32_t below, above;
+  if (!GRAPHICS_getColor(vm, 6, &below) || !GRAPHICS_getColor(vm, 7, &above)) {
+    return;
+  }
+  for (int64_t j = region.y0; j < region.y1; j++) {
+    uint32_t* row = buffer->pixels + j * buffer->width;
+    for (int64_t i = region.x0; i < region.x1; i++) {
+      uint32_t c = row[i];
+      // BT.601 luma, in fixed point
+      uint32_t luma = ((c & 0xFF) * 77 + ((c >> 8) & 0xFF) * 150 + ((c >> 16) & 0xFF) * 29) >> 8;
+      row[i] = luma >= level ? above : below;
+    }
+  }
+  wrenSetSlotNull(vm, 0);
+}
+
+// Slot 5 holds a 4x5 matrix, row by row. Each output channel is the
+// weighted sum of the input r, g, b and a, plus an offset in 0-255.
+internal void
+REGION_colorMatrix(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  REGION region;
+  if (!REGION_fromSlots(vm, buffer, &region)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 5, LIST, "matrix");
+  if (wrenGetListCount(vm, 5) != 20) {
+    VM_ABORT(vm, "Color matrix must have 20 entries");
+    return;
+  }
+  float m[20];
+  wrenEnsureSlots(vm, 7);
+  for (int i = 0; i < 20; i++) {
+    wrenGetListElement(vm, 5, i, 6);
+    ASSERT_SLOT_TYPE(vm, 6, NUM, "matrix entry");
+    m[i] = wrenGetSlotDouble(vm, 6);
+  }
+  for (int64_t j = region.y0; j < region.y1; j++) {
+    uint8_t* row = (uint8_t*)(buffer->pixels + j * buffer->width);
+    for (int64_t i = region.x0; i < region.x1; i++) {
+      uint8_t* p = row + i * 4;
+      float in[4] = { p[0], p[1], p[2], p[3] };
+      for (int k = 0; k < 4; k++) {
+        float* r = m + k * 5;
+        float v = r[0] * in[0] + r[1] * in[1] + r[2] * in[2] + r[3] * in[3] + r[4];
+        p[k] = v <= 0 ? 0 : (v >= 255 ? 255 : (uint8_t)(v + 0.5f));
+      }
+    }
+  }
+  wrenSetSlotNull(vm, 0);
+}
+
+internal bool
+CANVAS_buffer(WrenVM* vm, PIXEL_BUFFER* buffer) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  if (engine->palette.enabled) {
+    VM_ABORT(vm, "Region operations are not available in indexed mode");
+    return false;
+  }
+  *buffer = (PIXEL_BUFFER){ engine->height, engine->width, engine->pixels };
+  return true;
+}
+
+internal void
+CANVAS_getRegion(WrenVM* vm) {
+  PIXEL_BUFFER buffer;
+  if (!CANVAS_buffer(vm, &buffer)) {
+    return;
+  }
+  REGION_read(vm, &buffer);
+}
+
+internal void
+CANVAS_setRegion(WrenVM* vm) {
+  PIXEL_BUFFER buffer;
+  if (!CANVAS_buffer(vm, &buffer)) {
+    return;
+  }
+  REGION_write(vm, &buffer);
+}
+
+internal void
+CANVAS_paletteMap(WrenVM* vm) {
+  PIXEL_BUFFER buffer;
+  if (!CANVAS_buffer(vm, &buffer)) {
+    return;
+  }
+  REGION_paletteMap(vm, &buffer);
+}
+
+internal void
+CANVAS_threshold(WrenVM* vm) {
+  PIXEL_BUFFER buffer;
+  if (!CANVAS_buffer(vm, &buffer)) {
+    return;
+  }
+  REGION_threshold(vm, &buffer);
+}
+
+internal void
+CANVAS_colorMatrix(WrenVM* vm) {
+  PIXEL_BUFFER buffer;
+  if (!CANVAS_buffer(vm, &buffer)) {
+    return;
+  }
+  REGION_colorMatrix(vm, &buffer);
+}
+
+internal void
+CANVAS_getIndexed(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  wrenSetSlotBool(vm, 0, engine->palette.enabled);
+}
+
+internal void
+CANVAS_setIndexed(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, BOOL, "indexed");
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  if (!ENGINE_setIndexed(engine, wrenGetSlotBool(vm, 1))) {
+    VM_ABORT(vm, "Could not allocate the indexed canvas");
+    return;
+  }
+}
+
+internal bool
+PALETTE_getIndex(WrenVM* vm, int slot, uint8_t* index) {
+  ASSERT_SLOT_TYPE_RETURN(vm, slot, NUM, "index", false);
+  double value = wrenGetSlotDouble(vm, slot);
+  if (value < 0 || value >= ENGINE_PALETTE_SIZE || value != floor(value)) {
+    VM_ABORT(vm, "Palette index must be a whole number from 0 to 255");
+    return false;
+  }
+  *index = value;
+  return true;
+}
+
+internal void
+PALETTE_get(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint8_t index;
+  if (!PALETTE_getIndex(vm, 1, &index)) {
+    return;
+  }
+  wrenSetSlotDouble(vm, 0, engine->palette.colors[index]);
+}
+
+internal void
+PALETTE_set(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint8_t index;
+  if (!PALETTE_getIndex(vm, 1, &index)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "color");
+  uint32_t color;
+  if (!GRAPHICS_getColor(vm, 2, &color)) {
+    return;
+  }
+  engine->palette.colors[index] = color;
+}
+
+internal void
+PALETTE_swap(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint8_t a, b;
+  if (!PALETTE_getIndex(vm, 1, &a) || !PALETTE_getIndex(vm, 2, &b)) {
+    return;
+  }
+  uint32_t swap = engine->palette.colors[a];
+  engine->palette.colors[a] = engine->palette.colors[b];
+  engine->palette.colors[b] = swap;
+}
+
+internal void
+PALETTE_remap(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint8_t from, to;
+  if (!PALETTE_getIndex(vm, 1, &from) || !PALETTE_getIndex(vm, 2, &to)) {
+    return;
+  }
+  engine->palette.remap[from] = to;
+}
+
+internal void
+PALETTE_resetRemap(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  for (size_t i = 0; i < ENGINE_PALETTE_SIZE; i++) {
+    engine->palette.remap[i] = i;
+  }
+}
+
+internal void
+PALETTE_cycle(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  ENGINE_PALETTE* palette = &engine->palette;
+  uint8_t start, end;
+  if (!PALETTE_getIndex(vm, 1, &start) || !PALETTE_getIndex(vm, 2, &end)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 3, NUM, "delay");
+  double delay = wrenGetSlotDouble(vm, 3);
+  if (start > end) {
+    VM_ABORT(vm, "Cycle must start before it ends");
+    return;
+  }
+  if (delay < 1) {
+    VM_ABORT(vm, "Cycle delay must be at least one tick");
+    return;
+  }
+  if (palette->cycleCount >= ENGINE_PALETTE_MAX_CYCLES) {
+    VM_ABORT(vm, "Too many palette cycles");
+    return;
+  }
+  palette->cycles[palette->cycleCount++] = (ENGINE_PALETTE_CYCLE){ start, end, delay };
+}
+
+internal void
+PALETTE_clearCycles(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  engine->palette.cycleCount = 0;
+}
+
+internal void
+PALETTE_fade(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "color");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "amount");
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint32_t color;
+  if (!GRAPHICS_getColor(vm, 1, &color)) {
+    return;
+  }
+  engine->palette.fadeColor = color;
+  engine->palette.fadeAmount = round(fmid(0, wrenGetSlotDouble(vm, 2), 1) * 255);
+}
+
+internal void
+POSTPROCESS_addEffect(WrenVM* vm, POSTPROCESS_EFFECT effect) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  if (!POSTPROCESS_add(engine, effect)) {
+    VM_ABORT(vm, "Too many post-processing effects");
+    return;
+  }
+}
+
+internal void
+POSTPROCESS_reset(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  POSTPROCESS_clear(engine);
+}
+
+internal void
+POSTPROCESS_addScanlines(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "intensity");
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_SCANLINES };
+  effect.amount = wrenGetSlotDouble(vm, 1);
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+internal void
+POSTPROCESS_addCurvature(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "amount");
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_CURVATURE };
+  effect.amount = wrenGetSlotDouble(vm, 1);
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+internal void
+POSTPROCESS_addBloom(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "threshold");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "strength");
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_BLOOM };
+  effect.threshold = wrenGetSlotDouble(vm, 1);
+  effect.amount = wrenGetSlotDouble(vm, 2);
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+internal void
+POSTPROCESS_addGrade(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "lookup");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "width");
+  ASSERT_SLOT_TYPE(vm, 3, NUM, "height");
+  size_t width = wrenGetSlotDouble(vm, 2);
+  size_t height = wrenGetSlotDouble(vm, 3);
+  int length = 0;
+  const char* data = wrenGetSlotBytes(vm, 1, &length);
+  if (height < 2 || width != height * height || (size_t)length != width * height * 4) {
+    VM_ABORT(vm, "Color lookup must be a strip of N squares of N by N pixels");
+    return;
+  }
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_GRADE };
+  effect.lutSize = height;
+  effect.lut = malloc(length);
+  if (effect.lut == NULL) {
+    VM_ABORT(vm, "Not enough memory for the color lookup");
+    return;
+  }
+  memcpy(effect.lut, data, length);
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+internal void
+POSTPROCESS_addDither(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "levels");
+  double levels = wrenGetSlotDouble(vm, 1);
+  if (levels < 2 || levels > 256 || levels != floor(levels)) {
+    VM_ABORT(vm, "Dither levels must be a whole number from 2 to 256");
+    return;
+  }
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_DITHER };
+  effect.levels = levels;
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+internal void
+POSTPROCESS_addUpscale(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "scale");
+  double scale = wrenGetSlotDouble(vm, 1);
+  if (scale < 1 || scale > 8 || scale != floor(scale)) {
+    VM_ABORT(vm, "Upscale must be a whole number from 1 to 8");
+    return;
+  }
+  POSTPROCESS_EFFECT effect = { .type = POSTPROCESS_UPSCALE };
+  effect.scale = scale;
+  POSTPROCESS_addEffect(vm, effect);
+}
+
+// Reads one coordinate of a point, which must be finite and fit in 32 bits
+// so it can be converted to a pixel. Aborts on bad input.
+internal bool
+CANVAS_getCoordinate(WrenVM* vm, int slot, double* value) {
+  ASSERT_SLOT_TYPE_RETURN(vm, slot, NUM, "point", false);
+  *value = wrenGetSlotDouble(vm, slot);
+  if (!(fabs(*value) <= INT32_MAX)) {
+    VM_ABORT(vm, "Points must be finite numbers in the 32-bit range");
+    return false;
+  }
+  return true;
+}
+
+internal bool
+CANVAS_getPoint(WrenVM* vm, int xSlot, int ySlot, VEC* point) {
+  return CANVAS_getCoordinate(vm, xSlot, &point->x)
+    && CANVAS_getCoordinate(vm, ySlot, &point->y);
+}
+
+// Reads a flat list of [x, y, x, y, ...] into points, using the slot after
+// it as scratch space. Returns NULL, having aborted, on bad input.
+internal VEC*
+CANVAS_getPoints(WrenVM* vm, int slot, size_t* count) {
+  ASSERT_SLOT_TYPE_RETURN(vm, slot, LIST, "points", NULL);
+  size_t length = wrenGetListCount(vm, slot);
+  if (length % 2 != 0) {
+    VM_ABORT(vm, "Points must be pairs of x and y");
+    return NULL;
+  }
+  int scratch = wrenGetSlotCount(vm);
+  wrenEnsureSlots(vm, scratch + 1);
+  VEC* points = malloc(max(length / 2, 1) * sizeof(VEC));
+  if (points == NULL) {
+    VM_ABORT(vm, "Not enough memory for the points");
+    return NULL;
+  }
+  for (size_t i = 0; i < length; i++) {
+    wrenGetListElement(vm, slot, i, scratch);
+    VEC* point = &points[i / 2];
+    if (!CANVAS_getCoordinate(vm, scratch, i % 2 == 0 ? &point->x : &point->y)) {
+      free(points);
+      return NULL;
+    }
+  }
+  *count = length / 2;
+  return points;
+}
+
+internal void
+CANVAS_polygon(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "color");
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 2, &c)) {
+    return;
+  }
+  size_t count = 0;
+  VEC* points = CANVAS_getPoints(vm, 1, &count);
+  if (points == NULL) {
+    return;
+  }
+  ENGINE_polygon(engine, points, count, c);
+  free(points);
+}
+
+internal void
+CANVAS_polygonfill(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "color");
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 2, &c)) {
+    return;
+  }
+  size_t count = 0;
+  VEC* points = CANVAS_getPoints(vm, 1, &count);
+  if (points == NULL) {
+    return;
+  }
+  bool filled = ENGINE_polygonfill(engine, points, count, c);
+  free(points);
+  if (!filled) {
+    VM_ABORT(vm, "Not enough memory to fill the polygon");
+  }
+}
+
+internal void
+CANVAS_trianglefill(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  VEC points[3];
+  for (int i = 0; i < 3; i++) {
+    if (!CANVAS_getPoint(vm, 1 + i * 2, 2 + i * 2, &points[i])) {
+      return;
+    }
+  }
+  ASSERT_SLOT_TYPE(vm, 7, NUM, "color");
+  uint32_t c;
+  if (!CANVAS_getColor(vm, 7, &c)) {
+    return;
+  }
+  if (!ENGINE_polygonfill(engine, points, 3, c)) {
+    VM_ABORT(vm, "Not enough memory to fill the triangle");
+  }
+}
+
+internal void
+CANVAS_trianglefillGradient(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  VEC points[3];
+  uint32_t colors[3];
+  for (int i = 0; i < 3; i++) {
+    if (!CANVAS_getPoint(vm, 1 + i * 3, 2 + i * 3, &points[i])) {
+      return;
+    }
+    ASSERT_SLOT_TYPE(vm, 3 + i * 3, NUM, "color");
+    if (!CANVAS_getColor(vm, 3 + i * 3, &colors[i])) {
+      return;
+    }
+  }
+  if (!ENGINE_trianglefillGradient(engine, points, colors)) {
+    VM_ABORT(vm, "Not enough memory to fill the triangle");
+  }
+}
@@ -3,6 +3,8 @@ typedef struct {
   int32_t height;
   uint32_t* pixels;
   int32_t channels;
+  // Pixels hold palette indices, see IMAGE_toIndexed
+  bool indexed;
 } IMAGE;
 
 typedef enum { COLOR_MODE_RGBA, COLOR_MODE_MONO } COLOR_MODE;
@@ -133,6 +135,7 @@ DRAW_COMMAND_allocate(WrenVM* vm) {
   DRAW_COMMAND* command = (DRAW_COMMAND*)wrenSetSlotNewForeign(vm,
       0, 0, sizeof(DRAW_COMMAND));
 
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   IMAGE* image = wrenGetSlotForeign(vm, 1);
   *command = DRAW_COMMAND_init(image);
 
@@ -176,11 +179,17 @@ DRAW_COMMAND_allocate(WrenVM* vm) {
 
     wrenGetListElement(vm, 2, 8, 1);
     ASSERT_SLOT_TYPE(vm, 1, NUM, "foreground color");
-    command->foregroundColor = wrenGetSlotDouble(vm, 1);
+    if (!ENGINE_color(engine, wrenGetSlotDouble(vm, 1), &command->foregroundColor)) {
+      VM_ABORT(vm, "foreground color must be a 32-bit number");
+      return;
+    }
 
     wrenGetListElement(vm, 2, 9, 1);
     ASSERT_SLOT_TYPE(vm, 1, NUM, "background color");
-    command->backgroundColor = wrenGetSlotDouble(vm, 1);
+    if (!ENGINE_color(engine, wrenGetSlotDouble(vm, 1), &command->backgroundColor)) {
+      VM_ABORT(vm, "background color must be a 32-bit number");
+      return;
+    }
   }
 }
 
@@ -189,6 +198,17 @@ DRAW_COMMAND_finalize(void* data) {
   // Nothing here
 }
 
+internal bool
+IMAGE_canDraw(WrenVM* vm, ENGINE* engine, IMAGE* image) {
+  if (image->indexed != engine->palette.enabled) {
+    VM_ABORT(vm, image->indexed
+        ? "Indexed images can only be drawn on an indexed canvas"
+        : "Images must be converted with toIndexed() to draw on an indexed canvas");
+    return false;
+  }
+  return true;
+}
+
 internal void
 DRAW_COMMAND_draw(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, NUM, "x");
@@ -196,6 +216,9 @@ DRAW_COMMAND_draw(WrenVM* vm) {
 
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   DRAW_COMMAND* command = wrenGetSlotForeign(vm, 0);
+  if (!IMAGE_canDraw(vm, engine, command->image)) {
+    return;
+  }
 
   command->dest.x = wrenGetSlotDouble(vm, 1);
   command->dest.y = wrenGetSlotDouble(vm, 2);
@@ -203,24 +226,41 @@ DRAW_COMMAND_draw(WrenVM* vm) {
   DRAW_COMMAND_execute(engine, command);
 }
 
-void IMAGE_allocate(WrenVM* vm) {
-  ASSERT_SLOT_TYPE(vm, 1, STRING, "image");
-  // TODO: We should read this from a "DataBuffer" which is file loaded, rather than loading ourselves.
-  // So that we can defer the file loading to a thread.
-  int length;
-  const char* fileBuffer = wrenGetSlotBytes(vm, 1, &length);
-  IMAGE* image = (IMAGE*)wrenSetSlotNewForeign(vm,
-      0, 0, sizeof(IMAGE));
-
-  image->pixels = (uint32_t*)stbi_load_from_memory((const stbi_uc*)fileBuffer, length,
+// Safe to call from worker threads, but stb_image only keeps one failure
+// reason, so a concurrent failure may report the wrong message.
+internal const char*
+IMAGE_decode(IMAGE* image, FILE_VIEW* view) {
+  image->pixels = (uint32_t*)stbi_load_from_memory((const stbi_uc*)view->data, view->length,
       &image->width,
       &image->height,
       &image->channels,
       STBI_rgb_alpha);
+  image->indexed = false;
+  if (image->pixels == NULL) {
+    return stbi_failure_reason();
+  }
+  return NULL;
+}
 
-  if (image->pixels == NULL)
+void IMAGE_allocate(WrenVM* vm) {
+  if (ASSET_isPreloaded(vm)) {
+    IMAGE* image = (IMAGE*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(IMAGE));
+    ASSET_adopt(vm, ASSET_TYPE_IMAGE, image, sizeof(IMAGE));
+    return;
+  }
+
+  FILE_VIEW view;
+  if (!ASSET_openView(vm, &view)) {
+    return;
+  }
+  IMAGE* image = (IMAGE*)wrenSetSlotNewForeign(vm,
+      0, 0, sizeof(IMAGE));
+
+  const char* errorMsg = IMAGE_decode(image, &view);
+  FILE_VIEW_close(&view);
+
+  if (errorMsg != NULL)
   {
-    char* errorMsg = stbi_failure_reason();
     size_t errorLength = strlen(errorMsg);
     char buf[errorLength + 8];
     snprintf(buf, errorLength + 8, "Error: %s\n", errorMsg);
@@ -246,6 +286,9 @@ IMAGE_draw(WrenVM* vm) {
 
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  if (!IMAGE_canDraw(vm, engine, image)) {
+    return;
+  }
   int32_t x = wrenGetSlotDouble(vm, 1);
   int32_t y = wrenGetSlotDouble(vm, 2);
   if (image->channels == 2 || image->channels == 4) {
@@ -274,3 +317,127 @@ void IMAGE_getHeight(WrenVM* vm) {
   IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
   wrenSetSlotDouble(vm, 0, image->height);
 }
+
+internal PIXEL_BUFFER
+IMAGE_buffer(WrenVM* vm) {
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  return (PIXEL_BUFFER){ image->height, image->width, image->pixels };
+}
+
+internal void
+IMAGE_getRegion(WrenVM* vm) {
+  PIXEL_BUFFER buffer = IMAGE_buffer(vm);
+  REGION_read(vm, &buffer);
+}
+
+// Writes may introduce transparency, so the image can no longer be
+// fast blitted afterwards.
+internal void
+IMAGE_setRegion(WrenVM* vm) {
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  PIXEL_BUFFER buffer = IMAGE_buffer(vm);
+  REGION_write(vm, &buffer);
+  image->channels = 4;
+}
+
+internal void
+IMAGE_paletteMap(WrenVM* vm) {
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  PIXEL_BUFFER buffer = IMAGE_buffer(vm);
+  REGION_paletteMap(vm, &buffer);
+  image->channels = 4;
+}
+
+internal void
+IMAGE_threshold(WrenVM* vm) {
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  PIXEL_BUFFER buffer = IMAGE_buffer(vm);
+  REGION_threshold(vm, &buffer);
+  image->channels = 4;
+}
+
+internal void
+IMAGE_colorMatrix(WrenVM* vm) {
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  PIXEL_BUFFER buffer = IMAGE_buffer(vm);
+  REGION_colorMatrix(vm, &buffer);
+  image->channels = 4;
+}
+
+// Matches every pixel to the nearest color of the current palette. Mostly
+// transparent pixels become fully transparent, and the rest are stored as
+// opaque with the index in the low byte, which is how the drawing code
+// passes indices around.
+internal void
+IMAGE_toIndexed(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  if (image->indexed) {
+    return;
+  }
+  uint32_t* colors = engine->palette.colors;
+  uint32_t lastColor = 0;
+  uint32_t lastIndex = 0;
+  bool hasLast = false;
+  size_t count = image->width * image->height;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t c = image->pixels[i];
+    if ((c >> 24) < 0x80) {
+      image->pixels[i] = 0;
+      continue;
+    }
+    if (!hasLast || c != lastColor) {
+      int32_t r = c & 0xFF;
+      int32_t g = (c >> 8) & 0xFF;
+      int32_t b = (c >> 16) & 0xFF;
+      uint32_t best = UINT32_MAX;
+      for (uint32_t index = 0; index < ENGINE_PALETTE_SIZE && best > 0; index++) {
+        int32_t dr = r - (int32_t)(colors[index] & 0xFF);
+        int32_t dg = g - (int32_t)((colors[index] >> 8) & 0xFF);
+        int32_t db = b - (int32_t)((colors[index] >> 16) & 0xFF);
+        uint32_t distance = dr * dr + dg * dg + db * db;
+        if (distance < best) {
+          best = distance;
+          lastIndex = index;
+        }
+      }
+      lastColor = c;
+      hasLast = true;
+    }
+    image->pixels[i] = 0xFF000000 | lastIndex;
+  }
+  image->indexed = true;
+}
+
+// Slot 1 holds [x, y, u, v] for each of the three corners
+internal void
+IMAGE_triangle(WrenVM* vm) {
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  IMAGE* image = (IMAGE*)wrenGetSlotForeign(vm, 0);
+  if (!IMAGE_canDraw(vm, engine, image)) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, LIST, "corners");
+  if (wrenGetListCount(vm, 1) != 12) {
+    VM_ABORT(vm, "Textured triangles need x, y, u and v for each corner");
+    return;
+  }
+  wrenEnsureSlots(vm, 3);
+  double values[12];
+  for (int i = 0; i < 12; i++) {
+    wrenGetListElement(vm, 1, i, 2);
+    if (!CANVAS_getCoordinate(vm, 2, &values[i])) {
+      return;
+    }
+  }
+  VEC points[3];
+  VEC uvs[3];
+  for (int i = 0; i < 3; i++) {
+    points[i] = (VEC){ values[i * 4], values[i * 4 + 1] };
+    uvs[i] = (VEC){ values[i * 4 + 2], values[i * 4 + 3] };
+  }
+  PIXEL_BUFFER texture = IMAGE_buffer(vm);
+  if (!ENGINE_trianglefillTextured(engine, points, uvs, &texture)) {
+    VM_ABORT(vm, "Not enough memory to fill the triangle");
+  }
+}
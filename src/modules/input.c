@@ -1,20 +1,154 @@
-internal void KEYBOARD_isKeyDown(WrenVM* vm) {
-  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+// The state update() sees is a snapshot, taken before each tick from the
+// live state kept by events. Each key or button has a byte of flags, so a
+// tap which starts and ends between two ticks is still seen as pressed.
+#define INPUT_DOWN 1
+#define INPUT_PRESSED 2
+#define INPUT_RELEASED 4
+
+#define INPUT_MOUSE_BUTTONS 8
+#define INPUT_MAX_GAMEPADS 16
+
+typedef struct {
+  uint8_t buttons[SDL_CONTROLLER_BUTTON_MAX];
+  int16_t axes[SDL_CONTROLLER_AXIS_MAX];
+  // Whether a gamepad is open in this slot, so replays can connect and
+  // disconnect it at the same tick
+  uint8_t present;
+  uint8_t attached;
+  int32_t id;
+} INPUT_PAD_FRAME;
+
+// Everything a tick can read, kept flat so replay.c can record it.
+typedef struct {
+  uint8_t keys[SDL_NUM_SCANCODES];
+  uint8_t mouse[INPUT_MOUSE_BUTTONS];
+  float mouseX;
+  float mouseY;
+  INPUT_PAD_FRAME pads[INPUT_MAX_GAMEPADS];
+} INPUT_FRAME;
+
+typedef struct {
+  uint8_t liveKeys[SDL_NUM_SCANCODES];
+  uint8_t liveMouse[INPUT_MOUSE_BUTTONS];
+  INPUT_FRAME frame;
+  // Open gamepads, which are polled each tick, by the slot of their frame
+  struct GAMEPAD_t* pads[INPUT_MAX_GAMEPADS];
+  // While replaying, only the recorded gamepads exist
+  bool replaying;
+} INPUT_STATE;
+
+global_variable INPUT_STATE inputState;
+
+internal inline void
+INPUT_setLive(uint8_t* flags, bool down) {
+  if (down && !(*flags & INPUT_DOWN)) {
+    *flags |= INPUT_DOWN | INPUT_PRESSED;
+  } else if (!down && (*flags & INPUT_DOWN)) {
+    *flags = (*flags & ~INPUT_DOWN) | INPUT_RELEASED;
+  }
+}
+
+// Called for every polled event.
+internal void
+INPUT_handleEvent(SDL_Event* event) {
+  switch (event->type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      {
+        SDL_Scancode scancode = event->key.keysym.scancode;
+        if (scancode < SDL_NUM_SCANCODES) {
+          INPUT_setLive(&inputState.liveKeys[scancode], event->type == SDL_KEYDOWN);
+        }
+      } break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      {
+        uint8_t button = event->button.button;
+        if (button < INPUT_MOUSE_BUTTONS) {
+          INPUT_setLive(&inputState.liveMouse[button], event->type == SDL_MOUSEBUTTONDOWN);
+        }
+      } break;
+  }
+}
+
+internal inline uint8_t
+INPUT_snapshotFlags(uint8_t* live) {
+  uint8_t flags = *live;
+  *live &= INPUT_DOWN;
+  return flags;
+}
+
+internal void GAMEPAD_tick(struct GAMEPAD_t* gamepad, INPUT_PAD_FRAME* pad);
+
+// Called before each update(), so edges last for exactly one tick.
+internal void
+INPUT_tick(ENGINE* engine) {
+  INPUT_FRAME* frame = &inputState.frame;
+  for (size_t i = 0; i < SDL_NUM_SCANCODES; i++) {
+    frame->keys[i] = INPUT_snapshotFlags(&inputState.liveKeys[i]);
+  }
+  for (size_t i = 0; i < INPUT_MOUSE_BUTTONS; i++) {
+    frame->mouse[i] = INPUT_snapshotFlags(&inputState.liveMouse[i]);
+  }
+  frame->mouseX = ENGINE_getMouseX(engine);
+  frame->mouseY = ENGINE_getMouseY(engine);
+  for (size_t i = 0; i < INPUT_MAX_GAMEPADS; i++) {
+    if (inputState.pads[i] != NULL) {
+      GAMEPAD_tick(inputState.pads[i], &frame->pads[i]);
+    }
+  }
+}
+
+// A key pressed and released within one tick still counts as down for it.
+internal inline bool
+INPUT_isDown(uint8_t flags) {
+  return (flags & (INPUT_DOWN | INPUT_PRESSED)) != 0;
+}
+
+// Reads the flags for the index in slot 1, or 0 if it isn't a whole
+// number in range. The comparisons are written so that NaN fails them.
+internal uint8_t
+INPUT_getFlags(WrenVM* vm, const uint8_t* flags, size_t count) {
+  ASSERT_SLOT_TYPE_RETURN(vm, 1, NUM, "index", 0);
+  double index = wrenGetSlotDouble(vm, 1);
+  if (!(index >= 0 && index < count) || index != floor(index)) {
+    return 0;
+  }
+  return flags[(size_t)index];
+}
+
+// Key names go through the keycode, so they follow the keyboard layout.
+// The Wren side caches the result, so this runs once per name.
+internal void
+KEYBOARD_getScancode(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, STRING, "key name");
   const char* keyName = wrenGetSlotString(vm, 1);
-  bool result = ENGINE_getKeyState(engine, keyName);
-  wrenSetSlotBool(vm, 0, result);
+  SDL_Keycode keycode = SDL_GetKeyFromName(keyName);
+  wrenSetSlotDouble(vm, 0, SDL_GetScancodeFromKey(keycode));
+}
+
+internal void
+KEYBOARD_isKeyDown(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_isDown(INPUT_getFlags(vm, inputState.frame.keys, SDL_NUM_SCANCODES)));
+}
+
+internal void
+KEYBOARD_justPressed(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, inputState.frame.keys, SDL_NUM_SCANCODES) & INPUT_PRESSED);
+}
+
+internal void
+KEYBOARD_justReleased(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, inputState.frame.keys, SDL_NUM_SCANCODES) & INPUT_RELEASED);
 }
 
 internal void MOUSE_getX(WrenVM* vm) {
-  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
-  int x = ENGINE_getMouseX(engine);
+  int x = inputState.frame.mouseX;
   wrenSetSlotDouble(vm, 0, x);
 }
 
 internal void MOUSE_getY(WrenVM* vm) {
-  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
-  int y = ENGINE_getMouseY(engine);
+  int y = inputState.frame.mouseY;
   wrenSetSlotDouble(vm, 0, y);
 }
 
@@ -31,46 +165,103 @@ MOUSE_getHidden(WrenVM* vm) {
   wrenSetSlotBool(vm, 0, !shown);
 }
 
-internal void MOUSE_isButtonPressed(WrenVM* vm) {
-  WrenType type = wrenGetSlotType(vm, 1);
-  int buttonIndex = 0;
-  if (type == WREN_TYPE_STRING) {
-    char* buttonName = strToLower(wrenGetSlotString(vm, 1));
-    if (STRINGS_EQUAL(buttonName, "left")) {
-      buttonIndex = SDL_BUTTON_LEFT;
-    } else if (STRINGS_EQUAL(buttonName, "middle")) {
-      buttonIndex = SDL_BUTTON_MIDDLE;
-    } else if (STRINGS_EQUAL(buttonName, "right")) {
-      buttonIndex = SDL_BUTTON_RIGHT;
-    } else if (STRINGS_EQUAL(buttonName, "X1")) {
-      buttonIndex = SDL_BUTTON_X1;
-    } else if (STRINGS_EQUAL(buttonName, "X2")) {
-      buttonIndex = SDL_BUTTON_X2;
-    } else {
-      VM_ABORT(vm, "Unknown mouse button name");
-      return;
+typedef struct {
+  const char* name;
+  int index;
+} INPUT_BUTTON_NAME;
+
+global_variable const INPUT_BUTTON_NAME MOUSE_BUTTON_NAMES[] = {
+  { "left", SDL_BUTTON_LEFT },
+  { "middle", SDL_BUTTON_MIDDLE },
+  { "right", SDL_BUTTON_RIGHT },
+  { "x1", SDL_BUTTON_X1 },
+  { "x2", SDL_BUTTON_X2 },
+  { NULL, 0 }
+};
+
+// Looks up the button name in slot 1, ignoring case. Returns -1 if unknown.
+internal int
+INPUT_findButton(WrenVM* vm, const INPUT_BUTTON_NAME* names) {
+  const char* name = wrenGetSlotString(vm, 1);
+  for (const INPUT_BUTTON_NAME* entry = names; entry->name != NULL; entry++) {
+    if (SDL_strcasecmp(entry->name, name) == 0) {
+      return entry->index;
     }
-    free(buttonName);
-  } else if (type == WREN_TYPE_NUM) {
-    buttonIndex = wrenGetSlotDouble(vm, 1);
-  } else {
-    VM_ABORT(vm, "Invalid button index given")
+  }
+  return -1;
+}
+
+internal void
+MOUSE_getButtonIndex(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "button name");
+  int index = INPUT_findButton(vm, MOUSE_BUTTON_NAMES);
+  if (index == -1) {
+    VM_ABORT(vm, "Unknown mouse button name");
     return;
   }
+  wrenSetSlotDouble(vm, 0, index);
+}
 
-  wrenSetSlotBool(vm, 0, ENGINE_getMouseButton(buttonIndex));
+internal void
+MOUSE_isButtonPressed(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_isDown(INPUT_getFlags(vm, inputState.frame.mouse, INPUT_MOUSE_BUTTONS)));
 }
 
-typedef struct {
+internal void
+MOUSE_justPressed(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, inputState.frame.mouse, INPUT_MOUSE_BUTTONS) & INPUT_PRESSED);
+}
+
+internal void
+MOUSE_justReleased(WrenVM* vm) {
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, inputState.frame.mouse, INPUT_MOUSE_BUTTONS) & INPUT_RELEASED);
+}
+
+typedef struct GAMEPAD_t {
   int instanceId;
   SDL_GameController* controller;
+  // Which frame in the input snapshot is ours, or -1
+  int slot;
 } GAMEPAD;
 
+// Replays open their gamepads with these ids, one for each recorded slot.
+// Those gamepads have no controller and read everything from the snapshot.
+#define GAMEPAD_REPLAY_ID(slot) (-2 - (slot))
+
+// Dummy gamepads read from this, which is always empty
+global_variable const INPUT_PAD_FRAME GAMEPAD_EMPTY_FRAME;
+
+internal inline bool
+GAMEPAD_isOpen(GAMEPAD* gamepad) {
+  return gamepad->controller != NULL || gamepad->slot != -1;
+}
+
+internal const INPUT_PAD_FRAME*
+GAMEPAD_frame(GAMEPAD* gamepad) {
+  if (gamepad->slot == -1) {
+    return &GAMEPAD_EMPTY_FRAME;
+  }
+  return &inputState.frame.pads[gamepad->slot];
+}
+
 internal void
 GAMEPAD_allocate(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, NUM, "joystick id");
   int joystickId = floor(wrenGetSlotDouble(vm, 1));
   GAMEPAD* gamepad = wrenSetSlotNewForeign(vm, 0, 0, sizeof(GAMEPAD));
+  gamepad->slot = -1;
+
+  if (inputState.replaying) {
+    int slot = GAMEPAD_REPLAY_ID(joystickId);
+    gamepad->controller = NULL;
+    gamepad->instanceId = -1;
+    if (slot >= 0 && slot < INPUT_MAX_GAMEPADS && inputState.pads[slot] == NULL) {
+      inputState.pads[slot] = gamepad;
+      gamepad->slot = slot;
+      gamepad->instanceId = inputState.frame.pads[slot].id;
+    }
+    return;
+  }
 
   if (joystickId == -1 || SDL_IsGameController(joystickId) == SDL_FALSE) {
     gamepad->controller = NULL;
@@ -79,21 +270,62 @@ GAMEPAD_allocate(WrenVM* vm) {
   }
   SDL_GameController* controller = SDL_GameControllerOpen(joystickId);
   if (controller == NULL) {
+    gamepad->controller = NULL;
     VM_ABORT(vm, "Could not open gamepad");
     return;
   }
   gamepad->instanceId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller));
   gamepad->controller = controller;
+  // Foreign objects don't move, so the snapshot can keep a pointer
+  for (int i = 0; i < INPUT_MAX_GAMEPADS; i++) {
+    if (inputState.pads[i] == NULL) {
+      inputState.pads[i] = gamepad;
+      gamepad->slot = i;
+      break;
+    }
+  }
 }
 
 internal void
 closeController(GAMEPAD* gamepad) {
+  if (gamepad->slot != -1) {
+    inputState.pads[gamepad->slot] = NULL;
+    // A replay owns the snapshot, and sets the slot itself
+    if (!inputState.replaying) {
+      memset(&inputState.frame.pads[gamepad->slot], 0, sizeof(INPUT_PAD_FRAME));
+    }
+    gamepad->slot = -1;
+  }
   if (gamepad->controller != NULL) {
     SDL_GameControllerClose(gamepad->controller);
     gamepad->controller = NULL;
   }
 }
 
+// Gamepads are polled rather than driven by events.
+internal void
+GAMEPAD_tick(GAMEPAD* gamepad, INPUT_PAD_FRAME* pad) {
+  // Replayed gamepads are filled in from the recording
+  if (gamepad->controller == NULL) {
+    return;
+  }
+  for (int i = 0; i < SDL_CONTROLLER_BUTTON_MAX; i++) {
+    bool down = SDL_GameControllerGetButton(gamepad->controller, i);
+    bool wasDown = (pad->buttons[i] & INPUT_DOWN) != 0;
+    if (down) {
+      pad->buttons[i] = INPUT_DOWN | (wasDown ? 0 : INPUT_PRESSED);
+    } else {
+      pad->buttons[i] = wasDown ? INPUT_RELEASED : 0;
+    }
+  }
+  for (int i = 0; i < SDL_CONTROLLER_AXIS_MAX; i++) {
+    pad->axes[i] = SDL_GameControllerGetAxis(gamepad->controller, i);
+  }
+  pad->present = 1;
+  pad->attached = SDL_GameControllerGetAttached(gamepad->controller) == SDL_TRUE;
+  pad->id = gamepad->instanceId;
+}
+
 internal void
 GAMEPAD_close(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
@@ -106,60 +338,52 @@ GAMEPAD_finalize(void* data) {
   closeController((GAMEPAD*)data);
 }
 
+global_variable const INPUT_BUTTON_NAME GAMEPAD_BUTTON_NAMES[] = {
+  { "up", SDL_CONTROLLER_BUTTON_DPAD_UP },
+  { "left", SDL_CONTROLLER_BUTTON_DPAD_LEFT },
+  { "right", SDL_CONTROLLER_BUTTON_DPAD_RIGHT },
+  { "down", SDL_CONTROLLER_BUTTON_DPAD_DOWN },
+  { "start", SDL_CONTROLLER_BUTTON_START },
+  { "back", SDL_CONTROLLER_BUTTON_BACK },
+  { "guide", SDL_CONTROLLER_BUTTON_GUIDE },
+  { "leftstick", SDL_CONTROLLER_BUTTON_LEFTSTICK },
+  { "rightstick", SDL_CONTROLLER_BUTTON_RIGHTSTICK },
+  { "leftshoulder", SDL_CONTROLLER_BUTTON_LEFTSHOULDER },
+  { "rightshoulder", SDL_CONTROLLER_BUTTON_RIGHTSHOULDER },
+  { "a", SDL_CONTROLLER_BUTTON_A },
+  { "b", SDL_CONTROLLER_BUTTON_B },
+  { "x", SDL_CONTROLLER_BUTTON_X },
+  { "y", SDL_CONTROLLER_BUTTON_Y },
+  { NULL, 0 }
+};
+
 internal void
-GAMEPAD_isButtonPressed(WrenVM* vm) {
-  GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
-  if (gamepad->controller == NULL) {
-    wrenSetSlotBool(vm, 0, false);
+GAMEPAD_getButtonIndex(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "button name");
+  int index = INPUT_findButton(vm, GAMEPAD_BUTTON_NAMES);
+  if (index == -1) {
+    VM_ABORT(vm, "Unknown controller button name");
     return;
   }
-  int buttonIndex = 0;
-  WrenType type = wrenGetSlotType(vm, 1);
-  if (type == WREN_TYPE_STRING) {
-    char* buttonName = strToLower(wrenGetSlotString(vm, 1));
-    if (STRINGS_EQUAL(buttonName, "up")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_DPAD_UP;
-    } else if (STRINGS_EQUAL(buttonName, "left")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_DPAD_LEFT;
-    } else if (STRINGS_EQUAL(buttonName, "right")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_DPAD_RIGHT;
-    } else if (STRINGS_EQUAL(buttonName, "down")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_DPAD_DOWN;
-    } else if (STRINGS_EQUAL(buttonName, "start")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_START;
-    } else if (STRINGS_EQUAL(buttonName, "back")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_BACK;
-    } else if (STRINGS_EQUAL(buttonName, "guide")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_GUIDE;
-    } else if (STRINGS_EQUAL(buttonName, "leftstick")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_LEFTSTICK;
-    } else if (STRINGS_EQUAL(buttonName, "rightstick")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_RIGHTSTICK;
-    } else if (STRINGS_EQUAL(buttonName, "leftshoulder")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_LEFTSHOULDER;
-    } else if (STRINGS_EQUAL(buttonName, "rightshoulder")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_RIGHTSHOULDER;
-    } else if (STRINGS_EQUAL(buttonName, "a")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_A;
-    } else if (STRINGS_EQUAL(buttonName, "b")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_B;
-    } else if (STRINGS_EQUAL(buttonName, "x")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_X;
-    } else if (STRINGS_EQUAL(buttonName, "y")) {
-      buttonIndex = SDL_CONTROLLER_BUTTON_Y;
-    } else {
-      VM_ABORT(vm, "Unknown controller button name");
-      return;
-    }
-    free(buttonName);
-  } else if (type == WREN_TYPE_NUM) {
-    buttonIndex = wrenGetSlotDouble(vm, 1);
-  } else {
-    VM_ABORT(vm, "Invalid controller button index")
-    return;
-  }
-  bool isPressed = SDL_GameControllerGetButton(gamepad->controller, buttonIndex);
-  wrenSetSlotBool(vm, 0, isPressed);
+  wrenSetSlotDouble(vm, 0, index);
+}
+
+internal void
+GAMEPAD_isButtonPressed(WrenVM* vm) {
+  GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, INPUT_isDown(INPUT_getFlags(vm, GAMEPAD_frame(gamepad)->buttons, SDL_CONTROLLER_BUTTON_MAX)));
+}
+
+internal void
+GAMEPAD_justPressed(WrenVM* vm) {
+  GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, GAMEPAD_frame(gamepad)->buttons, SDL_CONTROLLER_BUTTON_MAX) & INPUT_PRESSED);
+}
+
+internal void
+GAMEPAD_justReleased(WrenVM* vm) {
+  GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, INPUT_getFlags(vm, GAMEPAD_frame(gamepad)->buttons, SDL_CONTROLLER_BUTTON_MAX) & INPUT_RELEASED);
 }
 
 internal void
@@ -167,17 +391,17 @@ GAMEPAD_getAnalogStick(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
   int16_t x = 0;
   int16_t y = 0;
-  if (gamepad->controller != NULL) {
+  if (GAMEPAD_isOpen(gamepad)) {
     ASSERT_SLOT_TYPE(vm, 1, STRING, "analog stick side");
-    char* side = strToLower(wrenGetSlotString(vm, 1));
-    if (STRINGS_EQUAL(side, "left")) {
-      x = SDL_GameControllerGetAxis(gamepad->controller, SDL_CONTROLLER_AXIS_LEFTX);
-      y = SDL_GameControllerGetAxis(gamepad->controller, SDL_CONTROLLER_AXIS_LEFTY);
-    } else if (STRINGS_EQUAL(side, "right")) {
-      x = SDL_GameControllerGetAxis(gamepad->controller, SDL_CONTROLLER_AXIS_RIGHTX);
-      y = SDL_GameControllerGetAxis(gamepad->controller, SDL_CONTROLLER_AXIS_RIGHTY);
+    const char* side = wrenGetSlotString(vm, 1);
+    const int16_t* axes = GAMEPAD_frame(gamepad)->axes;
+    if (SDL_strcasecmp(side, "left") == 0) {
+      x = axes[SDL_CONTROLLER_AXIS_LEFTX];
+      y = axes[SDL_CONTROLLER_AXIS_LEFTY];
+    } else if (SDL_strcasecmp(side, "right") == 0) {
+      x = axes[SDL_CONTROLLER_AXIS_RIGHTX];
+      y = axes[SDL_CONTROLLER_AXIS_RIGHTY];
     }
-    free(side);
   }
 
   wrenSetSlotNewList(vm, 0);
@@ -190,27 +414,30 @@ GAMEPAD_getAnalogStick(WrenVM* vm) {
 internal void
 GAMEPAD_getTrigger(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
-  if (gamepad->controller == NULL) {
+  if (!GAMEPAD_isOpen(gamepad)) {
     wrenSetSlotDouble(vm, 0, 0.0);
     return;
   }
   ASSERT_SLOT_TYPE(vm, 1, STRING, "trigger side");
-  char* side = strToLower(wrenGetSlotString(vm, 1));
-  int triggerIndex = SDL_CONTROLLER_AXIS_INVALID;
-  if (STRINGS_EQUAL(side, "left")) {
-    triggerIndex = SDL_CONTROLLER_AXIS_TRIGGERLEFT;
-  } else if (STRINGS_EQUAL(side, "right")) {
-    triggerIndex = SDL_CONTROLLER_AXIS_TRIGGERRIGHT;
+  const char* side = wrenGetSlotString(vm, 1);
+  int16_t value = 0;
+  if (SDL_strcasecmp(side, "left") == 0) {
+    value = GAMEPAD_frame(gamepad)->axes[SDL_CONTROLLER_AXIS_TRIGGERLEFT];
+  } else if (SDL_strcasecmp(side, "right") == 0) {
+    value = GAMEPAD_frame(gamepad)->axes[SDL_CONTROLLER_AXIS_TRIGGERRIGHT];
   }
-  free(side);
 
-  int16_t value = SDL_GameControllerGetAxis(gamepad->controller, triggerIndex);
   wrenSetSlotDouble(vm, 0, (double)value / SHRT_MAX);
 }
 
+// Read from the snapshot where there is one, so it can be replayed.
 internal void
 GAMEPAD_isAttached(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
+  if (gamepad->slot != -1) {
+    wrenSetSlotBool(vm, 0, GAMEPAD_frame(gamepad)->attached != 0);
+    return;
+  }
   if (gamepad->controller == NULL) {
     wrenSetSlotBool(vm, 0, false);
     return;
@@ -221,9 +448,12 @@ GAMEPAD_isAttached(WrenVM* vm) {
 internal void
 GAMEPAD_getName(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
-  if (gamepad->controller == NULL) {
+  if (!GAMEPAD_isOpen(gamepad)) {
     wrenSetSlotString(vm, 0, "NONE");
     return;
+  } else if (gamepad->controller == NULL) {
+    wrenSetSlotString(vm, 0, "REPLAY");
+    return;
   }
   wrenSetSlotString(vm, 0, SDL_GameControllerName(gamepad->controller));
 }
@@ -231,7 +461,7 @@ GAMEPAD_getName(WrenVM* vm) {
 internal void
 GAMEPAD_getId(WrenVM* vm) {
   GAMEPAD* gamepad = wrenGetSlotForeign(vm, 0);
-  if (gamepad->controller == NULL) {
+  if (!GAMEPAD_isOpen(gamepad)) {
     wrenSetSlotDouble(vm, 0, -1);
     return;
   }
@@ -245,6 +475,10 @@ GAMEPAD_getGamePadIds(WrenVM* vm) {
   int listCount = 0;
   wrenEnsureSlots(vm, 2);
   wrenSetSlotNewList(vm, 0);
+  // Replays connect their own gamepads as the recording says
+  if (inputState.replaying) {
+    return;
+  }
   for(int joystickId = 0; joystickId < maxJoysticks; joystickId++) {
     if (!SDL_IsGameController(joystickId)) {
       continue;
@@ -255,21 +489,74 @@ GAMEPAD_getGamePadIds(WrenVM* vm) {
   }
 }
 
+// Events are queued as they are polled and handed to Wren in one call per
+// frame, so a burst of them doesn't mean a burst of calls into the VM.
+typedef enum {
+  INPUT_EVENT_GAMEPAD_ADDED,
+  INPUT_EVENT_GAMEPAD_REMOVED
+} INPUT_EVENT_TYPE;
+
+typedef struct {
+  INPUT_EVENT_TYPE type;
+  int32_t value;
+} INPUT_EVENT;
+
+typedef struct {
+  INPUT_EVENT* events;
+  size_t count;
+  size_t capacity;
+} INPUT_EVENT_QUEUE;
+
+global_variable INPUT_EVENT_QUEUE inputEvents;
+
 internal void
-GAMEPAD_eventAdded(WrenVM* vm, int joystickId) {
-  WrenHandle* addedMethod = wrenMakeCallHandle(vm, "addGamePad(_)");
-  wrenSetSlotDouble(vm, 1, joystickId);
-  wrenGetVariable(vm, "input", "GamePad", 0);
-  wrenCall(vm, addedMethod);
-  wrenReleaseHandle(vm, addedMethod);
+INPUT_pushEvent(INPUT_EVENT_TYPE type, int32_t value) {
+  if (inputEvents.count == inputEvents.capacity) {
+    size_t capacity = max(inputEvents.capacity * 2, 16);
+    INPUT_EVENT* events = realloc(inputEvents.events, capacity * sizeof(INPUT_EVENT));
+    if (events == NULL) {
+      return;
+    }
+    inputEvents.events = events;
+    inputEvents.capacity = capacity;
+  }
+  inputEvents.events[inputEvents.count++] = (INPUT_EVENT){ type, value };
 }
 
+// Calls Input.dispatch_ with the queued events, as a flat list of type and
+// value pairs.
+internal WrenInterpretResult
+INPUT_dispatchEvents(WrenVM* vm) {
+  size_t count = inputEvents.count;
+  inputEvents.count = 0;
+  // Without the input module, nothing is listening
+  if (count == 0 || vmHandles.inputClass == NULL) {
+    return WREN_RESULT_SUCCESS;
+  }
+
+  wrenEnsureSlots(vm, 3);
+  wrenSetSlotHandle(vm, 0, vmHandles.inputClass);
+  wrenSetSlotNewList(vm, 1);
+  for (size_t i = 0; i < count; i++) {
+    wrenSetSlotDouble(vm, 2, inputEvents.events[i].type);
+    wrenInsertInList(vm, 1, -1, 2);
+    wrenSetSlotDouble(vm, 2, inputEvents.events[i].value);
+    wrenInsertInList(vm, 1, -1, 2);
+  }
+  return wrenCall(vm, vmHandles.dispatch);
+}
 
 internal void
-GAMEPAD_eventRemoved(WrenVM* vm, int instanceId) {
-  WrenHandle* removeMethod = wrenMakeCallHandle(vm, "removeGamePad(_)");
-  wrenSetSlotDouble(vm, 1, instanceId);
-  wrenGetVariable(vm, "input", "GamePad", 0);
-  wrenCall(vm, removeMethod);
-  wrenReleaseHandle(vm, removeMethod);
+INPUT_free(void) {
+  free(inputEvents.events);
+  inputEvents.events = NULL;
+  inputEvents.count = 0;
+  inputEvents.capacity = 0;
+}
+
+internal void
+INPUT_capture(WrenVM* vm) {
+  if (vmHandles.inputClass == NULL) {
+    vmHandles.inputClass = wrenGetSlotHandle(vm, 0);
+  }
 }
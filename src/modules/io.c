@@ -1,9 +1,34 @@
-typedef struct {
+typedef struct DBUFFER_t {
   bool ready;
   size_t length;
+  size_t capacity;
   char* data;
+  // A view shares its parent's bytes from offset onwards, and holds a
+  // handle so the parent outlives it.
+  struct DBUFFER_t* parent;
+  WrenHandle* parentHandle;
+  WrenVM* vm;
+  size_t offset;
+  // Live views are kept in a list, so their handles can be released
+  // before the VM is freed
+  struct DBUFFER_t* prevView;
+  struct DBUFFER_t* nextView;
 } DBUFFER;
 
+global_variable DBUFFER* dbufferViews = NULL;
+// Handles held by views which have been collected. Wren's finalizers run
+// in the middle of garbage collection, so they are released afterwards.
+global_variable WrenHandle** dbufferReleases = NULL;
+global_variable size_t dbufferReleaseCount = 0;
+global_variable size_t dbufferReleaseCapacity = 0;
+
+// Every live DataBuffer, so that C can tell one from other foreign objects
+// before reading it. Wren 0.3 has no way to ask for an object's class. An
+// open-addressed set of pointers, emptied by the finalizers.
+global_variable DBUFFER** dbufferLive = NULL;
+global_variable size_t dbufferLiveCount = 0;
+global_variable size_t dbufferLiveCapacity = 0;
+
 typedef struct {
   bool complete;
   bool error;
@@ -11,31 +36,121 @@ typedef struct {
   WrenHandle* bufferHandle;
 } ASYNCOP;
 
+internal inline size_t
+DBUFFER_liveHash(const void* buffer) {
+  // Fibonacci hashing, so aligned pointers still spread out
+  return (size_t)(((uint64_t)(uintptr_t)buffer * 11400714819323198485ull) >> 32);
+}
+
+// Returns the index holding buffer, or the empty one where it would go
+internal size_t
+DBUFFER_liveFind(DBUFFER** live, size_t capacity, const void* buffer) {
+  size_t mask = capacity - 1;
+  size_t index = DBUFFER_liveHash(buffer) & mask;
+  while (live[index] != NULL && live[index] != buffer) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+internal bool
+DBUFFER_isLive(const void* buffer) {
+  if (dbufferLiveCount == 0) {
+    return false;
+  }
+  return dbufferLive[DBUFFER_liveFind(dbufferLive, dbufferLiveCapacity, buffer)] == buffer;
+}
+
+internal bool
+DBUFFER_track(DBUFFER* buffer) {
+  // Keep the set at most three quarters full
+  if ((dbufferLiveCount + 1) * 4 > dbufferLiveCapacity * 3) {
+    size_t capacity = max(dbufferLiveCapacity * 2, 64);
+    DBUFFER** live = calloc(capacity, sizeof(DBUFFER*));
+    if (live == NULL) {
+      return false;
+    }
+    for (size_t i = 0; i < dbufferLiveCapacity; i++) {
+      if (dbufferLive[i] != NULL) {
+        live[DBUFFER_liveFind(live, capacity, dbufferLive[i])] = dbufferLive[i];
+      }
+    }
+    free(dbufferLive);
+    dbufferLive = live;
+    dbufferLiveCapacity = capacity;
+  }
+  dbufferLive[DBUFFER_liveFind(dbufferLive, dbufferLiveCapacity, buffer)] = buffer;
+  dbufferLiveCount++;
+  return true;
+}
+
+internal void
+DBUFFER_untrack(DBUFFER* buffer) {
+  if (!DBUFFER_isLive(buffer)) {
+    return;
+  }
+  size_t mask = dbufferLiveCapacity - 1;
+  size_t hole = DBUFFER_liveFind(dbufferLive, dbufferLiveCapacity, buffer);
+  dbufferLive[hole] = NULL;
+  dbufferLiveCount--;
+  // Shift back any entry which probed past the hole, so lookups don't stop
+  // short of it
+  size_t index = hole;
+  while (true) {
+    index = (index + 1) & mask;
+    DBUFFER* entry = dbufferLive[index];
+    if (entry == NULL) {
+      break;
+    }
+    size_t home = DBUFFER_liveHash(entry) & mask;
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      dbufferLive[hole] = entry;
+      dbufferLive[index] = NULL;
+      hole = index;
+    }
+  }
+}
+
+internal void
+DBUFFER_init(DBUFFER* buffer) {
+  memset(buffer, 0, sizeof(DBUFFER));
+}
+
+// Makes an empty DataBuffer in slot, whose class is in classSlot. Returns
+// NULL if there isn't memory to track it.
+internal DBUFFER*
+DBUFFER_new(WrenVM* vm, int slot, int classSlot) {
+  DBUFFER* buffer = (DBUFFER*)wrenSetSlotNewForeign(vm, slot, classSlot, sizeof(DBUFFER));
+  DBUFFER_init(buffer);
+  return DBUFFER_track(buffer) ? buffer : NULL;
+}
 
 internal void
 ASYNCOP_allocate(WrenVM* vm) {
   // Get a handle to the Stat class. We'll hang on to this so we don't have to
   // look it up by name every time.
   wrenEnsureSlots(vm, 2);
-  wrenSetSlotHandle(vm, 1, bufferClass);
-  DBUFFER* buffer = (DBUFFER*)wrenSetSlotNewForeign(vm, 1, 1, sizeof(DBUFFER));
-  buffer->data = NULL;
-  buffer->length = 0;
-  buffer->ready = false;
-
   ASYNCOP* op = (ASYNCOP*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(ASYNCOP));
   op->vm = vm;
+  op->bufferHandle = NULL;
+  op->complete = false;
+  op->error = false;
 
+  wrenSetSlotHandle(vm, 1, vmHandles.bufferClass);
+  if (DBUFFER_new(vm, 1, 1) == NULL) {
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+    return;
+  }
   // This is a handle to our specific buffer, not the DataBuffer class
   op->bufferHandle = wrenGetSlotHandle(vm, 1);
-  op->complete = false;
-  op->error = false;
 }
 
 internal void
 ASYNCOP_finalize(void* data) {
   ASYNCOP* op = data;
-  wrenReleaseHandle(op->vm, op->bufferHandle);
+  if (op->bufferHandle != NULL) {
+    wrenReleaseHandle(op->vm, op->bufferHandle);
+  }
 }
 
 internal void
@@ -45,6 +160,13 @@ ASYNCOP_getComplete(WrenVM* vm) {
   wrenSetSlotBool(vm, 0, op->complete);
 }
 
+internal void
+ASYNCOP_getError(WrenVM* vm) {
+  ASYNCOP* op = (ASYNCOP*)wrenGetSlotForeign(vm, 0);
+  wrenEnsureSlots(vm, 1);
+  wrenSetSlotBool(vm, 0, op->error);
+}
+
 internal void
 ASYNCOP_getResult(WrenVM* vm) {
   ASYNCOP* op = (ASYNCOP*)wrenGetSlotForeign(vm, 0);
@@ -52,36 +174,185 @@ ASYNCOP_getResult(WrenVM* vm) {
   wrenSetSlotHandle(vm, 0, op->bufferHandle);
 }
 
+// The bytes a buffer can see right now. A view is clipped to whatever is
+// left of its parent, which may have shrunk since the view was made.
+internal char*
+DBUFFER_bytes(DBUFFER* buffer, size_t* length) {
+  DBUFFER* parent = buffer->parent;
+  if (parent == NULL) {
+    *length = buffer->length;
+    return buffer->data;
+  }
+  if (buffer->offset >= parent->length) {
+    *length = 0;
+    return parent->data;
+  }
+  *length = min(buffer->length, parent->length - buffer->offset);
+  return parent->data + buffer->offset;
+}
+
+// Reads a String or DataBuffer argument without copying it. Returns NULL
+// for anything else, including foreign objects of other classes.
+internal const char*
+DBUFFER_getSlotBytes(WrenVM* vm, int slot, size_t* length) {
+  WrenType type = wrenGetSlotType(vm, slot);
+  if (type == WREN_TYPE_STRING) {
+    int bytes;
+    const char* data = wrenGetSlotBytes(vm, slot, &bytes);
+    *length = bytes;
+    return data;
+  }
+  if (type == WREN_TYPE_FOREIGN) {
+    DBUFFER* buffer = wrenGetSlotForeign(vm, slot);
+    if (DBUFFER_isLive(buffer) && buffer->ready) {
+      const char* data = DBUFFER_bytes(buffer, length);
+      return data != NULL ? data : "";
+    }
+  }
+  return NULL;
+}
+
+internal bool
+DBUFFER_reserve(DBUFFER* buffer, size_t capacity) {
+  if (capacity <= buffer->capacity) {
+    return true;
+  }
+  size_t newCapacity = max(max(capacity, buffer->capacity * 2), 16);
+  char* data = realloc(buffer->data, newCapacity);
+  if (data == NULL) {
+    return false;
+  }
+  buffer->data = data;
+  buffer->capacity = newCapacity;
+  return true;
+}
+
+internal bool
+DBUFFER_resize(DBUFFER* buffer, size_t length) {
+  if (!DBUFFER_reserve(buffer, length)) {
+    return false;
+  }
+  if (length > buffer->length) {
+    memset(buffer->data + buffer->length, 0, length - buffer->length);
+  }
+  buffer->length = length;
+  return true;
+}
+
 internal void
 DBUFFER_capture(WrenVM* vm) {
-  if (bufferClass == NULL) {
+  if (vmHandles.bufferClass == NULL) {
     wrenGetVariable(vm, "io", "DataBuffer", 0);
-    bufferClass = wrenGetSlotHandle(vm, 0);
+    vmHandles.bufferClass = wrenGetSlotHandle(vm, 0);
   }
 }
 
+// init() makes an empty buffer for an async load to fill in. new(size)
+// and new(data) make one which is ready to use.
 internal void
 DBUFFER_allocate(WrenVM* vm) {
-  wrenEnsureSlots(vm, 1);
-  DBUFFER* buffer = (DBUFFER*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(DBUFFER));
-  buffer->data = NULL;
-  buffer->length = 0;
-  buffer->ready = false;
+  int count = wrenGetSlotCount(vm);
+  DBUFFER* buffer = DBUFFER_new(vm, 0, 0);
+  if (buffer == NULL) {
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+    return;
+  }
+  if (count < 2) {
+    return;
+  }
+
+  buffer->ready = true;
+  size_t length;
+  const char* source = DBUFFER_getSlotBytes(vm, 1, &length);
+  if (wrenGetSlotType(vm, 1) == WREN_TYPE_NUM) {
+    double size = wrenGetSlotDouble(vm, 1);
+    if (size < 0 || size != floor(size)) {
+      VM_ABORT(vm, "DataBuffer size must be a positive integer");
+      return;
+    }
+    length = size;
+  } else if (source == NULL) {
+    VM_ABORT(vm, "DataBuffer needs a size, String or DataBuffer");
+    return;
+  }
+  if (!DBUFFER_resize(buffer, length)) {
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+    return;
+  }
+  if (source != NULL) {
+    memcpy(buffer->data, source, length);
+  }
 }
 
 internal void
 DBUFFER_finalize(void* data) {
   DBUFFER* buffer = (DBUFFER*) data;
-  if (buffer->ready && buffer->data != NULL) {
+  DBUFFER_untrack(buffer);
+  if (buffer->parent == NULL) {
     free(buffer->data);
+    return;
+  }
+  if (buffer->parentHandle == NULL) {
+    return;
+  }
+  if (buffer->prevView != NULL) {
+    buffer->prevView->nextView = buffer->nextView;
+  } else {
+    dbufferViews = buffer->nextView;
+  }
+  if (buffer->nextView != NULL) {
+    buffer->nextView->prevView = buffer->prevView;
+  }
+  if (dbufferReleaseCount == dbufferReleaseCapacity) {
+    size_t capacity = max(dbufferReleaseCapacity * 2, 16);
+    WrenHandle** releases = realloc(dbufferReleases, capacity * sizeof(WrenHandle*));
+    if (releases == NULL) {
+      // The handle leaks, but the parent is still freed with the VM
+      return;
+    }
+    dbufferReleases = releases;
+    dbufferReleaseCapacity = capacity;
+  }
+  dbufferReleases[dbufferReleaseCount++] = buffer->parentHandle;
+}
+
+// Releases the handles of views collected since the last call. Called
+// once per frame, outside of garbage collection.
+internal void
+DBUFFER_releaseHandles(WrenVM* vm) {
+  for (size_t i = 0; i < dbufferReleaseCount; i++) {
+    wrenReleaseHandle(vm, dbufferReleases[i]);
   }
+  dbufferReleaseCount = 0;
+}
+
+// Before the VM is freed, live views let go of their parents too, so that
+// no handles remain.
+internal void
+DBUFFER_free(WrenVM* vm) {
+  DBUFFER_releaseHandles(vm);
+  for (DBUFFER* view = dbufferViews; view != NULL; view = view->nextView) {
+    wrenReleaseHandle(vm, view->parentHandle);
+    view->parentHandle = NULL;
+  }
+  dbufferViews = NULL;
+  // The finalizers which run as the VM is freed find nothing left to remove
+  free(dbufferLive);
+  dbufferLive = NULL;
+  dbufferLiveCount = 0;
+  dbufferLiveCapacity = 0;
+  free(dbufferReleases);
+  dbufferReleases = NULL;
+  dbufferReleaseCapacity = 0;
 }
 
 internal void
 DBUFFER_getLength(WrenVM* vm) {
   DBUFFER* buffer = wrenGetSlotForeign(vm, 0);
+  size_t length;
+  DBUFFER_bytes(buffer, &length);
   wrenEnsureSlots(vm, 1);
-  wrenSetSlotDouble(vm, 0, buffer->length);
+  wrenSetSlotDouble(vm, 0, length);
 }
 
 internal void
@@ -94,10 +365,237 @@ DBUFFER_getReady(WrenVM* vm) {
 internal void
 DBUFFER_getData(WrenVM* vm) {
   DBUFFER* buffer = wrenGetSlotForeign(vm, 0);
+  size_t length;
+  char* data = DBUFFER_bytes(buffer, &length);
   wrenEnsureSlots(vm, 1);
-  wrenSetSlotBytes(vm, 0, buffer->data, buffer->length);
+  wrenSetSlotBytes(vm, 0, data, length);
+}
+
+internal DBUFFER*
+DBUFFER_getResizable(WrenVM* vm) {
+  DBUFFER* buffer = wrenGetSlotForeign(vm, 0);
+  if (!buffer->ready) {
+    VM_ABORT(vm, "DataBuffer is not ready");
+    return NULL;
+  }
+  if (buffer->parent != NULL) {
+    VM_ABORT(vm, "Cannot resize a view of a DataBuffer");
+    return NULL;
+  }
+  return buffer;
 }
 
+internal void
+DBUFFER_setLength(WrenVM* vm) {
+  DBUFFER* buffer = DBUFFER_getResizable(vm);
+  if (buffer == NULL) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "length");
+  double length = wrenGetSlotDouble(vm, 1);
+  if (length < 0 || length != floor(length)) {
+    VM_ABORT(vm, "DataBuffer length must be a positive integer");
+    return;
+  }
+  if (!DBUFFER_resize(buffer, length)) {
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+  }
+}
+
+internal void
+DBUFFER_append(WrenVM* vm) {
+  DBUFFER* buffer = DBUFFER_getResizable(vm);
+  if (buffer == NULL) {
+    return;
+  }
+  size_t length;
+  const char* source = DBUFFER_getSlotBytes(vm, 1, &length);
+  if (source == NULL) {
+    VM_ABORT(vm, "Can only append a String or DataBuffer");
+    return;
+  }
+  // Appending a buffer to itself moves the source when it grows
+  bool inside = buffer->data != NULL && source >= buffer->data && source < buffer->data + buffer->length;
+  size_t sourceOffset = inside ? (size_t)(source - buffer->data) : 0;
+  size_t start = buffer->length;
+  if (!DBUFFER_resize(buffer, start + length)) {
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+    return;
+  }
+  if (inside) {
+    source = buffer->data + sourceOffset;
+  }
+  memmove(buffer->data + start, source, length);
+}
+
+// Makes a view of bytes [start, end) which shares this buffer's memory.
+internal void
+DBUFFER_slice(WrenVM* vm) {
+  DBUFFER* buffer = wrenGetSlotForeign(vm, 0);
+  if (!buffer->ready) {
+    VM_ABORT(vm, "DataBuffer is not ready");
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "start");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "end");
+  double start = wrenGetSlotDouble(vm, 1);
+  double end = wrenGetSlotDouble(vm, 2);
+  size_t length;
+  DBUFFER_bytes(buffer, &length);
+  if (start < 0 || end < start || end > length || start != floor(start) || end != floor(end)) {
+    VM_ABORT(vm, "Slice is out of bounds");
+    return;
+  }
+
+  // Views of views share the original buffer directly
+  wrenEnsureSlots(vm, 4);
+  size_t offset = start;
+  DBUFFER* parent = buffer;
+  WrenHandle* parentHandle;
+  if (buffer->parent != NULL) {
+    offset += buffer->offset;
+    parent = buffer->parent;
+    wrenSetSlotHandle(vm, 2, buffer->parentHandle);
+    parentHandle = wrenGetSlotHandle(vm, 2);
+  } else {
+    parentHandle = wrenGetSlotHandle(vm, 0);
+  }
+
+  wrenSetSlotHandle(vm, 3, vmHandles.bufferClass);
+  DBUFFER* view = DBUFFER_new(vm, 0, 3);
+  if (view == NULL) {
+    wrenReleaseHandle(vm, parentHandle);
+    VM_ABORT(vm, "Not enough memory for DataBuffer");
+    return;
+  }
+  view->ready = true;
+  view->vm = vm;
+  view->parent = parent;
+  view->parentHandle = parentHandle;
+  view->offset = offset;
+  view->length = end - start;
+  view->nextView = dbufferViews;
+  if (dbufferViews != NULL) {
+    dbufferViews->prevView = view;
+  }
+  dbufferViews = view;
+}
+
+// Typed access to the bytes, little endian unless bigEndian is true.
+internal char*
+DBUFFER_at(WrenVM* vm, size_t size) {
+  DBUFFER* buffer = wrenGetSlotForeign(vm, 0);
+  if (!buffer->ready) {
+    VM_ABORT(vm, "DataBuffer is not ready");
+    return NULL;
+  }
+  ASSERT_SLOT_TYPE_RETURN(vm, 1, NUM, "offset", NULL);
+  double offset = wrenGetSlotDouble(vm, 1);
+  size_t length;
+  char* data = DBUFFER_bytes(buffer, &length);
+  if (offset < 0 || offset != floor(offset) || length < size || offset > length - size) {
+    VM_ABORT(vm, "Offset is out of bounds");
+    return NULL;
+  }
+  return data + (size_t)offset;
+}
+
+internal inline bool
+DBUFFER_isBigEndian(WrenVM* vm, int slot) {
+  return wrenGetSlotCount(vm) > slot
+    && wrenGetSlotType(vm, slot) == WREN_TYPE_BOOL
+    && wrenGetSlotBool(vm, slot);
+}
+
+internal inline uint64_t
+DBUFFER_load(char* data, size_t size, bool bigEndian) {
+  uint64_t bits = 0;
+  for (size_t i = 0; i < size; i++) {
+    uint8_t byte = data[bigEndian ? size - 1 - i : i];
+    bits |= (uint64_t)byte << (8 * i);
+  }
+  return bits;
+}
+
+internal inline void
+DBUFFER_store(char* data, size_t size, uint64_t bits, bool bigEndian) {
+  for (size_t i = 0; i < size; i++) {
+    data[bigEndian ? size - 1 - i : i] = (bits >> (8 * i)) & 0xFF;
+  }
+}
+
+// Out of range values wrap, as they would in C, rather than being undefined
+internal inline uint64_t
+DBUFFER_toInteger(double value) {
+  if (!isfinite(value)) {
+    return 0;
+  }
+  value = trunc(value);
+  if (value >= -9223372036854775808.0 && value < 9223372036854775808.0) {
+    return (uint64_t)(int64_t)value;
+  }
+  // Doubles this large are whole multiples of 2^11, so this is exact
+  value = fmod(value, 18446744073709551616.0);
+  if (value < 0) {
+    value += 18446744073709551616.0;
+  }
+  if (value >= 9223372036854775808.0) {
+    return (uint64_t)(value - 9223372036854775808.0) + 9223372036854775808ULL;
+  }
+  return (uint64_t)value;
+}
+
+#define DBUFFER_INTEGER_ACCESSORS(Name, type) \
+internal void \
+DBUFFER_get##Name(WrenVM* vm) { \
+  char* data = DBUFFER_at(vm, sizeof(type)); \
+  if (data != NULL) { \
+    type value = (type)DBUFFER_load(data, sizeof(type), DBUFFER_isBigEndian(vm, 2)); \
+    wrenSetSlotDouble(vm, 0, value); \
+  } \
+} \
+internal void \
+DBUFFER_set##Name(WrenVM* vm) { \
+  char* data = DBUFFER_at(vm, sizeof(type)); \
+  if (data != NULL) { \
+    ASSERT_SLOT_TYPE(vm, 2, NUM, "value"); \
+    uint64_t bits = DBUFFER_toInteger(wrenGetSlotDouble(vm, 2)); \
+    DBUFFER_store(data, sizeof(type), bits, DBUFFER_isBigEndian(vm, 3)); \
+  } \
+}
+
+#define DBUFFER_FLOAT_ACCESSORS(Name, type, bitsType) \
+internal void \
+DBUFFER_get##Name(WrenVM* vm) { \
+  char* data = DBUFFER_at(vm, sizeof(type)); \
+  if (data != NULL) { \
+    bitsType bits = DBUFFER_load(data, sizeof(type), DBUFFER_isBigEndian(vm, 2)); \
+    type value; \
+    memcpy(&value, &bits, sizeof(type)); \
+    wrenSetSlotDouble(vm, 0, value); \
+  } \
+} \
+internal void \
+DBUFFER_set##Name(WrenVM* vm) { \
+  char* data = DBUFFER_at(vm, sizeof(type)); \
+  if (data != NULL) { \
+    ASSERT_SLOT_TYPE(vm, 2, NUM, "value"); \
+    type value = wrenGetSlotDouble(vm, 2); \
+    bitsType bits; \
+    memcpy(&bits, &value, sizeof(type)); \
+    DBUFFER_store(data, sizeof(type), bits, DBUFFER_isBigEndian(vm, 3)); \
+  } \
+}
+
+DBUFFER_INTEGER_ACCESSORS(Uint8, uint8_t)
+DBUFFER_INTEGER_ACCESSORS(Int8, int8_t)
+DBUFFER_INTEGER_ACCESSORS(Uint16, uint16_t)
+DBUFFER_INTEGER_ACCESSORS(Int16, int16_t)
+DBUFFER_INTEGER_ACCESSORS(Uint32, uint32_t)
+DBUFFER_INTEGER_ACCESSORS(Int32, int32_t)
+DBUFFER_FLOAT_ACCESSORS(Float32, float, uint32_t)
+DBUFFER_FLOAT_ACCESSORS(Float64, double, uint64_t)
+
 typedef struct {
   WrenVM* vm;
   WrenHandle* opHandle;
@@ -152,11 +650,14 @@ FILESYSTEM_loadEventHandler(void* data) {
 
 internal void
 FILESYSTEM_saveSync(WrenVM* vm) {
-  int length;
+  size_t length;
   ASSERT_SLOT_TYPE(vm, 1, STRING, "file path");
-  ASSERT_SLOT_TYPE(vm, 2, STRING, "file data");
   const char* path = wrenGetSlotString(vm, 1);
-  const char* data = wrenGetSlotBytes(vm, 2, &length);
+  const char* data = DBUFFER_getSlotBytes(vm, 2, &length);
+  if (data == NULL) {
+    VM_ABORT(vm, "file data was not a String or DataBuffer");
+    return;
+  }
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
   ENGINE_WRITE_RESULT result = ENGINE_writeFile(engine, path, data, length);
   if (result == ENGINE_WRITE_PATH_INVALID) {
@@ -168,15 +669,235 @@ FILESYSTEM_saveSync(WrenVM* vm) {
   }
 }
 
+// Asynchronous saves. Each path being written has one FILESYSTEM_SAVE,
+// which holds the newest data not yet written. Saving to that path again
+// before the worker gets to it replaces the data, so a burst of autosaves
+// becomes one write, and every operation waiting on it completes together.
+// The worker keeps writing until no newer data is left, so two writes to
+// the same file never run at once.
+typedef struct {
+  WrenVM* vm;
+  WrenHandle** ops;
+  size_t opCount;
+  size_t opCapacity;
+  int result;
+} FILESYSTEM_SAVE_RESULT;
+
+typedef struct FILESYSTEM_SAVE_t {
+  struct FILESYSTEM_SAVE_t* next;
+  WrenVM* vm;
+  char* path;
+  // Pending data, which is NULL while the worker has the latest
+  char* data;
+  size_t length;
+  bool sync;
+  // The operations waiting on the pending data. It is allocated on the
+  // main thread, so the worker never has to report a failure to them.
+  FILESYSTEM_SAVE_RESULT* waiting;
+} FILESYSTEM_SAVE;
+
+global_variable SDL_mutex* saveLock = NULL;
+global_variable FILESYSTEM_SAVE* saves = NULL;
+
+internal void
+FILESYSTEM_failOperation(WrenVM* vm, int slot) {
+  ASYNCOP* op = (ASYNCOP*)wrenGetSlotForeign(vm, slot);
+  op->complete = true;
+  op->error = true;
+}
+
+// Adds the operation in slot 4 to those waiting on the save's next write.
+internal bool
+FILESYSTEM_addWaiting(FILESYSTEM_SAVE* save, WrenVM* vm) {
+  FILESYSTEM_SAVE_RESULT* waiting = save->waiting;
+  if (waiting == NULL) {
+    waiting = calloc(1, sizeof(FILESYSTEM_SAVE_RESULT));
+    if (waiting == NULL) {
+      return false;
+    }
+    waiting->vm = vm;
+    save->waiting = waiting;
+  }
+  if (waiting->opCount == waiting->opCapacity) {
+    size_t capacity = max(waiting->opCapacity * 2, 4);
+    WrenHandle** ops = realloc(waiting->ops, capacity * sizeof(WrenHandle*));
+    if (ops == NULL) {
+      return false;
+    }
+    waiting->ops = ops;
+    waiting->opCapacity = capacity;
+  }
+  waiting->ops[waiting->opCount++] = wrenGetSlotHandle(vm, 4);
+  return true;
+}
+
+internal void
+FILESYSTEM_saveAsync(WrenVM* vm) {
+  // Thread: main
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "file path");
+  ASSERT_SLOT_TYPE(vm, 3, BOOL, "sync");
+  const char* path = wrenGetSlotString(vm, 1);
+  size_t length;
+  const char* data = DBUFFER_getSlotBytes(vm, 2, &length);
+  if (data == NULL) {
+    VM_ABORT(vm, "file data was not a String or DataBuffer");
+    return;
+  }
+  bool sync = wrenGetSlotBool(vm, 3);
+
+  char* fullPath;
+  if (path[0] != '/') {
+    char* base = BASEPATH_get();
+    fullPath = malloc(strlen(base) + strlen(path) + 1);
+    strcpy(fullPath, base);
+    strcat(fullPath, path);
+  } else {
+    fullPath = strdup(path);
+  }
+  char* copy = malloc(max(length, 1));
+  if (fullPath == NULL || copy == NULL) {
+    free(fullPath);
+    free(copy);
+    VM_ABORT(vm, "Not enough memory to save file");
+    return;
+  }
+  memcpy(copy, data, length);
+
+  if (saveLock == NULL) {
+    saveLock = SDL_CreateMutex();
+  }
+
+  SDL_LockMutex(saveLock);
+  FILESYSTEM_SAVE* save = saves;
+  while (save != NULL && strcmp(save->path, fullPath) != 0) {
+    save = save->next;
+  }
+  bool queued = save != NULL;
+  if (!queued) {
+    save = calloc(1, sizeof(FILESYSTEM_SAVE));
+    if (save != NULL) {
+      save->vm = vm;
+      save->path = fullPath;
+    }
+  }
+  if (save == NULL || !FILESYSTEM_addWaiting(save, vm)) {
+    // Anything already queued for the path is still written
+    if (!queued) {
+      if (save != NULL && save->waiting != NULL) {
+        free(save->waiting->ops);
+        free(save->waiting);
+      }
+      free(save);
+      free(fullPath);
+    }
+    SDL_UnlockMutex(saveLock);
+    LOG_print(LOG_WARN, LOG_IO, "Not enough memory to save %s\n", path);
+    free(copy);
+    FILESYSTEM_failOperation(vm, 4);
+    return;
+  }
+  if (queued) {
+    // Superseded before it was written
+    free(save->data);
+    free(fullPath);
+  } else {
+    save->next = saves;
+    saves = save;
+  }
+  save->data = copy;
+  save->length = length;
+  save->sync = queued ? (save->sync || sync) : sync;
+  SDL_UnlockMutex(saveLock);
+
+  if (!queued) {
+    ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+    INIT_TO_ZERO(ABC_TASK, task);
+    task.type = TASK_WRITE_FILE;
+    task.data = save;
+    ABC_FIFO_pushTask(&engine->fifo, task);
+  }
+}
+
+internal void
+FILESYSTEM_saveTaskHandler(void* data) {
+  // Thread: Async
+  FILESYSTEM_SAVE* save = data;
+  bool more = true;
+  while (more) {
+    SDL_LockMutex(saveLock);
+    char* buffer = save->data;
+    size_t length = save->length;
+    bool sync = save->sync;
+    // Never NULL, as data is only queued once its operation is waiting
+    FILESYSTEM_SAVE_RESULT* result = save->waiting;
+    save->data = NULL;
+    save->sync = false;
+    save->waiting = NULL;
+    SDL_UnlockMutex(saveLock);
+
+    LOG_print(LOG_DEBUG, LOG_IO, "Writing to filesystem: %s\n", save->path);
+    result->result = writeEntireFileAtomic(save->path, buffer, length, sync);
+    if (result->result != 0) {
+      LOG_print(LOG_WARN, LOG_IO, "Could not save %s: %s\n", save->path, strerror(result->result));
+    }
+    free(buffer);
+
+    SDL_Event event;
+    SDL_memset(&event, 0, sizeof(event));
+    event.type = ENGINE_EVENT_TYPE;
+    event.user.code = EVENT_WRITE_FILE;
+    event.user.data1 = result;
+    SDL_PushEvent(&event);
+
+    SDL_LockMutex(saveLock);
+    more = save->data != NULL;
+    if (!more) {
+      FILESYSTEM_SAVE** link = &saves;
+      while (*link != save) {
+        link = &(*link)->next;
+      }
+      *link = save->next;
+    }
+    SDL_UnlockMutex(saveLock);
+  }
+  free(save->path);
+  free(save);
+}
+
+internal void
+FILESYSTEM_saveEventComplete(SDL_Event* event) {
+  // Thread: Main
+  FILESYSTEM_SAVE_RESULT* result = event->user.data1;
+  WrenVM* vm = result->vm;
+  wrenEnsureSlots(vm, 1);
+  for (size_t i = 0; i < result->opCount; i++) {
+    wrenSetSlotHandle(vm, 0, result->ops[i]);
+    ASYNCOP* op = (ASYNCOP*)wrenGetSlotForeign(vm, 0);
+    op->complete = true;
+    op->error = result->result != 0;
+    wrenReleaseHandle(vm, result->ops[i]);
+  }
+  free(result->ops);
+  free(result);
+}
+
+// Only safe once the worker pool has finished.
+internal void
+FILESYSTEM_free(void) {
+  if (saveLock != NULL) {
+    SDL_DestroyMutex(saveLock);
+    saveLock = NULL;
+  }
+}
+
 internal void
 FILESYSTEM_loadSync(WrenVM* vm) {
   ASSERT_SLOT_TYPE(vm, 1, STRING, "file path");
   const char* path = wrenGetSlotString(vm, 1);
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
 
-  size_t length;
-  char* data = ENGINE_readFile(engine, path, &length);
-  if (data == NULL) {
+  FILE_VIEW view;
+  if (!ENGINE_openFileView(engine, path, &view)) {
     size_t len = 22 + strlen(path);
     char message[len];
     snprintf(message, len, "Could not find file: %s", path);
@@ -184,10 +905,54 @@ FILESYSTEM_loadSync(WrenVM* vm) {
     return;
   }
   wrenEnsureSlots(vm, 1);
-  wrenSetSlotBytes(vm, 0, data, length);
-  free(data);
+  wrenSetSlotBytes(vm, 0, view.data, view.length);
+  FILE_VIEW_close(&view);
+}
+
+// Foreign asset classes (images, audio, fonts) are constructed either from
+// file data, or from a path and a null placeholder. When given a path, we
+// decode straight from the bundle or file mapping, so the asset is never
+// copied into a Wren string.
+internal bool
+ASSET_openView(WrenVM* vm, FILE_VIEW* view) {
+  if (wrenGetSlotCount(vm) > 2 && wrenGetSlotType(vm, 2) == WREN_TYPE_NULL) {
+    ASSERT_SLOT_TYPE_RETURN(vm, 1, STRING, "file path", false);
+    const char* path = wrenGetSlotString(vm, 1);
+    ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+    if (!ENGINE_openFileView(engine, path, view)) {
+      size_t len = 22 + strlen(path);
+      char message[len];
+      snprintf(message, len, "Could not find file: %s", path);
+      VM_ABORT(vm, message);
+      return false;
+    }
+    return true;
+  }
+
+  view->data = DBUFFER_getSlotBytes(vm, 1, &view->length);
+  if (view->data == NULL) {
+    VM_ABORT(vm, "file data was not a String or DataBuffer");
+    return false;
+  }
+  view->source = FILE_VIEW_BORROWED;
+  return true;
 }
 
+typedef enum {
+  ASSET_TYPE_UNKNOWN,
+  ASSET_TYPE_IMAGE,
+  ASSET_TYPE_AUDIO,
+  ASSET_TYPE_FONT
+} ASSET_TYPE;
+
+// Asset constructors called as f_adopt(batch, index) take an asset which
+// was already decoded by Assets.preload, see modules/assets.c
+internal inline bool
+ASSET_isPreloaded(WrenVM* vm) {
+  return wrenGetSlotCount(vm) > 2 && wrenGetSlotType(vm, 2) == WREN_TYPE_NUM;
+}
+internal bool ASSET_adopt(WrenVM* vm, ASSET_TYPE type, void* asset, size_t size);
+
 internal void
 FILESYSTEM_loadEventComplete(SDL_Event* event) {
   // Thread: Main
@@ -202,6 +967,7 @@ FILESYSTEM_loadEventComplete(SDL_Event* event) {
 
   buffer->data = task->buffer;
   buffer->length = task->length;
+  buffer->capacity = task->length;
   buffer->ready = true;
 
   op->complete = true;
@@ -308,3 +1074,533 @@ internal void
 FILESYSTEM_getBasePath(WrenVM* vm) {
   wrenSetSlotString(vm, 0, BASEPATH_get());
 }
+
+// Reads a file a piece at a time, so large files needn't be held in memory.
+// Files in the egg bundle are read from the bundle's memory, and others
+// straight from the disk.
+typedef struct {
+  bool open;
+  FILE* file;
+  FILE_VIEW view;
+  uint64_t length;
+  uint64_t position;
+  // Scratch space for lines and reads from the disk
+  char* scratch;
+  size_t scratchCapacity;
+} FILE_STREAM;
+
+internal bool
+FILE_STREAM_reserve(FILE_STREAM* stream, size_t capacity) {
+  if (capacity <= stream->scratchCapacity) {
+    return true;
+  }
+  size_t newCapacity = max(max(capacity, stream->scratchCapacity * 2), 256);
+  char* scratch = realloc(stream->scratch, newCapacity);
+  if (scratch == NULL) {
+    return false;
+  }
+  stream->scratch = scratch;
+  stream->scratchCapacity = newCapacity;
+  return true;
+}
+
+internal void
+FILE_STREAM_close(FILE_STREAM* stream) {
+  if (!stream->open) {
+    return;
+  }
+  if (stream->file != NULL) {
+    fclose(stream->file);
+    stream->file = NULL;
+  } else {
+    FILE_VIEW_close(&stream->view);
+  }
+  free(stream->scratch);
+  stream->scratch = NULL;
+  stream->scratchCapacity = 0;
+  stream->open = false;
+}
+
+internal void
+FILE_STREAM_allocate(WrenVM* vm) {
+  FILE_STREAM* stream = (FILE_STREAM*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(FILE_STREAM));
+  memset(stream, 0, sizeof(FILE_STREAM));
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "file path");
+  const char* path = wrenGetSlotString(vm, 1);
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+
+  if (ENGINE_openBundleView(engine, path, &stream->view)) {
+    stream->length = stream->view.length;
+    stream->open = true;
+    return;
+  }
+
+  char pathBuf[PATH_MAX];
+  if (ENGINE_resolvePath(path, pathBuf)) {
+    stream->file = fopen(pathBuf, "rb");
+  }
+  if (stream->file == NULL || seekFile(stream->file, 0, SEEK_END) != 0) {
+    if (stream->file != NULL) {
+      fclose(stream->file);
+      stream->file = NULL;
+    }
+    size_t len = 22 + strlen(path);
+    char message[len];
+    snprintf(message, len, "Could not find file: %s", path);
+    VM_ABORT(vm, message);
+    return;
+  }
+  LOG_print(LOG_DEBUG, LOG_IO, "Streaming from filesystem: %s\n", pathBuf);
+  stream->length = tellFile(stream->file);
+  seekFile(stream->file, 0, SEEK_SET);
+  stream->open = true;
+}
+
+internal void
+FILE_STREAM_finalize(void* data) {
+  FILE_STREAM_close((FILE_STREAM*)data);
+}
+
+internal FILE_STREAM*
+FILE_STREAM_get(WrenVM* vm) {
+  FILE_STREAM* stream = wrenGetSlotForeign(vm, 0);
+  if (!stream->open) {
+    VM_ABORT(vm, "FileStream is closed");
+    return NULL;
+  }
+  return stream;
+}
+
+// Reads up to count bytes from the current position. Bundle files hand
+// back a pointer into the bundle, and others are read into scratch.
+internal const char*
+FILE_STREAM_read(WrenVM* vm, FILE_STREAM* stream, size_t* count) {
+  *count = min(*count, stream->length - stream->position);
+  const char* data;
+  if (stream->file == NULL) {
+    data = stream->view.data + stream->position;
+  } else {
+    if (!FILE_STREAM_reserve(stream, *count)) {
+      VM_ABORT(vm, "Not enough memory to read file");
+      return NULL;
+    }
+    *count = fread(stream->scratch, 1, *count, stream->file);
+    data = stream->scratch;
+  }
+  stream->position += *count;
+  return data;
+}
+
+internal bool
+FILE_STREAM_getCount(WrenVM* vm, size_t* count) {
+  ASSERT_SLOT_TYPE_RETURN(vm, 1, NUM, "count", false);
+  double value = wrenGetSlotDouble(vm, 1);
+  if (value < 0 || value != floor(value)) {
+    VM_ABORT(vm, "count must be a positive integer");
+    return false;
+  }
+  *count = value < (double)SIZE_MAX ? (size_t)value : SIZE_MAX;
+  return true;
+}
+
+internal void
+FILE_STREAM_readString(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  size_t count;
+  if (stream == NULL || !FILE_STREAM_getCount(vm, &count)) {
+    return;
+  }
+  const char* data = FILE_STREAM_read(vm, stream, &count);
+  if (data != NULL) {
+    wrenSetSlotBytes(vm, 0, data, count);
+  }
+}
+
+internal void
+FILE_STREAM_readBuffer(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  size_t count;
+  if (stream == NULL || !FILE_STREAM_getCount(vm, &count)) {
+    return;
+  }
+  count = min(count, stream->length - stream->position);
+  char* data = malloc(max(count, 1));
+  if (data == NULL) {
+    VM_ABORT(vm, "Not enough memory to read file");
+    return;
+  }
+  if (stream->file == NULL) {
+    memcpy(data, stream->view.data + stream->position, count);
+  } else {
+    count = fread(data, 1, count, stream->file);
+  }
+  stream->position += count;
+
+  wrenEnsureSlots(vm, 2);
+  wrenSetSlotHandle(vm, 1, vmHandles.bufferClass);
+  DBUFFER* buffer = DBUFFER_new(vm, 0, 1);
+  if (buffer == NULL) {
+    free(data);
+    VM_ABORT(vm, "Not enough memory to read file");
+    return;
+  }
+  buffer->ready = true;
+  buffer->data = data;
+  buffer->length = count;
+  buffer->capacity = max(count, 1);
+}
+
+// Returns the next line without its line ending, or null at the end.
+internal void
+FILE_STREAM_readLine(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  if (stream == NULL) {
+    return;
+  }
+  if (stream->position >= stream->length) {
+    wrenSetSlotNull(vm, 0);
+    return;
+  }
+
+  const char* line;
+  size_t length;
+  if (stream->file == NULL) {
+    line = stream->view.data + stream->position;
+    size_t remaining = stream->length - stream->position;
+    const char* end = memchr(line, '\n', remaining);
+    length = end != NULL ? (size_t)(end - line) : remaining;
+    stream->position += length + (end != NULL ? 1 : 0);
+  } else {
+    length = 0;
+    int c;
+    while ((c = getc(stream->file)) != EOF) {
+      stream->position++;
+      if (c == '\n') {
+        break;
+      }
+      if (!FILE_STREAM_reserve(stream, length + 1)) {
+        VM_ABORT(vm, "Not enough memory to read file");
+        return;
+      }
+      stream->scratch[length++] = c;
+    }
+    line = stream->scratch;
+  }
+  if (length > 0 && line[length - 1] == '\r') {
+    length--;
+  }
+  wrenSetSlotBytes(vm, 0, line, length);
+}
+
+internal void
+FILE_STREAM_getPosition(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  if (stream != NULL) {
+    wrenSetSlotDouble(vm, 0, stream->position);
+  }
+}
+
+internal void
+FILE_STREAM_setPosition(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  if (stream == NULL) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "position");
+  double position = wrenGetSlotDouble(vm, 1);
+  if (position < 0 || position > stream->length || position != floor(position)) {
+    VM_ABORT(vm, "Position is outside of the file");
+    return;
+  }
+  if (stream->file != NULL && seekFile(stream->file, position, SEEK_SET) != 0) {
+    VM_ABORT(vm, "Could not seek in file");
+    return;
+  }
+  stream->position = position;
+}
+
+internal void
+FILE_STREAM_getLength(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  if (stream != NULL) {
+    wrenSetSlotDouble(vm, 0, stream->length);
+  }
+}
+
+internal void
+FILE_STREAM_getAtEnd(WrenVM* vm) {
+  FILE_STREAM* stream = FILE_STREAM_get(vm);
+  if (stream != NULL) {
+    wrenSetSlotBool(vm, 0, stream->position >= stream->length);
+  }
+}
+
+internal void
+FILE_STREAM_closeMethod(WrenVM* vm) {
+  FILE_STREAM_close(wrenGetSlotForeign(vm, 0));
+}
+
+// A recursive listing of a directory on disk, made on the worker pool.
+// Egg bundles aren't searched, as with listFiles. Links to directories
+// aren't followed, so a link cycle can't send the walk round in circles.
+#define DIRECTORY_WALK_MAX_DEPTH 64
+
+typedef struct {
+  bool complete;
+  bool error;
+  char** paths;
+  size_t count;
+} DIRECTORY_WALK;
+
+typedef struct {
+  WrenVM* vm;
+  WrenHandle* walkHandle;
+  char root[PATH_MAX];
+  char* pattern;
+  bool error;
+  char** paths;
+  size_t count;
+  size_t capacity;
+} DIRECTORY_WALK_TASK;
+
+// * and ? match within one directory, and ** across any number of them.
+internal bool
+FILESYSTEM_globMatch(const char* pattern, const char* path) {
+  while (*pattern != '\0') {
+    if (pattern[0] == '*' && pattern[1] == '*') {
+      pattern += 2;
+      // "**/" can also match no directories at all
+      bool directories = *pattern == '/';
+      if (directories) {
+        pattern++;
+      }
+      for (const char* p = path; ; p++) {
+        if ((!directories || p == path || p[-1] == '/') && FILESYSTEM_globMatch(pattern, p)) {
+          return true;
+        }
+        if (*p == '\0') {
+          return false;
+        }
+      }
+    }
+    if (*pattern == '*') {
+      pattern++;
+      for (const char* p = path; ; p++) {
+        if (FILESYSTEM_globMatch(pattern, p)) {
+          return true;
+        }
+        if (*p == '\0' || *p == '/') {
+          return false;
+        }
+      }
+    }
+    if (*path == '\0' || (*pattern == '?' ? *path == '/' : *pattern != *path)) {
+      return false;
+    }
+    pattern++;
+    path++;
+  }
+  return *path == '\0';
+}
+
+internal bool
+DIRECTORY_WALK_isLink(tinydir_file* file) {
+#ifdef __MINGW32__
+  DWORD attributes = GetFileAttributesA(file->path);
+  return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+#else
+  return S_ISLNK(file->_s.st_mode);
+#endif
+}
+
+internal void
+DIRECTORY_WALK_collect(DIRECTORY_WALK_TASK* task, const char* relative, size_t depth) {
+  char fullPath[PATH_MAX];
+  int fullLength = snprintf(fullPath, PATH_MAX, "%s%s", task->root, relative);
+  if (fullLength < 0 || fullLength >= PATH_MAX) {
+    task->error = true;
+    return;
+  }
+
+  tinydir_dir dir;
+  if (tinydir_open(&dir, fullPath) == -1) {
+    task->error = task->error || depth == 0;
+    return;
+  }
+  while (dir.has_next) {
+    tinydir_file file;
+    int read = tinydir_readfile(&dir, &file);
+    tinydir_next(&dir);
+    if (read == -1) {
+      // Names too long for tinydir land here
+      task->error = true;
+      continue;
+    }
+    if (STRINGS_EQUAL(file.name, ".") || STRINGS_EQUAL(file.name, "..")) {
+      continue;
+    }
+
+    char path[PATH_MAX];
+    int length = snprintf(path, PATH_MAX, "%s%s%s", relative, file.name, file.is_dir ? "/" : "");
+    if (length < 0 || length >= PATH_MAX) {
+      task->error = true;
+      continue;
+    }
+    if (file.is_dir) {
+      if (depth < DIRECTORY_WALK_MAX_DEPTH && !DIRECTORY_WALK_isLink(&file)) {
+        DIRECTORY_WALK_collect(task, path, depth + 1);
+      }
+      continue;
+    }
+    if (DIRECTORY_WALK_isLink(&file)) {
+      // A link to a directory, which lstat doesn't see through
+      struct stat target;
+      if (stat(file.path, &target) == 0 && S_ISDIR(target.st_mode)) {
+        continue;
+      }
+    }
+
+    // Patterns without a directory in them match the file name anywhere
+    if (task->pattern != NULL) {
+      const char* subject = strchr(task->pattern, '/') != NULL ? path : file.name;
+      if (!FILESYSTEM_globMatch(task->pattern, subject)) {
+        continue;
+      }
+    }
+    if (task->count == task->capacity) {
+      size_t capacity = max(task->capacity * 2, 64);
+      char** paths = realloc(task->paths, capacity * sizeof(char*));
+      if (paths == NULL) {
+        task->error = true;
+        break;
+      }
+      task->paths = paths;
+      task->capacity = capacity;
+    }
+    char* copy = strdup(path);
+    if (copy == NULL) {
+      task->error = true;
+      break;
+    }
+    task->paths[task->count++] = copy;
+  }
+  tinydir_close(&dir);
+}
+
+internal void
+DIRECTORY_WALK_allocate(WrenVM* vm) {
+  DIRECTORY_WALK* walk = (DIRECTORY_WALK*)wrenSetSlotNewForeign(vm, 0, 0, sizeof(DIRECTORY_WALK));
+  memset(walk, 0, sizeof(DIRECTORY_WALK));
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "directory path");
+  if (wrenGetSlotType(vm, 2) != WREN_TYPE_NULL) {
+    ASSERT_SLOT_TYPE(vm, 2, STRING, "pattern");
+  }
+
+  DIRECTORY_WALK_TASK* task = calloc(1, sizeof(DIRECTORY_WALK_TASK));
+  if (task == NULL) {
+    VM_ABORT(vm, "Not enough memory to walk directory");
+    return;
+  }
+  bool valid = ENGINE_resolvePath(wrenGetSlotString(vm, 1), task->root);
+  size_t rootLength = strlen(task->root);
+  if (valid && rootLength > 0 && task->root[rootLength - 1] != '/') {
+    if (rootLength < PATH_MAX - 1) {
+      strcat(task->root, "/");
+    } else {
+      valid = false;
+    }
+  }
+  if (wrenGetSlotType(vm, 2) == WREN_TYPE_STRING) {
+    task->pattern = strdup(wrenGetSlotString(vm, 2));
+    if (task->pattern == NULL) {
+      free(task);
+      VM_ABORT(vm, "Not enough memory to walk directory");
+      return;
+    }
+  }
+  if (!valid) {
+    // Nothing to walk, so finish straight away with an error
+    free(task->pattern);
+    free(task);
+    walk->error = true;
+    walk->complete = true;
+    return;
+  }
+  task->vm = vm;
+  // Keeps the walk alive until the worker is done with it
+  task->walkHandle = wrenGetSlotHandle(vm, 0);
+
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  INIT_TO_ZERO(ABC_TASK, abcTask);
+  abcTask.type = TASK_WALK_DIRECTORY;
+  abcTask.data = task;
+  ABC_FIFO_pushTask(&engine->fifo, abcTask);
+}
+
+internal void
+DIRECTORY_WALK_finalize(void* data) {
+  DIRECTORY_WALK* walk = data;
+  for (size_t i = 0; i < walk->count; i++) {
+    free(walk->paths[i]);
+  }
+  free(walk->paths);
+}
+
+internal void
+FILESYSTEM_walkTaskHandler(void* data) {
+  // Thread: Async
+  DIRECTORY_WALK_TASK* task = data;
+  DIRECTORY_WALK_collect(task, "", 0);
+
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = ENGINE_EVENT_TYPE;
+  event.user.code = EVENT_WALK_DIRECTORY;
+  event.user.data1 = task;
+  SDL_PushEvent(&event);
+}
+
+internal void
+FILESYSTEM_walkEventComplete(SDL_Event* event) {
+  // Thread: Main
+  DIRECTORY_WALK_TASK* task = event->user.data1;
+  WrenVM* vm = task->vm;
+  wrenEnsureSlots(vm, 1);
+  wrenSetSlotHandle(vm, 0, task->walkHandle);
+  DIRECTORY_WALK* walk = (DIRECTORY_WALK*)wrenGetSlotForeign(vm, 0);
+  walk->paths = task->paths;
+  walk->count = task->count;
+  walk->error = task->error;
+  walk->complete = true;
+
+  wrenReleaseHandle(vm, task->walkHandle);
+  free(task->pattern);
+  free(task);
+}
+
+internal void
+DIRECTORY_WALK_getComplete(WrenVM* vm) {
+  DIRECTORY_WALK* walk = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, walk->complete);
+}
+
+internal void
+DIRECTORY_WALK_getError(WrenVM* vm) {
+  DIRECTORY_WALK* walk = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, walk->error);
+}
+
+internal void
+DIRECTORY_WALK_getFiles(WrenVM* vm) {
+  DIRECTORY_WALK* walk = wrenGetSlotForeign(vm, 0);
+  if (!walk->complete) {
+    wrenSetSlotNull(vm, 0);
+    return;
+  }
+  wrenEnsureSlots(vm, 2);
+  wrenSetSlotNewList(vm, 0);
+  for (size_t i = 0; i < walk->count; i++) {
+    wrenSetSlotString(vm, 1, walk->paths[i]);
+    wrenInsertInList(vm, 0, -1, 1);
+  }
+}
@@ -1,122 +1,178 @@
 #include "modules.inc"
 
-typedef struct FUNCTION_NODE {
-  char* signature;
-  WrenForeignMethodFn fn;
-  struct FUNCTION_NODE* next;
-} FUNCTION_NODE;
+// Modules, foreign methods and foreign classes all share one open-addressed
+// hash table, keyed on the module name plus the signature or class name.
 
-typedef struct MODULE_NODE {
+#define MAP_INITIAL_CAPACITY 512
+
+typedef enum {
+  MAP_ENTRY_EMPTY,
+  MAP_ENTRY_MODULE,
+  MAP_ENTRY_FUNCTION,
+  MAP_ENTRY_CLASS
+} MAP_ENTRY_TYPE;
+
+typedef struct {
+  MAP_ENTRY_TYPE type;
+  uint32_t hash;
+  const char* module;
   const char* name;
-  const char* source;
-  struct FUNCTION_NODE* functions;
-  struct MODULE_NODE* next;
-} MODULE_NODE;
+  union {
+    struct {
+      const char* text;
+      size_t length;
+    } source;
+    WrenForeignMethodFn fn;
+    WrenForeignClassMethods methods;
+  } value;
+} MAP_ENTRY;
 
 typedef struct {
-  MODULE_NODE* head;
+  MAP_ENTRY* entries;
+  size_t count;
+  size_t capacity;
 } MAP;
 
+// FNV-1a
+internal uint32_t
+MAP_hash(MAP_ENTRY_TYPE type, const char* module, const char* name) {
+  uint32_t hash = 2166136261u;
+  hash = (hash ^ type) * 16777619u;
+  for (const char* c = module; *c != '\0'; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  // Separate the two, so "ab"+"c" and "a"+"bc" differ
+  hash *= 16777619u;
+  for (const char* c = name; *c != '\0'; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  return hash;
+}
+
+internal MAP_ENTRY*
+MAP_findSlot(MAP_ENTRY* entries, size_t capacity, MAP_ENTRY_TYPE type, uint32_t hash, const char* module, const char* name) {
+  size_t mask = capacity - 1;
+  size_t index = hash & mask;
+  while (true) {
+    MAP_ENTRY* entry = &entries[index];
+    if (entry->type == MAP_ENTRY_EMPTY) {
+      return entry;
+    }
+    if (entry->hash == hash && entry->type == type
+        && STRINGS_EQUAL(entry->module, module) && STRINGS_EQUAL(entry->name, name)) {
+      return entry;
+    }
+    index = (index + 1) & mask;
+  }
+}
 
 internal void
-MAP_addModule(MAP* map, char* name, const char* source) {
-  MODULE_NODE* newNode = malloc(sizeof(MODULE_NODE));
+MAP_grow(MAP* map) {
+  size_t capacity = map->capacity * 2;
+  MAP_ENTRY* entries = calloc(capacity, sizeof(MAP_ENTRY));
+  for (size_t i = 0; i < map->capacity; i++) {
+    MAP_ENTRY* entry = &map->entries[i];
+    if (entry->type != MAP_ENTRY_EMPTY) {
+      *MAP_findSlot(entries, capacity, entry->type, entry->hash, entry->module, entry->name) = *entry;
+    }
+  }
+  free(map->entries);
+  map->entries = entries;
+  map->capacity = capacity;
+}
 
-  newNode->source = source;
-  newNode->name = name;
-  newNode->functions = NULL;
+internal MAP_ENTRY*
+MAP_insert(MAP* map, MAP_ENTRY_TYPE type, const char* module, const char* name) {
+  // Keep the load under 3/4 so probes stay short
+  if ((map->count + 1) * 4 > map->capacity * 3) {
+    MAP_grow(map);
+  }
+  uint32_t hash = MAP_hash(type, module, name);
+  MAP_ENTRY* entry = MAP_findSlot(map->entries, map->capacity, type, hash, module, name);
+  if (entry->type == MAP_ENTRY_EMPTY) {
+    entry->type = type;
+    entry->hash = hash;
+    entry->module = module;
+    entry->name = name;
+    map->count++;
+  }
+  return entry;
+}
 
-  newNode->next = map->head;
-  map->head = newNode;
+internal MAP_ENTRY*
+MAP_lookup(MAP* map, MAP_ENTRY_TYPE type, const char* module, const char* name) {
+  uint32_t hash = MAP_hash(type, module, name);
+  MAP_ENTRY* entry = MAP_findSlot(map->entries, map->capacity, type, hash, module, name);
+  return entry->type == MAP_ENTRY_EMPTY ? NULL : entry;
 }
 
-internal MODULE_NODE*
+internal void
+MAP_addModule(MAP* map, char* name, const char* source, size_t length) {
+  MAP_ENTRY* entry = MAP_insert(map, MAP_ENTRY_MODULE, name, "");
+  entry->value.source.text = source;
+  entry->value.source.length = length;
+}
+
+internal MAP_ENTRY*
 MAP_getModule(MAP* map, const char* name) {
-  MODULE_NODE* node = map->head;
-  while (node != NULL) {
-    if (STRINGS_EQUAL(node->name, name)) {
-      return node;
-    } else {
-      node = node->next;
-    }
-  }
-  return NULL;
+  return MAP_lookup(map, MAP_ENTRY_MODULE, name, "");
 }
 
 internal const char*
-MAP_getSource(MAP* map, char* moduleName) {
-  MODULE_NODE* module = MAP_getModule(map, moduleName);
+MAP_getSource(MAP* map, const char* moduleName) {
+  MAP_ENTRY* module = MAP_getModule(map, moduleName);
   if (module == NULL) {
     // We don't have the module, but it might be built into Wren (aka Random,Meta)
     return NULL;
   }
 
-  size_t sourceLen = strlen(module->source);
-  char* file = calloc(sourceLen + 1, sizeof(char));
-  strcpy(file, module->source);
-  file[sourceLen] = '\0';
-  return file;
+  // Wren frees the source once it has compiled it, so it needs a copy.
+  // Comments and indentation were stripped when the module was embedded.
+  return MEMORY_copyString(module->value.source.text, module->value.source.length);
 }
 
 internal void
 MAP_addFunction(MAP* map, char* moduleName, char* signature, WrenForeignMethodFn fn) {
-  FUNCTION_NODE* node = (FUNCTION_NODE*) malloc(sizeof(FUNCTION_NODE));
-  node->signature = signature;
-  node->fn = fn;
-
-  MODULE_NODE* module = MAP_getModule(map, moduleName);
-  assert(module != NULL);
-
-  node->next = module->functions;
-  module->functions = node;
+  assert(MAP_getModule(map, moduleName) != NULL);
+  MAP_insert(map, MAP_ENTRY_FUNCTION, moduleName, signature)->value.fn = fn;
 }
 
 internal WrenForeignMethodFn
-MAP_getFunction(MAP* map, char* moduleName, const char* signature) {
-  MODULE_NODE* module = MAP_getModule(map, moduleName);
-  if (module == NULL) {
-    // We don't have the module, but it might be built into Wren (aka Random,Meta)
-    return NULL;
-  }
-  assert(module != NULL);
-
-  FUNCTION_NODE* node = module->functions;
-  while (node != NULL) {
-    if (STRINGS_EQUAL(signature, node->signature)) {
-      return node->fn;
-    } else {
-      node = node->next;
-    }
-  }
-  return NULL;
+MAP_getFunction(MAP* map, const char* moduleName, const char* signature) {
+  MAP_ENTRY* entry = MAP_lookup(map, MAP_ENTRY_FUNCTION, moduleName, signature);
+  return entry == NULL ? NULL : entry->value.fn;
 }
 
-
 internal void
-MAP_freeFunctions(FUNCTION_NODE* node) {
-  FUNCTION_NODE* nextNode;
-  while (node != NULL) {
-    nextNode = node->next;
-    free(node);
-    node = nextNode;
+MAP_addClass(MAP* map, char* moduleName, char* className, WrenForeignMethodFn allocate, WrenFinalizerFn finalize) {
+  assert(MAP_getModule(map, moduleName) != NULL);
+  MAP_ENTRY* entry = MAP_insert(map, MAP_ENTRY_CLASS, moduleName, className);
+  entry->value.methods.allocate = allocate;
+  entry->value.methods.finalize = finalize;
+}
+
+internal bool
+MAP_getClass(MAP* map, const char* moduleName, const char* className, WrenForeignClassMethods* methods) {
+  MAP_ENTRY* entry = MAP_lookup(map, MAP_ENTRY_CLASS, moduleName, className);
+  if (entry == NULL) {
+    return false;
   }
+  *methods = entry->value.methods;
+  return true;
 }
 
 internal void
 MAP_free(MAP* map) {
-  MODULE_NODE* module = map->head;
-  MODULE_NODE* nextModule;
-  while (module != NULL) {
-    MAP_freeFunctions(module->functions);
-    nextModule = module->next;
-    free(module);
-    module = nextModule;
-  }
+  free(map->entries);
+  map->entries = NULL;
+  map->count = 0;
+  map->capacity = 0;
 }
 
 internal void
 MAP_init(MAP* map) {
-  map->head = NULL;
+  map->count = 0;
+  map->capacity = MAP_INITIAL_CAPACITY;
+  map->entries = calloc(map->capacity, sizeof(MAP_ENTRY));
 #include "modulemap.c.inc"
 }
-
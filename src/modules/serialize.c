@@ -0,0 +1,692 @@
+// The binary format used by the serialize module.
+//
+// A header of "DSER", a format version byte and the game's own version
+// number (a little endian uint32) is followed by a single value. Each value
+// starts with a tag byte:
+//   NULL, FALSE, TRUE                 no payload
+//   INT                               zigzag varint, for whole numbers
+//   NUM                               little endian double
+//   STRING                            varint length, then the bytes
+//   STRING_REF                        varint index of an earlier STRING
+//   BYTES                             varint length, then the bytes of a
+//                                     DataBuffer
+//   LIST, FLAT_LIST                   varint count, then the elements
+//   MAP                               varint count, then key, value pairs
+//   OBJECT                            name as a STRING or STRING_REF, then
+//                                     the value the object serialized to
+//
+// Every STRING of up to SERIAL_SHARED_MAX bytes is numbered in the order it
+// appears, so repeats of short strings like map keys cost a couple of bytes.
+//
+// Wren 0.3 has no API for maps or for creating instances, so those are
+// walked in serialize.wren. Everything else, including whole lists whose
+// elements are all scalars (FLAT_LIST), is handled here in one call.
+
+#define SERIAL_MAGIC "DSER"
+#define SERIAL_FORMAT_VERSION 1
+#define SERIAL_HEADER_SIZE 9
+#define SERIAL_SHARED_MAX 64
+
+typedef enum {
+  SERIAL_NULL,
+  SERIAL_FALSE,
+  SERIAL_TRUE,
+  SERIAL_INT,
+  SERIAL_NUM,
+  SERIAL_STRING,
+  SERIAL_STRING_REF,
+  SERIAL_BYTES,
+  SERIAL_LIST,
+  SERIAL_FLAT_LIST,
+  SERIAL_MAP,
+  SERIAL_OBJECT
+} SERIAL_TAG;
+
+// What serialize.wren has to build, after f_read() returns the reader
+typedef enum {
+  SERIAL_KIND_LIST,
+  SERIAL_KIND_MAP,
+  SERIAL_KIND_OBJECT
+} SERIAL_KIND;
+
+typedef struct {
+  size_t offset;
+  size_t length;
+} SERIAL_SPAN;
+
+typedef struct {
+  char* data;
+  size_t length;
+  size_t capacity;
+  bool finished;
+
+  SERIAL_SPAN* strings;
+  size_t stringCount;
+  size_t stringCapacity;
+  // Open addressing, holding string index + 1, with 0 for empty
+  uint32_t* table;
+  size_t tableSize;
+} SERIAL_WRITER;
+
+typedef struct {
+  char* data;
+  size_t length;
+  size_t position;
+  bool failed;
+  uint32_t version;
+
+  SERIAL_SPAN* strings;
+  size_t stringCount;
+  size_t stringCapacity;
+
+  SERIAL_KIND kind;
+  size_t count;
+  SERIAL_SPAN name;
+} SERIAL_READER;
+
+internal bool
+SERIAL_WRITER_reserve(SERIAL_WRITER* writer, size_t extra) {
+  if (writer->length + extra <= writer->capacity) {
+    return true;
+  }
+  size_t capacity = max(max(writer->capacity * 2, writer->length + extra), 4096);
+  char* data = realloc(writer->data, capacity);
+  if (data == NULL) {
+    return false;
+  }
+  writer->data = data;
+  writer->capacity = capacity;
+  return true;
+}
+
+internal bool
+SERIAL_WRITER_bytes(SERIAL_WRITER* writer, const void* bytes, size_t length) {
+  if (!SERIAL_WRITER_reserve(writer, length)) {
+    return false;
+  }
+  memcpy(writer->data + writer->length, bytes, length);
+  writer->length += length;
+  return true;
+}
+
+internal inline bool
+SERIAL_WRITER_byte(SERIAL_WRITER* writer, uint8_t byte) {
+  return SERIAL_WRITER_bytes(writer, &byte, 1);
+}
+
+internal bool
+SERIAL_WRITER_varint(SERIAL_WRITER* writer, uint64_t value) {
+  uint8_t bytes[10];
+  size_t count = 0;
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    bytes[count++] = byte | (value != 0 ? 0x80 : 0);
+  } while (value != 0);
+  return SERIAL_WRITER_bytes(writer, bytes, count);
+}
+
+internal inline uint32_t
+SERIAL_hash(const char* text, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+  }
+  return hash;
+}
+
+internal bool
+SERIAL_WRITER_growTable(SERIAL_WRITER* writer) {
+  size_t size = max(writer->tableSize * 2, 256);
+  uint32_t* table = calloc(size, sizeof(uint32_t));
+  if (table == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < writer->stringCount; i++) {
+    SERIAL_SPAN* string = &writer->strings[i];
+    size_t slot = SERIAL_hash(writer->data + string->offset, string->length) & (size - 1);
+    while (table[slot] != 0) {
+      slot = (slot + 1) & (size - 1);
+    }
+    table[slot] = i + 1;
+  }
+  free(writer->table);
+  writer->table = table;
+  writer->tableSize = size;
+  return true;
+}
+
+internal bool
+SERIAL_WRITER_string(SERIAL_WRITER* writer, const char* text, size_t length) {
+  if (length > SERIAL_SHARED_MAX) {
+    return SERIAL_WRITER_byte(writer, SERIAL_STRING)
+      && SERIAL_WRITER_varint(writer, length)
+      && SERIAL_WRITER_bytes(writer, text, length);
+  }
+
+  if ((writer->stringCount + 1) * 2 > writer->tableSize && !SERIAL_WRITER_growTable(writer)) {
+    return false;
+  }
+  size_t slot = SERIAL_hash(text, length) & (writer->tableSize - 1);
+  while (writer->table[slot] != 0) {
+    size_t index = writer->table[slot] - 1;
+    SERIAL_SPAN* string = &writer->strings[index];
+    if (string->length == length && memcmp(writer->data + string->offset, text, length) == 0) {
+      return SERIAL_WRITER_byte(writer, SERIAL_STRING_REF)
+        && SERIAL_WRITER_varint(writer, index);
+    }
+    slot = (slot + 1) & (writer->tableSize - 1);
+  }
+
+  if (writer->stringCount == writer->stringCapacity) {
+    size_t capacity = max(writer->stringCapacity * 2, 64);
+    SERIAL_SPAN* strings = realloc(writer->strings, capacity * sizeof(SERIAL_SPAN));
+    if (strings == NULL) {
+      return false;
+    }
+    writer->strings = strings;
+    writer->stringCapacity = capacity;
+  }
+  if (!SERIAL_WRITER_byte(writer, SERIAL_STRING) || !SERIAL_WRITER_varint(writer, length)) {
+    return false;
+  }
+  SERIAL_SPAN* string = &writer->strings[writer->stringCount];
+  string->offset = writer->length;
+  string->length = length;
+  if (!SERIAL_WRITER_bytes(writer, text, length)) {
+    return false;
+  }
+  writer->table[slot] = ++writer->stringCount;
+  return true;
+}
+
+// Writes the value in the slot if it is a scalar or a String. Sets handled
+// to false, and writes nothing, for anything else. serialize.wren passes
+// DataBuffers to SERIAL_WRITER_writeBytes.
+internal bool
+SERIAL_WRITER_slot(SERIAL_WRITER* writer, WrenVM* vm, int slot, bool* handled) {
+  *handled = true;
+  switch (wrenGetSlotType(vm, slot)) {
+    case WREN_TYPE_NULL:
+      return SERIAL_WRITER_byte(writer, SERIAL_NULL);
+    case WREN_TYPE_BOOL:
+      return SERIAL_WRITER_byte(writer, wrenGetSlotBool(vm, slot) ? SERIAL_TRUE : SERIAL_FALSE);
+    case WREN_TYPE_NUM:
+      {
+        double value = wrenGetSlotDouble(vm, slot);
+        // Whole numbers which doubles hold exactly, except -0
+        if (value == floor(value) && fabs(value) <= 9007199254740992.0 && !(value == 0 && signbit(value))) {
+          int64_t integer = value;
+          uint64_t zigzag = ((uint64_t)integer << 1) ^ (uint64_t)(integer >> 63);
+          return SERIAL_WRITER_byte(writer, SERIAL_INT) && SERIAL_WRITER_varint(writer, zigzag);
+        }
+        uint8_t bytes[8];
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        for (size_t i = 0; i < 8; i++) {
+          bytes[i] = (bits >> (8 * i)) & 0xFF;
+        }
+        return SERIAL_WRITER_byte(writer, SERIAL_NUM) && SERIAL_WRITER_bytes(writer, bytes, 8);
+      }
+    case WREN_TYPE_STRING:
+      {
+        int length;
+        const char* text = wrenGetSlotBytes(vm, slot, &length);
+        return SERIAL_WRITER_string(writer, text, length);
+      }
+    default:
+      *handled = false;
+      return true;
+  }
+}
+
+internal SERIAL_WRITER*
+SERIAL_WRITER_get(WrenVM* vm) {
+  SERIAL_WRITER* writer = wrenGetSlotForeign(vm, 0);
+  if (writer->finished) {
+    VM_ABORT(vm, "This writer has already finished");
+    return NULL;
+  }
+  return writer;
+}
+
+internal void
+SERIAL_WRITER_allocate(WrenVM* vm) {
+  SERIAL_WRITER* writer = wrenSetSlotNewForeign(vm, 0, 0, sizeof(SERIAL_WRITER));
+  memset(writer, 0, sizeof(SERIAL_WRITER));
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "version");
+  double version = wrenGetSlotDouble(vm, 1);
+  if (version < 0 || version > UINT32_MAX || version != floor(version)) {
+    VM_ABORT(vm, "Version must be a positive integer");
+    return;
+  }
+  uint32_t userVersion = version;
+  uint8_t header[SERIAL_HEADER_SIZE];
+  memcpy(header, SERIAL_MAGIC, 4);
+  header[4] = SERIAL_FORMAT_VERSION;
+  for (size_t i = 0; i < 4; i++) {
+    header[5 + i] = (userVersion >> (8 * i)) & 0xFF;
+  }
+  if (!SERIAL_WRITER_bytes(writer, header, SERIAL_HEADER_SIZE)) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+  }
+}
+
+internal void
+SERIAL_WRITER_finalize(void* data) {
+  SERIAL_WRITER* writer = data;
+  free(writer->data);
+  free(writer->strings);
+  free(writer->table);
+}
+
+internal void
+SERIAL_WRITER_write(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  bool handled;
+  if (!SERIAL_WRITER_slot(writer, vm, 1, &handled)) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+    return;
+  }
+  wrenSetSlotBool(vm, 0, handled);
+}
+
+internal void
+SERIAL_WRITER_writeBytes(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  size_t length;
+  const char* data = DBUFFER_getSlotBytes(vm, 1, &length);
+  if (data == NULL) {
+    VM_ABORT(vm, "DataBuffer is not ready");
+    return;
+  }
+  if (!(SERIAL_WRITER_byte(writer, SERIAL_BYTES)
+        && SERIAL_WRITER_varint(writer, length)
+        && SERIAL_WRITER_bytes(writer, data, length))) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+    return;
+  }
+  wrenSetSlotNull(vm, 0);
+}
+
+// Writes list elements from start onwards, until one needs serialize.wren
+// to walk it. Returns that element's index, or -1 once the list is done.
+internal void
+SERIAL_WRITER_writeList(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, LIST, "list");
+  ASSERT_SLOT_TYPE(vm, 2, NUM, "start");
+  int count = wrenGetListCount(vm, 1);
+  int start = wrenGetSlotDouble(vm, 2);
+  wrenEnsureSlots(vm, 4);
+
+  // Assume the list is flat until proven otherwise. It can only be shown
+  // not to be in this first call, since later ones continue after an
+  // element which wasn't.
+  size_t tagPosition = writer->length;
+  if (start == 0 && !(SERIAL_WRITER_byte(writer, SERIAL_FLAT_LIST) && SERIAL_WRITER_varint(writer, count))) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+    return;
+  }
+  for (int i = start; i < count; i++) {
+    wrenGetListElement(vm, 1, i, 3);
+    bool handled;
+    if (!SERIAL_WRITER_slot(writer, vm, 3, &handled)) {
+      VM_ABORT(vm, "Not enough memory to serialize");
+      return;
+    }
+    if (!handled) {
+      if (start == 0) {
+        writer->data[tagPosition] = SERIAL_LIST;
+      }
+      wrenSetSlotDouble(vm, 0, i);
+      return;
+    }
+  }
+  wrenSetSlotDouble(vm, 0, -1);
+}
+
+internal void
+SERIAL_WRITER_beginMap(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "count");
+  if (!SERIAL_WRITER_byte(writer, SERIAL_MAP) || !SERIAL_WRITER_varint(writer, wrenGetSlotDouble(vm, 1))) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+  }
+}
+
+internal void
+SERIAL_WRITER_beginObject(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  ASSERT_SLOT_TYPE(vm, 1, STRING, "name");
+  int length;
+  const char* name = wrenGetSlotBytes(vm, 1, &length);
+  if (!SERIAL_WRITER_byte(writer, SERIAL_OBJECT) || !SERIAL_WRITER_string(writer, name, length)) {
+    VM_ABORT(vm, "Not enough memory to serialize");
+  }
+}
+
+// Hands the bytes over to a new DataBuffer without copying them.
+internal void
+SERIAL_WRITER_finish(WrenVM* vm) {
+  SERIAL_WRITER* writer = SERIAL_WRITER_get(vm);
+  if (writer == NULL) {
+    return;
+  }
+  writer->finished = true;
+  free(writer->strings);
+  free(writer->table);
+  writer->strings = NULL;
+  writer->table = NULL;
+
+  wrenEnsureSlots(vm, 2);
+  wrenSetSlotHandle(vm, 1, vmHandles.bufferClass);
+  DBUFFER* buffer = DBUFFER_new(vm, 0, 1);
+  if (buffer == NULL) {
+    // The writer keeps the bytes, and frees them when it is collected
+    VM_ABORT(vm, "Not enough memory to serialize");
+    return;
+  }
+  buffer->ready = true;
+  buffer->data = writer->data;
+  buffer->length = writer->length;
+  buffer->capacity = writer->capacity;
+  writer->data = NULL;
+}
+
+internal inline bool
+SERIAL_READER_has(SERIAL_READER* reader, size_t count) {
+  if (reader->failed || reader->length - reader->position < count) {
+    reader->failed = true;
+    return false;
+  }
+  return true;
+}
+
+internal uint8_t
+SERIAL_READER_byte(SERIAL_READER* reader) {
+  if (!SERIAL_READER_has(reader, 1)) {
+    return SERIAL_NULL;
+  }
+  return reader->data[reader->position++];
+}
+
+internal uint64_t
+SERIAL_READER_varint(SERIAL_READER* reader) {
+  uint64_t value = 0;
+  for (size_t shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = SERIAL_READER_byte(reader);
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  reader->failed = true;
+  return 0;
+}
+
+// Reads a length and checks that many bytes are left.
+internal size_t
+SERIAL_READER_length(SERIAL_READER* reader) {
+  uint64_t length = SERIAL_READER_varint(reader);
+  if (!SERIAL_READER_has(reader, length)) {
+    return 0;
+  }
+  return length;
+}
+
+internal bool
+SERIAL_READER_addString(SERIAL_READER* reader, size_t offset, size_t length) {
+  if (length > SERIAL_SHARED_MAX) {
+    return true;
+  }
+  if (reader->stringCount == reader->stringCapacity) {
+    size_t capacity = max(reader->stringCapacity * 2, 64);
+    SERIAL_SPAN* strings = realloc(reader->strings, capacity * sizeof(SERIAL_SPAN));
+    if (strings == NULL) {
+      return false;
+    }
+    reader->strings = strings;
+    reader->stringCapacity = capacity;
+  }
+  reader->strings[reader->stringCount].offset = offset;
+  reader->strings[reader->stringCount].length = length;
+  reader->stringCount++;
+  return true;
+}
+
+// Reads a STRING or STRING_REF which follows the given tag.
+internal bool
+SERIAL_READER_string(SERIAL_READER* reader, uint8_t tag, SERIAL_SPAN* string) {
+  if (tag == SERIAL_STRING) {
+    string->length = SERIAL_READER_length(reader);
+    string->offset = reader->position;
+    reader->position += string->length;
+    if (reader->failed || !SERIAL_READER_addString(reader, string->offset, string->length)) {
+      reader->failed = true;
+      return false;
+    }
+    return true;
+  }
+  if (tag == SERIAL_STRING_REF) {
+    uint64_t index = SERIAL_READER_varint(reader);
+    if (reader->failed || index >= reader->stringCount) {
+      reader->failed = true;
+      return false;
+    }
+    *string = reader->strings[index];
+    return true;
+  }
+  reader->failed = true;
+  return false;
+}
+
+// Reads a value which needs no help from serialize.wren into the slot.
+// Returns false for containers and objects, with the tag unread.
+internal bool
+SERIAL_READER_scalar(SERIAL_READER* reader, WrenVM* vm, int slot) {
+  if (!SERIAL_READER_has(reader, 1)) {
+    return false;
+  }
+  uint8_t tag = reader->data[reader->position];
+  if (tag >= SERIAL_LIST) {
+    return false;
+  }
+  reader->position++;
+  switch (tag) {
+    case SERIAL_NULL:
+      wrenSetSlotNull(vm, slot);
+      break;
+    case SERIAL_FALSE:
+    case SERIAL_TRUE:
+      wrenSetSlotBool(vm, slot, tag == SERIAL_TRUE);
+      break;
+    case SERIAL_INT:
+      {
+        uint64_t zigzag = SERIAL_READER_varint(reader);
+        int64_t integer = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        wrenSetSlotDouble(vm, slot, integer);
+      } break;
+    case SERIAL_NUM:
+      {
+        if (!SERIAL_READER_has(reader, 8)) {
+          return false;
+        }
+        uint64_t bits = 0;
+        for (size_t i = 0; i < 8; i++) {
+          bits |= (uint64_t)(uint8_t)reader->data[reader->position + i] << (8 * i);
+        }
+        reader->position += 8;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        wrenSetSlotDouble(vm, slot, value);
+      } break;
+    case SERIAL_STRING:
+    case SERIAL_STRING_REF:
+      {
+        SERIAL_SPAN string;
+        if (!SERIAL_READER_string(reader, tag, &string)) {
+          return false;
+        }
+        wrenSetSlotBytes(vm, slot, reader->data + string.offset, string.length);
+      } break;
+    case SERIAL_BYTES:
+      {
+        size_t length = SERIAL_READER_length(reader);
+        char* data = malloc(max(length, 1));
+        if (reader->failed || data == NULL) {
+          free(data);
+          reader->failed = true;
+          return false;
+        }
+        memcpy(data, reader->data + reader->position, length);
+        reader->position += length;
+        // The class goes in the slot the buffer replaces
+        wrenSetSlotHandle(vm, slot, vmHandles.bufferClass);
+        DBUFFER* buffer = DBUFFER_new(vm, slot, slot);
+        if (buffer == NULL) {
+          free(data);
+          reader->failed = true;
+          return false;
+        }
+        buffer->ready = true;
+        buffer->data = data;
+        buffer->length = length;
+        buffer->capacity = length;
+      } break;
+  }
+  return !reader->failed;
+}
+
+internal void
+SERIAL_READER_allocate(WrenVM* vm) {
+  SERIAL_READER* reader = wrenSetSlotNewForeign(vm, 0, 0, sizeof(SERIAL_READER));
+  memset(reader, 0, sizeof(SERIAL_READER));
+  size_t length;
+  const char* data = DBUFFER_getSlotBytes(vm, 1, &length);
+  if (data == NULL) {
+    VM_ABORT(vm, "Serialized data must be a String or DataBuffer");
+    return;
+  }
+  if (length < SERIAL_HEADER_SIZE || memcmp(data, SERIAL_MAGIC, 4) != 0) {
+    VM_ABORT(vm, "This is not serialized data");
+    return;
+  }
+  if (data[4] != SERIAL_FORMAT_VERSION) {
+    VM_ABORT(vm, "Serialized data is from an unsupported version of DOME");
+    return;
+  }
+  // Copied, so the source can be changed or collected while we read
+  reader->data = malloc(length);
+  if (reader->data == NULL) {
+    VM_ABORT(vm, "Not enough memory to deserialize");
+    return;
+  }
+  memcpy(reader->data, data, length);
+  reader->length = length;
+  for (size_t i = 0; i < 4; i++) {
+    reader->version |= (uint32_t)(uint8_t)data[5 + i] << (8 * i);
+  }
+  reader->position = SERIAL_HEADER_SIZE;
+}
+
+internal void
+SERIAL_READER_finalize(void* data) {
+  SERIAL_READER* reader = data;
+  free(reader->data);
+  free(reader->strings);
+}
+
+internal void
+SERIAL_READER_getVersion(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, reader->version);
+}
+
+// Returns the next value, or the reader itself when serialize.wren needs
+// to build a list, map or object, described by f_kind, f_count and f_name.
+internal void
+SERIAL_READER_read(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  if (reader->data == NULL) {
+    VM_ABORT(vm, "This is not serialized data");
+    return;
+  }
+  wrenEnsureSlots(vm, 2);
+  if (SERIAL_READER_scalar(reader, vm, 0)) {
+    return;
+  }
+
+  uint8_t tag = SERIAL_READER_byte(reader);
+  if (tag == SERIAL_FLAT_LIST) {
+    uint64_t count = SERIAL_READER_varint(reader);
+    // Every element takes at least a byte
+    if (!SERIAL_READER_has(reader, count)) {
+      VM_ABORT(vm, "Serialized data is corrupt");
+      return;
+    }
+    wrenSetSlotNewList(vm, 0);
+    for (uint64_t i = 0; i < count; i++) {
+      if (!SERIAL_READER_scalar(reader, vm, 1)) {
+        VM_ABORT(vm, "Serialized data is corrupt");
+        return;
+      }
+      wrenInsertInList(vm, 0, -1, 1);
+    }
+    return;
+  }
+
+  if (tag == SERIAL_LIST || tag == SERIAL_MAP) {
+    reader->kind = tag == SERIAL_LIST ? SERIAL_KIND_LIST : SERIAL_KIND_MAP;
+    reader->count = SERIAL_READER_varint(reader);
+  } else if (tag == SERIAL_OBJECT) {
+    reader->kind = SERIAL_KIND_OBJECT;
+    reader->count = 1;
+    SERIAL_READER_string(reader, SERIAL_READER_byte(reader), &reader->name);
+  } else {
+    reader->failed = true;
+  }
+  // Each element takes at least a byte, and a map entry two
+  if (reader->failed || !SERIAL_READER_has(reader, reader->count)) {
+    VM_ABORT(vm, "Serialized data is corrupt");
+  }
+}
+
+internal void
+SERIAL_READER_getKind(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, reader->kind);
+}
+
+internal void
+SERIAL_READER_getCount(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, reader->count);
+}
+
+internal void
+SERIAL_READER_getName(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBytes(vm, 0, reader->data + reader->name.offset, reader->name.length);
+}
+
+internal void
+SERIAL_READER_getDone(WrenVM* vm) {
+  SERIAL_READER* reader = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotBool(vm, 0, reader->position == reader->length);
+}
@@ -0,0 +1,252 @@
+typedef struct {
+  double x;
+  double y;
+  double z;
+  double w;
+} VECTOR;
+
+internal void
+VECTOR_allocate(WrenVM* vm) {
+  // Slot 0 holds the class until we replace it, so keep a handle for
+  // creating the results of arithmetic.
+  if (vmHandles.vectorClass == NULL) {
+    vmHandles.vectorClass = wrenGetSlotHandle(vm, 0);
+  }
+
+  double values[4] = { 0, 0, 0, 0 };
+  int count = wrenGetSlotCount(vm) - 1;
+  for (int i = 0; i < count && i < 4; i++) {
+    ASSERT_SLOT_TYPE(vm, i + 1, NUM, "component");
+    values[i] = wrenGetSlotDouble(vm, i + 1);
+  }
+
+  VECTOR* vector = wrenSetSlotNewForeign(vm, 0, 0, sizeof(VECTOR));
+  vector->x = values[0];
+  vector->y = values[1];
+  vector->z = values[2];
+  vector->w = values[3];
+}
+
+// Replaces slot 0 with a new vector, so read the receiver first.
+internal VECTOR*
+VECTOR_new(WrenVM* vm) {
+  wrenSetSlotHandle(vm, 0, vmHandles.vectorClass);
+  return wrenSetSlotNewForeign(vm, 0, 0, sizeof(VECTOR));
+}
+
+internal void
+VECTOR_getX(WrenVM* vm) {
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, vector->x);
+}
+
+internal void
+VECTOR_getY(WrenVM* vm) {
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, vector->y);
+}
+
+internal void
+VECTOR_getZ(WrenVM* vm) {
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, vector->z);
+}
+
+internal void
+VECTOR_getW(WrenVM* vm) {
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, vector->w);
+}
+
+internal void
+VECTOR_setX(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "x");
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  vector->x = wrenGetSlotDouble(vm, 1);
+}
+
+internal void
+VECTOR_setY(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "y");
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  vector->y = wrenGetSlotDouble(vm, 1);
+}
+
+internal void
+VECTOR_setZ(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "z");
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  vector->z = wrenGetSlotDouble(vm, 1);
+}
+
+internal void
+VECTOR_setW(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "w");
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  vector->w = wrenGetSlotDouble(vm, 1);
+}
+
+internal inline double
+VECTOR_length(VECTOR* v) {
+  return sqrt(v->x * v->x + v->y * v->y + v->z * v->z + v->w * v->w);
+}
+
+internal void
+VECTOR_getManhattan(WrenVM* vm) {
+  VECTOR* v = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, fabs(v->x) + fabs(v->y) + fabs(v->z) + fabs(v->w));
+}
+
+internal void
+VECTOR_getLength(WrenVM* vm) {
+  VECTOR* v = wrenGetSlotForeign(vm, 0);
+  wrenSetSlotDouble(vm, 0, VECTOR_length(v));
+}
+
+internal void
+VECTOR_getUnit(WrenVM* vm) {
+  VECTOR v = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  double length = VECTOR_length(&v);
+  VECTOR* result = VECTOR_new(vm);
+  if (length == 0) {
+    *result = (VECTOR){ 0, 0, 0, 0 };
+    return;
+  }
+  *result = (VECTOR){ v.x / length, v.y / length, v.z / length, v.w / length };
+}
+
+internal void
+VECTOR_getPerp(WrenVM* vm) {
+  VECTOR v = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  *VECTOR_new(vm) = (VECTOR){ -v.y, v.x, 0, 0 };
+}
+
+internal void
+VECTOR_negate(WrenVM* vm) {
+  VECTOR v = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  *VECTOR_new(vm) = (VECTOR){ -v.x, -v.y, -v.z, -v.w };
+}
+
+// The Wren side checks that the other operand is a Vector
+internal void
+VECTOR_dot(WrenVM* vm) {
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  VECTOR* b = wrenGetSlotForeign(vm, 1);
+  wrenSetSlotDouble(vm, 0, a->x * b->x + a->y * b->y + a->z * b->z + a->w * b->w);
+}
+
+internal void
+VECTOR_cross(WrenVM* vm) {
+  VECTOR a = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  VECTOR b = *(VECTOR*)wrenGetSlotForeign(vm, 1);
+  *VECTOR_new(vm) = (VECTOR){
+    a.y * b.z - a.z * b.y,
+    a.z * b.x - a.x * b.z,
+    a.x * b.y - a.y * b.x,
+    0
+  };
+}
+
+internal void
+VECTOR_plus(WrenVM* vm) {
+  VECTOR a = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  VECTOR b = *(VECTOR*)wrenGetSlotForeign(vm, 1);
+  *VECTOR_new(vm) = (VECTOR){ a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w };
+}
+
+internal void
+VECTOR_minus(WrenVM* vm) {
+  VECTOR a = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  VECTOR b = *(VECTOR*)wrenGetSlotForeign(vm, 1);
+  *VECTOR_new(vm) = (VECTOR){ a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w };
+}
+
+internal void
+VECTOR_times(WrenVM* vm) {
+  if (wrenGetSlotType(vm, 1) != WREN_TYPE_NUM) {
+    VM_ABORT(vm, "Vectors can only be multiplied by scalar values.");
+    return;
+  }
+  VECTOR a = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  double n = wrenGetSlotDouble(vm, 1);
+  *VECTOR_new(vm) = (VECTOR){ a.x * n, a.y * n, a.z * n, a.w * n };
+}
+
+internal void
+VECTOR_divide(WrenVM* vm) {
+  if (wrenGetSlotType(vm, 1) != WREN_TYPE_NUM) {
+    VM_ABORT(vm, "Vectors can only be divided by scalar values.");
+    return;
+  }
+  VECTOR a = *(VECTOR*)wrenGetSlotForeign(vm, 0);
+  double n = wrenGetSlotDouble(vm, 1);
+  *VECTOR_new(vm) = (VECTOR){ a.x / n, a.y / n, a.z / n, a.w / n };
+}
+
+internal void
+VECTOR_equals(WrenVM* vm) {
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  VECTOR* b = wrenGetSlotForeign(vm, 1);
+  wrenSetSlotBool(vm, 0, a->x == b->x && a->y == b->y && a->z == b->z && a->w == b->w);
+}
+
+// In-place variants, which update and return the receiver rather than
+// allocating a new vector.
+
+internal void
+VECTOR_add(WrenVM* vm) {
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  VECTOR* b = wrenGetSlotForeign(vm, 1);
+  a->x += b->x;
+  a->y += b->y;
+  a->z += b->z;
+  a->w += b->w;
+}
+
+internal void
+VECTOR_sub(WrenVM* vm) {
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  VECTOR* b = wrenGetSlotForeign(vm, 1);
+  a->x -= b->x;
+  a->y -= b->y;
+  a->z -= b->z;
+  a->w -= b->w;
+}
+
+internal void
+VECTOR_scale(WrenVM* vm) {
+  ASSERT_SLOT_TYPE(vm, 1, NUM, "scale");
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  double n = wrenGetSlotDouble(vm, 1);
+  a->x *= n;
+  a->y *= n;
+  a->z *= n;
+  a->w *= n;
+}
+
+internal void
+VECTOR_normalize(WrenVM* vm) {
+  VECTOR* a = wrenGetSlotForeign(vm, 0);
+  double length = VECTOR_length(a);
+  if (length != 0) {
+    a->x /= length;
+    a->y /= length;
+    a->z /= length;
+    a->w /= length;
+  }
+}
+
+internal void
+VECTOR_set(WrenVM* vm) {
+  VECTOR* vector = wrenGetSlotForeign(vm, 0);
+  double values[4] = { 0, 0, 0, 0 };
+  int count = wrenGetSlotCount(vm) - 1;
+  for (int i = 0; i < count && i < 4; i++) {
+    ASSERT_SLOT_TYPE(vm, i + 1, NUM, "component");
+    values[i] = wrenGetSlotDouble(vm, i + 1);
+  }
+  vector->x = values[0];
+  vector->y = values[1];
+  vector->z = values[2];
+  vector->w = values[3];
+}
@@ -0,0 +1,563 @@
+/*
+ pack.c
+
+ DOME's compressed egg format. Each file is split into fixed-size blocks
+ which are compressed independently, so large entries can be decompressed
+ across the worker pool, and the directory is sorted so lookups are a
+ binary search. Files which don't compress are stored as-is and can be
+ read straight out of the mapped bundle.
+
+ All integers are little endian.
+
+ Header:
+   char[8]   magic, "DOMEPACK"
+   uint32    version
+   uint32    block size
+   uint32    entry count
+   uint32    reserved
+   uint64    directory offset
+ Compressed entry data:
+   uint32[]  stored size of each block, with the top bit set if it is raw
+   block data
+ Directory, sorted by name:
+   uint16    name length, followed by the name without a terminator
+   uint8     method
+   uint64    offset
+   uint64    uncompressed size
+   uint64    stored size
+ */
+
+#define PACK_MAGIC "DOMEPACK"
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 32
+#define PACK_BLOCK_SIZE (256 * 1024)
+#define PACK_BLOCK_RAW 0x80000000U
+#define PACK_ENTRY_FIXED_SIZE (2 + 1 + 8 + 8 + 8)
+
+typedef enum {
+  PACK_METHOD_STORE,
+  PACK_METHOD_LZ
+} PACK_METHOD;
+
+typedef struct {
+  const char* name;
+  size_t nameLength;
+  PACK_METHOD method;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t storedSize;
+} PACK_ENTRY;
+
+typedef struct PACK_t {
+  char* data;
+  size_t length;
+  uint32_t blockSize;
+  uint32_t entryCount;
+  PACK_ENTRY* entries;
+} PACK;
+
+typedef struct {
+  const uint8_t* src;
+  size_t srcLength;
+  uint8_t* dst;
+  size_t dstLength;
+  bool raw;
+  SDL_atomic_t* failures;
+} PACK_BLOCK_TASK;
+
+// A compressed entry being read, one task per block.
+typedef struct {
+  uint8_t* output;
+  size_t length;
+  size_t blockCount;
+  PACK_BLOCK_TASK* blocks;
+  SDL_atomic_t failures;
+  ABC_FIFO_GROUP group;
+  // For whatever should run once every block is done
+  ABC_FIFO_CONTINUATION then;
+} PACK_READ;
+
+internal inline uint16_t
+PACK_read16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+internal inline uint32_t
+PACK_read32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+internal inline uint64_t
+PACK_read64(const uint8_t* p) {
+  return (uint64_t)PACK_read32(p) | ((uint64_t)PACK_read32(p + 4) << 32);
+}
+
+internal inline void
+PACK_write32(uint8_t* p, uint32_t value) {
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = (value >> 24) & 0xFF;
+}
+
+internal inline void
+PACK_write64(uint8_t* p, uint64_t value) {
+  PACK_write32(p, value & 0xFFFFFFFF);
+  PACK_write32(p + 4, value >> 32);
+}
+
+internal void
+PACK_close(PACK* pack) {
+  if (pack->data != NULL) {
+    unmapEntireFile(pack->data, pack->length);
+    pack->data = NULL;
+  }
+  free(pack->entries);
+  pack->entries = NULL;
+  pack->entryCount = 0;
+}
+
+internal bool
+PACK_open(PACK* pack, char* path) {
+  memset(pack, 0, sizeof(PACK));
+  pack->data = mapEntireFile(path, &pack->length);
+  if (pack->data == NULL) {
+    return false;
+  }
+
+  const uint8_t* header = (uint8_t*)pack->data;
+  if (pack->length < PACK_HEADER_SIZE
+      || memcmp(header, PACK_MAGIC, 8) != 0
+      || PACK_read32(header + 8) != PACK_VERSION) {
+    goto pack_open_fail;
+  }
+
+  pack->blockSize = PACK_read32(header + 12);
+  pack->entryCount = PACK_read32(header + 16);
+  uint64_t directoryOffset = PACK_read64(header + 24);
+  if (pack->blockSize == 0 || directoryOffset > pack->length) {
+    goto pack_open_fail;
+  }
+
+  pack->entries = calloc(max(pack->entryCount, 1), sizeof(PACK_ENTRY));
+  if (pack->entries == NULL) {
+    goto pack_open_fail;
+  }
+
+  const uint8_t* cursor = header + directoryOffset;
+  const uint8_t* end = header + pack->length;
+  for (uint32_t i = 0; i < pack->entryCount; i++) {
+    if ((size_t)(end - cursor) < PACK_ENTRY_FIXED_SIZE) {
+      goto pack_open_fail;
+    }
+    PACK_ENTRY* entry = &pack->entries[i];
+    entry->nameLength = PACK_read16(cursor);
+    cursor += 2;
+    if ((size_t)(end - cursor) < entry->nameLength + PACK_ENTRY_FIXED_SIZE - 2) {
+      goto pack_open_fail;
+    }
+    entry->name = (const char*)cursor;
+    cursor += entry->nameLength;
+    entry->method = *cursor++;
+    entry->offset = PACK_read64(cursor);
+    entry->size = PACK_read64(cursor + 8);
+    entry->storedSize = PACK_read64(cursor + 16);
+    cursor += 24;
+
+    if (entry->method > PACK_METHOD_LZ
+        || entry->offset > directoryOffset
+        || entry->storedSize > directoryOffset - entry->offset
+        || (entry->method == PACK_METHOD_STORE && entry->storedSize != entry->size)) {
+      goto pack_open_fail;
+    }
+  }
+
+  return true;
+
+pack_open_fail:
+  PACK_close(pack);
+  return false;
+}
+
+internal PACK_ENTRY*
+PACK_find(PACK* pack, const char* name) {
+  size_t nameLength = strlen(name);
+  size_t low = 0;
+  size_t high = pack->entryCount;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    PACK_ENTRY* entry = &pack->entries[mid];
+    // Matches the ordering strcmp gave us when the bundle was written
+    int cmp = memcmp(entry->name, name, min(entry->nameLength, nameLength));
+    if (cmp == 0) {
+      cmp = (entry->nameLength > nameLength) - (entry->nameLength < nameLength);
+    }
+    if (cmp == 0) {
+      return entry;
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NULL;
+}
+
+internal bool
+PACK_decodeBlock(PACK_BLOCK_TASK* block) {
+  if (block->raw) {
+    if (block->srcLength != block->dstLength) {
+      return false;
+    }
+    memcpy(block->dst, block->src, block->srcLength);
+    return true;
+  }
+  return LZ_decompress(block->src, block->srcLength, block->dst, block->dstLength);
+}
+
+internal void
+PACK_blockTaskHandler(void* data) {
+  // Thread: Async
+  PACK_BLOCK_TASK* block = data;
+  if (!PACK_decodeBlock(block)) {
+    SDL_AtomicAdd(block->failures, 1);
+  }
+}
+
+// Sets up a compressed entry's blocks, ready to decompress. On success,
+// PACK_finishRead must be called once they are done.
+internal bool
+PACK_beginRead(PACK* pack, PACK_ENTRY* entry, PACK_READ* read) {
+  const uint8_t* start = (uint8_t*)pack->data + entry->offset;
+  memset(read, 0, sizeof(PACK_READ));
+  read->length = entry->size;
+  read->blockCount = (entry->size + pack->blockSize - 1) / pack->blockSize;
+  size_t tableSize = read->blockCount * sizeof(uint32_t);
+  if (entry->method != PACK_METHOD_LZ || tableSize > entry->storedSize) {
+    return false;
+  }
+
+  read->output = malloc(max(entry->size, 1));
+  read->blocks = malloc(max(read->blockCount, 1) * sizeof(PACK_BLOCK_TASK));
+  if (read->output == NULL || read->blocks == NULL) {
+    goto pack_begin_fail;
+  }
+
+  SDL_AtomicSet(&read->failures, 0);
+  size_t position = tableSize;
+  for (size_t i = 0; i < read->blockCount; i++) {
+    uint32_t stored = PACK_read32(start + i * sizeof(uint32_t));
+    PACK_BLOCK_TASK* block = &read->blocks[i];
+    block->raw = (stored & PACK_BLOCK_RAW) != 0;
+    block->srcLength = stored & ~PACK_BLOCK_RAW;
+    if (block->srcLength > entry->storedSize - position) {
+      goto pack_begin_fail;
+    }
+    block->src = start + position;
+    block->dst = read->output + i * pack->blockSize;
+    block->dstLength = min(pack->blockSize, entry->size - i * pack->blockSize);
+    block->failures = &read->failures;
+    position += block->srcLength;
+  }
+  ABC_FIFO_initGroup(&read->group);
+  return true;
+
+pack_begin_fail:
+  free(read->blocks);
+  free(read->output);
+  read->blocks = NULL;
+  read->output = NULL;
+  return false;
+}
+
+// Pushes the blocks from first onwards into the read's group.
+internal void
+PACK_pushBlocks(PACK_READ* read, ABC_FIFO* fifo, size_t first) {
+  for (size_t i = first; i < read->blockCount; i++) {
+    INIT_TO_ZERO(ABC_TASK, task);
+    task.type = TASK_DECOMPRESS;
+    task.data = &read->blocks[i];
+    ABC_FIFO_pushGroupTask(fifo, &read->group, task);
+  }
+}
+
+// PRE: Every block is done
+// Hands the output to the view if all went well, and frees the rest.
+internal bool
+PACK_finishRead(PACK_READ* read, FILE_VIEW* view) {
+  ABC_FIFO_destroyGroup(&read->group);
+  free(read->blocks);
+  read->blocks = NULL;
+  if (SDL_AtomicGet(&read->failures) > 0) {
+    free(read->output);
+    read->output = NULL;
+    return false;
+  }
+  view->data = (const char*)read->output;
+  view->length = read->length;
+  view->source = FILE_VIEW_HEAP;
+  read->output = NULL;
+  return true;
+}
+
+// Reads an entry into the view. Stored entries point into the bundle,
+// compressed ones are decompressed onto the heap. If a fifo is given,
+// multi-block entries are shared out across its workers. Waiting on them
+// runs other tasks, so this is safe to call from inside a task too.
+internal bool
+PACK_read(PACK* pack, PACK_ENTRY* entry, FILE_VIEW* view, ABC_FIFO* fifo) {
+  if (entry->method == PACK_METHOD_STORE) {
+    view->data = pack->data + entry->offset;
+    view->length = entry->size;
+    view->source = FILE_VIEW_BUNDLE;
+    return true;
+  }
+
+  PACK_READ read;
+  if (!PACK_beginRead(pack, entry, &read)) {
+    return false;
+  }
+  if (fifo != NULL && read.blockCount > 1) {
+    PACK_pushBlocks(&read, fifo, 1);
+    // Take the first block ourselves rather than sitting idle
+    PACK_blockTaskHandler(&read.blocks[0]);
+    ABC_FIFO_waitForGroup(fifo, &read.group);
+  } else {
+    for (size_t i = 0; i < read.blockCount; i++) {
+      PACK_blockTaskHandler(&read.blocks[i]);
+    }
+  }
+  return PACK_finishRead(&read, view);
+}
+
+typedef struct {
+  char** paths;
+  size_t count;
+  size_t capacity;
+} PACK_FILE_LIST;
+
+internal int
+PACK_comparePaths(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+internal bool
+PACK_collectFiles(PACK_FILE_LIST* list, const char* root, const char* relative) {
+  char fullPath[PATH_MAX];
+  snprintf(fullPath, PATH_MAX, "%s/%s", root, relative);
+
+  tinydir_dir dir;
+  if (tinydir_open(&dir, fullPath) == -1) {
+    return false;
+  }
+
+  bool success = true;
+  while (success && dir.has_next) {
+    tinydir_file file;
+    tinydir_readfile(&dir, &file);
+    tinydir_next(&dir);
+
+    size_t nameLength = strlen(file.name);
+    // Skip hidden files (and . and ..), and any bundles already in the tree
+    if (file.name[0] == '.'
+        || (nameLength > 4 && STRINGS_EQUAL(file.name + nameLength - 4, ".egg"))) {
+      continue;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s%s%s", relative, file.name, file.is_dir ? "/" : "");
+    if (file.is_dir) {
+      success = PACK_collectFiles(list, root, path);
+      continue;
+    }
+
+    if (list->count == list->capacity) {
+      size_t capacity = max(list->capacity * 2, 64);
+      char** paths = realloc(list->paths, capacity * sizeof(char*));
+      if (paths == NULL) {
+        success = false;
+        break;
+      }
+      list->paths = paths;
+      list->capacity = capacity;
+    }
+    char* copy = strdup(path);
+    if (copy == NULL) {
+      success = false;
+      break;
+    }
+    list->paths[list->count++] = copy;
+  }
+
+  tinydir_close(&dir);
+  return success;
+}
+
+// Compresses a file's contents into out, which must have room for
+// length + block table bytes. Returns the stored size, or 0 if the
+// file doesn't benefit from compression.
+internal size_t
+PACK_compressEntry(const uint8_t* data, size_t length, uint8_t* out) {
+  size_t blockCount = (length + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+  size_t position = blockCount * sizeof(uint32_t);
+  for (size_t i = 0; i < blockCount; i++) {
+    const uint8_t* block = data + i * PACK_BLOCK_SIZE;
+    size_t blockLength = min(PACK_BLOCK_SIZE, length - i * PACK_BLOCK_SIZE);
+    // Only keep the compressed block if it actually saves space
+    size_t stored = LZ_compress(block, blockLength, out + position, blockLength - 1);
+    if (stored == 0) {
+      memcpy(out + position, block, blockLength);
+      PACK_write32(out + i * sizeof(uint32_t), blockLength | PACK_BLOCK_RAW);
+      stored = blockLength;
+    } else {
+      PACK_write32(out + i * sizeof(uint32_t), stored);
+    }
+    position += stored;
+  }
+  return position < length ? position : 0;
+}
+
+internal bool
+PACK_writeAll(FILE* out, const void* data, size_t length) {
+  return fwrite(data, 1, length, out) == length;
+}
+
+// Any error leaves no output behind, rather than a truncated bundle.
+internal int
+PACK_create(ENGINE* engine, char* inputDir, char* outputPath) {
+  int result = EXIT_FAILURE;
+  FILE* out = NULL;
+  bool opened = false;
+  PACK_ENTRY* entries = NULL;
+  INIT_TO_ZERO(PACK_FILE_LIST, list);
+
+  if (!isDirectory(inputDir) || !PACK_collectFiles(&list, inputDir, "")) {
+    LOG_print(LOG_ERROR, LOG_IO, "Error: Could not list the files in %s\n", inputDir);
+    goto pack_create_end;
+  }
+  qsort(list.paths, list.count, sizeof(char*), PACK_comparePaths);
+
+  out = fopen(outputPath, "wb");
+  if (out == NULL) {
+    LOG_print(LOG_ERROR, LOG_IO, "Error: Could not open %s for writing\n", outputPath);
+    goto pack_create_end;
+  }
+  opened = true;
+
+  uint8_t header[PACK_HEADER_SIZE];
+  memset(header, 0, PACK_HEADER_SIZE);
+  if (!PACK_writeAll(out, header, PACK_HEADER_SIZE)) {
+    goto pack_create_write_error;
+  }
+
+  entries = calloc(max(list.count, 1), sizeof(PACK_ENTRY));
+  if (entries == NULL) {
+    LOG_print(LOG_ERROR, LOG_IO, "Error: Not enough memory to pack %s\n", inputDir);
+    goto pack_create_end;
+  }
+  uint64_t offset = PACK_HEADER_SIZE;
+  uint64_t totalSize = 0;
+  for (size_t i = 0; i < list.count; i++) {
+    char fullPath[PATH_MAX];
+    snprintf(fullPath, PATH_MAX, "%s/%s", inputDir, list.paths[i]);
+
+    size_t length = 0;
+    char* data = readEntireFile(fullPath, &length);
+    if (data == NULL) {
+      LOG_print(LOG_ERROR, LOG_IO, "Error: Could not read %s\n", fullPath);
+      goto pack_create_end;
+    }
+
+    size_t tableSize = ((length + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE) * sizeof(uint32_t);
+    uint8_t* compressed = malloc(length + tableSize + 1);
+    if (compressed == NULL) {
+      free(data);
+      LOG_print(LOG_ERROR, LOG_IO, "Error: Not enough memory to pack %s\n", fullPath);
+      goto pack_create_end;
+    }
+    size_t storedSize = PACK_compressEntry((uint8_t*)data, length, compressed);
+
+    PACK_ENTRY* entry = &entries[i];
+    entry->name = list.paths[i];
+    entry->nameLength = strlen(list.paths[i]);
+    entry->offset = offset;
+    entry->size = length;
+    bool written;
+    if (storedSize > 0) {
+      entry->method = PACK_METHOD_LZ;
+      entry->storedSize = storedSize;
+      written = PACK_writeAll(out, compressed, storedSize);
+    } else {
+      entry->method = PACK_METHOD_STORE;
+      entry->storedSize = length;
+      written = PACK_writeAll(out, data, length);
+    }
+    offset += entry->storedSize;
+    totalSize += length;
+    free(compressed);
+    free(data);
+    if (!written) {
+      goto pack_create_write_error;
+    }
+
+    if (DEBUG_MODE) {
+      ENGINE_printLog(engine, "Packed %s (%zu -> %zu bytes)\n", entry->name, length, (size_t)entry->storedSize);
+    }
+  }
+
+  uint64_t directoryOffset = offset;
+  for (size_t i = 0; i < list.count; i++) {
+    PACK_ENTRY* entry = &entries[i];
+    uint8_t record[PACK_ENTRY_FIXED_SIZE];
+    record[0] = entry->nameLength & 0xFF;
+    record[1] = (entry->nameLength >> 8) & 0xFF;
+    if (!PACK_writeAll(out, record, 2) || !PACK_writeAll(out, entry->name, entry->nameLength)) {
+      goto pack_create_write_error;
+    }
+    record[0] = entry->method;
+    PACK_write64(record + 1, entry->offset);
+    PACK_write64(record + 9, entry->size);
+    PACK_write64(record + 17, entry->storedSize);
+    if (!PACK_writeAll(out, record, PACK_ENTRY_FIXED_SIZE - 2)) {
+      goto pack_create_write_error;
+    }
+    offset += 2 + entry->nameLength + PACK_ENTRY_FIXED_SIZE - 2;
+  }
+
+  memcpy(header, PACK_MAGIC, 8);
+  PACK_write32(header + 8, PACK_VERSION);
+  PACK_write32(header + 12, PACK_BLOCK_SIZE);
+  PACK_write32(header + 16, list.count);
+  PACK_write64(header + 24, directoryOffset);
+  if (fseek(out, 0, SEEK_SET) != 0 || !PACK_writeAll(out, header, PACK_HEADER_SIZE)) {
+    goto pack_create_write_error;
+  }
+  // Closing flushes whatever is still buffered, which can fail too
+  int closed = fclose(out);
+  out = NULL;
+  if (closed != 0) {
+    goto pack_create_write_error;
+  }
+
+  ENGINE_printLog(engine, "Packed %zu files into %s (%llu -> %llu bytes)\n",
+      list.count, outputPath, (unsigned long long)totalSize, (unsigned long long)offset);
+  result = EXIT_SUCCESS;
+  goto pack_create_end;
+
+pack_create_write_error:
+  LOG_print(LOG_ERROR, LOG_IO, "Error: Could not write to %s\n", outputPath);
+
+pack_create_end:
+  if (out != NULL) {
+    fclose(out);
+  }
+  if (result != EXIT_SUCCESS && opened) {
+    remove(outputPath);
+  }
+  free(entries);
+  for (size_t i = 0; i < list.count; i++) {
+    free(list.paths[i]);
+  }
+  free(list.paths);
+  return result;
+}
@@ -0,0 +1,430 @@
+/*
+ postprocess.c
+
+ An optional chain of effects applied to the canvas after draw(), on its
+ way to the screen. The canvas itself is left alone, so games which don't
+ clear every frame keep working.
+
+ Each effect is one pass from one buffer into the other. A pass is split
+ into bands of rows, which the workers share with the main thread, and
+ the next pass starts once every band is done.
+ */
+
+#define POSTPROCESS_MAX_EFFECTS 8
+#define POSTPROCESS_MAX_BANDS 16
+
+typedef enum {
+  POSTPROCESS_SCANLINES,
+  POSTPROCESS_CURVATURE,
+  POSTPROCESS_BLOOM,
+  POSTPROCESS_GRADE,
+  POSTPROCESS_DITHER,
+  POSTPROCESS_UPSCALE
+} POSTPROCESS_EFFECT_TYPE;
+
+typedef struct {
+  POSTPROCESS_EFFECT_TYPE type;
+  float amount;
+  float threshold;
+  size_t scale;
+  size_t levels;
+  // Color grading lookup, a strip of size * size squares
+  uint32_t* lut;
+  size_t lutSize;
+} POSTPROCESS_EFFECT;
+
+typedef struct {
+  POSTPROCESS_EFFECT* effect;
+  uint32_t* src;
+  uint32_t* dest;
+  size_t srcWidth;
+  size_t srcHeight;
+  size_t destWidth;
+  size_t destHeight;
+  // Upscaling applied by earlier effects
+  size_t scale;
+  size_t startRow;
+  size_t endRow;
+} POSTPROCESS_BAND;
+
+typedef struct POSTPROCESS_t {
+  POSTPROCESS_EFFECT effects[POSTPROCESS_MAX_EFFECTS];
+  size_t count;
+  uint32_t* buffers[2];
+  size_t capacity;
+  SDL_Texture* texture;
+  size_t textureWidth;
+  size_t textureHeight;
+  bool textureSmooth;
+  // The renderer's limit, or zero until it has been asked
+  size_t maxTextureWidth;
+  size_t maxTextureHeight;
+  POSTPROCESS_BAND bands[POSTPROCESS_MAX_BANDS];
+  ABC_FIFO_GROUP group;
+} POSTPROCESS;
+
+internal inline uint32_t
+POSTPROCESS_scaleColor(uint32_t c, uint32_t factor) {
+  // Scales red and blue together, then green, in 8.8 fixed point
+  uint32_t rb = (((c & 0x00FF00FF) * factor) >> 8) & 0x00FF00FF;
+  uint32_t g = (((c & 0x0000FF00) * factor) >> 8) & 0x0000FF00;
+  return (c & 0xFF000000) | rb | g;
+}
+
+internal void
+POSTPROCESS_scanlines(POSTPROCESS_BAND* band) {
+  // Darken the lower half of every canvas row, or every other row when
+  // the image hasn't been upscaled yet.
+  size_t period = max(2, band->scale);
+  uint32_t factor = 256 - (uint32_t)(fmid(0, band->effect->amount, 1) * 256);
+  size_t width = band->destWidth;
+  for (size_t j = band->startRow; j < band->endRow; j++) {
+    uint32_t* src = band->src + j * width;
+    uint32_t* dest = band->dest + j * width;
+    if ((j % period) < (period + 1) / 2) {
+      memcpy(dest, src, width * 4);
+      continue;
+    }
+    for (size_t i = 0; i < width; i++) {
+      dest[i] = POSTPROCESS_scaleColor(src[i], factor);
+    }
+  }
+}
+
+internal void
+POSTPROCESS_curvature(POSTPROCESS_BAND* band) {
+  float amount = band->effect->amount;
+  size_t width = band->destWidth;
+  size_t height = band->destHeight;
+  for (size_t j = band->startRow; j < band->endRow; j++) {
+    uint32_t* dest = band->dest + j * width;
+    float v = (2.0f * j + 1) / height - 1;
+    for (size_t i = 0; i < width; i++) {
+      float u = (2.0f * i + 1) / width - 1;
+      float su = u * (1 + amount * v * v);
+      float sv = v * (1 + amount * u * u);
+      if (su < -1 || su >= 1 || sv < -1 || sv >= 1) {
+        dest[i] = 0xFF000000;
+        continue;
+      }
+      size_t x = (su + 1) * 0.5f * width;
+      size_t y = (sv + 1) * 0.5f * height;
+      dest[i] = band->src[y * width + x];
+    }
+  }
+}
+
+// The part of a color brighter than the threshold
+internal inline void
+POSTPROCESS_brightPass(uint32_t c, int32_t threshold, int32_t* sum) {
+  int32_t r = c & 0xFF;
+  int32_t g = (c >> 8) & 0xFF;
+  int32_t b = (c >> 16) & 0xFF;
+  if (((r * 77 + g * 150 + b * 29) >> 8) >= threshold) {
+    sum[0] += r;
+    sum[1] += g;
+    sum[2] += b;
+  }
+}
+
+// Rather than a true blur, samples a sparse ring around each pixel, which
+// is enough to make bright areas glow.
+internal void
+POSTPROCESS_bloom(POSTPROCESS_BAND* band) {
+  int32_t threshold = fmid(0, band->effect->threshold, 255);
+  int32_t strength = fmid(0, band->effect->amount, 4) * 256;
+  int64_t radius = 2 * band->scale;
+  int64_t width = band->destWidth;
+  int64_t height = band->destHeight;
+  for (int64_t j = band->startRow; j < (int64_t)band->endRow; j++) {
+    uint32_t* dest = band->dest + j * width;
+    int64_t up = max(0, j - radius) * width;
+    int64_t row = j * width;
+    int64_t down = min(height - 1, j + radius) * width;
+    for (int64_t i = 0; i < width; i++) {
+      int64_t left = max(0, i - radius);
+      int64_t right = min(width - 1, i + radius);
+      int32_t sum[3] = { 0, 0, 0 };
+      uint32_t* src = band->src;
+      POSTPROCESS_brightPass(src[up + left], threshold, sum);
+      POSTPROCESS_brightPass(src[up + i], threshold, sum);
+      POSTPROCESS_brightPass(src[up + right], threshold, sum);
+      POSTPROCESS_brightPass(src[row + left], threshold, sum);
+      POSTPROCESS_brightPass(src[row + i], threshold, sum);
+      POSTPROCESS_brightPass(src[row + right], threshold, sum);
+      POSTPROCESS_brightPass(src[down + left], threshold, sum);
+      POSTPROCESS_brightPass(src[down + i], threshold, sum);
+      POSTPROCESS_brightPass(src[down + right], threshold, sum);
+
+      uint32_t c = src[row + i];
+      uint32_t result = c & 0xFF000000;
+      for (int k = 0; k < 3; k++) {
+        int32_t value = ((c >> (k * 8)) & 0xFF) + (sum[k] * strength) / (9 * 256);
+        result |= (uint32_t)min(value, 255) << (k * 8);
+      }
+      dest[i] = result;
+    }
+  }
+}
+
+internal void
+POSTPROCESS_grade(POSTPROCESS_BAND* band) {
+  POSTPROCESS_EFFECT* effect = band->effect;
+  size_t size = effect->lutSize;
+  size_t pitch = size * size;
+  uint32_t* lut = effect->lut;
+  float scale = (size - 1) / 255.0f;
+  size_t width = band->destWidth;
+  for (size_t j = band->startRow; j < band->endRow; j++) {
+    uint32_t* src = band->src + j * width;
+    uint32_t* dest = band->dest + j * width;
+    for (size_t i = 0; i < width; i++) {
+      uint32_t c = src[i];
+      float position[3] = {
+        (c & 0xFF) * scale,
+        ((c >> 8) & 0xFF) * scale,
+        ((c >> 16) & 0xFF) * scale
+      };
+      size_t low[3];
+      size_t high[3];
+      float t[3];
+      for (int k = 0; k < 3; k++) {
+        low[k] = position[k];
+        high[k] = min(low[k] + 1, size - 1);
+        t[k] = position[k] - low[k];
+      }
+      // Trilinear interpolation between the eight surrounding entries.
+      // Red runs across each square, green down it and blue across squares.
+      float out[3] = { 0, 0, 0 };
+      for (int corner = 0; corner < 8; corner++) {
+        size_t r = (corner & 1) ? high[0] : low[0];
+        size_t g = (corner & 2) ? high[1] : low[1];
+        size_t b = (corner & 4) ? high[2] : low[2];
+        float weight = ((corner & 1) ? t[0] : 1 - t[0])
+          * ((corner & 2) ? t[1] : 1 - t[1])
+          * ((corner & 4) ? t[2] : 1 - t[2]);
+        uint32_t entry = lut[g * pitch + b * size + r];
+        out[0] += weight * (entry & 0xFF);
+        out[1] += weight * ((entry >> 8) & 0xFF);
+        out[2] += weight * ((entry >> 16) & 0xFF);
+      }
+      dest[i] = (c & 0xFF000000)
+        | ((uint32_t)(out[2] + 0.5f) << 16)
+        | ((uint32_t)(out[1] + 0.5f) << 8)
+        | (uint32_t)(out[0] + 0.5f);
+    }
+  }
+}
+
+internal void
+POSTPROCESS_dither(POSTPROCESS_BAND* band) {
+  local_persist const int32_t bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+  };
+  int32_t steps = band->effect->levels - 1;
+  size_t width = band->destWidth;
+  for (size_t j = band->startRow; j < band->endRow; j++) {
+    uint32_t* src = band->src + j * width;
+    uint32_t* dest = band->dest + j * width;
+    // Dither in canvas pixels, even after upscaling
+    const int32_t* pattern = bayer[(j / band->scale) & 3];
+    for (size_t i = 0; i < width; i++) {
+      uint32_t c = src[i];
+      // Offset each channel by up to half a step either way, then
+      // round it to the nearest level.
+      int32_t bias = pattern[(i / band->scale) & 3] * 2 - 15;
+      uint32_t result = c & 0xFF000000;
+      for (int k = 0; k < 24; k += 8) {
+        int32_t value = (c >> k) & 0xFF;
+        int32_t level = (value * steps * 32 + bias * 255 + 255 * 16) / (255 * 32);
+        level = mid(0, level, steps);
+        result |= (uint32_t)(level * 255 / steps) << k;
+      }
+      dest[i] = result;
+    }
+  }
+}
+
+internal void
+POSTPROCESS_upscale(POSTPROCESS_BAND* band) {
+  // The factor may have been reduced to fit the renderer
+  size_t scale = band->destWidth / band->srcWidth;
+  size_t width = band->destWidth;
+  for (size_t j = band->startRow; j < band->endRow; j++) {
+    uint32_t* src = band->src + (j / scale) * band->srcWidth;
+    uint32_t* dest = band->dest + j * width;
+    for (size_t i = 0; i < width; i++) {
+      dest[i] = src[i / scale];
+    }
+  }
+}
+
+internal void
+POSTPROCESS_bandTaskHandler(void* data) {
+  // Thread: Async, or Main when helping
+  POSTPROCESS_BAND* band = data;
+  switch (band->effect->type) {
+    case POSTPROCESS_SCANLINES: POSTPROCESS_scanlines(band); break;
+    case POSTPROCESS_CURVATURE: POSTPROCESS_curvature(band); break;
+    case POSTPROCESS_BLOOM: POSTPROCESS_bloom(band); break;
+    case POSTPROCESS_GRADE: POSTPROCESS_grade(band); break;
+    case POSTPROCESS_DITHER: POSTPROCESS_dither(band); break;
+    case POSTPROCESS_UPSCALE: POSTPROCESS_upscale(band); break;
+  }
+}
+
+internal POSTPROCESS*
+POSTPROCESS_get(ENGINE* engine) {
+  if (engine->postprocess == NULL) {
+    engine->postprocess = calloc(1, sizeof(POSTPROCESS));
+    ABC_FIFO_initGroup(&engine->postprocess->group);
+  }
+  return engine->postprocess;
+}
+
+internal bool
+POSTPROCESS_add(ENGINE* engine, POSTPROCESS_EFFECT effect) {
+  POSTPROCESS* post = POSTPROCESS_get(engine);
+  if (post->count >= POSTPROCESS_MAX_EFFECTS) {
+    free(effect.lut);
+    return false;
+  }
+  post->effects[post->count++] = effect;
+  return true;
+}
+
+internal void
+POSTPROCESS_clear(ENGINE* engine) {
+  POSTPROCESS* post = engine->postprocess;
+  if (post == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < post->count; i++) {
+    free(post->effects[i].lut);
+  }
+  post->count = 0;
+}
+
+// Runs the chain over the canvas and uploads the result. Returns the
+// texture to present, or NULL if there are no effects or they couldn't be
+// applied, in which case the canvas should be presented as it is.
+internal SDL_Texture*
+POSTPROCESS_apply(ENGINE* engine) {
+  POSTPROCESS* post = engine->postprocess;
+  if (post == NULL || post->count == 0) {
+    return NULL;
+  }
+
+  if (post->maxTextureWidth == 0) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(engine->renderer, &info) == 0 && info.max_texture_width > 0) {
+      post->maxTextureWidth = info.max_texture_width;
+      post->maxTextureHeight = info.max_texture_height;
+    } else {
+      post->maxTextureWidth = SIZE_MAX;
+      post->maxTextureHeight = SIZE_MAX;
+    }
+  }
+
+  // Chained upscales stop short of a texture the renderer can't create
+  size_t factors[POSTPROCESS_MAX_EFFECTS];
+  size_t totalScale = 1;
+  for (size_t i = 0; i < post->count; i++) {
+    factors[i] = 1;
+    if (post->effects[i].type == POSTPROCESS_UPSCALE) {
+      size_t limit = min(post->maxTextureWidth / (engine->width * totalScale),
+                         post->maxTextureHeight / (engine->height * totalScale));
+      factors[i] = max(1, min(post->effects[i].scale, limit));
+      totalScale *= factors[i];
+    }
+  }
+  size_t size = engine->width * engine->height * totalScale * totalScale;
+  if (post->capacity < size) {
+    for (int i = 0; i < 2; i++) {
+      uint32_t* buffer = realloc(post->buffers[i], size * 4);
+      if (buffer == NULL) {
+        return NULL;
+      }
+      post->buffers[i] = buffer;
+    }
+    post->capacity = size;
+  }
+
+  uint32_t* src = engine->pixels;
+  size_t width = engine->width;
+  size_t height = engine->height;
+  size_t scale = 1;
+  size_t target = 0;
+  for (size_t e = 0; e < post->count; e++) {
+    POSTPROCESS_EFFECT* effect = &post->effects[e];
+    size_t factor = factors[e];
+    size_t destWidth = width * factor;
+    size_t destHeight = height * factor;
+    uint32_t* dest = post->buffers[target];
+
+    size_t bandCount = min(min(engine->fifo.workerCount + 1, POSTPROCESS_MAX_BANDS), destHeight);
+    size_t rows = (destHeight + bandCount - 1) / bandCount;
+    for (size_t b = 0; b < bandCount; b++) {
+      POSTPROCESS_BAND* band = &post->bands[b];
+      *band = (POSTPROCESS_BAND){
+        effect, src, dest, width, height, destWidth, destHeight, scale,
+        b * rows, min((b + 1) * rows, destHeight)
+      };
+      if (b > 0) {
+        INIT_TO_ZERO(ABC_TASK, task);
+        task.type = TASK_POSTPROCESS;
+        task.data = band;
+        ABC_FIFO_pushGroupTask(&engine->fifo, &post->group, task);
+      }
+    }
+    POSTPROCESS_bandTaskHandler(&post->bands[0]);
+    ABC_FIFO_waitForGroup(&engine->fifo, &post->group);
+
+    src = dest;
+    target ^= 1;
+    width = destWidth;
+    height = destHeight;
+    scale *= factor;
+  }
+
+  // After an integer upscale, smooth filtering only blends the edges of
+  // each pixel, giving sharp results at any window size.
+  bool smooth = scale > 1;
+  if (post->texture == NULL || post->textureWidth != width
+      || post->textureHeight != height || post->textureSmooth != smooth) {
+    if (post->texture != NULL) {
+      SDL_DestroyTexture(post->texture);
+    }
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, smooth ? "linear" : "nearest");
+    post->texture = SDL_CreateTexture(engine->renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    post->textureWidth = width;
+    post->textureHeight = height;
+    post->textureSmooth = smooth;
+    if (post->texture == NULL) {
+      return NULL;
+    }
+  }
+  SDL_UpdateTexture(post->texture, NULL, src, width * 4);
+  return post->texture;
+}
+
+internal void
+POSTPROCESS_free(ENGINE* engine) {
+  POSTPROCESS* post = engine->postprocess;
+  if (post == NULL) {
+    return;
+  }
+  POSTPROCESS_clear(engine);
+  ABC_FIFO_destroyGroup(&post->group);
+  if (post->texture != NULL) {
+    SDL_DestroyTexture(post->texture);
+  }
+  free(post->buffers[0]);
+  free(post->buffers[1]);
+  free(post);
+  engine->postprocess = NULL;
+}
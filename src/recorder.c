@@ -0,0 +1,302 @@
+/*
+ recorder.c
+
+ Records the canvas to a gif, a y4m video or a numbered sequence of pngs.
+
+ After drawing, the main thread copies every Nth game frame into a small ring
+ of slots and hands the slot to a worker, which scales and encodes it. Frames
+ are written in the order they were captured by whichever worker finishes the
+ next one due. If the ring fills up, the main thread helps with the encoding
+ rather than dropping frames, so a recording never skips.
+ */
+
+#define RECORDER_RING_SIZE 8
+#define RECORDER_TICKS_PER_SECOND 60
+
+typedef enum {
+  RECORDER_FORMAT_GIF,
+  RECORDER_FORMAT_Y4M,
+  RECORDER_FORMAT_PNG
+} RECORDER_FORMAT;
+
+typedef enum {
+  RECORDER_FRAME_FREE,
+  RECORDER_FRAME_QUEUED,
+  RECORDER_FRAME_ENCODED
+} RECORDER_FRAME_STATE;
+
+typedef struct RECORDER_t RECORDER;
+
+typedef struct {
+  RECORDER* recorder;
+  size_t number;
+  // Game ticks since the previous captured frame
+  size_t ticks;
+  uint32_t* pixels;
+  uint32_t* scaled;
+  SDL_atomic_t state;
+  ABC_FIFO_GROUP group;
+  jo_gif_frame_t gif;
+  uint8_t* data;
+  size_t length;
+} RECORDER_FRAME;
+
+struct RECORDER_t {
+  ENGINE* engine;
+  RECORDER_FORMAT format;
+  char* path;
+  size_t width;
+  size_t height;
+  size_t scale;
+  size_t interval;
+  // Main thread only
+  size_t pendingTicks;
+  size_t captured;
+  // Guarded by writeLock
+  SDL_mutex* writeLock;
+  size_t written;
+  uint64_t totalTicks;
+  uint64_t output;
+  FILE* file;
+  jo_gif_t gif;
+  RECORDER_FRAME frames[RECORDER_RING_SIZE];
+};
+
+internal RECORDER_FORMAT
+RECORDER_formatFromPath(const char* path) {
+  const char* dot = strrchr(path, '.');
+  if (dot != NULL) {
+    if (SDL_strcasecmp(dot, ".y4m") == 0) {
+      return RECORDER_FORMAT_Y4M;
+    } else if (SDL_strcasecmp(dot, ".png") == 0) {
+      return RECORDER_FORMAT_PNG;
+    }
+  }
+  return RECORDER_FORMAT_GIF;
+}
+
+internal void
+RECORDER_encodeY4M(RECORDER_FRAME* frame, uint8_t* rgba, size_t size) {
+  // Full chroma, limited range BT.601, which is what players assume
+  frame->length = size * 3;
+  frame->data = malloc(frame->length);
+  uint8_t* y = frame->data;
+  uint8_t* u = y + size;
+  uint8_t* v = u + size;
+  for (size_t i = 0; i < size; i++) {
+    int r = rgba[i * 4];
+    int g = rgba[i * 4 + 1];
+    int b = rgba[i * 4 + 2];
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+}
+
+// PRE: writeLock is held
+internal void
+RECORDER_writeFrame(RECORDER* recorder, RECORDER_FRAME* frame) {
+  recorder->totalTicks += frame->ticks;
+  switch (recorder->format) {
+    case RECORDER_FORMAT_GIF:
+      {
+        // Gif delays are in centiseconds, so carry the rounding forward
+        // to keep the recording in time with the game.
+        uint64_t end = (recorder->totalTicks * 100 + RECORDER_TICKS_PER_SECOND / 2) / RECORDER_TICKS_PER_SECOND;
+        short delay = min(end - recorder->output, SHRT_MAX);
+        recorder->output += delay;
+        jo_gif_write(&recorder->gif, &frame->gif, delay);
+        jo_gif_frame_free(&frame->gif);
+      } break;
+    case RECORDER_FORMAT_Y4M:
+      {
+        // The stream has a fixed rate, so frames which took longer are
+        // repeated, and a frame with no time of its own is left out.
+        uint64_t end = recorder->totalTicks / recorder->interval;
+        for (; recorder->output < end; recorder->output++) {
+          fputs("FRAME\n", recorder->file);
+          fwrite(frame->data, 1, frame->length, recorder->file);
+        }
+        free(frame->data);
+      } break;
+    case RECORDER_FORMAT_PNG:
+      {
+        size_t len = strlen(recorder->path) + 16;
+        char name[len];
+        snprintf(name, len, "%s-%06zu.png", recorder->path, frame->number);
+        writeEntireFile(name, (char*)frame->data, frame->length);
+        free(frame->data);
+      } break;
+  }
+  frame->data = NULL;
+  frame->length = 0;
+}
+
+// Writes out every frame which is encoded and next in line.
+internal void
+RECORDER_flush(RECORDER* recorder) {
+  SDL_LockMutex(recorder->writeLock);
+  while (true) {
+    RECORDER_FRAME* frame = &recorder->frames[recorder->written % RECORDER_RING_SIZE];
+    if (frame->number != recorder->written || SDL_AtomicGet(&frame->state) != RECORDER_FRAME_ENCODED) {
+      break;
+    }
+    RECORDER_writeFrame(recorder, frame);
+    recorder->written++;
+    SDL_AtomicSet(&frame->state, RECORDER_FRAME_FREE);
+  }
+  SDL_UnlockMutex(recorder->writeLock);
+}
+
+internal void
+RECORDER_encodeTaskHandler(void* data) {
+  // Thread: Async
+  RECORDER_FRAME* frame = data;
+  RECORDER* recorder = frame->recorder;
+  uint32_t* pixels = frame->pixels;
+  size_t width = recorder->width * recorder->scale;
+  size_t height = recorder->height * recorder->scale;
+
+  if (recorder->scale > 1) {
+    for (size_t j = 0; j < height; j++) {
+      uint32_t* row = pixels + (j / recorder->scale) * recorder->width;
+      for (size_t i = 0; i < width; i++) {
+        frame->scaled[j * width + i] = row[i / recorder->scale];
+      }
+    }
+    pixels = frame->scaled;
+  }
+
+  switch (recorder->format) {
+    case RECORDER_FORMAT_GIF:
+      jo_gif_encode(&recorder->gif, (uint8_t*)pixels, &frame->gif);
+      break;
+    case RECORDER_FORMAT_Y4M:
+      RECORDER_encodeY4M(frame, (uint8_t*)pixels, width * height);
+      break;
+    case RECORDER_FORMAT_PNG:
+      {
+        int length = 0;
+        frame->data = stbi_write_png_to_mem((uint8_t*)pixels, width * 4, width, height, 4, &length);
+        frame->length = length;
+      } break;
+  }
+
+  SDL_AtomicSet(&frame->state, RECORDER_FRAME_ENCODED);
+  RECORDER_flush(recorder);
+}
+
+internal bool
+RECORDER_start(ENGINE* engine) {
+  ENGINE_RECORDER* settings = &engine->record;
+  RECORDER* recorder = calloc(1, sizeof(RECORDER));
+  recorder->engine = engine;
+  recorder->format = RECORDER_formatFromPath(settings->path);
+  recorder->width = engine->width;
+  recorder->height = engine->height;
+  recorder->scale = max(GIF_SCALE, 1);
+  recorder->interval = settings->interval;
+  if (recorder->interval == 0) {
+    // Most gif viewers can't play faster than 50fps
+    recorder->interval = recorder->format == RECORDER_FORMAT_GIF ? 2 : 1;
+  }
+
+  size_t width = recorder->width * recorder->scale;
+  size_t height = recorder->height * recorder->scale;
+  if (recorder->format == RECORDER_FORMAT_GIF) {
+    recorder->gif = jo_gif_start(settings->path, width, height, 0, 31);
+    recorder->file = recorder->gif.fp;
+  } else if (recorder->format == RECORDER_FORMAT_Y4M) {
+    recorder->file = fopen(settings->path, "wb");
+    if (recorder->file != NULL) {
+      fprintf(recorder->file, "YUV4MPEG2 W%zu H%zu F%i:%zu Ip A1:1 C444\n",
+          width, height, RECORDER_TICKS_PER_SECOND, recorder->interval);
+    }
+  }
+  if (recorder->format != RECORDER_FORMAT_PNG && recorder->file == NULL) {
+    LOG_print(LOG_ERROR, LOG_IO, "Could not open %s for recording\n", settings->path);
+    free(recorder);
+    return false;
+  }
+
+  // The frame number goes between the name and the extension
+  recorder->path = strdup(settings->path);
+  if (recorder->format == RECORDER_FORMAT_PNG) {
+    *strrchr(recorder->path, '.') = '\0';
+  }
+
+  recorder->writeLock = SDL_CreateMutex();
+  for (size_t i = 0; i < RECORDER_RING_SIZE; i++) {
+    RECORDER_FRAME* frame = &recorder->frames[i];
+    frame->recorder = recorder;
+    frame->pixels = malloc(recorder->width * recorder->height * 4);
+    if (recorder->scale > 1) {
+      frame->scaled = malloc(width * height * 4);
+    }
+    SDL_AtomicSet(&frame->state, RECORDER_FRAME_FREE);
+    ABC_FIFO_initGroup(&frame->group);
+  }
+
+  settings->recorder = recorder;
+  return true;
+}
+
+// Called after each draw, with the number of game ticks since the last one.
+internal void
+RECORDER_update(ENGINE* engine, size_t ticks) {
+  RECORDER* recorder = engine->record.recorder;
+  if (recorder == NULL) {
+    return;
+  }
+  recorder->pendingTicks += ticks;
+  if (recorder->pendingTicks < recorder->interval) {
+    return;
+  }
+
+  RECORDER_FRAME* frame = &recorder->frames[recorder->captured % RECORDER_RING_SIZE];
+  if (SDL_AtomicGet(&frame->state) != RECORDER_FRAME_FREE) {
+    // Every earlier frame has been written, so once this one's task is
+    // done, so is its write.
+    ABC_FIFO_waitForGroup(&engine->fifo, &frame->group);
+  }
+
+  memcpy(frame->pixels, engine->pixels, recorder->width * recorder->height * 4);
+  frame->number = recorder->captured++;
+  frame->ticks = recorder->pendingTicks;
+  recorder->pendingTicks = 0;
+  SDL_AtomicSet(&frame->state, RECORDER_FRAME_QUEUED);
+
+  INIT_TO_ZERO(ABC_TASK, task);
+  task.type = TASK_ENCODE_FRAME;
+  task.data = frame;
+  ABC_FIFO_pushGroupTask(&engine->fifo, &frame->group, task);
+}
+
+// Waits for the remaining frames and closes the recording.
+internal void
+RECORDER_finish(ENGINE* engine) {
+  RECORDER* recorder = engine->record.recorder;
+  if (recorder == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < RECORDER_RING_SIZE; i++) {
+    RECORDER_FRAME* frame = &recorder->frames[i];
+    ABC_FIFO_waitForGroup(&engine->fifo, &frame->group);
+    ABC_FIFO_destroyGroup(&frame->group);
+    free(frame->pixels);
+    free(frame->scaled);
+  }
+
+  if (recorder->format == RECORDER_FORMAT_GIF) {
+    jo_gif_end(&recorder->gif);
+  } else if (recorder->file != NULL) {
+    fclose(recorder->file);
+  }
+  ENGINE_printLog(engine, "Recorded %zu frames to %s\n", recorder->written, engine->record.path);
+
+  SDL_DestroyMutex(recorder->writeLock);
+  free(recorder->path);
+  free(recorder);
+  engine->record.recorder = NULL;
+}
@@ -0,0 +1,207 @@
+/*
+ replay.c
+
+ Records the input snapshot that each update() sees, and plays it back.
+
+ The file starts with a short header, followed by one record per tick. A
+ record lists the bytes of the INPUT_FRAME which changed since the previous
+ tick, as a count followed by offset and value pairs, so a tick where
+ nothing changed costs two bytes. Values are written in the host's byte
+ order, so recordings are only meant to be replayed on the same kind of
+ machine.
+
+ While replaying, real input is ignored and the game loop runs exactly one
+ tick per frame without waiting, so a replay doubles as a benchmark. DOME
+ exits when the recording runs out. Gamepads are connected and disconnected
+ on the ticks the recording says, as stand-ins bound to the recorded slots,
+ so no real gamepad is needed.
+
+ If writing a recording fails, recording stops there and the game carries
+ on. The ticks written so far still replay.
+ */
+
+#define REPLAY_MAGIC "DOMEINPT"
+#define REPLAY_VERSION 2
+
+typedef enum {
+  REPLAY_OFF,
+  REPLAY_RECORD,
+  REPLAY_PLAY
+} REPLAY_MODE;
+
+typedef struct {
+  REPLAY_MODE mode;
+  char* path;
+  FILE* file;
+  INPUT_FRAME previous;
+  uint64_t ticks;
+  uint64_t startTime;
+} REPLAY;
+
+global_variable REPLAY replay;
+
+// Stops recording after a failed write, keeping what was written.
+internal void
+REPLAY_abandon(int error) {
+  LOG_print(LOG_ERROR, LOG_IO, "Could not write input recording %s: %s. Recording stopped after %llu ticks.\n",
+      replay.path, strerror(error), (unsigned long long)replay.ticks);
+  fclose(replay.file);
+  replay.file = NULL;
+  replay.mode = REPLAY_OFF;
+}
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t frameSize;
+} REPLAY_HEADER;
+
+internal bool
+REPLAY_start(ENGINE* engine) {
+  if (replay.mode == REPLAY_OFF) {
+    return true;
+  }
+  bool recording = replay.mode == REPLAY_RECORD;
+  replay.file = fopen(replay.path, recording ? "wb" : "rb");
+  if (replay.file == NULL) {
+    LOG_print(LOG_ERROR, LOG_IO, "Could not open %s for input %s\n", replay.path, recording ? "recording" : "replay");
+    replay.mode = REPLAY_OFF;
+    return false;
+  }
+
+  INIT_TO_ZERO(REPLAY_HEADER, header);
+  if (recording) {
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.frameSize = sizeof(INPUT_FRAME);
+    errno = 0;
+    if (fwrite(&header, sizeof(header), 1, replay.file) != 1) {
+      REPLAY_abandon(errno != 0 ? errno : EIO);
+      return false;
+    }
+  } else {
+    bool valid = fread(&header, sizeof(header), 1, replay.file) == 1
+      && memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) == 0
+      && header.version == REPLAY_VERSION
+      && header.frameSize == sizeof(INPUT_FRAME);
+    if (!valid) {
+      LOG_print(LOG_ERROR, LOG_IO, "%s is not an input recording from this version of DOME\n", replay.path);
+      fclose(replay.file);
+      replay.file = NULL;
+      replay.mode = REPLAY_OFF;
+      return false;
+    }
+  }
+
+  memset(&replay.previous, 0, sizeof(INPUT_FRAME));
+  replay.ticks = 0;
+  replay.startTime = SDL_GetPerformanceCounter();
+  return true;
+}
+
+// Returns errno, or EIO, if the record couldn't be written.
+internal int
+REPLAY_write(INPUT_FRAME* frame) {
+  uint8_t* current = (uint8_t*)frame;
+  uint8_t* previous = (uint8_t*)&replay.previous;
+  // The frame is only about a kilobyte, so offsets fit in 16 bits
+  uint8_t changes[sizeof(INPUT_FRAME) * 3];
+  uint16_t count = 0;
+  for (size_t i = 0; i < sizeof(INPUT_FRAME); i++) {
+    if (current[i] != previous[i]) {
+      uint16_t offset = i;
+      memcpy(changes + count * 3, &offset, sizeof(offset));
+      changes[count * 3 + 2] = current[i];
+      count++;
+    }
+  }
+  errno = 0;
+  if (fwrite(&count, sizeof(count), 1, replay.file) != 1
+      || fwrite(changes, 3, count, replay.file) != count) {
+    return errno != 0 ? errno : EIO;
+  }
+  return 0;
+}
+
+internal bool
+REPLAY_read(INPUT_FRAME* frame) {
+  uint8_t* previous = (uint8_t*)&replay.previous;
+  uint16_t count;
+  if (fread(&count, sizeof(count), 1, replay.file) != 1) {
+    return false;
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t change[3];
+    if (fread(change, 3, 1, replay.file) != 1) {
+      return false;
+    }
+    uint16_t offset;
+    memcpy(&offset, change, sizeof(offset));
+    if (offset < sizeof(INPUT_FRAME)) {
+      previous[offset] = change[2];
+    }
+  }
+  *frame = replay.previous;
+  return true;
+}
+
+// Called after the input snapshot is taken for a tick. While replaying, the
+// snapshot is replaced with the recorded one.
+internal void
+REPLAY_tick(ENGINE* engine) {
+  INPUT_FRAME* frame = &inputState.frame;
+  if (replay.mode == REPLAY_RECORD) {
+    int error = REPLAY_write(frame);
+    if (error != 0) {
+      REPLAY_abandon(error);
+      return;
+    }
+  } else if (replay.mode == REPLAY_PLAY) {
+    INPUT_PAD_FRAME pads[INPUT_MAX_GAMEPADS];
+    memcpy(pads, replay.previous.pads, sizeof(pads));
+    if (!REPLAY_read(frame)) {
+      engine->running = false;
+      return;
+    }
+    // Dispatched before this tick's update, as they were when recorded
+    for (int i = 0; i < INPUT_MAX_GAMEPADS; i++) {
+      bool present = frame->pads[i].present != 0;
+      bool wasPresent = pads[i].present != 0;
+      // Unless the game closed it itself, which it will have done again
+      bool open = inputState.pads[i] != NULL;
+      if (wasPresent && open && (!present || pads[i].id != frame->pads[i].id)) {
+        INPUT_pushEvent(INPUT_EVENT_GAMEPAD_REMOVED, pads[i].id);
+      }
+      if (present && (!wasPresent || pads[i].id != frame->pads[i].id)) {
+        INPUT_pushEvent(INPUT_EVENT_GAMEPAD_ADDED, GAMEPAD_REPLAY_ID(i));
+      }
+    }
+  } else {
+    return;
+  }
+  replay.previous = *frame;
+  replay.ticks++;
+}
+
+internal void
+REPLAY_finish(ENGINE* engine) {
+  if (replay.mode == REPLAY_OFF) {
+    return;
+  }
+  double seconds = (double)(SDL_GetPerformanceCounter() - replay.startTime) / SDL_GetPerformanceFrequency();
+  if (replay.mode == REPLAY_RECORD) {
+    // Whatever is still buffered is written now, and can fail too
+    errno = 0;
+    if (fflush(replay.file) != 0) {
+      REPLAY_abandon(errno != 0 ? errno : EIO);
+      return;
+    }
+    ENGINE_printLog(engine, "Recorded input for %llu ticks to %s\n", (unsigned long long)replay.ticks, replay.path);
+  } else {
+    ENGINE_printLog(engine, "Replayed %llu ticks in %.3fs (%.1f ticks per second)\n",
+        (unsigned long long)replay.ticks, seconds, seconds > 0 ? replay.ticks / seconds : 0.0);
+  }
+  fclose(replay.file);
+  replay.file = NULL;
+  replay.mode = REPLAY_OFF;
+}
@@ -33,6 +33,98 @@ char* readEntireFile(char* path, size_t* lengthPtr) {
   return source;
 }
 
+void copyString(const char* src, size_t length, size_t* i, char* out, size_t* o);
+
+// Copies code inside an interpolation up to its closing parenthesis
+void copyInterpolation(const char* src, size_t length, size_t* i, char* out, size_t* o) {
+  int depth = 1;
+  while (*i < length && depth > 0) {
+    char c = src[*i];
+    if (c == '"') {
+      copyString(src, length, i, out, o);
+      continue;
+    }
+    if (c == '(') {
+      depth++;
+    } else if (c == ')') {
+      depth--;
+    }
+    out[(*o)++] = c;
+    (*i)++;
+  }
+}
+
+// Copies a string literal, including its quotes, exactly as written
+void copyString(const char* src, size_t length, size_t* i, char* out, size_t* o) {
+  out[(*o)++] = src[(*i)++];
+  while (*i < length) {
+    char c = src[*i];
+    out[(*o)++] = c;
+    (*i)++;
+    if (c == '\\' && *i < length) {
+      out[(*o)++] = src[(*i)++];
+    } else if (c == '%' && *i < length && src[*i] == '(') {
+      out[(*o)++] = src[(*i)++];
+      copyInterpolation(src, length, i, out, o);
+    } else if (c == '"') {
+      return;
+    }
+  }
+}
+
+// Drops comments and indentation, so there is less for Wren to scan each
+// time the module is imported. Every newline is kept, so line numbers in
+// error messages still match the original file.
+size_t stripSource(const char* src, size_t length, char* out) {
+  size_t i = 0;
+  size_t o = 0;
+  int lineStart = 1;
+  while (i < length) {
+    char c = src[i];
+    if (lineStart && (c == ' ' || c == '\t' || c == '\r')) {
+      i++;
+      continue;
+    }
+    lineStart = 0;
+
+    if (c == '"') {
+      copyString(src, length, &i, out, &o);
+    } else if (c == '/' && i + 1 < length && src[i + 1] == '/') {
+      while (i < length && src[i] != '\n') {
+        i++;
+      }
+    } else if (c == '/' && i + 1 < length && src[i + 1] == '*') {
+      // Block comments nest in Wren
+      int depth = 0;
+      do {
+        if (src[i] == '/' && i + 1 < length && src[i + 1] == '*') {
+          depth++;
+          i += 2;
+        } else if (src[i] == '*' && i + 1 < length && src[i + 1] == '/') {
+          depth--;
+          i += 2;
+        } else {
+          if (src[i] == '\n') {
+            out[o++] = '\n';
+          }
+          i++;
+        }
+      } while (i < length && depth > 0);
+    } else if (c == '\n') {
+      while (o > 0 && (out[o - 1] == ' ' || out[o - 1] == '\t' || out[o - 1] == '\r')) {
+        o--;
+      }
+      out[o++] = '\n';
+      lineStart = 1;
+      i++;
+    } else {
+      out[o++] = c;
+      i++;
+    }
+  }
+  return o;
+}
+
 int main(int argc, char* args[])
 {
   if (argc != 4) {
@@ -40,19 +132,24 @@ int main(int argc, char* args[])
     printf("Not enough arguments.\n");
     return EXIT_FAILURE;
   } 
-  size_t length;
-  char* fileToConvert = readEntireFile(args[1], &length);
+  size_t sourceLength;
+  char* source = readEntireFile(args[1], &sourceLength);
+  char* fileToConvert = malloc(sourceLength + 1);
+  size_t length = stripSource(source, sourceLength, fileToConvert);
+  free(source);
   char* moduleName = args[2];
   FILE *fp;
   fp = fopen(args[3], "w+");
   fputs("// auto-generated file, do not modify\n", fp);
-  fputs("const char* ", fp);
+  fputs("const char ", fp);
   fputs(moduleName, fp);
-  fputs(" = \"", fp);
+  fputs("[] = \"", fp);
   for (size_t i = 0; i < length; i++ ) {
     char* ptr = fileToConvert + i;
     if (*ptr == '\"') {
       fputs("\\\"", fp);
+    } else if (*ptr == '\\') {
+      fputs("\\\\", fp);
     } else if (*ptr == '\n') {
       fputs("\\n\"", fp);
       fputs("\n", fp);
@@ -10,7 +10,9 @@ declare -a arr=(
 "audio"
 "vector"
 "image"
+"assets"
 "math"
+"serialize"
 )
  
 declare -a opts=(
@@ -27,7 +29,7 @@ for i in "${arr[@]}"
 do
   ./embed ../modules/${i}.wren ${i}Module ../modules/${i}.wren.inc
   echo "#include \"${i}.wren.inc\"" >> ../modules/modules.inc
-  echo "MAP_addModule(map, \"${i}\", ${i}Module);" >> ../modules/modulemap.c.inc
+  echo "MAP_addModule(map, \"${i}\", ${i}Module, sizeof(${i}Module) - 1);" >> ../modules/modulemap.c.inc
 done
 
 for i in "${opts[@]}"
@@ -38,6 +40,6 @@ do
   echo "#include \"${i}.wren.inc\"" >> ../modules/modules.inc
   echo "#endif" >> ../modules/modules.inc
   echo "#if DOME_OPT_${UPPER}" >> ../modules/modulemap.c.inc
-  echo "MAP_addModule(map, \"${i}\", ${i}Module);" >> ../modules/modulemap.c.inc
+  echo "MAP_addModule(map, \"${i}\", ${i}Module, sizeof(${i}Module) - 1);" >> ../modules/modulemap.c.inc
   echo "#endif" >> ../modules/modulemap.c.inc
 done
@@ -5,68 +5,8 @@ VM_bind_foreign_class(WrenVM* vm, const char* module, const char* className) {
   methods.allocate = NULL;
   methods.finalize = NULL;
 
-  #if DOME_OPT_FFI
-
-  if (STRINGS_EQUAL(module, "ffi")) {
-    if (STRINGS_EQUAL(className, "LibraryHandle")) {
-      methods.allocate = LIBRARY_HANDLE_allocate;
-      methods.finalize = LIBRARY_HANDLE_finalize;
-    } else if (STRINGS_EQUAL(className, "Function")) {
-      methods.allocate = FUNCTION_allocate;
-      methods.finalize = FUNCTION_finalize;
-    } else if (STRINGS_EQUAL(className, "StructTypeData")) {
-      methods.allocate = STRUCT_TYPE_allocate;
-      methods.finalize = STRUCT_TYPE_finalize;
-    } else if (STRINGS_EQUAL(className, "Struct")) {
-      methods.allocate = STRUCT_allocate;
-      methods.finalize = STRUCT_finalize;
-    } else if (STRINGS_EQUAL(className, "Pointer")) {
-      methods.allocate = POINTER_allocate;
-    }
-  }
-  #endif
-  if (STRINGS_EQUAL(module, "image")) {
-    if (STRINGS_EQUAL(className, "ImageData")) {
-      methods.allocate = IMAGE_allocate;
-      methods.finalize = IMAGE_finalize;
-    } else if (STRINGS_EQUAL(className, "DrawCommand")) {
-      methods.allocate = DRAW_COMMAND_allocate;
-      methods.finalize = DRAW_COMMAND_finalize;
-    }
-  } else if (STRINGS_EQUAL(module, "io")) {
-    if (STRINGS_EQUAL(className, "DataBuffer")) {
-      methods.allocate = DBUFFER_allocate;
-      methods.finalize = DBUFFER_finalize;
-    } else if (STRINGS_EQUAL(className, "AsyncOperation")) {
-      methods.allocate = ASYNCOP_allocate;
-      methods.finalize = ASYNCOP_finalize;
-    }
-  } else if (STRINGS_EQUAL(module, "audio")) {
-    if (STRINGS_EQUAL(className, "AudioData")) {
-      methods.allocate = AUDIO_allocate;
-      methods.finalize = AUDIO_finalize;
-    } else if (STRINGS_EQUAL(className, "SystemChannel")) {
-      methods.allocate = AUDIO_CHANNEL_allocate;
-      methods.finalize = AUDIO_CHANNEL_finalize;
-    }
-  } else if (STRINGS_EQUAL(module, "input")) {
-    if (STRINGS_EQUAL(className, "GamePad")) {
-      methods.allocate = GAMEPAD_allocate;
-      methods.finalize = GAMEPAD_finalize;
-    }
-  } else if (STRINGS_EQUAL(module, "font")) {
-    if (STRINGS_EQUAL(className, "FontFile")) {
-      methods.allocate = FONT_allocate;
-      methods.finalize = FONT_finalize;
-    } else if (STRINGS_EQUAL(className, "RasterizedFont")) {
-      methods.allocate = FONT_RASTER_allocate;
-      methods.finalize = FONT_RASTER_finalize;
-    }
-  } else {
-    // TODO: Check if it's a module we lazy-loaded
-
-  }
-
+  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
+  MAP_getClass(&engine->moduleMap, module, className, &methods);
   return methods;
 }
 
@@ -77,47 +17,37 @@ internal WrenForeignMethodFn VM_bind_foreign_method(
     bool isStatic,
     const char* signature) {
 
-  // This file is seperate because it has a Copyright notice with it.
-#include "signature.c.inc"
+  char fullName[256];
+  snprintf(fullName, sizeof(fullName), "%s%s.%s", isStatic ? "static " : "", className, signature);
 
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
-  MAP moduleMap = engine->moduleMap;
-  return MAP_getFunction(&moduleMap, module, fullName);
+  return MAP_getFunction(&engine->moduleMap, module, fullName);
 }
 
 internal char* VM_load_module(WrenVM* vm, const char* name) {
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
-  MAP moduleMap = engine->moduleMap;
 
-  if (DEBUG_MODE) {
-    ENGINE_printLog(engine, "Loading module %s from ", name);
-  }
+  LOG_print(LOG_DEBUG, LOG_SCRIPT, "Loading module %s from ", name);
 
   // Check against wren optional modules
 #if WREN_OPT_META
   if (strcmp(name, "meta") == 0) {
-    if (DEBUG_MODE) {
-      ENGINE_printLog(engine, "wren\n", name);
-    }
+    LOG_print(LOG_DEBUG, LOG_SCRIPT, "wren\n");
     return NULL;
   }
 #endif
 #if WREN_OPT_RANDOM
   if (strcmp(name, "random") == 0) {
-    if (DEBUG_MODE) {
-      ENGINE_printLog(engine, "wren\n", name);
-    }
+    LOG_print(LOG_DEBUG, LOG_SCRIPT, "wren\n");
     return NULL;
   }
 #endif
 
   // Check against dome modules
-  char* module = (char*)MAP_getSource(&moduleMap, name);
+  char* module = (char*)MAP_getSource(&engine->moduleMap, name);
 
   if (module != NULL) {
-    if (DEBUG_MODE) {
-      ENGINE_printLog(engine, "dome\n", name);
-    }
+    LOG_print(LOG_DEBUG, LOG_SCRIPT, "dome\n");
     return module;
   }
 
@@ -128,21 +58,25 @@ internal char* VM_load_module(WrenVM* vm, const char* name) {
   strcpy(path, name); /* add the extension */
   strcat(path, extension); /* add the extension */
 
-  if (DEBUG_MODE) {
-    ENGINE_printLog(engine, "%s\n", engine->tar ? "egg bundle" : "filesystem");
-  }
-
-  // This pointer becomes owned by the WrenVM and freed later.
-  char* file = ENGINE_readFile(engine, path, NULL);
+  LOG_print(LOG_DEBUG, LOG_SCRIPT, "%s\n", (engine->tar || engine->pack) ? "egg bundle" : "filesystem");
 
+  FILE_VIEW view;
+  bool found = ENGINE_openFileView(engine, path, &view);
   free(path);
+  if (!found) {
+    return NULL;
+  }
+
+  // This pointer becomes owned by the WrenVM and freed later, through
+  // our allocator.
+  char* file = MEMORY_copyString(view.data, view.length);
+  FILE_VIEW_close(&view);
   return file;
 }
 
 // Debug output for VM
 internal void VM_write(WrenVM* vm, const char* text) {
-  ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
-  ENGINE_printLog(engine, "%s", text);
+  LOG_print(LOG_INFO, LOG_SCRIPT, "%s", text);
 }
 
 internal void VM_error(WrenVM* vm, WrenErrorType type, const char* module,
@@ -151,9 +85,7 @@ internal void VM_error(WrenVM* vm, WrenErrorType type, const char* module,
   ENGINE* engine = (ENGINE*)wrenGetUserData(vm);
 
   if (DEBUG_MODE == false) {
-    MAP moduleMap = engine->moduleMap;
-
-    if (module != NULL && MAP_getModule(&moduleMap, module) != NULL) {
+    if (module != NULL && MAP_getModule(&engine->moduleMap, module) != NULL) {
       return;
     }
   }
@@ -196,12 +128,43 @@ internal WrenVM* VM_create(ENGINE* engine) {
   config.bindForeignMethodFn = VM_bind_foreign_method;
   config.bindForeignClassFn = VM_bind_foreign_class;
   config.loadModuleFn = VM_load_module;
+  config.reallocateFn = MEMORY_reallocate;
+  // The allocator decides when to collect, from the heap settings
+  config.initialHeapSize = SIZE_MAX;
+  config.minHeapSize = SIZE_MAX;
+  config.heapGrowthPercent = memory.heapGrowthPercent;
 
   WrenVM* vm = wrenNewVM(&config);
   wrenSetUserData(vm, engine);
+  MEMORY_attach(vm);
 
   // Set modules
 
+  // Foreign classes
+#if DOME_OPT_FFI
+  MAP_addClass(&engine->moduleMap, "ffi", "LibraryHandle", LIBRARY_HANDLE_allocate, LIBRARY_HANDLE_finalize);
+  MAP_addClass(&engine->moduleMap, "ffi", "Function", FUNCTION_allocate, FUNCTION_finalize);
+  MAP_addClass(&engine->moduleMap, "ffi", "StructTypeData", STRUCT_TYPE_allocate, STRUCT_TYPE_finalize);
+  MAP_addClass(&engine->moduleMap, "ffi", "Struct", STRUCT_allocate, STRUCT_finalize);
+  MAP_addClass(&engine->moduleMap, "ffi", "Pointer", POINTER_allocate, NULL);
+#endif
+  MAP_addClass(&engine->moduleMap, "image", "ImageData", IMAGE_allocate, IMAGE_finalize);
+  MAP_addClass(&engine->moduleMap, "image", "DrawCommand", DRAW_COMMAND_allocate, DRAW_COMMAND_finalize);
+  MAP_addClass(&engine->moduleMap, "io", "DataBuffer", DBUFFER_allocate, DBUFFER_finalize);
+  MAP_addClass(&engine->moduleMap, "io", "AsyncOperation", ASYNCOP_allocate, ASYNCOP_finalize);
+  MAP_addClass(&engine->moduleMap, "io", "FileStream", FILE_STREAM_allocate, FILE_STREAM_finalize);
+  MAP_addClass(&engine->moduleMap, "io", "DirectoryWalk", DIRECTORY_WALK_allocate, DIRECTORY_WALK_finalize);
+  MAP_addClass(&engine->moduleMap, "serialize", "SerialWriter", SERIAL_WRITER_allocate, SERIAL_WRITER_finalize);
+  MAP_addClass(&engine->moduleMap, "serialize", "SerialReader", SERIAL_READER_allocate, SERIAL_READER_finalize);
+  MAP_addClass(&engine->moduleMap, "audio", "AudioData", AUDIO_allocate, AUDIO_finalize);
+  MAP_addClass(&engine->moduleMap, "audio", "SystemChannel", AUDIO_CHANNEL_allocate, AUDIO_CHANNEL_finalize);
+  MAP_addClass(&engine->moduleMap, "input", "GamePad", GAMEPAD_allocate, GAMEPAD_finalize);
+  MAP_addClass(&engine->moduleMap, "assets", "AssetBatch", ASSET_BATCH_allocate, ASSET_BATCH_finalize);
+  MAP_addClass(&engine->moduleMap, "font", "FontFile", FONT_allocate, FONT_finalize);
+  MAP_addClass(&engine->moduleMap, "font", "RasterizedFont", FONT_RASTER_allocate, FONT_RASTER_finalize);
+  MAP_addClass(&engine->moduleMap, "graphics", "Color", COLOR_allocate, NULL);
+  MAP_addClass(&engine->moduleMap, "vector", "Vector", VECTOR_allocate, NULL);
+
   // DOME
   MAP_addFunction(&engine->moduleMap, "dome", "static Process.f_exit(_)", PROCESS_exit);
   MAP_addFunction(&engine->moduleMap, "dome", "static Window.resize(_,_)", WINDOW_resize);
@@ -214,15 +177,43 @@ internal WrenVM* VM_create(ENGINE* engine) {
   MAP_addFunction(&engine->moduleMap, "dome", "static Window.width", WINDOW_getWidth);
   MAP_addFunction(&engine->moduleMap, "dome", "static Window.height", WINDOW_getHeight);
   MAP_addFunction(&engine->moduleMap, "dome", "static Version.toString", VERSION_getString);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.bytes", MEMORY_getBytes);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.peakBytes", MEMORY_getPeakBytes);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.reserved", MEMORY_getReserved);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.allocations", MEMORY_getAllocations);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.frees", MEMORY_getFrees);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.frameAllocations", MEMORY_getFrameAllocations);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.frameBytes", MEMORY_getFrameBytes);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.heapSize", MEMORY_getHeapSize);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.minHeapSize", MEMORY_getMinHeapSize);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.heapGrowth", MEMORY_getHeapGrowth);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.heapSize=(_)", MEMORY_setHeapSize);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.minHeapSize=(_)", MEMORY_setMinHeapSize);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.heapGrowth=(_)", MEMORY_setHeapGrowth);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.collect()", MEMORY_collect);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.requestCollection()", MEMORY_requestCollection);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.collections", MEMORY_getCollections);
+  MAP_addFunction(&engine->moduleMap, "dome", "static Memory.collectTime", MEMORY_getCollectTime);
 
 #if DOME_OPT_FFI
   // FFI
   MAP_addFunction(&engine->moduleMap, "ffi", "Function.f_call(_)", FUNCTION_call);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke()", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_,_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_,_,_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_,_,_,_,_)", FUNCTION_callDirect);
+  MAP_addFunction(&engine->moduleMap, "ffi", "Function.invoke(_,_,_,_,_,_,_,_)", FUNCTION_callDirect);
   MAP_addFunction(&engine->moduleMap, "ffi", "StructTypeData.getMemberOffset(_)", STRUCT_TYPE_getOffset);
   MAP_addFunction(&engine->moduleMap, "ffi", "Struct.getValue(_)", STRUCT_getValue);
   MAP_addFunction(&engine->moduleMap, "ffi", "Pointer.asString()", POINTER_asString);
   MAP_addFunction(&engine->moduleMap, "ffi", "Pointer.asBytes(_)", POINTER_asBytes);
   MAP_addFunction(&engine->moduleMap, "ffi", "static Pointer.reserve(_)", POINTER_reserve);
+  MAP_addFunction(&engine->moduleMap, "ffi", "static Pointer.f_capture()", POINTER_capture);
+  MAP_addFunction(&engine->moduleMap, "ffi", "static Struct.f_capture()", STRUCT_capture);
   MAP_addFunction(&engine->moduleMap, "ffi", "Pointer.free()", POINTER_free);
 #endif
 
@@ -237,9 +228,74 @@ internal WrenVM* VM_create(ENGINE* engine) {
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_circlefill(_,_,_,_)", CANVAS_circle_filled);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_ellipse(_,_,_,_,_)", CANVAS_ellipse);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_ellipsefill(_,_,_,_,_)", CANVAS_ellipsefill);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_polygon(_,_)", CANVAS_polygon);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_polygonfill(_,_)", CANVAS_polygonfill);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_trianglefill(_,_,_,_,_,_,_)", CANVAS_trianglefill);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_trianglefill(_,_,_,_,_,_,_,_,_)", CANVAS_trianglefillGradient);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_print(_,_,_,_)", CANVAS_print);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.offset(_,_)", CANVAS_offset);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_resize(_,_,_)", CANVAS_resize);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_screenshot(_,_,_)", CANVAS_screenshot);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.getRegion(_,_,_,_)", CANVAS_getRegion);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.setRegion(_,_,_,_,_)", CANVAS_setRegion);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_paletteMap(_,_,_,_,_)", CANVAS_paletteMap);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.f_threshold(_,_,_,_,_,_,_)", CANVAS_threshold);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.colorMatrix(_,_,_,_,_)", CANVAS_colorMatrix);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.indexed", CANVAS_getIndexed);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.indexed=(_)", CANVAS_setIndexed);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.f_get(_)", PALETTE_get);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.f_set(_,_)", PALETTE_set);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.swap(_,_)", PALETTE_swap);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.remap(_,_)", PALETTE_remap);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.resetRemap()", PALETTE_resetRemap);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.cycle(_,_,_)", PALETTE_cycle);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.clearCycles()", PALETTE_clearCycles);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static Palette.f_fade(_,_)", PALETTE_fade);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.clear()", POSTPROCESS_reset);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.scanlines(_)", POSTPROCESS_addScanlines);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.curvature(_)", POSTPROCESS_addCurvature);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.bloom(_,_)", POSTPROCESS_addBloom);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.f_grade(_,_,_)", POSTPROCESS_addGrade);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.dither(_)", POSTPROCESS_addDither);
+  MAP_addFunction(&engine->moduleMap, "graphics", "static PostProcess.upscale(_)", POSTPROCESS_addUpscale);
+
+  // Color
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.setrgb(_,_,_,_)", COLOR_setRGB);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.f_setNum(_)", COLOR_setNum);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.toNum", COLOR_toNum);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.r", COLOR_getR);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.g", COLOR_getG);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.b", COLOR_getB);
+  MAP_addFunction(&engine->moduleMap, "graphics", "Color.a", COLOR_getA);
+
+  // Vector
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.x", VECTOR_getX);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.y", VECTOR_getY);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.z", VECTOR_getZ);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.w", VECTOR_getW);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.x=(_)", VECTOR_setX);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.y=(_)", VECTOR_setY);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.z=(_)", VECTOR_setZ);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.w=(_)", VECTOR_setW);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.manhattan", VECTOR_getManhattan);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.length", VECTOR_getLength);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.unit", VECTOR_getUnit);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.perp", VECTOR_getPerp);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector./(_)", VECTOR_divide);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.*(_)", VECTOR_times);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.-", VECTOR_negate);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.scale(_)", VECTOR_scale);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.normalize()", VECTOR_normalize);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.set(_,_)", VECTOR_set);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.set(_,_,_)", VECTOR_set);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.set(_,_,_,_)", VECTOR_set);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_dot(_)", VECTOR_dot);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_cross(_)", VECTOR_cross);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_plus(_)", VECTOR_plus);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_minus(_)", VECTOR_minus);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_equals(_)", VECTOR_equals);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_add(_)", VECTOR_add);
+  MAP_addFunction(&engine->moduleMap, "vector", "Vector.f_sub(_)", VECTOR_sub);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.width", CANVAS_getWidth);
   MAP_addFunction(&engine->moduleMap, "graphics", "static Canvas.height", CANVAS_getHeight);
 
@@ -250,8 +306,21 @@ internal WrenVM* VM_create(ENGINE* engine) {
   MAP_addFunction(&engine->moduleMap, "image", "ImageData.draw(_,_)", IMAGE_draw);
   MAP_addFunction(&engine->moduleMap, "image", "ImageData.width", IMAGE_getWidth);
   MAP_addFunction(&engine->moduleMap, "image", "ImageData.height", IMAGE_getHeight);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.getRegion(_,_,_,_)", IMAGE_getRegion);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.setRegion(_,_,_,_,_)", IMAGE_setRegion);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.f_paletteMap(_,_,_,_,_)", IMAGE_paletteMap);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.f_threshold(_,_,_,_,_,_,_)", IMAGE_threshold);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.colorMatrix(_,_,_,_,_)", IMAGE_colorMatrix);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.toIndexed()", IMAGE_toIndexed);
+  MAP_addFunction(&engine->moduleMap, "image", "ImageData.f_triangle(_)", IMAGE_triangle);
   MAP_addFunction(&engine->moduleMap, "image", "DrawCommand.draw(_,_)", DRAW_COMMAND_draw);
 
+  // Assets
+  MAP_addFunction(&engine->moduleMap, "assets", "AssetBatch.count", ASSET_BATCH_getCount);
+  MAP_addFunction(&engine->moduleMap, "assets", "AssetBatch.loaded", ASSET_BATCH_getLoaded);
+  MAP_addFunction(&engine->moduleMap, "assets", "AssetBatch.f_type(_)", ASSET_BATCH_getType);
+  MAP_addFunction(&engine->moduleMap, "assets", "AssetBatch.f_error(_)", ASSET_BATCH_getError);
+
   // Audio
   MAP_addFunction(&engine->moduleMap, "audio", "SystemChannel.enabled=(_)", AUDIO_CHANNEL_setEnabled);
   MAP_addFunction(&engine->moduleMap, "audio", "SystemChannel.enabled", AUDIO_CHANNEL_getEnabled);
@@ -278,6 +347,7 @@ internal WrenVM* VM_create(ENGINE* engine) {
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.f_load(_,_)", FILESYSTEM_loadAsync);
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.load(_)", FILESYSTEM_loadSync);
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.save(_,_)", FILESYSTEM_saveSync);
+  MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.f_save(_,_,_,_)", FILESYSTEM_saveAsync);
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.listFiles(_)", FILESYSTEM_listFiles);
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.listDirectories(_)", FILESYSTEM_listDirectories);
   MAP_addFunction(&engine->moduleMap, "io", "static FileSystem.prefPath(_,_)", FILESYSTEM_getPrefPath);
@@ -289,32 +359,142 @@ internal WrenVM* VM_create(ENGINE* engine) {
   MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.f_data", DBUFFER_getData);
   MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.ready", DBUFFER_getReady);
   MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.f_length", DBUFFER_getLength);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.length=(_)", DBUFFER_setLength);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.append(_)", DBUFFER_append);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.f_slice(_,_)", DBUFFER_slice);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.[_]", DBUFFER_getUint8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.[_]=(_)", DBUFFER_setUint8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getUint8(_)", DBUFFER_getUint8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getInt8(_)", DBUFFER_getInt8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getUint16(_)", DBUFFER_getUint16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getUint16(_,_)", DBUFFER_getUint16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getInt16(_)", DBUFFER_getInt16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getInt16(_,_)", DBUFFER_getInt16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getUint32(_)", DBUFFER_getUint32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getUint32(_,_)", DBUFFER_getUint32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getInt32(_)", DBUFFER_getInt32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getInt32(_,_)", DBUFFER_getInt32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getFloat32(_)", DBUFFER_getFloat32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getFloat32(_,_)", DBUFFER_getFloat32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getFloat64(_)", DBUFFER_getFloat64);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.getFloat64(_,_)", DBUFFER_getFloat64);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setUint8(_,_)", DBUFFER_setUint8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setInt8(_,_)", DBUFFER_setInt8);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setUint16(_,_)", DBUFFER_setUint16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setUint16(_,_,_)", DBUFFER_setUint16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setInt16(_,_)", DBUFFER_setInt16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setInt16(_,_,_)", DBUFFER_setInt16);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setUint32(_,_)", DBUFFER_setUint32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setUint32(_,_,_)", DBUFFER_setUint32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setInt32(_,_)", DBUFFER_setInt32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setInt32(_,_,_)", DBUFFER_setInt32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setFloat32(_,_)", DBUFFER_setFloat32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setFloat32(_,_,_)", DBUFFER_setFloat32);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setFloat64(_,_)", DBUFFER_setFloat64);
+  MAP_addFunction(&engine->moduleMap, "io", "DataBuffer.setFloat64(_,_,_)", DBUFFER_setFloat64);
 
   // AsyncOperation
   MAP_addFunction(&engine->moduleMap, "io", "AsyncOperation.result", ASYNCOP_getResult);
   MAP_addFunction(&engine->moduleMap, "io", "AsyncOperation.complete", ASYNCOP_getComplete);
+  MAP_addFunction(&engine->moduleMap, "io", "AsyncOperation.error", ASYNCOP_getError);
+
+  // FileStream
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.length", FILE_STREAM_getLength);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.position", FILE_STREAM_getPosition);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.position=(_)", FILE_STREAM_setPosition);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.atEnd", FILE_STREAM_getAtEnd);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.read(_)", FILE_STREAM_readString);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.readBuffer(_)", FILE_STREAM_readBuffer);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.readLine()", FILE_STREAM_readLine);
+  MAP_addFunction(&engine->moduleMap, "io", "FileStream.close()", FILE_STREAM_closeMethod);
+
+  // DirectoryWalk
+  MAP_addFunction(&engine->moduleMap, "io", "DirectoryWalk.complete", DIRECTORY_WALK_getComplete);
+  MAP_addFunction(&engine->moduleMap, "io", "DirectoryWalk.error", DIRECTORY_WALK_getError);
+  MAP_addFunction(&engine->moduleMap, "io", "DirectoryWalk.files", DIRECTORY_WALK_getFiles);
+
+  // Serialize
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_write(_)", SERIAL_WRITER_write);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_writeBytes(_)", SERIAL_WRITER_writeBytes);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_writeList(_,_)", SERIAL_WRITER_writeList);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_beginMap(_)", SERIAL_WRITER_beginMap);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_beginObject(_)", SERIAL_WRITER_beginObject);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialWriter.f_finish()", SERIAL_WRITER_finish);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.version", SERIAL_READER_getVersion);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.f_read()", SERIAL_READER_read);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.f_kind", SERIAL_READER_getKind);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.f_count", SERIAL_READER_getCount);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.f_name", SERIAL_READER_getName);
+  MAP_addFunction(&engine->moduleMap, "serialize", "SerialReader.f_done", SERIAL_READER_getDone);
 
   // Input
-  MAP_addFunction(&engine->moduleMap, "input", "static Keyboard.isKeyDown(_)", KEYBOARD_isKeyDown);
+  MAP_addFunction(&engine->moduleMap, "input", "static Keyboard.f_scancode(_)", KEYBOARD_getScancode);
+  MAP_addFunction(&engine->moduleMap, "input", "static Keyboard.f_isKeyDown(_)", KEYBOARD_isKeyDown);
+  MAP_addFunction(&engine->moduleMap, "input", "static Keyboard.f_justPressed(_)", KEYBOARD_justPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "static Keyboard.f_justReleased(_)", KEYBOARD_justReleased);
   MAP_addFunction(&engine->moduleMap, "input", "static Mouse.x", MOUSE_getX);
   MAP_addFunction(&engine->moduleMap, "input", "static Mouse.y", MOUSE_getY);
-  MAP_addFunction(&engine->moduleMap, "input", "static Mouse.isButtonPressed(_)", MOUSE_isButtonPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "static Mouse.f_buttonIndex(_)", MOUSE_getButtonIndex);
+  MAP_addFunction(&engine->moduleMap, "input", "static Mouse.f_isButtonPressed(_)", MOUSE_isButtonPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "static Mouse.f_justPressed(_)", MOUSE_justPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "static Mouse.f_justReleased(_)", MOUSE_justReleased);
   MAP_addFunction(&engine->moduleMap, "input", "static Mouse.hidden=(_)", MOUSE_setHidden);
   MAP_addFunction(&engine->moduleMap, "input", "static Mouse.hidden", MOUSE_getHidden);
   MAP_addFunction(&engine->moduleMap, "input", "static GamePad.f_getGamePadIds()", GAMEPAD_getGamePadIds);
+  MAP_addFunction(&engine->moduleMap, "input", "static GamePad.f_buttonIndex(_)", GAMEPAD_getButtonIndex);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.f_isButtonPressed(_)", GAMEPAD_isButtonPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "GamePad.f_justPressed(_)", GAMEPAD_justPressed);
+  MAP_addFunction(&engine->moduleMap, "input", "GamePad.f_justReleased(_)", GAMEPAD_justReleased);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.getTrigger(_)", GAMEPAD_getTrigger);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.close()", GAMEPAD_close);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.f_getAnalogStick(_)", GAMEPAD_getAnalogStick);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.attached", GAMEPAD_isAttached);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.name", GAMEPAD_getName);
   MAP_addFunction(&engine->moduleMap, "input", "GamePad.id", GAMEPAD_getId);
+  MAP_addFunction(&engine->moduleMap, "input", "static Input.f_capture()", INPUT_capture);
 
   return vm;
 }
 
+// Makes the handles the game loop uses every frame, once the game is loaded.
+internal void
+VM_makeHandles(WrenVM* vm) {
+  vmHandles.init = wrenMakeCallHandle(vm, "init()");
+  vmHandles.update = wrenMakeCallHandle(vm, "update()");
+  vmHandles.draw = wrenMakeCallHandle(vm, "draw(_)");
+  vmHandles.dispatch = wrenMakeCallHandle(vm, "dispatch_(_)");
+  wrenEnsureSlots(vm, 1);
+  wrenGetVariable(vm, "main", "Game", 0);
+  vmHandles.gameClass = wrenGetSlotHandle(vm, 0);
+}
+
+internal void
+VM_releaseHandle(WrenVM* vm, WrenHandle** handle) {
+  if (*handle != NULL) {
+    wrenReleaseHandle(vm, *handle);
+    *handle = NULL;
+  }
+}
+
+internal void
+VM_releaseHandles(WrenVM* vm) {
+  VM_releaseHandle(vm, &vmHandles.gameClass);
+  VM_releaseHandle(vm, &vmHandles.audioEngineClass);
+  VM_releaseHandle(vm, &vmHandles.bufferClass);
+  VM_releaseHandle(vm, &vmHandles.pointerClass);
+  VM_releaseHandle(vm, &vmHandles.structClass);
+  VM_releaseHandle(vm, &vmHandles.vectorClass);
+  VM_releaseHandle(vm, &vmHandles.inputClass);
+  VM_releaseHandle(vm, &vmHandles.init);
+  VM_releaseHandle(vm, &vmHandles.update);
+  VM_releaseHandle(vm, &vmHandles.draw);
+  VM_releaseHandle(vm, &vmHandles.dispatch);
+}
+
 internal void VM_free(WrenVM* vm) {
   if (vm != NULL) {
+    DBUFFER_free(vm);
+    MEMORY_detach();
     wrenFreeVM(vm);
   }
 }